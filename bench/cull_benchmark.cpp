@@ -0,0 +1,117 @@
+//
+// Created by rfdic on 10/2/2024.
+//
+
+// Frustum culls 100k objects with cull_bounds and with a plain per-object loop
+// over the same sphere and box test, and prints the time of each. Build in
+// Release, the scalar loop is what cull_bounds falls back to without SSE.
+
+#include "culling.hpp"
+#include "mesh.hpp"
+
+#include <random>
+
+using namespace obsidian;
+
+constexpr size_t   OBJECT_COUNT = 100000;
+constexpr uint32_t ITERATIONS   = 200;
+
+// array-of-structures bounds, what every object carried before BoundsBatch
+struct ObjectBounds
+{
+	glm::vec3 sphere_center;
+	float     sphere_radius;
+	glm::vec3 box_center;
+	glm::vec3 extent;
+};
+
+static bool object_visible(const Frustum &frustum, const ObjectBounds &bounds)
+{
+	for (const glm::vec4 &plane : frustum.planes)
+	{
+		const glm::vec3 normal(plane);
+		const float     box_radius = glm::dot(glm::abs(normal), bounds.extent);
+
+		if (glm::dot(normal, bounds.sphere_center) + plane.w < -bounds.sphere_radius ||
+		    glm::dot(normal, bounds.box_center) + plane.w < -box_radius)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template <typename Function>
+static double milliseconds_per_iteration(Function function)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < ITERATIONS; i++)
+	{
+		function();
+	}
+	const auto elapsed = std::chrono::duration<double, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+	return elapsed / ITERATIONS;
+}
+
+int main()
+{
+	Mesh mesh          = {};
+	mesh.bounds_min    = glm::vec3(-1.0f);
+	mesh.bounds_max    = glm::vec3(1.0f);
+	mesh.sphere_center = glm::vec3(0.0f);
+	mesh.sphere_radius = glm::sqrt(3.0f);
+
+	// objects scattered around the camera so roughly a quarter survive
+	std::mt19937                          random(1234);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> scale(0.5f, 4.0f);
+
+	BoundsBatch               batch;
+	std::vector<ObjectBounds> objects(OBJECT_COUNT);
+	for (ObjectBounds &object : objects)
+	{
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random) * 0.1f, position(random)));
+		transform           = glm::scale(transform, glm::vec3(scale(random)));
+
+		batch.push(mesh, transform);
+		const size_t i = batch.size() - 1;
+
+		object.sphere_center = glm::vec3(batch.sphere_x[i], batch.sphere_y[i], batch.sphere_z[i]);
+		object.sphere_radius = batch.sphere_radius[i];
+		object.box_center    = glm::vec3(batch.box_x[i], batch.box_y[i], batch.box_z[i]);
+		object.extent        = glm::vec3(batch.extent_x[i], batch.extent_y[i], batch.extent_z[i]);
+	}
+
+	const glm::mat4 view       = glm::lookAt(glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(0.0f, 10.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+	const Frustum   frustum    = extract_frustum(projection * view);
+
+	uint32_t     scalar_visible = 0;
+	const double scalar_ms      = milliseconds_per_iteration([&]() {
+		scalar_visible = 0;
+		for (const ObjectBounds &object : objects)
+		{
+			scalar_visible += object_visible(frustum, object) ? 1 : 0;
+		}
+	});
+
+	std::vector<uint8_t> visible;
+	uint32_t             batch_visible = 0;
+	const double         batch_ms      = milliseconds_per_iteration([&]() {
+		batch_visible = cull_bounds(frustum, batch, visible);
+	});
+
+	std::cout << OBJECT_COUNT << " objects, " << ITERATIONS << " iterations" << std::endl;
+	std::cout << "  scalar:      " << scalar_ms << " ms, " << scalar_visible << " visible" << std::endl;
+	std::cout << "  cull_bounds: " << batch_ms << " ms, " << batch_visible << " visible" << std::endl;
+	std::cout << "  speedup:     " << scalar_ms / batch_ms << "x" << std::endl;
+
+	// both run the same test, only objects touching a plane may round differently
+	if (scalar_visible != batch_visible)
+	{
+		std::cout << "  visible counts differ by " << std::abs(int64_t(scalar_visible) - int64_t(batch_visible)) << std::endl;
+	}
+
+	return 0;
+}
@@ -1,7 +1,6 @@
 #version 450
 
 layout(set = 0, binding = 0) uniform CameraUBO {
-    mat4 model;
     mat4 view;
     mat4 proj;
 } camera;
@@ -2,17 +2,31 @@
 
 layout(location = 0) in vec3 inPosition;
 
-layout (binding = 0) uniform UniformBufferObject {
+struct ObjectData {
     mat4 model;
-    mat4 view;
-    mat4 proj;
-    mat4 lightSpaceMatrix;
-    vec3 lightDirection;
-} ubo;
+    mat4 normalMatrix;
+    uint materialId;
+};
 
+layout(std430, binding = 4) readonly buffer InstanceBuffer {
+    uint objectIndices[];
+};
+
+// set for GPU driven draws, whose firstInstance is the object itself
+layout(constant_id = 0) const bool DIRECT_OBJECTS = false;
+
+layout(std430, binding = 6) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+};
+
+// light view projection of the cascade or atlas tile being rendered
+layout(push_constant) uniform PushConstants {
+    mat4 viewProjection;
+} pc;
 
 
 void main() {
-    gl_Position = ubo.lightSpaceMatrix * vec4(inPosition, 1.0);
+    uint object = DIRECT_OBJECTS ? uint(gl_InstanceIndex) : objectIndices[gl_InstanceIndex];
+    gl_Position = pc.viewProjection * objects[object].model * vec4(inPosition, 1.0);
 
 }
\ No newline at end of file
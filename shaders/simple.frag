@@ -1,10 +1,10 @@
 #version 450
 
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
-    mat4 lightSpaceMatrix;
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
     vec3 lightDirection;
     float near_plane;
     float far_plane;
@@ -12,37 +12,145 @@ layout(binding = 0) uniform UniformBufferObject {
 
 layout(binding = 1) uniform sampler2D texSampler;
 layout(binding = 2) uniform sampler2D cubeMap;
-layout(binding = 3) uniform sampler2DShadow shadowMap;
+layout(binding = 3) uniform sampler2DArrayShadow shadowMap;
+layout(binding = 8) uniform sampler2DShadow shadowAtlas;
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 fragNormal;
-layout(location = 3) in vec4 fragPosLightSpace;
 layout(location = 4) in vec3 fragPos;
+layout(location = 5) flat in uint fragMaterialId;
 
 layout(location = 0) out vec4 outColor;
 
-layout(push_constant) uniform PushConstants {
+struct MaterialData {
     float scale;
-    bool useTexture;
-} pushConstants;
+    uint useTexture;
+};
+
+layout(std430, binding = 5) readonly buffer MaterialBuffer {
+    MaterialData materials[];
+};
+
+const uint LIGHT_SPOT = 0;
+const uint LIGHT_POINT = 1;
+
+struct LightData {
+    vec4 positionRange;
+    vec4 directionCone;
+    vec4 color;
+    uint type;
+    int firstShadowView;
+};
+
+struct ShadowView {
+    mat4 viewProjection;
+    vec4 uvRect;
+};
+
+layout(std430, binding = 7) readonly buffer LightBuffer {
+    uint lightCount;
+    LightData lights[64];
+    ShadowView shadowViews[128];
+};
+
+
+// the first cascade whose far split is past the fragment covers it
+float ShadowCalculation(vec3 worldPos)
+{
+    float depth = -(ubo.view * vec4(worldPos, 1.0)).z;
+
+    int cascade = 0;
+    while (cascade < 3 && depth > ubo.cascadeSplits[cascade]) {
+        cascade++;
+    }
+
+    // nothing is rendered past the last cascade
+    if (depth > ubo.cascadeSplits[3]) {
+        return 0.0;
+    }
+
+    // the cascade projections already have zero to one depth, only xy needs the bias
+    vec4 lightSpace = ubo.cascadeMatrices[cascade] * vec4(worldPos, 1.0);
+    vec2 uv = lightSpace.xy * 0.5 + 0.5;
+
+    return 1.0 - texture(shadowMap, vec4(uv, float(cascade), lightSpace.z));
+}
+
+// point lights have a tile per cube face, picked by the major axis like a cube map
+float LightShadow(LightData light, vec3 worldPos)
+{
+    if (light.firstShadowView < 0) {
+        return 0.0;
+    }
+
+    int view = light.firstShadowView;
+    if (light.type == LIGHT_POINT) {
+        vec3 d = worldPos - light.positionRange.xyz;
+        vec3 a = abs(d);
+        if (a.x >= a.y && a.x >= a.z) {
+            view += d.x > 0.0 ? 0 : 1;
+        } else if (a.y >= a.z) {
+            view += d.y > 0.0 ? 2 : 3;
+        } else {
+            view += d.z > 0.0 ? 4 : 5;
+        }
+    }
 
+    vec4 lightSpace = shadowViews[view].viewProjection * vec4(worldPos, 1.0);
+    vec3 ndc = lightSpace.xyz / lightSpace.w;
 
-float ShadowCalculation(vec4 fragPosLightSpace)
+    // stay half a texel inside the tile so filtering never reads a neighbour
+    vec4 rect = shadowViews[view].uvRect;
+    vec2 texel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+    vec2 uv = rect.xy + (ndc.xy * 0.5 + 0.5) * rect.zw;
+    uv = clamp(uv, rect.xy + texel, rect.xy + rect.zw - texel);
+
+    return 1.0 - texture(shadowAtlas, vec3(uv, ndc.z));
+}
+
+vec3 LocalLights(vec3 normal, vec3 worldPos)
 {
-    return 1.0 - texture(shadowMap, fragPosLightSpace.xyz);
+    vec3 result = vec3(0.0);
+    for (uint i = 0; i < lightCount; i++) {
+        LightData light = lights[i];
+
+        vec3 toLight = light.positionRange.xyz - worldPos;
+        float distance = length(toLight);
+        if (distance >= light.positionRange.w) {
+            continue;
+        }
+
+        vec3 lightDir = toLight / distance;
+
+        // smooth window to zero at the range
+        float ratio = distance / light.positionRange.w;
+        float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+
+        if (light.type == LIGHT_SPOT) {
+            float cosAngle = dot(-lightDir, light.directionCone.xyz);
+            attenuation *= smoothstep(light.directionCone.w, mix(light.directionCone.w, 1.0, 0.1), cosAngle);
+        }
+
+        float diff = max(dot(normal, lightDir), 0.0);
+        result += diff * attenuation * (1.0 - LightShadow(light, worldPos)) * light.color.rgb;
+    }
+    return result;
 }
 
 void main() {
 
+    MaterialData material = materials[fragMaterialId];
+
     vec3 color;
-    if (pushConstants.useTexture) {
+    if (material.useTexture != 0) {
         // load the diffuse map texture
         color = texture(texSampler, fragTexCoord).rgb;
     } else {
 
-        float pattern = mod(floor(fragTexCoord.x * pushConstants.scale) +
-                            floor(fragTexCoord.y * pushConstants.scale), 2.0);
+        float pattern = mod(floor(fragTexCoord.x * material.scale) +
+                            floor(fragTexCoord.y * material.scale), 2.0);
         if (pattern > 0.0) {
             color = vec3(0.2, 0.2, 0.2);
         } else {
@@ -64,10 +172,10 @@ void main() {
     vec3 diffuse = diff * lightColor;
 
     // Calculate shadow
-    float shadow = ShadowCalculation(fragPosLightSpace);
+    float shadow = ShadowCalculation(fragPos);
 
     // Combine lighting components
-    vec3 lighting = (ambient + (1.0 - shadow) * diffuse) * color;
+    vec3 lighting = (ambient + (1.0 - shadow) * diffuse + LocalLights(normal, fragPos)) * color;
 
     // Final color
     outColor = vec4(lighting, 1.0);
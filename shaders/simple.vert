@@ -2,13 +2,31 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout (binding = 0) uniform UniformBufferObject {
-	mat4 model;
 	mat4 view;
 	mat4 proj;
-	mat4 lightSpaceMatrix;
+	mat4 cascadeMatrices[4];
+	vec4 cascadeSplits;
 	vec3 lightDirection;
 } ubo;
 
+struct ObjectData {
+	mat4 model;
+	mat4 normalMatrix;
+	uint materialId;
+};
+
+// firstInstance of every draw points at its slice, so gl_InstanceIndex indexes it directly
+layout (std430, binding = 4) readonly buffer InstanceBuffer {
+	uint objectIndices[];
+};
+
+// set for GPU driven draws, whose firstInstance is the object itself
+layout (constant_id = 0) const bool DIRECT_OBJECTS = false;
+
+layout (std430, binding = 6) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+};
+
 layout (location = 0) in vec3 inPosition;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inTexCoord;
@@ -17,27 +35,20 @@ layout (location = 3) in vec3 inNormal;
 layout (location = 0) out vec3 fragColor;
 layout (location = 1) out vec2 fragTexCoord;
 layout (location = 2) out vec3 fragNormal;
-layout (location = 3) out vec4 fragPosLightSpace;
 layout (location = 4) out vec3 fragPos;
+layout (location = 5) flat out uint fragMaterialId;
 
 void main ()
 {
-	vec4 worldPos = ubo.model * vec4(inPosition, 1.0);
+	ObjectData object = objects[DIRECT_OBJECTS ? uint(gl_InstanceIndex) : objectIndices[gl_InstanceIndex]];
+
+	vec4 worldPos = object.model * vec4(inPosition, 1.0);
 	gl_Position = ubo.proj * ubo.view * worldPos;
 
 	fragColor = inColor;
 	fragTexCoord = inTexCoord;
-	fragNormal = mat3(transpose(inverse(ubo.model))) * inNormal;
-	fragPosLightSpace = ubo.lightSpaceMatrix * worldPos;
-
-	mat4 biasMatrix = mat4(
-		0.5, 0.0, 0.0, 0.0,
-		0.0, 0.5, 0.0, 0.0,
-		0.0, 0.0, 1.0, 0.0,
-		0.5, 0.5, 0.0, 1.0
-	);
-
-	fragPosLightSpace = biasMatrix * fragPosLightSpace;
+	fragNormal = mat3(object.normalMatrix) * inNormal;
 
 	fragPos = worldPos.xyz;
+	fragMaterialId = object.materialId;
 }
\ No newline at end of file
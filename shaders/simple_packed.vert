@@ -0,0 +1,73 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// simple.vert for VertexFormat::COMPACT, positions and uvs arrive as fp16 and
+// the normal is octahedral encoded in two snorm16 components. Built again with
+// VERTEX_COLOR for COMPACT_COLOR, which adds an rgba8 color at location 1.
+
+layout (binding = 0) uniform UniformBufferObject {
+	mat4 view;
+	mat4 proj;
+	mat4 cascadeMatrices[4];
+	vec4 cascadeSplits;
+	vec3 lightDirection;
+} ubo;
+
+struct ObjectData {
+	mat4 model;
+	mat4 normalMatrix;
+	uint materialId;
+};
+
+// firstInstance of every draw points at its slice, so gl_InstanceIndex indexes it directly
+layout (std430, binding = 4) readonly buffer InstanceBuffer {
+	uint objectIndices[];
+};
+
+// set for GPU driven draws, whose firstInstance is the object itself
+layout (constant_id = 0) const bool DIRECT_OBJECTS = false;
+
+layout (std430, binding = 6) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+};
+
+layout (location = 0) in vec3 inPosition;
+#ifdef VERTEX_COLOR
+layout (location = 1) in vec3 inColor;
+#endif
+layout (location = 2) in vec2 inTexCoord;
+layout (location = 3) in vec2 inNormal;
+
+layout (location = 0) out vec3 fragColor;
+layout (location = 1) out vec2 fragTexCoord;
+layout (location = 2) out vec3 fragNormal;
+layout (location = 4) out vec3 fragPos;
+layout (location = 5) flat out uint fragMaterialId;
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main ()
+{
+	ObjectData object = objects[DIRECT_OBJECTS ? uint(gl_InstanceIndex) : objectIndices[gl_InstanceIndex]];
+
+	vec4 worldPos = object.model * vec4(inPosition, 1.0);
+	gl_Position = ubo.proj * ubo.view * worldPos;
+
+#ifdef VERTEX_COLOR
+	fragColor = inColor;
+#else
+	fragColor = vec3(1.0);
+#endif
+	fragTexCoord = inTexCoord;
+	fragNormal = mat3(object.normalMatrix) * decodeOctahedral(inNormal);
+
+	fragPos = worldPos.xyz;
+	fragMaterialId = object.materialId;
+}
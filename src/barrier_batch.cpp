@@ -0,0 +1,105 @@
+//
+// Created by rfdic on 9/27/2024.
+//
+
+#include "barrier_batch.hpp"
+
+namespace obsidian
+{
+
+BarrierBatch::BarrierBatch(Init &init) :
+    init(init)
+{
+}
+
+BarrierBatch &BarrierBatch::image(VkImage                        image,
+                                  const VkImageSubresourceRange &range,
+                                  VkImageLayout                  old_layout,
+                                  VkImageLayout                  new_layout,
+                                  VkPipelineStageFlags2          src_stages,
+                                  VkAccessFlags2                 src_access,
+                                  VkPipelineStageFlags2          dst_stages,
+                                  VkAccessFlags2                 dst_access,
+                                  uint32_t                       src_family,
+                                  uint32_t                       dst_family)
+{
+	VkImageMemoryBarrier2 barrier = {};
+	barrier.sType                 = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+	barrier.srcStageMask          = src_stages;
+	barrier.srcAccessMask         = src_access;
+	barrier.dstStageMask          = dst_stages;
+	barrier.dstAccessMask         = dst_access;
+	barrier.oldLayout             = old_layout;
+	barrier.newLayout             = new_layout;
+	barrier.srcQueueFamilyIndex   = src_family;
+	barrier.dstQueueFamilyIndex   = dst_family;
+	barrier.image                 = image;
+	barrier.subresourceRange      = range;
+
+	image_barriers.push_back(barrier);
+	return *this;
+}
+
+BarrierBatch &BarrierBatch::buffer(VkBuffer              buffer,
+                                   VkDeviceSize          offset,
+                                   VkDeviceSize          size,
+                                   VkPipelineStageFlags2 src_stages,
+                                   VkAccessFlags2        src_access,
+                                   VkPipelineStageFlags2 dst_stages,
+                                   VkAccessFlags2        dst_access,
+                                   uint32_t              src_family,
+                                   uint32_t              dst_family)
+{
+	VkBufferMemoryBarrier2 barrier = {};
+	barrier.sType                  = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+	barrier.srcStageMask           = src_stages;
+	barrier.srcAccessMask          = src_access;
+	barrier.dstStageMask           = dst_stages;
+	barrier.dstAccessMask          = dst_access;
+	barrier.srcQueueFamilyIndex    = src_family;
+	barrier.dstQueueFamilyIndex    = dst_family;
+	barrier.buffer                 = buffer;
+	barrier.offset                 = offset;
+	barrier.size                   = size;
+
+	buffer_barriers.push_back(barrier);
+	return *this;
+}
+
+bool BarrierBatch::empty() const
+{
+	return image_barriers.empty() && buffer_barriers.empty();
+}
+
+void BarrierBatch::flush(VkCommandBuffer command_buffer)
+{
+	if (empty())
+	{
+		return;
+	}
+
+	VkDependencyInfo dependency_info         = {};
+	dependency_info.sType                    = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	dependency_info.bufferMemoryBarrierCount = static_cast<uint32_t>(buffer_barriers.size());
+	dependency_info.pBufferMemoryBarriers    = buffer_barriers.data();
+	dependency_info.imageMemoryBarrierCount  = static_cast<uint32_t>(image_barriers.size());
+	dependency_info.pImageMemoryBarriers     = image_barriers.data();
+
+	init.disp.cmdPipelineBarrier2(command_buffer, &dependency_info);
+
+	image_barriers.clear();
+	buffer_barriers.clear();
+}
+
+VkImageSubresourceRange image_range(VkImageAspectFlags aspect, uint32_t base_layer, uint32_t layer_count)
+{
+	VkImageSubresourceRange range = {};
+	range.aspectMask              = aspect;
+	range.baseMipLevel            = 0;
+	range.levelCount              = VK_REMAINING_MIP_LEVELS;
+	range.baseArrayLayer          = base_layer;
+	range.layerCount              = layer_count;
+	return range;
+}
+
+}        // namespace obsidian
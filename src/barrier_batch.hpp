@@ -0,0 +1,59 @@
+//
+// Created by rfdic on 9/27/2024.
+//
+
+#ifndef TOYRENDERER_BARRIER_BATCH_HPP
+#define TOYRENDERER_BARRIER_BATCH_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+// Collects image and buffer barriers with their own stage and access masks and
+// records them as one vkCmdPipelineBarrier2. Add everything a pass boundary
+// needs, then flush once right before the pass.
+class BarrierBatch
+{
+  public:
+	explicit BarrierBatch(Init &init);
+
+	BarrierBatch &image(VkImage                        image,
+	                    const VkImageSubresourceRange &range,
+	                    VkImageLayout                  old_layout,
+	                    VkImageLayout                  new_layout,
+	                    VkPipelineStageFlags2          src_stages,
+	                    VkAccessFlags2                 src_access,
+	                    VkPipelineStageFlags2          dst_stages,
+	                    VkAccessFlags2                 dst_access,
+	                    uint32_t                       src_family = VK_QUEUE_FAMILY_IGNORED,
+	                    uint32_t                       dst_family = VK_QUEUE_FAMILY_IGNORED);
+
+	BarrierBatch &buffer(VkBuffer              buffer,
+	                     VkDeviceSize          offset,
+	                     VkDeviceSize          size,
+	                     VkPipelineStageFlags2 src_stages,
+	                     VkAccessFlags2        src_access,
+	                     VkPipelineStageFlags2 dst_stages,
+	                     VkAccessFlags2        dst_access,
+	                     uint32_t              src_family = VK_QUEUE_FAMILY_IGNORED,
+	                     uint32_t              dst_family = VK_QUEUE_FAMILY_IGNORED);
+
+	bool empty() const;
+
+	// record everything added so far, nothing when empty, and start over
+	void flush(VkCommandBuffer command_buffer);
+
+  private:
+	Init &init;
+
+	std::vector<VkImageMemoryBarrier2>  image_barriers;
+	std::vector<VkBufferMemoryBarrier2> buffer_barriers;
+};
+
+// every mip of the given layers, all layers by default
+VkImageSubresourceRange image_range(VkImageAspectFlags aspect, uint32_t base_layer = 0, uint32_t layer_count = VK_REMAINING_ARRAY_LAYERS);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_BARRIER_BATCH_HPP
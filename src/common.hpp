@@ -7,7 +7,18 @@ namespace obsidian
 {
 
 class CubeMap;
+class FrameAllocator;
+class UploadQueue;
+class GeometryPool;
+class ObjectBuffer;
+class InstanceBuffer;
+class ShadowAtlas;
+class TransientImagePool;
+class ParallelRecorder;
+class GpuCulling;
+class DepthPyramid;
 struct Mesh;
+struct Scene;
 struct ShadowMap;
 
 struct Init
@@ -22,6 +33,9 @@ struct Init
 	vkb::Swapchain             swapchain;
 	VmaAllocator               allocator;
 	VkQueue                    graphics_queue;
+	VkQueue                    transfer_queue;        // dedicated transfer queue, or graphics_queue when there is none
+	uint32_t                   graphics_queue_family;
+	uint32_t                   transfer_queue_family;
 	VkCommandPool              command_pool;
 };
 
@@ -32,19 +46,106 @@ struct BufferAllocation
 	VkDeviceSize  size;
 };
 
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+
+// Everything the CPU touches while recording one frame. The ring of contexts
+// is indexed by RenderData::current_frame, never by the swapchain image index,
+// so waiting on a context's fence is the only throttle between CPU and GPU.
+struct FrameContext
+{
+	VkCommandPool           command_pool;
+	VkCommandBuffer         command_buffer;
+	std::array<uint32_t, 5> dynamic_offsets;        // into the frame allocator: UBO, instances, materials, objects, lights (bindings 0, 4, 5, 6, 7)
+	VkDescriptorSet         descriptor_set;
+	VkFence                 in_flight_fence;
+	VkSemaphore             available_semaphore;
+	VkSemaphore             finished_semaphore;
+};
+
+constexpr uint32_t SHADOW_CASCADE_COUNT = 4;
+
+// What a cached cascade was rendered with, any difference means it is stale.
+// Where the camera is plays no part: the cache lives in the light's world
+// anchored texel grid and scrolls with the cascade.
+struct ShadowCacheEntry
+{
+	glm::vec3  light_direction;
+	float      bias;
+	float      slope_bias;
+	uint32_t   static_revision;
+	bool       valid = false;
+
+	// layout of the layer, changing these keeps the entry but redraws the whole layer
+	float      texel_size;
+	glm::vec2  depth_range;
+	glm::ivec2 base;          // light space texel stored at the layer's (0, 0), texel p lives at (p - base) mod size
+	glm::ivec2 window;        // first light space texel of the cascade the layer holds
+};
+
+// Cascaded shadow map: one layer of a depth array per slice of the camera's
+// view range, each with an orthographic projection fitted around that slice.
+// All cascades share one rotation anchored at the world origin and a depth
+// range fitted around the static casters, so moving the camera only slides a
+// cascade's window over the light's texel grid. Static casters are rendered
+// into a cache array that scrolls along, drawing just the texels that come into
+// view, and copied into the sampled layers; dynamic casters are drawn over the
+// copy every frame.
 struct ShadowMap {
 	VkImage image;
-	VkImageView image_view;
+	VkImageView image_view;        // all cascades, sampled as sampler2DArrayShadow
+	std::array<VkImageView, SHADOW_CASCADE_COUNT> layer_views;        // one per cascade, rendered to
 	VmaAllocation allocation;
 	VkSampler sampler;
-	glm::mat4 light_space_matrix;
+	std::array<glm::mat4, SHADOW_CASCADE_COUNT> cascade_matrices;
+	std::array<float, SHADOW_CASCADE_COUNT> cascade_splits;        // far end of each cascade, view space distance
+	std::array<glm::ivec2, SHADOW_CASCADE_COUNT> cascade_windows;        // first light space texel of each cascade
+	std::array<float, SHADOW_CASCADE_COUNT> cascade_texel_sizes;        // world units per texel
+	glm::mat4 light_view;        // rotation into light space, looking down -z
+	glm::vec2 depth_range;        // lowest and highest light space z the cascades cover, the highest faces the light
 	glm::vec3 light_direction;
-	float light_distance = 25.0f;
+	float light_distance = 25.0f;        // how far behind a cascade casters are still caught
 	float bias = 1.25f;
 	float slope_bias = 1.75f;
-	float radius = 10.0f;
-	float near_plane = 1.0f;
-	float far_plane = 25.0f;
+	float shadow_distance = 50.0f;        // shadows end here or at the camera's far plane
+	float split_lambda = 0.75f;        // 0 uniform splits, 1 logarithmic
+
+	// world box of the static casters, refitted when the scene's static_revision moves on
+	glm::vec3 static_bounds_min;
+	glm::vec3 static_bounds_max;
+	uint32_t static_bounds_revision = UINT32_MAX;
+	bool has_static_bounds = false;
+
+	VkImage cache_image;
+	VmaAllocation cache_allocation;
+	std::array<VkImageView, SHADOW_CASCADE_COUNT> cache_layer_views;
+	std::array<ShadowCacheEntry, SHADOW_CASCADE_COUNT> cache_entries;
+	std::array<bool, SHADOW_CASCADE_COUNT> layer_is_cache = {};        // the layer holds only the cached casters
+};
+
+// what the per-frame culling kept, shown in the debug UI
+struct CullingStats
+{
+	uint32_t objects_total;
+	uint32_t objects_visible;
+	uint32_t meshlets_total;
+	uint32_t meshlets_visible;
+	uint32_t triangles;
+	uint32_t draw_calls;
+	uint32_t shadow_casters_total;
+	uint32_t shadow_casters_visible;
+	uint32_t shadow_cascades_cached;
+	uint32_t shadow_lights;
+	uint32_t shadow_views_rendered;
+	uint32_t secondary_buffers;        // main pass chunks recorded on the workers, 0 when recorded inline
+};
+
+// GPU layouts a Vertex can be stored in, see vertex_format.hpp. Attribute locations
+// are the same in every format: 0 position, 1 color, 2 tex coord, 3 normal.
+enum class VertexFormat : uint32_t
+{
+	FULL,                 // Vertex as is, 44 bytes
+	COMPACT,              // fp16 position, octahedral snorm16 normal, fp16 uv, 16 bytes
+	COMPACT_COLOR,        // COMPACT followed by an rgba8 color, 20 bytes
 };
 
 struct RenderData
@@ -57,38 +158,49 @@ struct RenderData
 	VkRenderPass     render_pass;
 	VkPipelineLayout pipeline_layout;
 	VkPipeline       graphics_pipeline;
+	VkPipeline       gpu_graphics_pipeline;        // DIRECT_OBJECTS variant for the GPU culling's draw lists
 
-	VkCommandPool command_pool;
-
-	std::vector<VkCommandBuffer> command_buffers;
-
-	std::vector<VkSemaphore> available_semaphores;
-	std::vector<VkSemaphore> finished_semaphore;
-	std::vector<VkFence>     in_flight_fences;
-	std::vector<VkFence>     image_in_flight;
-	size_t                   current_frame = 0;
+	std::array<FrameContext, MAX_FRAMES_IN_FLIGHT> frames;
+	size_t                                         current_frame = 0;
 
-	std::vector<BufferAllocation> uniform_buffers;
+	FrameAllocator *frame_allocator;
 
-
-	VkDescriptorPool             descriptor_pool;
-	VkDescriptorSetLayout        descriptor_set_layout;
-	std::vector<VkDescriptorSet> descriptor_sets;
+	VkDescriptorPool      descriptor_pool;
+	VkDescriptorSetLayout descriptor_set_layout;
 
 	Camera camera;
 	TextureImage    texture;
 	TextureImage    cube_map_texture;
 	CubeMap         *cube_map;
 	Mesh 		   	*mesh;
-	Mesh 		   	*plane_mesh;
-	Mesh 			*bunny_mesh;
+	Scene           *scene = nullptr;
+	CullingStats     culling_stats = {};
+	float            lod_pixel_error        = 1.0f;        // allowed simplification error on screen, in pixels
+	float            shadow_lod_pixel_error = 4.0f;        // shadows blur the silhouette, so they can go coarser
+	VertexFormat     vertex_format = VertexFormat::COMPACT;        // layout of the geometry pool and the pipelines reading it
 
 	// shadow stuff
 	ShadowMap 	   			shadow_map;
 	VkPipelineLayout 		shadow_pipeline_layout;
 	VkPipeline 		   		shadow_pipeline;
+	VkPipeline              gpu_shadow_pipeline;        // DIRECT_OBJECTS variant for the GPU culling's draw lists
+	ShadowAtlas            *shadow_atlas;
 
 	BufferAllocation staging_buffer;
+	UploadQueue     *upload_queue;
+	GeometryPool    *geometry_pool;
+	ObjectBuffer    *object_buffer;
+	InstanceBuffer  *instance_buffer;
+	TransientImagePool *transient_images;        // physical images behind the render graph's transient attachments
+	ParallelRecorder   *recorder;
+	bool                parallel_recording = true;        // main pass draws recorded into secondary buffers on the workers
+	GpuCulling         *gpu_culling;
+	bool                gpu_driven         = false;        // camera and cascade culling in a compute pass, drawn indirectly
+	bool                verify_gpu_culling = false;        // read the culling results back and compare them with the CPU
+	DepthPyramid       *depth_pyramid;
+	bool                occlusion_culling  = true;        // GPU driven only, the main view in two phases against the depth pyramid
+	uint32_t         scene_first_object = 0;        // object buffer index of the scene's first instance this frame
+	int              selected_instance  = 0;        // instance moved by the debug UI
 
 	struct
 	{
@@ -113,16 +225,62 @@ struct Vertex
 
 struct UniformBufferObject
 {
-	glm::mat4 model;
 	glm::mat4 view;
 	glm::mat4 proj;
-	glm::mat4 lightSpaceMatrix;
+	glm::mat4 cascadeMatrices[SHADOW_CASCADE_COUNT];
+	glm::vec4 cascadeSplits;
 	glm::vec3 lightDirection;
 	float nearPlane;
 	float farPlane;
 	float padding;
 };
 
+// std430 layout of one element of the object buffer (binding 6)
+struct ObjectData
+{
+	glm::mat4 model;
+	glm::mat4 normal_matrix;        // inverse transpose of the upper 3x3, kept as a mat4 for std430
+	uint32_t  material_id;
+	uint32_t  padding[3];
+};
+
+// std430 layout of one element of the material buffer (binding 5)
+struct MaterialData
+{
+	float    pattern_scale;
+	uint32_t use_texture;
+};
+
+constexpr uint32_t MAX_LIGHTS       = 64;
+constexpr uint32_t MAX_SHADOW_VIEWS = 128;
+
+// std430 layout of one light in the light buffer
+struct LightData
+{
+	glm::vec4 position_range;        // world position, range in w
+	glm::vec4 direction_cone;        // spot direction, cosine of the outer angle in w
+	glm::vec4 color;                 // color times intensity
+	uint32_t  type;                  // LightType
+	int32_t   first_shadow_view;        // -1 without a tile in the shadow atlas, point lights use six views
+	uint32_t  padding[2];
+};
+
+// std430 layout of one rendered view of the shadow atlas
+struct ShadowViewData
+{
+	glm::mat4 view_projection;
+	glm::vec4 uv_rect;        // offset in xy and size in zw, atlas uv
+};
+
+// std430 layout of the light buffer (binding 7), fixed size so the descriptor range never changes
+struct LightBuffer
+{
+	uint32_t       light_count;
+	uint32_t       padding[3];
+	LightData      lights[MAX_LIGHTS];
+	ShadowViewData shadow_views[MAX_SHADOW_VIEWS];
+};
+
 
 
 }; // namespace obsidian
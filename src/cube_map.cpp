@@ -220,9 +220,9 @@ VkResult CubeMap::createPipeline() {
     return VK_SUCCESS;
 }
 
-VkResult CubeMap::render(Init& init, RenderData& render_data, VkCommandBuffer command_buffer, uint32_t image_index)
+VkResult CubeMap::render(Init& init, RenderData& render_data, VkCommandBuffer command_buffer, uint32_t image_index, VkImageView depth_image_view)
 {
-	auto frame_index = render_data.current_frame;
+	auto &frame = render_data.frames[render_data.current_frame];
 
 	VkRenderingAttachmentInfo color_attachments[1];
 	color_attachments[0].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
@@ -239,7 +239,7 @@ VkResult CubeMap::render(Init& init, RenderData& render_data, VkCommandBuffer co
 	VkRenderingAttachmentInfo depth_attachment;
 	depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
 	depth_attachment.pNext = nullptr;
-	depth_attachment.imageView = render_data.depth_image_view;
+	depth_attachment.imageView = depth_image_view;
 	depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
 	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
@@ -279,7 +279,7 @@ VkResult CubeMap::render(Init& init, RenderData& render_data, VkCommandBuffer co
 	init.disp.cmdBindDescriptorSets(command_buffer,
 	                                VK_PIPELINE_BIND_POINT_GRAPHICS,
 	                                render_data.cube_map->pipeline_layout, 0, 1,
-	                                &render_data.descriptor_sets[frame_index], 0, nullptr);
+	                                &frame.descriptor_set, static_cast<uint32_t>(frame.dynamic_offsets.size()), frame.dynamic_offsets.data());
 
 	init.disp.cmdDraw(command_buffer, 36, 1, 0, 0);
 	init.disp.cmdEndRendering(command_buffer);
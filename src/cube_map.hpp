@@ -23,7 +23,7 @@ class CubeMap
 	VkResult createPipeline();
 	VkResult createPipelineLayout();
 
-	VkResult render(Init& init, RenderData& render_data, VkCommandBuffer command_buffer, uint32_t image_index);
+	VkResult render(Init& init, RenderData& render_data, VkCommandBuffer command_buffer, uint32_t image_index, VkImageView depth_image_view);
 };
 
 } // namespace obsidian
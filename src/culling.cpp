@@ -0,0 +1,295 @@
+//
+// Created by rfdic on 9/17/2024.
+//
+
+#include "culling.hpp"
+
+#include "mesh.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#	define OBSIDIAN_CULLING_SSE 1
+#	include <xmmintrin.h>
+#endif
+
+namespace obsidian
+{
+
+Frustum extract_frustum(const glm::mat4 &view_projection)
+{
+	// rows of the matrix, glm is column major
+	const glm::mat4 m = glm::transpose(view_projection);
+
+	Frustum frustum;
+	frustum.planes[0] = m[3] + m[0];
+	frustum.planes[1] = m[3] - m[0];
+	frustum.planes[2] = m[3] + m[1];
+	frustum.planes[3] = m[3] - m[1];
+	frustum.planes[4] = m[3] + m[2];
+	frustum.planes[5] = m[3] - m[2];
+
+	for (glm::vec4 &plane : frustum.planes)
+	{
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	return frustum;
+}
+
+bool sphere_in_frustum(const Frustum &frustum, const glm::vec3 &center, float radius)
+{
+	for (const glm::vec4 &plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void BoundsBatch::clear()
+{
+	for (std::vector<float> *lane : {&sphere_x, &sphere_y, &sphere_z, &sphere_radius, &box_x, &box_y, &box_z, &extent_x, &extent_y, &extent_z})
+	{
+		lane->clear();
+	}
+}
+
+size_t BoundsBatch::size() const
+{
+	return sphere_x.size();
+}
+
+void BoundsBatch::push(const Mesh &mesh, const glm::mat4 &transform)
+{
+	glm::vec3 center;
+	float     radius;
+	bounding_sphere(mesh, transform, center, radius);
+
+	sphere_x.push_back(center.x);
+	sphere_y.push_back(center.y);
+	sphere_z.push_back(center.z);
+	sphere_radius.push_back(radius);
+
+	// Arvo: the world box of a transformed box is |M| applied to the half size
+	const glm::mat3 linear(transform);
+	const glm::mat3 absolute(glm::abs(linear[0]), glm::abs(linear[1]), glm::abs(linear[2]));
+	const glm::vec3 box_center = glm::vec3(transform * glm::vec4((mesh.bounds_min + mesh.bounds_max) * 0.5f, 1.0f));
+	const glm::vec3 extent     = absolute * ((mesh.bounds_max - mesh.bounds_min) * 0.5f);
+
+	box_x.push_back(box_center.x);
+	box_y.push_back(box_center.y);
+	box_z.push_back(box_center.z);
+	extent_x.push_back(extent.x);
+	extent_y.push_back(extent.y);
+	extent_z.push_back(extent.z);
+}
+
+static bool bounds_visible(const Frustum &frustum, const BoundsBatch &batch, size_t i)
+{
+	for (const glm::vec4 &plane : frustum.planes)
+	{
+		const float sphere_distance = plane.x * batch.sphere_x[i] + plane.y * batch.sphere_y[i] + plane.z * batch.sphere_z[i] + plane.w;
+		const float box_distance    = plane.x * batch.box_x[i] + plane.y * batch.box_y[i] + plane.z * batch.box_z[i] + plane.w;
+		const float box_radius      = std::abs(plane.x) * batch.extent_x[i] + std::abs(plane.y) * batch.extent_y[i] + std::abs(plane.z) * batch.extent_z[i];
+
+		if (sphere_distance < -batch.sphere_radius[i] || box_distance < -box_radius)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+uint32_t cull_bounds(const Frustum &frustum, const BoundsBatch &batch, std::vector<uint8_t> &visible)
+{
+	const size_t count = batch.size();
+	visible.resize(count);
+
+	size_t   i             = 0;
+	uint32_t visible_count = 0;
+
+#ifdef OBSIDIAN_CULLING_SSE
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 sphere_x      = _mm_loadu_ps(&batch.sphere_x[i]);
+		const __m128 sphere_y      = _mm_loadu_ps(&batch.sphere_y[i]);
+		const __m128 sphere_z      = _mm_loadu_ps(&batch.sphere_z[i]);
+		const __m128 sphere_radius = _mm_loadu_ps(&batch.sphere_radius[i]);
+		const __m128 box_x         = _mm_loadu_ps(&batch.box_x[i]);
+		const __m128 box_y         = _mm_loadu_ps(&batch.box_y[i]);
+		const __m128 box_z         = _mm_loadu_ps(&batch.box_z[i]);
+		const __m128 extent_x      = _mm_loadu_ps(&batch.extent_x[i]);
+		const __m128 extent_y      = _mm_loadu_ps(&batch.extent_y[i]);
+		const __m128 extent_z      = _mm_loadu_ps(&batch.extent_z[i]);
+
+		// a lane stays set while it is inside every plane seen so far
+		__m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+
+		for (const glm::vec4 &plane : frustum.planes)
+		{
+			const __m128 nx = _mm_set1_ps(plane.x);
+			const __m128 ny = _mm_set1_ps(plane.y);
+			const __m128 nz = _mm_set1_ps(plane.z);
+			const __m128 w  = _mm_set1_ps(plane.w);
+
+			const __m128 sphere_distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, sphere_x), _mm_mul_ps(ny, sphere_y)),
+			                                          _mm_add_ps(_mm_mul_ps(nz, sphere_z), w));
+			const __m128 box_distance    = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, box_x), _mm_mul_ps(ny, box_y)),
+			                                          _mm_add_ps(_mm_mul_ps(nz, box_z), w));
+			const __m128 box_radius      = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, nx), extent_x),
+			                                                     _mm_mul_ps(_mm_andnot_ps(sign_mask, ny), extent_y)),
+			                                          _mm_mul_ps(_mm_andnot_ps(sign_mask, nz), extent_z));
+
+			// distance + radius >= 0 for both volumes
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(sphere_distance, sphere_radius), _mm_setzero_ps()));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(box_distance, box_radius), _mm_setzero_ps()));
+		}
+
+		const int mask = _mm_movemask_ps(inside);
+		for (size_t lane = 0; lane < 4; lane++)
+		{
+			visible[i + lane] = (mask >> lane) & 1;
+			visible_count += visible[i + lane];
+		}
+	}
+#endif
+
+	// the tail, or everything without SSE
+	for (; i < count; i++)
+	{
+		visible[i] = bounds_visible(frustum, batch, i) ? 1 : 0;
+		visible_count += visible[i];
+	}
+
+	return visible_count;
+}
+
+void bounding_sphere(const Mesh &mesh, const glm::mat4 &transform, glm::vec3 &center, float &radius)
+{
+	const glm::mat3 linear(transform);
+	const float     scale = std::max(glm::length(linear[0]), std::max(glm::length(linear[1]), glm::length(linear[2])));
+
+	center = glm::vec3(transform * glm::vec4(mesh.sphere_center, 1.0f));
+	radius = mesh.sphere_radius * scale;
+}
+
+bool swept_sphere_in_frustum(const Frustum &frustum, const glm::vec3 &center, float radius, const glm::vec3 &direction, float length)
+{
+	for (const glm::vec4 &plane : frustum.planes)
+	{
+		// the distance is linear along the sweep, so the ends bound it
+		const float start = glm::dot(glm::vec3(plane), center) + plane.w;
+		const float end   = start + glm::dot(glm::vec3(plane), direction) * length;
+		if (std::max(start, end) < -radius)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool cone_backfacing(const glm::vec3 &camera_position, const glm::vec3 &center, float radius, const glm::vec3 &cone_axis, float cone_cutoff)
+{
+	const glm::vec3 to_center = center - camera_position;
+	return glm::dot(to_center, cone_axis) >= cone_cutoff * glm::length(to_center) + radius;
+}
+
+float projection_scale(float fov_y, float viewport_height)
+{
+	return viewport_height / (2.0f * std::tan(glm::radians(fov_y) * 0.5f));
+}
+
+uint32_t select_lod(const Mesh      &mesh,
+                    const glm::mat4 &transform,
+                    const glm::vec3 &camera_position,
+                    float            projection_scale,
+                    float            pixel_error)
+{
+	if (mesh.lods.size() <= 1)
+	{
+		return 0;
+	}
+
+	const glm::mat3 linear(transform);
+	const float     scale = std::max(glm::length(linear[0]), std::max(glm::length(linear[1]), glm::length(linear[2])));
+
+	glm::vec3 center;
+	float     radius;
+	bounding_sphere(mesh, transform, center, radius);
+
+	// inside the sphere every level could be right under the camera, keep the full mesh
+	const float distance = glm::length(center - camera_position) - radius;
+	if (distance <= 0.0f)
+	{
+		return 0;
+	}
+
+	uint32_t level = 0;
+	for (uint32_t i = 1; i < mesh.lods.size(); i++)
+	{
+		if (mesh.lods[i].error * scale * projection_scale / distance > pixel_error)
+		{
+			break;
+		}
+		level = i;
+	}
+
+	return level;
+}
+
+void cull_meshlets(const Mesh             &mesh,
+                   const glm::mat4        &transform,
+                   const Frustum          &frustum,
+                   const glm::vec3        &camera_position,
+                   std::vector<DrawRange> &draws,
+                   CullingStats           &stats)
+{
+	const glm::mat3 linear(transform);
+	const float     scale_x = glm::length(linear[0]);
+	const float     scale_y = glm::length(linear[1]);
+	const float     scale_z = glm::length(linear[2]);
+	const float     scale   = std::max(scale_x, std::max(scale_y, scale_z));
+
+	// the cone bound only survives rotation and uniform scale
+	const bool      uniform_scale = scale - std::min(scale_x, std::min(scale_y, scale_z)) <= scale * 0.01f;
+	const glm::mat3 rotation      = scale > 0.0f ? linear / scale : linear;
+
+	stats.meshlets_total += static_cast<uint32_t>(mesh.meshlets.size());
+
+	for (const Meshlet &meshlet : mesh.meshlets)
+	{
+		const glm::vec3 center = glm::vec3(transform * glm::vec4(meshlet.center, 1.0f));
+		const float     radius = meshlet.radius * scale;
+
+		if (!sphere_in_frustum(frustum, center, radius))
+		{
+			continue;
+		}
+
+		if (uniform_scale && meshlet.cone_cutoff < 1.0f &&
+		    cone_backfacing(camera_position, center, radius, rotation * meshlet.cone_axis, meshlet.cone_cutoff))
+		{
+			continue;
+		}
+
+		stats.meshlets_visible++;
+
+		// meshlets are consecutive in the index list, grow the last range when possible
+		if (!draws.empty() && draws.back().first_index + draws.back().index_count == meshlet.first_index)
+		{
+			draws.back().index_count += meshlet.index_count;
+		}
+		else
+		{
+			draws.push_back({meshlet.first_index, meshlet.index_count});
+		}
+	}
+}
+
+}        // namespace obsidian
@@ -0,0 +1,87 @@
+//
+// Created by rfdic on 9/17/2024.
+//
+
+#ifndef TOYRENDERER_CULLING_HPP
+#define TOYRENDERER_CULLING_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+struct Mesh;
+
+// Six normalized planes, a point is inside when dot(plane.xyz, p) + plane.w >= 0.
+struct Frustum
+{
+	std::array<glm::vec4, 6> planes;        // left, right, bottom, top, near, far
+};
+
+// part of a mesh's index list, first_index relative to the mesh
+struct DrawRange
+{
+	uint32_t first_index;
+	uint32_t index_count;
+};
+
+// Gribb/Hartmann plane extraction. The near plane is taken as z >= -w, which is
+// exact for GL style depth and slightly conservative for zero-to-one depth.
+Frustum extract_frustum(const glm::mat4 &view_projection);
+
+bool sphere_in_frustum(const Frustum &frustum, const glm::vec3 &center, float radius);
+
+// The sphere swept from center along a unit direction for length, as a shadow
+// volume. True when any part of it may be inside.
+bool swept_sphere_in_frustum(const Frustum &frustum, const glm::vec3 &center, float radius, const glm::vec3 &direction, float length);
+
+// World space bounds of many objects in structure-of-arrays layout, so the
+// frustum test runs four objects per instruction. Each object has a sphere and
+// a box; an object is culled when either one is fully outside a plane.
+struct BoundsBatch
+{
+	std::vector<float> sphere_x, sphere_y, sphere_z, sphere_radius;
+	std::vector<float> box_x, box_y, box_z;                  // box center
+	std::vector<float> extent_x, extent_y, extent_z;        // box half size
+
+	void   clear();
+	size_t size() const;
+
+	// transform the mesh's local bounds and append them
+	void push(const Mesh &mesh, const glm::mat4 &transform);
+};
+
+// Write 1 to visible[i] for every object of the batch that is at least partly
+// inside, 0 otherwise. Returns the number visible. Uses SSE when the target has it.
+uint32_t cull_bounds(const Frustum &frustum, const BoundsBatch &batch, std::vector<uint8_t> &visible);
+
+// the mesh's bounding sphere placed at transform, scaled by the largest axis
+void bounding_sphere(const Mesh &mesh, const glm::mat4 &transform, glm::vec3 &center, float &radius);
+
+// true when every triangle under the cone faces away from the camera
+bool cone_backfacing(const glm::vec3 &camera_position, const glm::vec3 &center, float radius, const glm::vec3 &cone_axis, float cone_cutoff);
+
+// Test every meshlet of the mesh placed at transform and append the index ranges
+// of the survivors, merging neighbours into one range. Pure CPU, no device needed.
+void cull_meshlets(const Mesh             &mesh,
+                   const glm::mat4        &transform,
+                   const Frustum          &frustum,
+                   const glm::vec3        &camera_position,
+                   std::vector<DrawRange> &draws,
+                   CullingStats           &stats);
+
+// Pixels per unit of view-space size at distance one, for a vertical fov in degrees.
+float projection_scale(float fov_y, float viewport_height);
+
+// Coarsest lod of the mesh placed at transform whose simplification error stays
+// under pixel_error pixels on screen. Measured at the closest point of the mesh's
+// bounding sphere, so it errs towards the finer level.
+uint32_t select_lod(const Mesh      &mesh,
+                    const glm::mat4 &transform,
+                    const glm::vec3 &camera_position,
+                    float            projection_scale,
+                    float            pixel_error);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_CULLING_HPP
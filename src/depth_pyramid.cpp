@@ -0,0 +1,335 @@
+//
+// Created by rfdic on 9/30/2024.
+//
+
+#include "depth_pyramid.hpp"
+
+#include "barrier_batch.hpp"
+#include "utils.hpp"
+
+namespace obsidian
+{
+
+constexpr VkFormat DEPTH_PYRAMID_FORMAT = VK_FORMAT_R32G32_SFLOAT;
+
+struct PyramidPushConstants
+{
+	glm::ivec2 source_size;
+	glm::ivec2 destination_size;
+	uint32_t   from_depth;
+};
+
+static uint32_t previous_power_of_two(uint32_t value)
+{
+	uint32_t result = 1;
+	while (result * 2 <= value)
+	{
+		result *= 2;
+	}
+	return result;
+}
+
+static VkImageSubresourceRange level_range(uint32_t level, uint32_t level_count)
+{
+	return {VK_IMAGE_ASPECT_COLOR_BIT, level, level_count, 0, 1};
+}
+
+DepthPyramid::DepthPyramid(Init &init, VkExtent2D depth_extent) :
+    init(init),
+    depth_extent(depth_extent)
+{
+	VkSamplerCreateInfo sampler_info = {};
+	sampler_info.sType               = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter           = VK_FILTER_NEAREST;
+	sampler_info.minFilter           = VK_FILTER_NEAREST;
+	sampler_info.mipmapMode          = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.addressModeU        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.maxAnisotropy       = 1.0f;
+	sampler_info.minLod              = 0.0f;
+	sampler_info.maxLod              = VK_LOD_CLAMP_NONE;
+
+	// the shaders only texelFetch, the sampler just has to exist
+	if (init.disp.createSampler(&sampler_info, nullptr, &point_sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pyramid sampler!");
+	}
+
+	create_pipeline();
+	create_image();
+}
+
+DepthPyramid::~DepthPyramid()
+{
+	destroy_image();
+
+	init.disp.destroyPipeline(pipeline, nullptr);
+	init.disp.destroyPipelineLayout(pipeline_layout, nullptr);
+	init.disp.destroyDescriptorPool(descriptor_pool, nullptr);
+	init.disp.destroyDescriptorSetLayout(descriptor_set_layout, nullptr);
+	init.disp.destroySampler(point_sampler, nullptr);
+}
+
+void DepthPyramid::create_pipeline()
+{
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+	bindings[0].binding         = 0;
+	bindings[0].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[1].binding         = 1;
+	bindings[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layout_info = {};
+	layout_info.sType                           = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount                    = static_cast<uint32_t>(bindings.size());
+	layout_info.pBindings                       = bindings.data();
+
+	if (init.disp.createDescriptorSetLayout(&layout_info, nullptr, &descriptor_set_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pyramid descriptor set layout!");
+	}
+
+	const VkDescriptorPoolSize pool_sizes[] = {
+	    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_PYRAMID_LEVELS * MAX_FRAMES_IN_FLIGHT},
+	    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_PYRAMID_LEVELS * MAX_FRAMES_IN_FLIGHT},
+	};
+
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType                      = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.maxSets                    = MAX_PYRAMID_LEVELS * MAX_FRAMES_IN_FLIGHT;
+	pool_info.poolSizeCount              = 2;
+	pool_info.pPoolSizes                 = pool_sizes;
+
+	if (init.disp.createDescriptorPool(&pool_info, nullptr, &descriptor_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pyramid descriptor pool!");
+	}
+
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.stageFlags          = VK_SHADER_STAGE_COMPUTE_BIT;
+	push_constant_range.offset              = 0;
+	push_constant_range.size                = sizeof(PyramidPushConstants);
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType                      = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount             = 1;
+	pipeline_layout_info.pSetLayouts                = &descriptor_set_layout;
+	pipeline_layout_info.pushConstantRangeCount     = 1;
+	pipeline_layout_info.pPushConstantRanges        = &push_constant_range;
+
+	if (init.disp.createPipelineLayout(&pipeline_layout_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pyramid pipeline layout!");
+	}
+
+	VkShaderModule shader_module = create_shader_module(init, read_file("shaders/depth_pyramid.comp.spv"));
+
+	VkComputePipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType                       = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_info.stage.sType                 = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_info.stage.stage                 = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_info.stage.module                = shader_module;
+	pipeline_info.stage.pName                 = "main";
+	pipeline_info.layout                      = pipeline_layout;
+
+	if (init.disp.createComputePipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pyramid pipeline!");
+	}
+
+	init.disp.destroyShaderModule(shader_module, nullptr);
+}
+
+void DepthPyramid::create_image()
+{
+	base_extent = {previous_power_of_two(std::max(depth_extent.width, 1u)), previous_power_of_two(std::max(depth_extent.height, 1u))};
+	levels      = 1;
+	while ((std::max(base_extent.width, base_extent.height) >> levels) > 0)
+	{
+		levels++;
+	}
+	levels = std::min(levels, MAX_PYRAMID_LEVELS);
+
+	VkImageCreateInfo image_info = {};
+	image_info.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType         = VK_IMAGE_TYPE_2D;
+	image_info.extent            = {base_extent.width, base_extent.height, 1};
+	image_info.mipLevels         = levels;
+	image_info.arrayLayers       = 1;
+	image_info.format            = DEPTH_PYRAMID_FORMAT;
+	image_info.tiling            = VK_IMAGE_TILING_OPTIMAL;
+	image_info.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.usage             = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.samples           = VK_SAMPLE_COUNT_1_BIT;
+
+	VmaAllocationCreateInfo allocation_create_info = {};
+	allocation_create_info.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	if (vmaCreateImage(init.allocator, &image_info, &allocation_create_info, &image, &allocation, nullptr) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pyramid!");
+	}
+
+	VkImageViewCreateInfo view_info = {};
+	view_info.sType                 = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image                 = image;
+	view_info.viewType              = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format                = DEPTH_PYRAMID_FORMAT;
+	view_info.subresourceRange      = level_range(0, levels);
+
+	if (init.disp.createImageView(&view_info, nullptr, &full_view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create depth pyramid view!");
+	}
+
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		view_info.subresourceRange = level_range(level, 1);
+		if (init.disp.createImageView(&view_info, nullptr, &level_views[level]) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create depth pyramid level view!");
+		}
+	}
+
+	// every level reads the one above and writes its own, only the base's source changes per frame
+	for (auto &frame_sets : descriptor_sets)
+	{
+		std::array<VkDescriptorSetLayout, MAX_PYRAMID_LEVELS> layouts;
+		layouts.fill(descriptor_set_layout);
+
+		VkDescriptorSetAllocateInfo allocate_info = {};
+		allocate_info.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocate_info.descriptorPool              = descriptor_pool;
+		allocate_info.descriptorSetCount          = levels;
+		allocate_info.pSetLayouts                 = layouts.data();
+
+		if (init.disp.allocateDescriptorSets(&allocate_info, frame_sets.data()) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate depth pyramid descriptor sets!");
+		}
+
+		for (uint32_t level = 0; level < levels; level++)
+		{
+			const VkDescriptorImageInfo source_info      = {point_sampler, level > 0 ? level_views[level - 1] : VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL};
+			const VkDescriptorImageInfo destination_info = {VK_NULL_HANDLE, level_views[level], VK_IMAGE_LAYOUT_GENERAL};
+
+			std::array<VkWriteDescriptorSet, 2> writes = {};
+			writes[0].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[0].dstSet          = frame_sets[level];
+			writes[0].dstBinding      = 0;
+			writes[0].descriptorCount = 1;
+			writes[0].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[0].pImageInfo      = &source_info;
+			writes[1].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[1].dstSet          = frame_sets[level];
+			writes[1].dstBinding      = 1;
+			writes[1].descriptorCount = 1;
+			writes[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[1].pImageInfo      = &destination_info;
+
+			// the base's source is the depth buffer, written by build
+			if (level == 0)
+			{
+				init.disp.updateDescriptorSets(1, &writes[1], 0, nullptr);
+			}
+			else
+			{
+				init.disp.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+			}
+		}
+	}
+
+	// the culling shader samples it even before the first build, so it starts out in GENERAL
+	const auto   command_buffer = begin_single_time_commands(init);
+	BarrierBatch barriers(init);
+	barriers.image(image, level_range(0, levels), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+	               VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+	               VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	barriers.flush(command_buffer);
+	end_single_time_commands(init, command_buffer);
+}
+
+void DepthPyramid::destroy_image()
+{
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		init.disp.destroyImageView(level_views[level], nullptr);
+	}
+	init.disp.destroyImageView(full_view, nullptr);
+	vmaDestroyImage(init.allocator, image, allocation);
+
+	init.disp.resetDescriptorPool(descriptor_pool, 0);
+	levels = 0;
+}
+
+void DepthPyramid::resize(VkExtent2D extent)
+{
+	destroy_image();
+	depth_extent = extent;
+	create_image();
+}
+
+void DepthPyramid::build(VkCommandBuffer command_buffer, uint32_t frame, VkImageView depth_view)
+{
+	// the frame's sets are idle once its fence signalled
+	const VkDescriptorImageInfo depth_info = {point_sampler, depth_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+	VkWriteDescriptorSet write = {};
+	write.sType                = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet               = descriptor_sets[frame][0];
+	write.dstBinding           = 0;
+	write.descriptorCount      = 1;
+	write.descriptorType       = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo           = &depth_info;
+	init.disp.updateDescriptorSets(1, &write, 0, nullptr);
+
+	// last frame's culling may still be sampling it
+	BarrierBatch barriers(init);
+	barriers.image(image, level_range(0, levels), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+	               VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+	               VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	barriers.flush(command_buffer);
+
+	init.disp.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+	glm::ivec2 source_size = glm::ivec2(depth_extent.width, depth_extent.height);
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		const glm::ivec2 size = glm::max(glm::ivec2(base_extent.width >> level, base_extent.height >> level), glm::ivec2(1));
+
+		const PyramidPushConstants push_constants = {source_size, size, level == 0 ? 1u : 0u};
+
+		init.disp.cmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &descriptor_sets[frame][level], 0, nullptr);
+		init.disp.cmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+		init.disp.cmdDispatch(command_buffer, (size.x + 7) / 8, (size.y + 7) / 8, 1);
+
+		// the next level reads this one, and so do the culling shaders after the last
+		barriers.image(image, level_range(level, 1), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+		               VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		               VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+		barriers.flush(command_buffer);
+
+		source_size = size;
+	}
+}
+
+VkImageView DepthPyramid::view() const
+{
+	return full_view;
+}
+
+VkSampler DepthPyramid::sampler() const
+{
+	return point_sampler;
+}
+
+uint32_t DepthPyramid::level_count() const
+{
+	return levels;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,65 @@
+//
+// Created by rfdic on 9/30/2024.
+//
+
+#ifndef TOYRENDERER_DEPTH_PYRAMID_HPP
+#define TOYRENDERER_DEPTH_PYRAMID_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+constexpr uint32_t MAX_PYRAMID_LEVELS = 16;
+
+// Hierarchical Z of the scene depth: a mip chain where every texel holds the
+// farthest and nearest depth of the texels it covers, down to 1x1. The base is
+// the depth buffer rounded down to powers of two, so one texel of level n
+// covers at most 2^n depth texels a side. Lives in GENERAL, written and read by
+// compute shaders only.
+class DepthPyramid
+{
+  public:
+	DepthPyramid(Init &init, VkExtent2D depth_extent);
+	~DepthPyramid();
+
+	// match a new depth buffer size, nothing may be using the pyramid
+	void resize(VkExtent2D depth_extent);
+
+	// Reduce the depth, which has to be in SHADER_READ_ONLY_OPTIMAL, one level at
+	// a time. Compute shaders recorded afterwards can sample every level.
+	void build(VkCommandBuffer command_buffer, uint32_t frame, VkImageView depth_view);
+
+	VkImageView view() const;
+	VkSampler   sampler() const;
+	uint32_t    level_count() const;
+
+  private:
+	void create_pipeline();
+	void create_image();
+	void destroy_image();
+
+	Init &init;
+
+	VkExtent2D depth_extent;
+	VkExtent2D base_extent;
+	uint32_t   levels = 0;
+
+	VkImage                                      image;
+	VmaAllocation                                allocation;
+	VkImageView                                  full_view;        // every level, for the culling shader
+	std::array<VkImageView, MAX_PYRAMID_LEVELS>  level_views;
+	VkSampler                                    point_sampler;
+
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool      descriptor_pool;
+	VkPipelineLayout      pipeline_layout;
+	VkPipeline            pipeline;
+
+	// one set per level, the base's source is the frame's depth buffer and rewritten each build
+	std::array<std::array<VkDescriptorSet, MAX_PYRAMID_LEVELS>, MAX_FRAMES_IN_FLIGHT> descriptor_sets;
+};
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_DEPTH_PYRAMID_HPP
@@ -0,0 +1,123 @@
+//
+// Created by rfdic on 9/2/2024.
+//
+
+#include "frame_allocator.hpp"
+
+#include "utils.hpp"
+
+namespace obsidian
+{
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+FrameAllocator::FrameAllocator(Init &init, VkDeviceSize frame_capacity) :
+    init(init)
+{
+	const auto &limits = init.physical_device.properties.limits;
+	uniform_alignment  = limits.minUniformBufferOffsetAlignment;
+	storage_alignment  = limits.minStorageBufferOffsetAlignment;
+
+	// keep every region start aligned so offsets stay valid for any descriptor type
+	capacity = align_up(frame_capacity, std::max(uniform_alignment, storage_alignment));
+
+	VkBufferCreateInfo buffer_info = {
+	    .sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	    .size        = capacity * MAX_FRAMES_IN_FLIGHT,
+	    .usage       = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+
+	VmaAllocationCreateInfo alloc_info = {
+	    .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+	             VMA_ALLOCATION_CREATE_MAPPED_BIT,
+	    .usage = VMA_MEMORY_USAGE_AUTO,
+	};
+
+	VmaAllocationInfo allocation_info = {};
+	if (vmaCreateBuffer(init.allocator, &buffer_info, &alloc_info,
+	                    &buffer_allocation.buffer,
+	                    &buffer_allocation.allocation,
+	                    &allocation_info) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create frame allocator buffer!");
+	}
+
+	buffer_allocation.size = buffer_info.size;
+	mapped_data            = static_cast<uint8_t *>(allocation_info.pMappedData);
+
+	frame_begin = 0;
+	head        = 0;
+}
+
+FrameAllocator::~FrameAllocator()
+{
+	cleanup_buffer(init, buffer_allocation);
+}
+
+void FrameAllocator::reset(uint32_t frame_index)
+{
+	frame_begin = capacity * frame_index;
+	head        = frame_begin;
+}
+
+FrameAllocation FrameAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+	VkDeviceSize offset = align_up(head, alignment);
+
+	if (offset + size > frame_begin + capacity)
+	{
+		throw std::runtime_error("frame allocator out of memory!");
+	}
+
+	head = offset + size;
+
+	return {
+	    .buffer = buffer_allocation.buffer,
+	    .offset = offset,
+	    .size   = size,
+	    .data   = mapped_data + offset,
+	};
+}
+
+FrameAllocation FrameAllocator::push_uniform(const void *data, VkDeviceSize size)
+{
+	FrameAllocation allocation = allocate(size, uniform_alignment);
+	memcpy(allocation.data, data, static_cast<size_t>(size));
+	return allocation;
+}
+
+FrameAllocation FrameAllocator::push_storage(const void *data, VkDeviceSize size)
+{
+	FrameAllocation allocation = allocate_storage(size);
+	memcpy(allocation.data, data, static_cast<size_t>(size));
+	return allocation;
+}
+
+FrameAllocation FrameAllocator::allocate_storage(VkDeviceSize size)
+{
+	return allocate(size, storage_alignment);
+}
+
+void FrameAllocator::flush()
+{
+	if (head > frame_begin)
+	{
+		vmaFlushAllocation(init.allocator, buffer_allocation.allocation, frame_begin, head - frame_begin);
+	}
+}
+
+VkBuffer FrameAllocator::buffer() const
+{
+	return buffer_allocation.buffer;
+}
+
+VkDeviceSize FrameAllocator::frame_capacity() const
+{
+	return capacity;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,63 @@
+//
+// Created by rfdic on 9/2/2024.
+//
+
+#ifndef TOYRENDERER_FRAME_ALLOCATOR_HPP
+#define TOYRENDERER_FRAME_ALLOCATOR_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+struct FrameAllocation
+{
+	VkBuffer     buffer;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	void        *data;
+};
+
+// Linear allocator over one persistently mapped, host-visible buffer. The buffer
+// is split into one region per frame in flight; a frame bumps through its own
+// region and rewinds it with reset() once that frame's fence has signalled, so
+// per-object constants cost a memcpy instead of a map/unmap and a new buffer.
+class FrameAllocator
+{
+  public:
+	FrameAllocator(Init &init, VkDeviceSize frame_capacity);
+	~FrameAllocator();
+
+	// rewind the region owned by frame_index, only call after its fence signalled
+	void reset(uint32_t frame_index);
+
+	FrameAllocation allocate(VkDeviceSize size, VkDeviceSize alignment);
+	FrameAllocation push_uniform(const void *data, VkDeviceSize size);
+	FrameAllocation push_storage(const void *data, VkDeviceSize size);
+
+	// storage aligned space the caller fills in later, before flush()
+	FrameAllocation allocate_storage(VkDeviceSize size);
+
+	// make this frame's writes visible to the device when the memory is not coherent
+	void flush();
+
+	VkBuffer     buffer() const;
+	VkDeviceSize frame_capacity() const;
+
+  private:
+	Init &init;
+
+	BufferAllocation buffer_allocation;
+	uint8_t         *mapped_data;
+
+	VkDeviceSize capacity;
+	VkDeviceSize frame_begin;
+	VkDeviceSize head;
+
+	VkDeviceSize uniform_alignment;
+	VkDeviceSize storage_alignment;
+};
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_FRAME_ALLOCATOR_HPP
@@ -0,0 +1,259 @@
+//
+// Created by rfdic on 9/5/2024.
+//
+
+#include "geometry_pool.hpp"
+
+#include "mesh.hpp"
+#include "upload_queue.hpp"
+#include "utils.hpp"
+
+namespace obsidian
+{
+
+FreeListAllocator::FreeListAllocator(uint64_t capacity) :
+    total(capacity), allocated(0)
+{
+	if (capacity > 0)
+	{
+		free_blocks[0] = capacity;
+	}
+}
+
+bool FreeListAllocator::allocate(uint64_t count, uint64_t alignment, uint64_t &offset)
+{
+	for (auto it = free_blocks.begin(); it != free_blocks.end(); ++it)
+	{
+		const uint64_t block_offset = it->first;
+		const uint64_t block_size   = it->second;
+		const uint64_t aligned      = (block_offset + alignment - 1) / alignment * alignment;
+		const uint64_t padding      = aligned - block_offset;
+
+		if (padding + count > block_size)
+		{
+			continue;
+		}
+
+		free_blocks.erase(it);
+
+		// keep the alignment padding and the tail as free blocks
+		if (padding > 0)
+		{
+			free_blocks[block_offset] = padding;
+		}
+		if (padding + count < block_size)
+		{
+			free_blocks[aligned + count] = block_size - padding - count;
+		}
+
+		allocated += count;
+		offset = aligned;
+		return true;
+	}
+
+	return false;
+}
+
+void FreeListAllocator::free(uint64_t offset, uint64_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	allocated -= count;
+
+	auto it = free_blocks.emplace(offset, count).first;
+
+	// merge with the following block
+	auto next = std::next(it);
+	if (next != free_blocks.end() && it->first + it->second == next->first)
+	{
+		it->second += next->second;
+		free_blocks.erase(next);
+	}
+
+	// merge with the preceding block
+	if (it != free_blocks.begin())
+	{
+		auto prev = std::prev(it);
+		if (prev->first + prev->second == it->first)
+		{
+			prev->second += it->second;
+			free_blocks.erase(it);
+		}
+	}
+}
+
+uint64_t FreeListAllocator::capacity() const
+{
+	return total;
+}
+
+uint64_t FreeListAllocator::used() const
+{
+	return allocated;
+}
+
+GeometryPool::GeometryPool(Init &init, VertexFormat vertex_format, uint32_t vertex_capacity, uint32_t index_capacity) :
+    init(init), format(vertex_format), vertex_allocator(vertex_capacity), index_allocator(static_cast<uint64_t>(index_capacity) * sizeof(uint32_t))
+{
+	create_upload_buffer(init, static_cast<VkDeviceSize>(vertex_capacity) * vertex_position_stride(format),
+	                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	                     VMA_MEMORY_USAGE_GPU_ONLY, positions);
+	create_upload_buffer(init, static_cast<VkDeviceSize>(vertex_capacity) * vertex_attribute_stride(format),
+	                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+	                     VMA_MEMORY_USAGE_GPU_ONLY, attributes);
+	create_upload_buffer(init, static_cast<VkDeviceSize>(index_capacity) * sizeof(uint32_t),
+	                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+	                     VMA_MEMORY_USAGE_GPU_ONLY, indices);
+}
+
+GeometryPool::~GeometryPool()
+{
+	cleanup_buffer(init, positions);
+	cleanup_buffer(init, attributes);
+	cleanup_buffer(init, indices);
+}
+
+void GeometryPool::upload(UploadQueue &upload_queue, const std::vector<Mesh *> &meshes)
+{
+	for (Mesh *mesh : meshes)
+	{
+		uint64_t       vertex_offset = 0;
+		uint64_t       index_offset  = 0;
+		const uint32_t index_size    = index_type_size(mesh->index_type);
+
+		if (!vertex_allocator.allocate(mesh->vertex_count, 1, vertex_offset))
+		{
+			throw std::runtime_error("geometry pool is out of vertex space!");
+		}
+		if (!index_allocator.allocate(static_cast<uint64_t>(mesh->index_count) * index_size, index_size, index_offset))
+		{
+			vertex_allocator.free(vertex_offset, mesh->vertex_count);
+			throw std::runtime_error("geometry pool is out of index space!");
+		}
+
+		mesh->vertex_offset = static_cast<int32_t>(vertex_offset);
+		mesh->first_index   = static_cast<uint32_t>(index_offset / index_size);
+	}
+
+	// pack as many meshes per staging reservation as fit, normally that is all of them
+	std::vector<Mesh *> group;
+	VkDeviceSize        group_size = 0;
+
+	auto queue_group = [&]() {
+		if (group.empty())
+		{
+			return;
+		}
+
+		StagingRange staging = upload_queue.reserve_staging(group_size);
+		queue_upload_mesh_data(upload_queue, pack_mesh_data(group, staging, positions.buffer, attributes.buffer, indices.buffer, format));
+
+		group.clear();
+		group_size = 0;
+	};
+
+	for (Mesh *mesh : meshes)
+	{
+		const VkDeviceSize mesh_size = mesh_upload_size(*mesh, format);
+		if (group_size + mesh_size > upload_queue.staging_capacity())
+		{
+			queue_group();
+		}
+
+		group.push_back(mesh);
+		group_size += mesh_size;
+	}
+	queue_group();
+
+	for (Mesh *mesh : meshes)
+	{
+		mesh->gpu_data_initialized = true;
+	}
+
+	if (format == VertexFormat::FULL)
+	{
+		return;
+	}
+
+	// report what the compact encoding cost, meshes coming from a cooked blob were measured when cooked
+	VertexEncodingError worst = {};
+	bool                measured = false;
+	for (const Mesh *mesh : meshes)
+	{
+		if (mesh->packed_position_data || mesh->vertices.empty())
+		{
+			continue;
+		}
+
+		const VertexEncodingError error = measure_encoding_error(mesh->vertices, format);
+		worst.position       = std::max(worst.position, error.position);
+		worst.normal_degrees = std::max(worst.normal_degrees, error.normal_degrees);
+		worst.tex_coord      = std::max(worst.tex_coord, error.tex_coord);
+		worst.color          = std::max(worst.color, error.color);
+		measured             = true;
+	}
+
+	if (measured)
+	{
+		std::cout << "Compact vertex error: position " << worst.position
+		          << ", normal " << worst.normal_degrees << " deg"
+		          << ", uv " << worst.tex_coord << std::endl;
+	}
+}
+
+void GeometryPool::release(Mesh &mesh)
+{
+	if (!mesh.gpu_data_initialized)
+	{
+		return;
+	}
+
+	vertex_allocator.free(static_cast<uint64_t>(mesh.vertex_offset), mesh.vertex_count);
+	const uint32_t index_size = index_type_size(mesh.index_type);
+	index_allocator.free(static_cast<uint64_t>(mesh.first_index) * index_size, static_cast<uint64_t>(mesh.index_count) * index_size);
+	mesh.gpu_data_initialized = false;
+}
+
+GeometryBinding GeometryPool::bind(VkCommandBuffer command_buffer)
+{
+	const VkBuffer     buffers[] = {positions.buffer, attributes.buffer};
+	const VkDeviceSize offsets[] = {0, 0};
+	init.disp.cmdBindVertexBuffers(command_buffer, POSITION_BINDING, 2, buffers, offsets);
+	init.disp.cmdBindIndexBuffer(command_buffer, indices.buffer, 0, VK_INDEX_TYPE_UINT16);
+
+	return {indices.buffer, VK_INDEX_TYPE_UINT16};
+}
+
+GeometryBinding GeometryPool::bind_positions(VkCommandBuffer command_buffer)
+{
+	VkDeviceSize offset = 0;
+	init.disp.cmdBindVertexBuffers(command_buffer, POSITION_BINDING, 1, &positions.buffer, &offset);
+	init.disp.cmdBindIndexBuffer(command_buffer, indices.buffer, 0, VK_INDEX_TYPE_UINT16);
+
+	return {indices.buffer, VK_INDEX_TYPE_UINT16};
+}
+
+VertexFormat GeometryPool::vertex_format() const
+{
+	return format;
+}
+
+VkBuffer GeometryPool::position_buffer() const
+{
+	return positions.buffer;
+}
+
+VkBuffer GeometryPool::attribute_buffer() const
+{
+	return attributes.buffer;
+}
+
+VkBuffer GeometryPool::index_buffer() const
+{
+	return indices.buffer;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,84 @@
+//
+// Created by rfdic on 9/5/2024.
+//
+
+#ifndef TOYRENDERER_GEOMETRY_POOL_HPP
+#define TOYRENDERER_GEOMETRY_POOL_HPP
+
+#include "common.hpp"
+#include "vertex_format.hpp"
+
+namespace obsidian
+{
+
+struct Mesh;
+class UploadQueue;
+
+// First-fit free list over a range of elements. Freed blocks are merged with
+// their neighbours so long-lived pools do not fragment into slivers.
+class FreeListAllocator
+{
+  public:
+	explicit FreeListAllocator(uint64_t capacity = 0);
+
+	bool allocate(uint64_t count, uint64_t alignment, uint64_t &offset);
+	void free(uint64_t offset, uint64_t count);
+
+	uint64_t capacity() const;
+	uint64_t used() const;
+
+  private:
+	std::map<uint64_t, uint64_t> free_blocks;        // offset -> element count
+	uint64_t                     total;
+	uint64_t                     allocated;
+};
+
+// Index state of a command buffer after GeometryPool::bind. Meshes of either
+// index width share the pool's index buffer, so draws only rebind it when the
+// width changes.
+struct GeometryBinding
+{
+	VkBuffer    index_buffer;
+	VkIndexType index_type;
+};
+
+// Device-local position, attribute and index buffers that every mesh is
+// suballocated from. Both vertex streams share one vertex allocation, so a
+// mesh's vertex_offset is valid in either. A pass binds the pool once and then
+// only issues draws with the mesh's first_index/vertex_offset.
+class GeometryPool
+{
+  public:
+	// index_capacity is in 32-bit indices, 16-bit meshes fit twice as many
+	GeometryPool(Init &init, VertexFormat vertex_format, uint32_t vertex_capacity, uint32_t index_capacity);
+	~GeometryPool();
+
+	// reserve space for the meshes and queue their data on the upload queue
+	void upload(UploadQueue &upload_queue, const std::vector<Mesh *> &meshes);
+	void release(Mesh &mesh);
+
+	GeometryBinding bind(VkCommandBuffer command_buffer);
+
+	// depth-only passes only fetch the position stream
+	GeometryBinding bind_positions(VkCommandBuffer command_buffer);
+
+	VertexFormat vertex_format() const;
+	VkBuffer     position_buffer() const;
+	VkBuffer     attribute_buffer() const;
+	VkBuffer     index_buffer() const;
+
+  private:
+	Init        &init;
+	VertexFormat format;
+
+	BufferAllocation positions;
+	BufferAllocation attributes;
+	BufferAllocation indices;
+
+	FreeListAllocator vertex_allocator;
+	FreeListAllocator index_allocator;        // in bytes, ranges are aligned to their index width
+};
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_GEOMETRY_POOL_HPP
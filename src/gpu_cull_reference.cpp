@@ -0,0 +1,95 @@
+//
+// Created by rfdic on 10/2/2024.
+//
+
+#include "gpu_culling.hpp"
+
+#include "culling.hpp"
+
+// The CPU side of cull.comp, apart from the GpuCulling class so checks can
+// link it without the renderer.
+
+namespace obsidian
+{
+
+GpuCullView make_cull_view(const glm::mat4 &view_projection,
+                           const glm::vec3 &camera_position,
+                           float            projection_scale,
+                           float            pixel_error,
+                           uint32_t         required_flags,
+                           uint32_t         excluded_flags)
+{
+	const Frustum frustum = extract_frustum(view_projection);
+
+	GpuCullView view = {};
+	for (size_t i = 0; i < frustum.planes.size(); i++)
+	{
+		view.planes[i] = frustum.planes[i];
+	}
+	view.camera_position = glm::vec4(camera_position, projection_scale);
+	view.pixel_error     = pixel_error;
+	view.required_flags  = required_flags;
+	view.excluded_flags  = excluded_flags;
+	view.view_projection = view_projection;
+	return view;
+}
+
+void gpu_cull_reference(std::span<const GpuDrawData>                              draws,
+                        std::span<const glm::mat4>                                transforms,
+                        const GpuCullView                                        &view,
+                        uint32_t                                                  first_object,
+                        std::array<std::vector<VkDrawIndexedIndirectCommand>, 2> &lists)
+{
+	for (auto &list : lists)
+	{
+		list.clear();
+	}
+
+	for (uint32_t i = 0; i < draws.size(); i++)
+	{
+		const GpuDrawData &draw = draws[i];
+		if (draw.lod_count == 0 || (draw.flags & view.required_flags) != view.required_flags || (draw.flags & view.excluded_flags) != 0)
+		{
+			continue;
+		}
+
+		const glm::mat4 &model  = transforms[i];
+		const float      scale  = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		const glm::vec3  center = glm::vec3(model * glm::vec4(glm::vec3(draw.sphere), 1.0f));
+		const float      radius = draw.sphere.w * scale;
+
+		bool inside = true;
+		for (const glm::vec4 &plane : view.planes)
+		{
+			inside = inside && glm::dot(glm::vec3(plane), center) + plane.w >= -radius;
+		}
+		if (!inside)
+		{
+			continue;
+		}
+
+		uint32_t    level    = 0;
+		const float distance = glm::length(center - glm::vec3(view.camera_position)) - radius;
+		if (distance > 0.0f)
+		{
+			for (uint32_t l = 1; l < draw.lod_count; l++)
+			{
+				if (draw.lod_error[l] * scale * view.camera_position.w / distance > view.pixel_error)
+				{
+					break;
+				}
+				level = l;
+			}
+		}
+
+		VkDrawIndexedIndirectCommand command = {};
+		command.indexCount                   = draw.lod_index_count[level];
+		command.instanceCount                = 1;
+		command.firstIndex                   = draw.lod_first_index[level];
+		command.vertexOffset                 = draw.vertex_offset;
+		command.firstInstance                = first_object + i;
+		lists[(draw.flags & DRAW_INDEX32) != 0 ? 1 : 0].push_back(command);
+	}
+}
+
+}        // namespace obsidian
@@ -0,0 +1,554 @@
+//
+// Created by rfdic on 9/29/2024.
+//
+
+#include "gpu_culling.hpp"
+
+#include "barrier_batch.hpp"
+#include "depth_pyramid.hpp"
+#include "frame_allocator.hpp"
+#include "geometry_pool.hpp"
+#include "mesh.hpp"
+#include "scene.hpp"
+#include "upload_queue.hpp"
+#include "utils.hpp"
+
+namespace obsidian
+{
+
+static_assert(sizeof(GpuDrawData) == 80, "GpuDrawData has to match DrawData in cull.comp");
+static_assert(sizeof(GpuCullView) == 192, "GpuCullView has to match CullView in cull.comp");
+
+constexpr uint32_t     LIST_COUNT     = (MAX_GPU_CULL_VIEWS + 1) * 2;        // the main view's late lists last
+constexpr VkDeviceSize COUNT_BYTES    = 256;        // the counts, padded so the commands start aligned in the readback
+constexpr VkDeviceSize COMMAND_STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+
+static_assert(LIST_COUNT * sizeof(uint32_t) <= COUNT_BYTES, "the counts don't fit");
+
+GpuDrawData make_draw_data(const Scene &scene, size_t instance)
+{
+	const Mesh &mesh = *scene.meshes[scene.mesh_indices[instance]];
+
+	GpuDrawData draw   = {};
+	draw.sphere        = glm::vec4(mesh.sphere_center, mesh.sphere_radius);
+	draw.vertex_offset = mesh.vertex_offset;
+	draw.flags         = (mesh.index_type == VK_INDEX_TYPE_UINT32 ? DRAW_INDEX32 : 0) |
+	                     (scene.casts_shadows[instance] ? DRAW_CASTS_SHADOW : 0) |
+	                     (scene.is_static[instance] ? DRAW_STATIC : 0);
+
+	if (!mesh.gpu_data_initialized)
+	{
+		return draw;
+	}
+
+	// levels past MAX_GPU_LODS are never picked, the last one kept is the coarsest drawn
+	draw.lod_count = static_cast<uint32_t>(std::clamp<size_t>(mesh.lods.size(), 1, MAX_GPU_LODS));
+	for (uint32_t level = 0; level < draw.lod_count; level++)
+	{
+		const MeshLod range           = mesh.lod(level);
+		draw.lod_first_index[level]   = mesh.first_index + range.first_index;
+		draw.lod_index_count[level]   = range.index_count;
+		draw.lod_error[level]         = range.error;
+	}
+
+	return draw;
+}
+
+GpuCulling::GpuCulling(Init &init, UploadQueue &upload_queue, FrameAllocator &frame_allocator, uint32_t capacity) :
+    init(init),
+    upload_queue(upload_queue),
+    frame_allocator(frame_allocator),
+    capacity(capacity)
+{
+	create_pipeline();
+
+	create_buffer(init, VkDeviceSize(capacity) * sizeof(uint32_t),
+	              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	              VMA_MEMORY_USAGE_GPU_ONLY, visibility);
+
+	for (FrameResources &resources : frames)
+	{
+		create_frame_resources(resources);
+	}
+}
+
+GpuCulling::~GpuCulling()
+{
+	for (FrameResources &resources : frames)
+	{
+		cleanup_buffer(init, resources.draws);
+		cleanup_buffer(init, resources.commands);
+		cleanup_buffer(init, resources.counts);
+		cleanup_buffer(init, resources.readback);
+	}
+	cleanup_buffer(init, visibility);
+
+	init.disp.destroyPipeline(pipeline, nullptr);
+	init.disp.destroyPipelineLayout(pipeline_layout, nullptr);
+	init.disp.destroyDescriptorPool(descriptor_pool, nullptr);
+	init.disp.destroyDescriptorSetLayout(descriptor_set_layout, nullptr);
+}
+
+void GpuCulling::create_pipeline()
+{
+	std::array<VkDescriptorSetLayoutBinding, CULL_BINDING_TYPES.size()> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding         = i;
+		bindings[i].descriptorType  = CULL_BINDING_TYPES[i];
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layout_info = {};
+	layout_info.sType                           = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount                    = static_cast<uint32_t>(bindings.size());
+	layout_info.pBindings                       = bindings.data();
+
+	if (init.disp.createDescriptorSetLayout(&layout_info, nullptr, &descriptor_set_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor set layout!");
+	}
+
+	const VkDescriptorPoolSize pool_sizes[] = {
+	    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2 * MAX_FRAMES_IN_FLIGHT},
+	    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * MAX_FRAMES_IN_FLIGHT},
+	    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_FRAMES_IN_FLIGHT},
+	};
+
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType                      = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.maxSets                    = MAX_FRAMES_IN_FLIGHT;
+	pool_info.poolSizeCount              = 3;
+	pool_info.pPoolSizes                 = pool_sizes;
+
+	if (init.disp.createDescriptorPool(&pool_info, nullptr, &descriptor_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor pool!");
+	}
+
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.stageFlags          = VK_SHADER_STAGE_COMPUTE_BIT;
+	push_constant_range.offset              = 0;
+	push_constant_range.size                = sizeof(CullPushConstants);
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType                      = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount             = 1;
+	pipeline_layout_info.pSetLayouts                = &descriptor_set_layout;
+	pipeline_layout_info.pushConstantRangeCount     = 1;
+	pipeline_layout_info.pPushConstantRanges        = &push_constant_range;
+
+	if (init.disp.createPipelineLayout(&pipeline_layout_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling pipeline layout!");
+	}
+
+	VkShaderModule shader_module = create_shader_module(init, read_file("shaders/cull.comp.spv"));
+
+	VkComputePipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType                       = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_info.stage.sType                 = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_info.stage.stage                 = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_info.stage.module                = shader_module;
+	pipeline_info.stage.pName                 = "main";
+	pipeline_info.layout                      = pipeline_layout;
+
+	if (init.disp.createComputePipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling pipeline!");
+	}
+
+	init.disp.destroyShaderModule(shader_module, nullptr);
+}
+
+void GpuCulling::create_frame_resources(FrameResources &resources)
+{
+	const VkDeviceSize command_bytes = VkDeviceSize(LIST_COUNT) * capacity * COMMAND_STRIDE;
+
+	create_upload_buffer(init, VkDeviceSize(capacity) * sizeof(GpuDrawData),
+	                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	                     VMA_MEMORY_USAGE_GPU_ONLY, resources.draws);
+	create_buffer(init, command_bytes,
+	              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	              VMA_MEMORY_USAGE_GPU_ONLY, resources.commands);
+	create_buffer(init, COUNT_BYTES,
+	              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+	                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	              VMA_MEMORY_USAGE_GPU_ONLY, resources.counts);
+	create_buffer(init, COUNT_BYTES + command_bytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, resources.readback);
+
+	VkDescriptorSetAllocateInfo allocate_info = {};
+	allocate_info.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocate_info.descriptorPool              = descriptor_pool;
+	allocate_info.descriptorSetCount          = 1;
+	allocate_info.pSetLayouts                 = &descriptor_set_layout;
+
+	if (init.disp.allocateDescriptorSets(&allocate_info, &resources.descriptor_set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate culling descriptor set!");
+	}
+
+	const VkDescriptorBufferInfo buffer_infos[] = {
+	    {frame_allocator.buffer(), 0, VkDeviceSize(capacity) * sizeof(ObjectData)},
+	    {resources.draws.buffer, 0, VK_WHOLE_SIZE},
+	    {frame_allocator.buffer(), 0, VkDeviceSize(MAX_GPU_CULL_VIEWS) * sizeof(GpuCullView)},
+	    {resources.commands.buffer, 0, VK_WHOLE_SIZE},
+	    {resources.counts.buffer, 0, VK_WHOLE_SIZE},
+	    {visibility.buffer, 0, VK_WHOLE_SIZE},
+	};
+
+	// the pyramid comes later, from set_depth_pyramid
+	std::array<VkWriteDescriptorSet, DEPTH_PYRAMID_BINDING> writes = {};
+	for (uint32_t i = 0; i < writes.size(); i++)
+	{
+		writes[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet          = resources.descriptor_set;
+		writes[i].dstBinding      = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType  = CULL_BINDING_TYPES[i];
+		writes[i].pBufferInfo     = &buffer_infos[i];
+	}
+
+	init.disp.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void GpuCulling::begin_frame(uint32_t frame_index)
+{
+	frame = frame_index;
+
+	FrameResources &resources = frames[frame];
+	if (!resources.verify_pending)
+	{
+		return;
+	}
+	resources.verify_pending = false;
+
+	void *mapped = nullptr;
+	vmaMapMemory(init.allocator, resources.readback.allocation, &mapped);
+	vmaInvalidateAllocation(init.allocator, resources.readback.allocation, 0, VK_WHOLE_SIZE);
+
+	const auto *counts   = static_cast<const uint32_t *>(mapped);
+	const auto *commands = reinterpret_cast<const VkDrawIndexedIndirectCommand *>(static_cast<const uint8_t *>(mapped) + COUNT_BYTES);
+
+	auto same_command = [](const VkDrawIndexedIndirectCommand &a, const VkDrawIndexedIndirectCommand &b) {
+		return a.indexCount == b.indexCount && a.instanceCount == b.instanceCount && a.firstIndex == b.firstIndex &&
+		       a.vertexOffset == b.vertexOffset && a.firstInstance == b.firstInstance;
+	};
+
+	bool matches = true;
+	for (uint32_t view = 0; view < resources.reference.size(); view++)
+	{
+		// the occluded instances are only known on the device, the two phases together have to be a subset of the frustum culled set
+		const bool occlusion = resources.occlusion && view == GPU_VIEW_MAIN;
+
+		for (uint32_t bucket = 0; bucket < 2; bucket++)
+		{
+			std::vector<VkDrawIndexedIndirectCommand> written;
+			for (uint32_t list : {view * 2 + bucket, GPU_VIEW_MAIN_LATE * 2 + bucket})
+			{
+				written.insert(written.end(), commands + list * capacity, commands + list * capacity + counts[list]);
+				if (!occlusion)
+				{
+					break;
+				}
+			}
+			std::sort(written.begin(), written.end(), [](const VkDrawIndexedIndirectCommand &a, const VkDrawIndexedIndirectCommand &b) {
+				return a.firstInstance < b.firstInstance;
+			});
+
+			const std::vector<VkDrawIndexedIndirectCommand> &expected = resources.reference[view][bucket];
+			if (!occlusion && written.size() != expected.size())
+			{
+				matches = false;
+				continue;
+			}
+
+			// both sorted by instance, every written command has to match the expected one of its instance once
+			size_t next = 0;
+			for (size_t i = 0; i < written.size() && matches; i++)
+			{
+				while (next < expected.size() && expected[next].firstInstance < written[i].firstInstance)
+				{
+					next++;
+				}
+				matches = next < expected.size() && same_command(written[i], expected[next]);
+				next++;
+			}
+		}
+	}
+
+	vmaUnmapMemory(init.allocator, resources.readback.allocation);
+
+	verified++;
+	if (!matches)
+	{
+		mismatched++;
+		std::cout << "GPU culling differs from the CPU reference\n";
+	}
+}
+
+void GpuCulling::prepare(const Scene &scene, uint32_t first_object_index, std::span<const GpuCullView> views, bool occlusion)
+{
+	// the object buffer was created with the same capacity, it would have failed first
+	if (scene.instance_count() > capacity)
+	{
+		throw std::runtime_error("scene grew past the GPU culling capacity!");
+	}
+	if (views.size() > MAX_GPU_CULL_VIEWS)
+	{
+		throw std::runtime_error("too many culling views!");
+	}
+
+	object_count = static_cast<uint32_t>(scene.instance_count());
+	first_object = first_object_index;
+	view_count   = static_cast<uint32_t>(views.size());
+
+	// instances only change their transforms between scene edits, which come through the object buffer
+	if (table_revision != scene.static_revision || draw_table.size() != object_count)
+	{
+		draw_table.resize(object_count);
+		for (size_t i = 0; i < object_count; i++)
+		{
+			draw_table[i] = make_draw_data(scene, i);
+		}
+		table_revision   = scene.static_revision;
+		visibility_reset = true;
+	}
+
+	// every frame in flight has its own copy, this one is idle since its fence signalled; the
+	// frame's submission waits on the upload queue's timeline, so nothing blocks here
+	FrameResources &resources = frames[frame];
+	if (resources.draw_revision != table_revision || resources.draw_count != object_count)
+	{
+		if (object_count > 0)
+		{
+			upload_queue.upload_buffer(resources.draws.buffer, 0, draw_table.data(), draw_table.size() * sizeof(GpuDrawData));
+		}
+		resources.draw_revision = table_revision;
+		resources.draw_count    = object_count;
+	}
+
+	FrameAllocation view_allocation = frame_allocator.allocate_storage(VkDeviceSize(MAX_GPU_CULL_VIEWS) * sizeof(GpuCullView));
+	memcpy(view_allocation.data, views.data(), views.size_bytes());
+	views_offset = static_cast<uint32_t>(view_allocation.offset);
+
+	resources.occlusion = occlusion;
+	resources.reference.clear();
+	if (verify)
+	{
+		resources.reference.resize(view_count);
+		for (uint32_t view = 0; view < view_count; view++)
+		{
+			gpu_cull_reference(draw_table, scene.transforms, views[view], first_object, resources.reference[view]);
+		}
+	}
+}
+
+void GpuCulling::dispatch(VkCommandBuffer command_buffer, uint32_t object_offset)
+{
+	FrameResources &resources = frames[frame];
+	BarrierBatch    barriers(init);
+
+	// the last reader of these buffers was this frame in flight's previous draw, behind its fence
+	init.disp.cmdFillBuffer(command_buffer, resources.counts.buffer, 0, COUNT_BYTES, 0);
+	barriers.buffer(resources.counts.buffer, 0, VK_WHOLE_SIZE,
+	                VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+	// the previous frame's late pass wrote the visibility, nothing but the submission order is between them
+	if (resources.occlusion)
+	{
+		barriers.buffer(visibility.buffer, 0, VK_WHOLE_SIZE,
+		                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT,
+		                VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+		barriers.flush(command_buffer);
+
+		// nothing is known about the instances yet, the late pass finds them all
+		if (visibility_reset)
+		{
+			init.disp.cmdFillBuffer(command_buffer, visibility.buffer, 0, VK_WHOLE_SIZE, 0);
+			barriers.buffer(visibility.buffer, 0, VK_WHOLE_SIZE,
+			                VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+			visibility_reset = false;
+		}
+	}
+	barriers.flush(command_buffer);
+
+	if (object_count > 0)
+	{
+		const uint32_t dynamic_offsets[] = {object_offset, views_offset};
+		const CullPushConstants push_constants = {object_count, first_object, capacity,
+		                                          resources.occlusion ? CULL_EARLY : CULL_ALL, 0};
+
+		init.disp.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		init.disp.cmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &resources.descriptor_set, 2, dynamic_offsets);
+		init.disp.cmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+		init.disp.cmdDispatch(command_buffer, (object_count + 63) / 64, view_count, 1);
+	}
+
+	// with occlusion the late pass reads back both phases' lists
+	if (resources.occlusion)
+	{
+		barriers.buffer(resources.commands.buffer, 0, VK_WHOLE_SIZE,
+		                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		                VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+		barriers.buffer(resources.counts.buffer, 0, VK_WHOLE_SIZE,
+		                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+		                VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+		                VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+		barriers.flush(command_buffer);
+		return;
+	}
+
+	read_back(command_buffer, resources);
+}
+
+void GpuCulling::dispatch_late(VkCommandBuffer command_buffer, uint32_t object_offset)
+{
+	FrameResources &resources = frames[frame];
+	BarrierBatch    barriers(init);
+
+	// the early pass read the visibility this one rewrites
+	barriers.buffer(visibility.buffer, 0, VK_WHOLE_SIZE,
+	                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+	                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+	barriers.flush(command_buffer);
+
+	if (object_count > 0)
+	{
+		const uint32_t dynamic_offsets[] = {object_offset, views_offset};
+		const CullPushConstants push_constants = {object_count, first_object, capacity,
+		                                          CULL_LATE, GPU_VIEW_MAIN_LATE * 2};
+
+		init.disp.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		init.disp.cmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &resources.descriptor_set, 2, dynamic_offsets);
+		init.disp.cmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+		init.disp.cmdDispatch(command_buffer, (object_count + 63) / 64, 1, 1);
+	}
+
+	read_back(command_buffer, resources);
+}
+
+// make the lists visible to the indirect draws and, when verifying, copy them out for begin_frame
+void GpuCulling::read_back(VkCommandBuffer command_buffer, FrameResources &resources)
+{
+	BarrierBatch barriers(init);
+
+	const bool            copy       = verify && !resources.reference.empty();
+	VkPipelineStageFlags2 dst_stages = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+	VkAccessFlags2        dst_access = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+	if (copy)
+	{
+		dst_stages |= VK_PIPELINE_STAGE_2_COPY_BIT;
+		dst_access |= VK_ACCESS_2_TRANSFER_READ_BIT;
+	}
+
+	barriers.buffer(resources.commands.buffer, 0, VK_WHOLE_SIZE,
+	                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, dst_stages, dst_access);
+	barriers.buffer(resources.counts.buffer, 0, VK_WHOLE_SIZE,
+	                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, dst_stages, dst_access);
+	barriers.flush(command_buffer);
+
+	if (!copy)
+	{
+		return;
+	}
+
+	// only the part of each list an instance can reach
+	std::vector<uint32_t> lists;
+	for (uint32_t list = 0; list < view_count * 2; list++)
+	{
+		lists.push_back(list);
+	}
+	if (resources.occlusion)
+	{
+		lists.push_back(GPU_VIEW_MAIN_LATE * 2);
+		lists.push_back(GPU_VIEW_MAIN_LATE * 2 + 1);
+	}
+
+	std::vector<VkBufferCopy> regions;
+	for (uint32_t list : lists)
+	{
+		const VkDeviceSize offset = VkDeviceSize(list) * capacity * COMMAND_STRIDE;
+		if (object_count > 0)
+		{
+			regions.push_back({offset, COUNT_BYTES + offset, object_count * COMMAND_STRIDE});
+		}
+	}
+
+	const VkBufferCopy count_region = {0, 0, COUNT_BYTES};
+	init.disp.cmdCopyBuffer(command_buffer, resources.counts.buffer, resources.readback.buffer, 1, &count_region);
+	if (!regions.empty())
+	{
+		init.disp.cmdCopyBuffer(command_buffer, resources.commands.buffer, resources.readback.buffer, static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	barriers.buffer(resources.readback.buffer, 0, VK_WHOLE_SIZE,
+	                VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	                VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+	barriers.flush(command_buffer);
+
+	resources.verify_pending = true;
+}
+
+void GpuCulling::set_depth_pyramid(const DepthPyramid &pyramid)
+{
+	const VkDescriptorImageInfo pyramid_info = {pyramid.sampler(), pyramid.view(), VK_IMAGE_LAYOUT_GENERAL};
+
+	for (FrameResources &resources : frames)
+	{
+		VkWriteDescriptorSet write = {};
+		write.sType                = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet               = resources.descriptor_set;
+		write.dstBinding           = DEPTH_PYRAMID_BINDING;
+		write.descriptorCount      = 1;
+		write.descriptorType       = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo           = &pyramid_info;
+		init.disp.updateDescriptorSets(1, &write, 0, nullptr);
+	}
+}
+
+void GpuCulling::draw(VkCommandBuffer command_buffer, GeometryBinding &geometry, uint32_t view) const
+{
+	if (object_count == 0)
+	{
+		return;
+	}
+
+	const FrameResources &resources = frames[frame];
+	for (uint32_t bucket = 0; bucket < 2; bucket++)
+	{
+		const uint32_t    list       = view * 2 + bucket;
+		const VkIndexType index_type = bucket == 0 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+		if (geometry.index_type != index_type)
+		{
+			init.disp.cmdBindIndexBuffer(command_buffer, geometry.index_buffer, 0, index_type);
+			geometry.index_type = index_type;
+		}
+
+		init.disp.cmdDrawIndexedIndirectCount(command_buffer,
+		                                      resources.commands.buffer, VkDeviceSize(list) * capacity * COMMAND_STRIDE,
+		                                      resources.counts.buffer, VkDeviceSize(list) * sizeof(uint32_t),
+		                                      object_count, static_cast<uint32_t>(COMMAND_STRIDE));
+	}
+}
+
+void GpuCulling::set_verify(bool enabled)
+{
+	verify = enabled;
+}
+
+uint32_t GpuCulling::verified_frames() const
+{
+	return verified;
+}
+
+uint32_t GpuCulling::mismatched_frames() const
+{
+	return mismatched;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,202 @@
+//
+// Created by rfdic on 9/29/2024.
+//
+
+#ifndef TOYRENDERER_GPU_CULLING_HPP
+#define TOYRENDERER_GPU_CULLING_HPP
+
+#include "common.hpp"
+
+#include <span>
+
+namespace obsidian
+{
+
+class DepthPyramid;
+class FrameAllocator;
+class UploadQueue;
+struct GeometryBinding;
+
+constexpr uint32_t GPU_VIEW_MAIN          = 0;
+constexpr uint32_t GPU_VIEW_FIRST_CASCADE = 1;
+constexpr uint32_t MAX_GPU_CULL_VIEWS     = GPU_VIEW_FIRST_CASCADE + SHADOW_CASCADE_COUNT;
+constexpr uint32_t GPU_VIEW_MAIN_LATE     = MAX_GPU_CULL_VIEWS;        // draw lists of the main view's late pass, not a view of its own
+constexpr uint32_t MAX_GPU_LODS           = 4;
+
+constexpr uint32_t DRAW_INDEX32      = 1;
+constexpr uint32_t DRAW_CASTS_SHADOW = 2;
+constexpr uint32_t DRAW_STATIC       = 4;
+
+// std430 layout of one scene instance in the draw table, see cull.comp
+struct GpuDrawData
+{
+	glm::vec4  sphere;        // local center, radius in w
+	int32_t    vertex_offset;
+	uint32_t   lod_count;        // 0 while the mesh isn't in the geometry pool
+	uint32_t   flags;            // DRAW_*
+	uint32_t   padding;
+	glm::uvec4 lod_first_index;        // absolute, into the geometry pool's index buffer
+	glm::uvec4 lod_index_count;
+	glm::vec4  lod_error;
+};
+
+// std430 layout of one view the culling shader writes draw lists for
+struct GpuCullView
+{
+	glm::vec4 planes[6];
+	glm::vec4 camera_position;        // projection scale in w, for lod selection
+	float     pixel_error;
+	uint32_t  required_flags;        // an instance is drawn when it has all of these
+	uint32_t  excluded_flags;        // and none of these
+	uint32_t  padding;
+	glm::mat4 view_projection;        // for the occlusion test
+};
+
+// which instances a dispatch takes, see cull.comp
+constexpr uint32_t CULL_ALL   = 0;
+constexpr uint32_t CULL_EARLY = 1;
+constexpr uint32_t CULL_LATE  = 2;
+
+// PushConstants in cull.comp
+struct CullPushConstants
+{
+	uint32_t object_count;
+	uint32_t first_object;
+	uint32_t capacity;        // commands per list
+	uint32_t pass;            // CULL_*
+	uint32_t first_list;
+};
+
+// The bindings of cull.comp: objects and views live in the frame allocator and
+// move every frame, the visibility is shared, the rest is per frame in flight.
+constexpr std::array<VkDescriptorType, 7> CULL_BINDING_TYPES = {
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+};
+
+constexpr uint32_t DEPTH_PYRAMID_BINDING = 6;
+
+GpuCullView make_cull_view(const glm::mat4 &view_projection,
+                           const glm::vec3 &camera_position,
+                           float            projection_scale,
+                           float            pixel_error,
+                           uint32_t         required_flags = 0,
+                           uint32_t         excluded_flags = 0);
+
+// the draw table entry of one scene instance
+GpuDrawData make_draw_data(const Scene &scene, size_t instance);
+
+// What cull.comp writes for one view, a list of commands per index width with
+// every command sorted by firstInstance, the object buffer index of the
+// instance, since the shader appends in no particular order. Pure CPU, no device needed, so GPU results can be checked
+// against it, e.g. on a software implementation.
+void gpu_cull_reference(std::span<const GpuDrawData>                                   draws,
+                        std::span<const glm::mat4>                                     transforms,
+                        const GpuCullView                                             &view,
+                        uint32_t                                                       first_object,
+                        std::array<std::vector<VkDrawIndexedIndirectCommand>, 2>      &lists);
+
+// GPU driven drawing of the scene. Every frame a compute pass culls the whole
+// scene against the main camera and each cascade and writes the indirect draws
+// and their counts, which the passes then consume with
+// vkCmdDrawIndexedIndirectCount; what the CPU does per frame no longer depends
+// on how many instances there are or how many survive. The draw table holding
+// each instance's bounds, flags and index ranges only changes with the scene.
+// Each draw is one instance whose firstInstance is its object, so the passes
+// drawing the lists read the object buffer without the instance buffer.
+//
+// With occlusion culling the main view is drawn in two phases: the early pass
+// draws what was visible last frame, the late pass tests the rest against the
+// depth pyramid of that and draws what it missed, see cull.comp.
+//
+// The tables and lists are sized for capacity instances, the object buffer's.
+class GpuCulling
+{
+  public:
+	GpuCulling(Init &init, UploadQueue &upload_queue, FrameAllocator &frame_allocator, uint32_t capacity);
+	~GpuCulling();
+
+	// check last use's results against the reference when verifying, call once the frame's fence signalled
+	void begin_frame(uint32_t frame);
+
+	// Refresh the frame's draw table if the scene changed and write the views. A new
+	// table is only queued on the upload queue, the frame's submission has to wait
+	// for its flush.
+	void prepare(const Scene &scene, uint32_t first_object, std::span<const GpuCullView> views, bool occlusion);
+
+	// clear the counts and cull, outside of any rendering; object_offset is the object buffer's dynamic offset
+	void dispatch(VkCommandBuffer command_buffer, uint32_t object_offset);
+
+	// the main view's late pass, once the pyramid holds what the early lists drew
+	void dispatch_late(VkCommandBuffer command_buffer, uint32_t object_offset);
+
+	// the pyramid the late pass tests against, rewritten into every frame's set so nothing may be in flight
+	void set_depth_pyramid(const DepthPyramid &pyramid);
+
+	// both draw lists of the view, expects the geometry pool and a pipeline built with DIRECT_OBJECTS bound
+	void draw(VkCommandBuffer command_buffer, GeometryBinding &geometry, uint32_t view) const;
+
+	void     set_verify(bool verify);
+	uint32_t verified_frames() const;
+	uint32_t mismatched_frames() const;
+
+  private:
+	struct FrameResources
+	{
+		BufferAllocation draws;
+		BufferAllocation commands;
+		BufferAllocation counts;
+		BufferAllocation readback;        // counts, then commands at COUNT_BYTES, host visible
+		VkDescriptorSet  descriptor_set;
+
+		uint32_t draw_revision = UINT32_MAX;        // scene static_revision the table was built for
+		uint32_t draw_count    = 0;
+
+		bool occlusion = false;        // whether prepare split the main view into early and late lists
+
+		// what the CPU expects for the last dispatch, when verifying
+		bool                                                                 verify_pending = false;
+		std::vector<std::array<std::vector<VkDrawIndexedIndirectCommand>, 2>> reference;
+	};
+
+	void create_pipeline();
+	void create_frame_resources(FrameResources &resources);
+	void read_back(VkCommandBuffer command_buffer, FrameResources &resources);
+
+	Init           &init;
+	UploadQueue    &upload_queue;
+	FrameAllocator &frame_allocator;
+	uint32_t        capacity;        // instances, and commands per list since every instance fits in one
+
+	VkDescriptorSetLayout descriptor_set_layout;
+	VkDescriptorPool      descriptor_pool;
+	VkPipelineLayout      pipeline_layout;
+	VkPipeline            pipeline;
+
+	std::array<FrameResources, MAX_FRAMES_IN_FLIGHT> frames;
+
+	// shared by the frames in flight, one frame's late pass feeds the next one's early pass
+	BufferAllocation visibility;
+	bool             visibility_reset = true;        // cleared before the next early pass, instances moved around
+	uint32_t                                         frame = 0;
+
+	std::vector<GpuDrawData> draw_table;        // CPU copy of the table, for the reference
+	uint32_t                 table_revision = UINT32_MAX;
+	uint32_t                 object_count   = 0;
+	uint32_t                 first_object   = 0;
+	uint32_t                 view_count     = 0;
+	uint32_t                 views_offset   = 0;
+
+	bool     verify     = false;
+	uint32_t verified   = 0;
+	uint32_t mismatched = 0;
+};
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_GPU_CULLING_HPP
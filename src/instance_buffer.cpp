@@ -0,0 +1,184 @@
+//
+// Created by rfdic on 9/21/2024.
+//
+
+#include "instance_buffer.hpp"
+
+#include "mesh.hpp"
+#include "scene.hpp"
+
+namespace obsidian
+{
+
+ObjectBuffer::ObjectBuffer(FrameAllocator &allocator, uint32_t capacity) :
+    allocator(allocator),
+    object_capacity(capacity)
+{
+}
+
+void ObjectBuffer::begin_frame()
+{
+	// the descriptor range is fixed, so the whole block is reserved up front
+	allocation = allocator.allocate_storage(range());
+	head       = 0;
+}
+
+uint32_t ObjectBuffer::push(std::span<const glm::mat4> transforms, std::span<const uint32_t> material_ids)
+{
+	if (transforms.size() != material_ids.size())
+	{
+		throw std::runtime_error("object transform and material counts differ!");
+	}
+
+	if (head + transforms.size() > object_capacity)
+	{
+		throw std::runtime_error("object buffer out of space!");
+	}
+
+	const uint32_t first   = head;
+	auto          *objects = static_cast<ObjectData *>(allocation.data) + first;
+	for (size_t i = 0; i < transforms.size(); i++)
+	{
+		objects[i].model         = transforms[i];
+		objects[i].normal_matrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(transforms[i]))));
+		objects[i].material_id   = material_ids[i];
+	}
+
+	head += static_cast<uint32_t>(transforms.size());
+	return first;
+}
+
+uint32_t ObjectBuffer::push(const glm::mat4 &transform, uint32_t material_id)
+{
+	return push(std::span<const glm::mat4>(&transform, 1), std::span<const uint32_t>(&material_id, 1));
+}
+
+uint32_t ObjectBuffer::dynamic_offset() const
+{
+	return static_cast<uint32_t>(allocation.offset);
+}
+
+uint32_t ObjectBuffer::count() const
+{
+	return head;
+}
+
+uint32_t ObjectBuffer::capacity() const
+{
+	return object_capacity;
+}
+
+VkDeviceSize ObjectBuffer::range() const
+{
+	return VkDeviceSize(object_capacity) * sizeof(ObjectData);
+}
+
+InstanceBuffer::InstanceBuffer(FrameAllocator &allocator, uint32_t capacity) :
+    allocator(allocator),
+    capacity(capacity)
+{
+}
+
+void InstanceBuffer::begin_frame()
+{
+	allocation = allocator.allocate_storage(range());
+	head       = 0;
+}
+
+uint32_t InstanceBuffer::push(std::span<const uint32_t> object_indices)
+{
+	if (head + object_indices.size() > capacity)
+	{
+		throw std::runtime_error("instance buffer out of space!");
+	}
+
+	const uint32_t first = head;
+	memcpy(static_cast<uint32_t *>(allocation.data) + first, object_indices.data(), object_indices.size_bytes());
+
+	head += static_cast<uint32_t>(object_indices.size());
+	return first;
+}
+
+uint32_t InstanceBuffer::push(uint32_t object_index)
+{
+	return push(std::span<const uint32_t>(&object_index, 1));
+}
+
+uint32_t InstanceBuffer::dynamic_offset() const
+{
+	return static_cast<uint32_t>(allocation.offset);
+}
+
+uint32_t InstanceBuffer::count() const
+{
+	return head;
+}
+
+VkDeviceSize InstanceBuffer::range() const
+{
+	return VkDeviceSize(capacity) * sizeof(uint32_t);
+}
+
+void batch_instance_draws(InstanceBuffer            &instances,
+                          const Scene               &scene,
+                          uint32_t                   first_object,
+                          std::vector<InstanceDraw> &draws,
+                          std::vector<MeshDraw>     &out,
+                          CullingStats              &stats)
+{
+	std::sort(draws.begin(), draws.end(), [](const InstanceDraw &a, const InstanceDraw &b) {
+		return a.mesh_index != b.mesh_index ? a.mesh_index < b.mesh_index : a.lod < b.lod;
+	});
+
+	std::vector<uint32_t> object_indices;
+
+	for (size_t begin = 0; begin < draws.size();)
+	{
+		const InstanceDraw &first = draws[begin];
+
+		object_indices.clear();
+
+		size_t end = begin;
+		while (end < draws.size() && draws[end].mesh_index == first.mesh_index && draws[end].lod == first.lod)
+		{
+			object_indices.push_back(first_object + draws[end].instance);
+			end++;
+		}
+
+		const Mesh &mesh = *scene.meshes[first.mesh_index];
+		if (mesh.gpu_data_initialized)
+		{
+			const MeshLod range = mesh.lod(first.lod);
+			out.push_back({&mesh, range.first_index, range.index_count, instances.push(object_indices), static_cast<uint32_t>(object_indices.size())});
+
+			stats.draw_calls++;
+			stats.triangles += range.index_count / 3 * static_cast<uint32_t>(object_indices.size());
+		}
+
+		begin = end;
+	}
+}
+
+void record_mesh_draws(Init &init, VkCommandBuffer command_buffer, GeometryBinding &geometry, std::span<const MeshDraw> draws)
+{
+	for (const MeshDraw &draw : draws)
+	{
+		draw.mesh->draw_range(init, command_buffer, geometry, draw.first_index, draw.index_count, draw.first_instance, draw.instance_count);
+	}
+}
+
+void draw_instance_batches(Init                      &init,
+                           VkCommandBuffer            command_buffer,
+                           GeometryBinding           &geometry,
+                           InstanceBuffer            &instances,
+                           const Scene               &scene,
+                           uint32_t                   first_object,
+                           std::vector<InstanceDraw> &draws,
+                           CullingStats              &stats)
+{
+	std::vector<MeshDraw> mesh_draws;
+	batch_instance_draws(instances, scene, first_object, draws, mesh_draws, stats);
+	record_mesh_draws(init, command_buffer, geometry, mesh_draws);
+}
+
+}        // namespace obsidian
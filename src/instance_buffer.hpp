@@ -0,0 +1,126 @@
+//
+// Created by rfdic on 9/21/2024.
+//
+
+#ifndef TOYRENDERER_INSTANCE_BUFFER_HPP
+#define TOYRENDERER_INSTANCE_BUFFER_HPP
+
+#include "common.hpp"
+#include "frame_allocator.hpp"
+
+#include <span>
+
+namespace obsidian
+{
+
+struct GeometryBinding;
+struct Mesh;
+
+constexpr uint32_t MAX_MATERIALS = 256;
+
+// The most instances one object can take in a frame: one in the main pass, up
+// to eight per cascade for the pieces its static cache is redrawn in where the
+// scrolled strips wrap plus one for the dynamic casters, and one per atlas
+// view. Sizing the instance buffer with it means no frame can run out.
+constexpr uint32_t MAX_INSTANCES_PER_OBJECT = 1 + SHADOW_CASCADE_COUNT * 9 + MAX_SHADOW_VIEWS;
+
+// Per-frame array of ObjectData in the frame allocator. Each object's matrices
+// are computed once per frame here, whichever passes draw it afterwards.
+// Created for the scene, capacity is its instance count.
+class ObjectBuffer
+{
+  public:
+	ObjectBuffer(FrameAllocator &allocator, uint32_t capacity);
+
+	// reserve this frame's block, call right after FrameAllocator::reset
+	void begin_frame();
+
+	// returns the index of the first object written
+	uint32_t push(std::span<const glm::mat4> transforms, std::span<const uint32_t> material_ids);
+	uint32_t push(const glm::mat4 &transform, uint32_t material_id);
+
+	uint32_t     dynamic_offset() const;
+	uint32_t     count() const;
+	uint32_t     capacity() const;
+	VkDeviceSize range() const;        // bytes covered by the descriptor
+
+  private:
+	FrameAllocator &allocator;
+	uint32_t        object_capacity;
+
+	FrameAllocation allocation = {};
+	uint32_t        head       = 0;
+};
+
+// Per-frame array of object indices, read by the vertex shaders through
+// gl_InstanceIndex. Every draw of a frame appends the objects it draws and
+// passes the returned index as firstInstance, so N copies of a mesh are one
+// draw and four bytes each. Needs MAX_INSTANCES_PER_OBJECT entries per object.
+class InstanceBuffer
+{
+  public:
+	InstanceBuffer(FrameAllocator &allocator, uint32_t capacity);
+
+	// reserve this frame's block, call right after FrameAllocator::reset
+	void begin_frame();
+
+	// returns the index of the first instance written
+	uint32_t push(std::span<const uint32_t> object_indices);
+	uint32_t push(uint32_t object_index);
+
+	uint32_t     dynamic_offset() const;
+	uint32_t     count() const;
+	VkDeviceSize range() const;        // bytes covered by the descriptor
+
+  private:
+	FrameAllocator &allocator;
+	uint32_t        capacity;
+
+	FrameAllocation allocation = {};
+	uint32_t        head       = 0;
+};
+
+// scene instance i drawn at a lod of its mesh, the scene's objects start at first_object
+struct InstanceDraw
+{
+	uint32_t mesh_index;
+	uint32_t lod;
+	uint32_t instance;
+};
+
+// One indexed draw whose instances are already in the instance buffer. Draws
+// are resolved on the thread that culls, recording them only reads the mesh.
+struct MeshDraw
+{
+	const Mesh *mesh;
+	uint32_t    first_index;        // relative to the mesh's own indices
+	uint32_t    index_count;
+	uint32_t    first_instance;
+	uint32_t    instance_count;
+};
+
+// Sort the draws by mesh and lod, push the instances of each run and append
+// one instanced draw per run to out. Adds the number of draws and triangles to
+// stats.
+void batch_instance_draws(InstanceBuffer            &instances,
+                          const Scene               &scene,
+                          uint32_t                   first_object,
+                          std::vector<InstanceDraw> &draws,
+                          std::vector<MeshDraw>     &out,
+                          CullingStats              &stats);
+
+void record_mesh_draws(Init &init, VkCommandBuffer command_buffer, GeometryBinding &geometry, std::span<const MeshDraw> draws);
+
+// batch_instance_draws and record_mesh_draws in one go
+void draw_instance_batches(Init                      &init,
+                           VkCommandBuffer            command_buffer,
+                           GeometryBinding           &geometry,
+                           InstanceBuffer            &instances,
+                           const Scene               &scene,
+                           uint32_t                   first_object,
+                           std::vector<InstanceDraw> &draws,
+                           CullingStats              &stats);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_INSTANCE_BUFFER_HPP
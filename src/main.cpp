@@ -12,19 +12,26 @@
 #include "debug_utils.hpp"
 #include "shadow.hpp"
 #include "obj_loader.hpp"
+#include "frame_allocator.hpp"
+#include "upload_queue.hpp"
+#include "geometry_pool.hpp"
+#include "scene.hpp"
+#include "mesh_cache.hpp"
+#include "vertex_format.hpp"
+#include "culling.hpp"
+#include "instance_buffer.hpp"
+#include "shadow_atlas.hpp"
+#include "render_graph.hpp"
+#include "barrier_batch.hpp"
+#include "parallel_recorder.hpp"
+#include "gpu_culling.hpp"
+#include "depth_pyramid.hpp"
 
 using namespace obsidian;
 
 const int WIDTH = 1280;
 const int HEIGHT = 720;
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
-
-struct PushConstantBuffer {
-	float scale;
-	bool useTexture;
-};
-
 
 void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
     auto data = static_cast<RenderData *>(glfwGetWindowUserPointer(window));
@@ -142,24 +149,77 @@ void copy_buffer(Init& init, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSiz
     init.disp.freeCommandBuffers(init.command_pool, 1, &commandBuffer);
 }
 
-void copy_buffer_data(Init& init, BufferAllocation buffer, VkDeviceSize size, void* data) {
-	void *mapped_data;
-	vmaMapMemory(init.allocator, buffer.allocation, &mapped_data);
-	memcpy(mapped_data, data, size);
-	vmaUnmapMemory(init.allocator, buffer.allocation);
-}
-
-void update_uniform_buffer(uint32_t current, Init &init, RenderData& renderData) {
+void update_uniform_buffer(FrameContext &frame, Init &init, RenderData& renderData) {
 
 	UniformBufferObject ubo {
-		.model = glm::mat4(1.0f),
 		.view = renderData.camera.getViewMatrix(),
 		.proj = renderData.camera.getProjectionMatrix(),
-	    .lightSpaceMatrix = renderData.shadow_map.light_space_matrix,
 	    .lightDirection = renderData.shadow_map.light_direction
 	};
 
-	copy_buffer_data(init, renderData.uniform_buffers[current], sizeof(ubo), &ubo);
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		ubo.cascadeMatrices[cascade] = renderData.shadow_map.cascade_matrices[cascade];
+		ubo.cascadeSplits[cascade]   = renderData.shadow_map.cascade_splits[cascade];
+	}
+
+	FrameAllocation allocation = renderData.frame_allocator->push_uniform(&ubo, sizeof(ubo));
+	frame.dynamic_offsets[0] = static_cast<uint32_t>(allocation.offset);
+}
+
+void update_instance_buffers(FrameContext &frame, RenderData& renderData) {
+	const std::vector<Material> &materials = renderData.scene->materials;
+	if (materials.size() > MAX_MATERIALS)
+	{
+		throw std::runtime_error("too many materials!");
+	}
+
+	// the descriptor covers MAX_MATERIALS entries, reserve all of them
+	FrameAllocation allocation = renderData.frame_allocator->allocate_storage(MAX_MATERIALS * sizeof(MaterialData));
+	auto *material_data = static_cast<MaterialData *>(allocation.data);
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		material_data[i].pattern_scale = materials[i].pattern_scale;
+		material_data[i].use_texture   = materials[i].use_texture ? 1 : 0;
+	}
+
+	// model and normal matrices once per object, every pass indexes the same entries
+	const Scene &scene = *renderData.scene;
+	renderData.object_buffer->begin_frame();
+	renderData.scene_first_object = renderData.object_buffer->push(scene.transforms, scene.material_indices);
+
+	// the passes append their instances while recording
+	renderData.instance_buffer->begin_frame();
+
+	frame.dynamic_offsets[1] = renderData.instance_buffer->dynamic_offset();
+	frame.dynamic_offsets[2] = static_cast<uint32_t>(allocation.offset);
+	frame.dynamic_offsets[3] = renderData.object_buffer->dynamic_offset();
+}
+
+void update_light_buffer(FrameContext &frame, Init &init, RenderData& renderData) {
+	FrameAllocation allocation = renderData.frame_allocator->allocate_storage(sizeof(LightBuffer));
+
+	// places the shadowed lights in the atlas, the shadow pass renders what went stale
+	renderData.shadow_atlas->update(*renderData.scene, renderData.camera, static_cast<float>(init.swapchain.extent.height),
+	                                *static_cast<LightBuffer *>(allocation.data));
+
+	frame.dynamic_offsets[4] = static_cast<uint32_t>(allocation.offset);
+}
+
+void update_gpu_culling(Init &init, RenderData& renderData) {
+	const Camera &camera    = renderData.camera;
+	const float   lod_scale = projection_scale(camera.fov, static_cast<float>(init.swapchain.extent.height));
+
+	// cascades take the dynamic casters only, the static ones come from the cache; lods are judged from the camera
+	std::array<GpuCullView, MAX_GPU_CULL_VIEWS> views;
+	views[GPU_VIEW_MAIN] = make_cull_view(camera.getProjectionMatrix() * camera.getViewMatrix(), camera.position, lod_scale, renderData.lod_pixel_error);
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		views[GPU_VIEW_FIRST_CASCADE + cascade] = make_cull_view(renderData.shadow_map.cascade_matrices[cascade], camera.position, lod_scale,
+		                                                         renderData.shadow_lod_pixel_error, DRAW_CASTS_SHADOW, DRAW_STATIC);
+	}
+
+	renderData.gpu_culling->prepare(*renderData.scene, renderData.scene_first_object, views, renderData.occlusion_culling);
 }
 
 GLFWwindow* create_window_glfw(const char* window_name = "", bool resize = true) {
@@ -218,6 +278,8 @@ int device_initialization(Init& init) {
     VkPhysicalDeviceFeatures required_features = {};
     required_features.samplerAnisotropy = VK_TRUE;
 	required_features.textureCompressionBC = VK_TRUE;
+	required_features.multiDrawIndirect = VK_TRUE;
+	required_features.drawIndirectFirstInstance = VK_TRUE;
 
 	VkPhysicalDeviceVulkan13Features vulkan13Features = {};
 	vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
@@ -229,6 +291,8 @@ int device_initialization(Init& init) {
 	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
 	features12.bufferDeviceAddress = VK_TRUE;
 	features12.descriptorIndexing = true;
+	features12.timelineSemaphore = VK_TRUE;
+	features12.drawIndirectCount = VK_TRUE;
 
 	VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_features = {};
 	dynamic_rendering_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
@@ -265,6 +329,17 @@ int device_initialization(Init& init) {
         return -1;
     }
     init.graphics_queue = graphics_queue_ret.value();
+    init.graphics_queue_family = init.device.get_queue_index(vkb::QueueType::graphics).value();
+
+    // uploads go to a transfer-only queue when the device exposes one
+    auto transfer_queue_ret = init.device.get_dedicated_queue(vkb::QueueType::transfer);
+    if (transfer_queue_ret) {
+        init.transfer_queue = transfer_queue_ret.value();
+        init.transfer_queue_family = init.device.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    } else {
+        init.transfer_queue = init.graphics_queue;
+        init.transfer_queue_family = init.graphics_queue_family;
+    }
 
     VkCommandPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -371,7 +446,14 @@ int create_render_pass(Init& init, RenderData& data) {
 
 
 int create_graphics_pipeline(Init& init, RenderData& data) {
-    auto vert_code = read_file("shaders/simple.vert.spv");
+    // compact formats carry an octahedral normal the packed shader decodes, its color variant reads location 1
+    const char *vert_path = "shaders/simple.vert.spv";
+    if (data.vertex_format == VertexFormat::COMPACT) {
+        vert_path = "shaders/simple_packed.vert.spv";
+    } else if (data.vertex_format == VertexFormat::COMPACT_COLOR) {
+        vert_path = "shaders/simple_packed_color.vert.spv";
+    }
+    auto vert_code = read_file(vert_path);
     auto frag_code = read_file("shaders/simple.frag.spv");
 
     VkShaderModule vert_module = create_shader_module(init, vert_code);
@@ -395,39 +477,9 @@ int create_graphics_pipeline(Init& init, RenderData& data) {
 
     VkPipelineShaderStageCreateInfo shader_stages[] = { vert_stage_info, frag_stage_info };
 
-    VkVertexInputBindingDescription bindingDescription;
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, tex_coord);
-
-    attributeDescriptions[3].binding = 0;
-    attributeDescriptions[3].location = 3;
-    attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[3].offset = offsetof(Vertex, normal);
-
-    VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
-    vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_info.vertexBindingDescriptionCount = 1;
-    vertex_input_info.pVertexBindingDescriptions = &bindingDescription;
-    vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertex_input_info.pVertexAttributeDescriptions = attributeDescriptions.data();
+    // vertex input follows whatever layout the geometry pool stores
+    const VertexInputDescription vertex_input = describe_vertex_input(data.vertex_format);
+    VkPipelineVertexInputStateCreateInfo vertex_input_info = vertex_input.create_info();
 
     VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
     input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -491,17 +543,13 @@ int create_graphics_pipeline(Init& init, RenderData& data) {
 //	pushConstantRange.size = sizeof(float);
 //
 
-	VkPushConstantRange pushConstantRange = {};
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(PushConstantBuffer);
-
+	// transforms and materials come from the instance and material buffers, no push constants
     VkPipelineLayoutCreateInfo pipeline_layout_info = {};
     pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipeline_layout_info.setLayoutCount = 1;
     pipeline_layout_info.pSetLayouts = &data.descriptor_set_layout;
-    pipeline_layout_info.pushConstantRangeCount = 1;
-	pipeline_layout_info.pPushConstantRanges = &pushConstantRange;
+    pipeline_layout_info.pushConstantRangeCount = 0;
+	pipeline_layout_info.pPushConstantRanges = nullptr;
 
     if (init.disp.createPipelineLayout(&pipeline_layout_info, nullptr, &data.pipeline_layout) != VK_SUCCESS) {
         std::cout << "failed to create pipeline layout\n";
@@ -554,6 +602,17 @@ int create_graphics_pipeline(Init& init, RenderData& data) {
         return -1; // failed to create graphics pipeline
     }
 
+    // the GPU culling's draws carry the object index as firstInstance
+    const VkBool32 direct_objects = VK_TRUE;
+    const VkSpecializationMapEntry specialization_entry = {0, 0, sizeof(VkBool32)};
+    const VkSpecializationInfo specialization_info = {1, &specialization_entry, sizeof(VkBool32), &direct_objects};
+    shader_stages[0].pSpecializationInfo = &specialization_info;
+
+    if (init.disp.createGraphicsPipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &data.gpu_graphics_pipeline) != VK_SUCCESS) {
+        std::cout << "failed to create pipline\n";
+        return -1; // failed to create graphics pipeline
+    }
+
     init.disp.destroyShaderModule(frag_module, nullptr);
     init.disp.destroyShaderModule(vert_module, nullptr);
     return 0;
@@ -588,49 +647,42 @@ int create_framebuffers(Init& init, RenderData& data) {
 }
 
 int create_command_pool(Init& init, RenderData& data) {
+    // one transient pool per frame in flight, reset wholesale at the start of the frame
     VkCommandPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     pool_info.queueFamilyIndex = init.device.get_queue_index(vkb::QueueType::graphics).value();
-    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-    if (init.disp.createCommandPool(&pool_info, nullptr, &data.command_pool) != VK_SUCCESS) {
-        std::cout << "failed to create command pool\n";
-        return -1; // failed to create command pool
-    }
-
-    // let's create a main command pool
-    VkCommandPoolCreateInfo main_pool_info = {};
-    main_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    main_pool_info.queueFamilyIndex = init.device.get_queue_index(vkb::QueueType::graphics).value();
-    main_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-
-    if (init.disp.createCommandPool(&main_pool_info, nullptr, &init.command_pool) != VK_SUCCESS) {
-        std::cout << "failed to create main command pool\n";
-        return -1; // failed to create command pool
+    for (auto& frame : data.frames) {
+        if (init.disp.createCommandPool(&pool_info, nullptr, &frame.command_pool) != VK_SUCCESS) {
+            std::cout << "failed to create command pool\n";
+            return -1; // failed to create command pool
+        }
     }
 
     return 0;
 }
 
 int create_command_buffers(Init& init, RenderData& data) {
-    data.command_buffers.resize(init.swapchain.image_count);
-
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = data.command_pool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (uint32_t)data.command_buffers.size(); // We only need one command buffer now
-
-    if (init.disp.allocateCommandBuffers(&allocInfo, data.command_buffers.data()) != VK_SUCCESS) {
-        std::cout << "failed to allocate command buffers\n";
-        return -1;
+    for (auto& frame : data.frames) {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = frame.command_pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        if (init.disp.allocateCommandBuffers(&allocInfo, &frame.command_buffer) != VK_SUCCESS) {
+            std::cout << "failed to allocate command buffers\n";
+            return -1;
+        }
     }
     return 0;
 }
 
 int render_cubemap(Init& init, RenderData& data, uint32_t imageIndex) {
 
-    VkCommandBuffer commandBuffer = data.command_buffers[imageIndex];
+    FrameContext& frame = data.frames[data.current_frame];
+    VkCommandBuffer commandBuffer = frame.command_buffer;
 
     std::array<VkClearValue, 2> clearValues = {};
     clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
@@ -666,7 +718,7 @@ int render_cubemap(Init& init, RenderData& data, uint32_t imageIndex) {
     init.disp.cmdBindDescriptorSets(commandBuffer,
                                     VK_PIPELINE_BIND_POINT_GRAPHICS,
                                     data.cube_map->pipeline_layout, 0, 1,
-                                    &data.descriptor_sets[imageIndex], 0, nullptr);
+                                    &frame.descriptor_set, static_cast<uint32_t>(frame.dynamic_offsets.size()), frame.dynamic_offsets.data());
 
     init.disp.cmdDraw(commandBuffer, 36, 1, 0, 0);
     init.disp.cmdEndRenderPass(commandBuffer);
@@ -676,7 +728,9 @@ int render_cubemap(Init& init, RenderData& data, uint32_t imageIndex) {
 void begin_rendering(Init& init,
                      const VkCommandBuffer command_buffer,
                      const VkImageView& image_view,
-                     const VkImageView& depth_image_view) {
+                     const VkImageView& depth_image_view,
+                     VkAttachmentLoadOp depth_load_op,
+                     VkRenderingFlags flags) {
 
 	VkRenderingAttachmentInfo color_attachments[1];
 	color_attachments[0].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
@@ -698,8 +752,9 @@ void begin_rendering(Init& init,
 	depth_attachment.pNext = nullptr;
 	depth_attachment.imageView = depth_image_view;
 	depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_attachment.loadOp = depth_load_op;
+	// the depth pyramid and the late pass read it back
+	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	depth_attachment.resolveMode = VK_RESOLVE_MODE_NONE;
 	depth_attachment.resolveImageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	depth_attachment.resolveImageView = VK_NULL_HANDLE;
@@ -707,7 +762,7 @@ void begin_rendering(Init& init,
 	VkRenderingInfo rendering_info = {};
 	rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
 	rendering_info.pNext = nullptr;
-	rendering_info.flags = 0;
+	rendering_info.flags = flags;
 	rendering_info.pColorAttachments = color_attachments;
 	rendering_info.colorAttachmentCount = 1;
 	rendering_info.pDepthAttachment = &depth_attachment;
@@ -747,52 +802,16 @@ void render_imgui(Init& init, const VkCommandBuffer& command_buffer, const VkIma
 		.pStencilAttachment = nullptr,
 	};
 
-	begin_debug_label(init, command_buffer, "ImGui Rendering", {0.5f, 0.76f, 0.34f});
 	init.disp.cmdBeginRendering(command_buffer, &renderingInfo);
 	ImGui::Render();
 	ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), command_buffer);
 	init.disp.cmdEndRendering(command_buffer);
-	end_debug_label(init, command_buffer);
 }
 
-int record_command_buffer(Init& init, RenderData& data, uint32_t imageIndex) {
-
-    init.disp.resetCommandBuffer(data.command_buffers[imageIndex], 0);
-
-	auto command_buffer = data.command_buffers[imageIndex];
-
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    if (init.disp.beginCommandBuffer(command_buffer, &beginInfo) != VK_SUCCESS) {
-        std::cout << "failed to begin recording command buffer\n";
-        return -1;
-    }
-
-	// transition undefined images
-	transition_image_to_color_attachment(init, command_buffer, data.swapchain_images[imageIndex]);
-	transition_image_to_depth_attachment(init, command_buffer, data.depth_image.image);
-
-	begin_debug_label(init, data.command_buffers[imageIndex], "Cube Map Rendering", {1.0f, 0.0f, 0.0f});
-	data.cube_map->render(init, data, data.command_buffers[imageIndex], imageIndex);
-	init.disp.cmdEndDebugUtilsLabelEXT(data.command_buffers[imageIndex]);
-
-	// transition shadow map image
-	transition_shadowmap_to_depth_attachment(init, command_buffer, data.shadow_map.image);
-
-	// shadow map rendering
-	begin_debug_label(init, data.command_buffers[imageIndex], "Shadow Map Rendering", {0.0f, 1.0f, 0.0f});
-	draw_shadow(init, data, command_buffer, imageIndex);
-	init.disp.cmdEndDebugUtilsLabelEXT(data.command_buffers[imageIndex]);
-
-	// transition shadow map image
-	transition_shadowmap_to_shader_read(init, command_buffer, data.shadow_map.image);
-
-	begin_debug_label(init, data.command_buffers[imageIndex], "Main Rendering", {1.0f, 1.0f, 0.0f});
-	begin_rendering(init, data.command_buffers[imageIndex], data.swapchain_image_views[imageIndex], data.depth_image_view);
+// The main pass from the lists the culling pass wrote, the CPU doesn't look at a single instance.
+void record_gpu_driven_pass(Init& init, RenderData& data, VkCommandBuffer command_buffer, uint32_t view) {
+	const FrameContext &frame = data.frames[data.current_frame];
 
-	// set scissor and viewport
 	VkViewport viewport = {};
 	viewport.x = 0.0f;
 	viewport.y = 0.0f;
@@ -805,36 +824,236 @@ int record_command_buffer(Init& init, RenderData& data, uint32_t imageIndex) {
 	scissor.offset = {0, 0};
 	scissor.extent = init.swapchain.extent;
 
-	init.disp.cmdSetViewport(data.command_buffers[imageIndex], 0, 1, &viewport);
-	init.disp.cmdSetScissor(data.command_buffers[imageIndex], 0, 1, &scissor);
+	init.disp.cmdSetViewport(command_buffer, 0, 1, &viewport);
+	init.disp.cmdSetScissor(command_buffer, 0, 1, &scissor);
 
-	init.disp.cmdBindPipeline(data.command_buffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, data.graphics_pipeline);
-	// bind descriptor sets
-	init.disp.cmdBindDescriptorSets(data.command_buffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, data.pipeline_layout, 0, 1, &data.descriptor_sets[imageIndex], 0, nullptr);
+	init.disp.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.gpu_graphics_pipeline);
+	init.disp.cmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.pipeline_layout, 0, 1, &frame.descriptor_set,
+	                                static_cast<uint32_t>(frame.dynamic_offsets.size()), frame.dynamic_offsets.data());
 
-	PushConstantBuffer push_constant = {};
-	push_constant.scale = 2.0f;
-	push_constant.useTexture = true;
+	GeometryBinding geometry = data.geometry_pool->bind(command_buffer);
+	data.gpu_culling->draw(command_buffer, geometry, view);
 
-	vkCmdPushConstants(data.command_buffers[imageIndex], data.pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantBuffer), &push_constant);
+	// how many survived stays on the device, only the indirect draws are known here
+	data.culling_stats.draw_calls += 2;
+}
 
-	// draw the bunny
-	data.bunny_mesh->draw(init, data.command_buffers[imageIndex]);
+int record_command_buffer(Init& init, RenderData& data, uint32_t imageIndex) {
 
-	push_constant.scale = 20.0f;
-	push_constant.useTexture = false;
-	vkCmdPushConstants(data.command_buffers[imageIndex], data.pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstantBuffer), &push_constant);
+	FrameContext& frame = data.frames[data.current_frame];
+	auto command_buffer = frame.command_buffer;
 
-	data.plane_mesh->draw(init, data.command_buffers[imageIndex]);
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-	init.disp.cmdEndRendering(data.command_buffers[imageIndex]);
-	end_debug_label(init, data.command_buffers[imageIndex]);
+    if (init.disp.beginCommandBuffer(command_buffer, &beginInfo) != VK_SUCCESS) {
+        std::cout << "failed to begin recording command buffer\n";
+        return -1;
+    }
 
-	render_imgui(init, data.command_buffers[imageIndex], data.swapchain_image_views[imageIndex]);
+	// the frame as passes over the images they touch, the graph works out the barriers between them
+	RenderGraph graph;
+
+	const ImageState swapchain_initial = {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE};
+	const ImageState swapchain_final   = image_usage_state(ImageUsage::PRESENT);
+	const ImageState shadow_read       = image_usage_state(ImageUsage::FRAGMENT_SAMPLED);
+
+	const RenderResource swapchain = graph.import_image("swapchain", data.swapchain_images[imageIndex], data.swapchain_image_views[imageIndex],
+	                                                    VK_IMAGE_ASPECT_COLOR_BIT, swapchain_initial, &swapchain_final);
+	const RenderResource shadow_map = graph.import_image("shadow map", data.shadow_map.image, data.shadow_map.image_view,
+	                                                     VK_IMAGE_ASPECT_DEPTH_BIT, shadow_read, &shadow_read);
+	const RenderResource depth = graph.create_image("scene depth", {VK_FORMAT_D24_UNORM_S8_UINT, init.swapchain.extent,
+	                                                                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+	                                                                VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT});
+
+	// writes the draw lists both the shadow and the main pass consume, nothing in the graph tracks buffers
+	if (data.gpu_driven)
+	{
+		graph.add_pass("GPU Culling", {0.0f, 0.5f, 1.0f}, [&](VkCommandBuffer command_buffer) {
+			data.gpu_culling->dispatch(command_buffer, data.object_buffer->dynamic_offset());
+		})
+		    .side_effect();
+	}
+
+	graph.add_pass("Cube Map Rendering", {1.0f, 0.0f, 0.0f}, [&](VkCommandBuffer command_buffer) {
+		data.cube_map->render(init, data, command_buffer, imageIndex, graph.image_view(depth));
+	})
+	    .write(swapchain, ImageUsage::COLOR_ATTACHMENT, true)
+	    .write(depth, ImageUsage::DEPTH_ATTACHMENT, true);
+
+	// the atlas tiles are rendered in this pass too, the atlas moves itself in and out of sampling
+	graph.add_pass("Shadow Map Rendering", {0.0f, 1.0f, 0.0f}, [&](VkCommandBuffer command_buffer) {
+		// both passes add to the stats
+		data.culling_stats = {};
+		draw_shadow(init, data, command_buffer);
+	})
+	    .write(shadow_map, ImageUsage::DEPTH_ATTACHMENT);
+
+	graph.add_pass("Main Rendering", {1.0f, 1.0f, 0.0f}, [&](VkCommandBuffer command_buffer) {
+		if (data.gpu_driven)
+		{
+			begin_rendering(init, command_buffer, data.swapchain_image_views[imageIndex], graph.image_view(depth), VK_ATTACHMENT_LOAD_OP_CLEAR, 0);
+			record_gpu_driven_pass(init, data, command_buffer, GPU_VIEW_MAIN);
+			init.disp.cmdEndRendering(command_buffer);
+			return;
+		}
+
+		const Frustum frustum = extract_frustum(data.camera.getProjectionMatrix() * data.camera.getViewMatrix());
+		std::vector<DrawRange> draws;
+
+		const float lod_scale = projection_scale(data.camera.fov, static_cast<float>(init.swapchain.extent.height));
+
+		// whole-mesh draws are collected and instanced per mesh and lod, meshlet draws go one instance at a time
+		std::vector<InstanceDraw> batched;
+
+		// everything the pass draws, culled and with its instances pushed before any of it is recorded
+		std::vector<MeshDraw> mesh_draws;
+
+		const Scene &scene = *data.scene;
+
+		// whole objects first, in one batch over structure-of-arrays bounds
+		BoundsBatch          bounds;
+		std::vector<uint8_t> visible;
+		for (size_t i = 0; i < scene.instance_count(); i++)
+		{
+			bounds.push(*scene.meshes[scene.mesh_indices[i]], scene.transforms[i]);
+		}
+
+		data.culling_stats.objects_total   = static_cast<uint32_t>(scene.instance_count());
+		data.culling_stats.objects_visible = cull_bounds(frustum, bounds, visible);
+
+		for (size_t i = 0; i < scene.instance_count(); i++)
+		{
+			if (!visible[i])
+			{
+				continue;
+			}
+
+			const Mesh &mesh = *scene.meshes[scene.mesh_indices[i]];
+
+			// meshlets only cover the full detail level, coarser levels are drawn whole
+			const uint32_t level = select_lod(mesh, scene.transforms[i], data.camera.position, lod_scale, data.lod_pixel_error);
+			if (level > 0 || mesh.meshlets.empty())
+			{
+				batched.push_back({scene.mesh_indices[i], level, static_cast<uint32_t>(i)});
+				continue;
+			}
+
+			draws.clear();
+			cull_meshlets(mesh, scene.transforms[i], frustum, data.camera.position, draws, data.culling_stats);
+			if (draws.empty())
+			{
+				continue;
+			}
+
+			const uint32_t instance = data.instance_buffer->push(data.scene_first_object + static_cast<uint32_t>(i));
+
+			for (const DrawRange &range : draws)
+			{
+				data.culling_stats.triangles += range.index_count / 3;
+				data.culling_stats.draw_calls++;
+				mesh_draws.push_back({&mesh, range.first_index, range.index_count, instance, 1});
+			}
+		}
+
+		batch_instance_draws(*data.instance_buffer, scene, data.scene_first_object, batched, mesh_draws, data.culling_stats);
+
+		uint32_t chunk_count = 1;
+		if (data.parallel_recording)
+		{
+			const uint32_t wanted = static_cast<uint32_t>((mesh_draws.size() + MIN_DRAWS_PER_CHUNK - 1) / MIN_DRAWS_PER_CHUNK);
+			chunk_count           = std::clamp(wanted, 1u, data.recorder->worker_count());
+		}
+
+		// a secondary buffer starts with nothing bound, every chunk sets up the pass state on its own
+		auto record_chunk = [&](VkCommandBuffer chunk_buffer, uint32_t chunk) {
+			VkViewport viewport = {};
+			viewport.x = 0.0f;
+			viewport.y = 0.0f;
+			viewport.width = (float)init.swapchain.extent.width;
+			viewport.height = (float)init.swapchain.extent.height;
+			viewport.minDepth = 0.0f;
+			viewport.maxDepth = 1.0f;
+
+			VkRect2D scissor = {};
+			scissor.offset = {0, 0};
+			scissor.extent = init.swapchain.extent;
+
+			init.disp.cmdSetViewport(chunk_buffer, 0, 1, &viewport);
+			init.disp.cmdSetScissor(chunk_buffer, 0, 1, &scissor);
+
+			init.disp.cmdBindPipeline(chunk_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.graphics_pipeline);
+			init.disp.cmdBindDescriptorSets(chunk_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.pipeline_layout, 0, 1, &frame.descriptor_set,
+			                                static_cast<uint32_t>(frame.dynamic_offsets.size()), frame.dynamic_offsets.data());
+
+			// every mesh lives in the geometry pool, bind it once per chunk
+			GeometryBinding geometry = data.geometry_pool->bind(chunk_buffer);
+
+			const size_t begin = mesh_draws.size() * chunk / chunk_count;
+			const size_t end   = mesh_draws.size() * (chunk + 1) / chunk_count;
+			record_mesh_draws(init, chunk_buffer, geometry, std::span<const MeshDraw>(mesh_draws).subspan(begin, end - begin));
+		};
+
+		if (data.parallel_recording)
+		{
+			begin_rendering(init, command_buffer, data.swapchain_image_views[imageIndex], graph.image_view(depth), VK_ATTACHMENT_LOAD_OP_CLEAR,
+			                VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT);
+
+			const VkFormat color_format = init.swapchain.image_format;
+
+			VkCommandBufferInheritanceRenderingInfo rendering = {};
+			rendering.sType                   = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+			rendering.colorAttachmentCount    = 1;
+			rendering.pColorAttachmentFormats = &color_format;
+			rendering.depthAttachmentFormat   = VK_FORMAT_D24_UNORM_S8_UINT;
+			rendering.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+			rendering.rasterizationSamples    = VK_SAMPLE_COUNT_1_BIT;
+
+			data.recorder->execute(command_buffer, rendering, chunk_count, record_chunk);
+			data.culling_stats.secondary_buffers = chunk_count;
+		}
+		else
+		{
+			begin_rendering(init, command_buffer, data.swapchain_image_views[imageIndex], graph.image_view(depth), VK_ATTACHMENT_LOAD_OP_CLEAR, 0);
+			record_chunk(command_buffer, 0);
+		}
+
+		init.disp.cmdEndRendering(command_buffer);
+	})
+	    .read(shadow_map, ImageUsage::FRAGMENT_SAMPLED)
+	    .write(swapchain, ImageUsage::COLOR_ATTACHMENT)
+	    .write(depth, ImageUsage::DEPTH_ATTACHMENT, true);
+
+	// the late half of the main view: the pyramid of what the early lists drew, what it doesn't hide is drawn on top
+	if (data.gpu_driven && data.occlusion_culling)
+	{
+		graph.add_pass("Depth Pyramid", {0.0f, 0.5f, 1.0f}, [&](VkCommandBuffer command_buffer) {
+			data.depth_pyramid->build(command_buffer, static_cast<uint32_t>(data.current_frame), graph.image_view(depth));
+			data.gpu_culling->dispatch_late(command_buffer, data.object_buffer->dynamic_offset());
+		})
+		    .read(depth, ImageUsage::COMPUTE_SAMPLED)
+		    .side_effect();
+
+		graph.add_pass("Late Main Rendering", {1.0f, 1.0f, 0.0f}, [&](VkCommandBuffer command_buffer) {
+			begin_rendering(init, command_buffer, data.swapchain_image_views[imageIndex], graph.image_view(depth), VK_ATTACHMENT_LOAD_OP_LOAD, 0);
+			record_gpu_driven_pass(init, data, command_buffer, GPU_VIEW_MAIN_LATE);
+			init.disp.cmdEndRendering(command_buffer);
+		})
+		    .read(shadow_map, ImageUsage::FRAGMENT_SAMPLED)
+		    .write(swapchain, ImageUsage::COLOR_ATTACHMENT)
+		    .write(depth, ImageUsage::DEPTH_ATTACHMENT);
+	}
+
+	graph.add_pass("ImGui Rendering", {0.5f, 0.76f, 0.34f}, [&](VkCommandBuffer command_buffer) {
+		render_imgui(init, command_buffer, data.swapchain_image_views[imageIndex]);
+	})
+	    .write(swapchain, ImageUsage::COLOR_ATTACHMENT);
 
-	transition_image_to_present(init, data.command_buffers[imageIndex], data.swapchain_images[imageIndex]);
+	graph.compile();
+	graph.execute(init, command_buffer, *data.transient_images);
 
-    if (init.disp.endCommandBuffer(data.command_buffers[imageIndex]) != VK_SUCCESS) {
+    if (init.disp.endCommandBuffer(command_buffer) != VK_SUCCESS) {
         std::cout << "failed to record command buffer\n";
         return -1;
     }
@@ -843,11 +1062,6 @@ int record_command_buffer(Init& init, RenderData& data, uint32_t imageIndex) {
 }
 
 int create_sync_objects(Init& init, RenderData& data) {
-    data.available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    data.finished_semaphore.resize(MAX_FRAMES_IN_FLIGHT);
-    data.in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
-    data.image_in_flight.resize(init.swapchain.image_count, VK_NULL_HANDLE);
-
     VkSemaphoreCreateInfo semaphore_info = {};
     semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
@@ -855,10 +1069,10 @@ int create_sync_objects(Init& init, RenderData& data) {
     fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        if (init.disp.createSemaphore(&semaphore_info, nullptr, &data.available_semaphores[i]) != VK_SUCCESS ||
-            init.disp.createSemaphore(&semaphore_info, nullptr, &data.finished_semaphore[i]) != VK_SUCCESS ||
-            init.disp.createFence(&fence_info, nullptr, &data.in_flight_fences[i]) != VK_SUCCESS) {
+    for (auto& frame : data.frames) {
+        if (init.disp.createSemaphore(&semaphore_info, nullptr, &frame.available_semaphore) != VK_SUCCESS ||
+            init.disp.createSemaphore(&semaphore_info, nullptr, &frame.finished_semaphore) != VK_SUCCESS ||
+            init.disp.createFence(&fence_info, nullptr, &frame.in_flight_fence) != VK_SUCCESS) {
             std::cout << "failed to create sync objects\n";
             return -1; // failed to create synchronization objects for a frame
         }
@@ -869,8 +1083,6 @@ int create_sync_objects(Init& init, RenderData& data) {
 int recreate_swapchain(Init& init, RenderData& data) {
     init.disp.deviceWaitIdle();
 
-    init.disp.destroyCommandPool(data.command_pool, nullptr);
-
     for (auto framebuffer : data.framebuffers) {
         init.disp.destroyFramebuffer(framebuffer, nullptr);
     }
@@ -879,17 +1091,22 @@ int recreate_swapchain(Init& init, RenderData& data) {
 
     if (0 != create_swapchain(init)) return -1;
     if (0 != create_framebuffers(init, data)) return -1;
-    if (0 != create_command_pool(init, data)) return -1;
-    if (0 != create_command_buffers(init, data)) return -1;
+
+    // the device is idle, the culling sets can point at the new pyramid
+    data.depth_pyramid->resize(init.swapchain.extent);
+    data.gpu_culling->set_depth_pyramid(*data.depth_pyramid);
     return 0;
 }
 
 int draw_frame(Init& init, RenderData& data) {
-    init.disp.waitForFences(1, &data.in_flight_fences[data.current_frame], VK_TRUE, UINT64_MAX);
+    FrameContext& frame = data.frames[data.current_frame];
+
+    // once this fence signals, nothing the GPU is doing still references the frame's resources
+    init.disp.waitForFences(1, &frame.in_flight_fence, VK_TRUE, UINT64_MAX);
 
     uint32_t image_index = 0;
     VkResult result = init.disp.acquireNextImageKHR(
-            init.swapchain, UINT64_MAX, data.available_semaphores[data.current_frame], VK_NULL_HANDLE, &image_index);
+            init.swapchain, UINT64_MAX, frame.available_semaphore, VK_NULL_HANDLE, &image_index);
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         return recreate_swapchain(init, data);
@@ -898,39 +1115,62 @@ int draw_frame(Init& init, RenderData& data) {
         return -1;
     }
 
-    if (data.image_in_flight[image_index] != VK_NULL_HANDLE) {
-        init.disp.waitForFences(1, &data.image_in_flight[image_index], VK_TRUE, UINT64_MAX);
-    }
-    data.image_in_flight[image_index] = data.in_flight_fences[data.current_frame];
+    init.disp.resetCommandPool(frame.command_pool, 0);
+    data.frame_allocator->reset(static_cast<uint32_t>(data.current_frame));
+    data.transient_images->begin_frame();
+    data.recorder->begin_frame(static_cast<uint32_t>(data.current_frame));
+    data.gpu_culling->begin_frame(static_cast<uint32_t>(data.current_frame));
 
-	// update state
-	update_uniform_buffer(image_index, init, data);
+	// update state, the cascades first since the UBO carries them
 	update_shadow(init, data);
+	update_uniform_buffer(frame, init, data);
+	update_instance_buffers(frame, data);
+	update_light_buffer(frame, init, data);
+	if (data.gpu_driven)
+	{
+		update_gpu_culling(init, data);
+	}
 
     // Record the command buffer for this frame
     if (record_command_buffer(init, data, image_index) != 0) {
         return -1;
     }
 
+    data.frame_allocator->flush();
+
+    // whatever this frame queued for upload, e.g. a new draw table, lands before the frame reads it
+    const UploadTicket upload_ticket = data.upload_queue->flush();
+
+    VkSemaphore wait_semaphores[] = { frame.available_semaphore, data.upload_queue->timeline() };
+    VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+    uint64_t wait_values[] = { 0, upload_ticket };
+    uint64_t signal_values[] = { 0 };
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {};
+    timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timeline_info.waitSemaphoreValueCount = 2;
+    timeline_info.pWaitSemaphoreValues = wait_values;
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = signal_values;
+
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timeline_info;
 
-    VkSemaphore wait_semaphores[] = { data.available_semaphores[data.current_frame] };
-    VkPipelineStageFlags wait_stages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.waitSemaphoreCount = 2;
     submitInfo.pWaitSemaphores = wait_semaphores;
     submitInfo.pWaitDstStageMask = wait_stages;
 
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &data.command_buffers[image_index];
+    submitInfo.pCommandBuffers = &frame.command_buffer;
 
-    VkSemaphore signal_semaphores[] = { data.finished_semaphore[data.current_frame] };
+    VkSemaphore signal_semaphores[] = { frame.finished_semaphore };
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signal_semaphores;
 
-    init.disp.resetFences(1, &data.in_flight_fences[data.current_frame]);
+    init.disp.resetFences(1, &frame.in_flight_fence);
 
-    if (init.disp.queueSubmit(init.graphics_queue, 1, &submitInfo, data.in_flight_fences[data.current_frame]) != VK_SUCCESS) {
+    if (init.disp.queueSubmit(init.graphics_queue, 1, &submitInfo, frame.in_flight_fence) != VK_SUCCESS) {
         std::cout << "failed to submit draw command buffer\n";
         return -1; //"failed to submit draw command buffer
     }
@@ -967,11 +1207,6 @@ void cleanup(Init& init, RenderData& data) {
     init.disp.destroyImageView(data.depth_image_view, nullptr);
     vmaDestroyImage(init.allocator, data.depth_image.image, data.depth_image.allocation);
 
-    // Keep this loop for uniform buffer cleanup
-    for (size_t i = 0; i < init.swapchain.image_count; i++) {
-        vmaDestroyBuffer(init.allocator, data.uniform_buffers[i].buffer, data.uniform_buffers[i].allocation);
-    }
-
     // Cleanup ImGui
     ImGui_ImplVulkan_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -981,21 +1216,21 @@ void cleanup(Init& init, RenderData& data) {
 
     init.disp.destroyDescriptorPool(data.descriptor_pool, nullptr);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        init.disp.destroySemaphore(data.finished_semaphore[i], nullptr);
-        init.disp.destroySemaphore(data.available_semaphores[i], nullptr);
-        init.disp.destroyFence(data.in_flight_fences[i], nullptr);
-    }
-
-    init.disp.freeCommandBuffers(data.command_pool, data.command_buffers.size(), data.command_buffers.data());
+    for (auto& frame : data.frames) {
+        init.disp.destroySemaphore(frame.finished_semaphore, nullptr);
+        init.disp.destroySemaphore(frame.available_semaphore, nullptr);
+        init.disp.destroyFence(frame.in_flight_fence, nullptr);
 
-    init.disp.destroyCommandPool(data.command_pool, nullptr);
+        // destroying the pool frees its command buffer as well
+        init.disp.destroyCommandPool(frame.command_pool, nullptr);
+    }
 
     for (auto framebuffer : data.framebuffers) {
         init.disp.destroyFramebuffer(framebuffer, nullptr);
     }
 
     init.disp.destroyPipeline(data.graphics_pipeline, nullptr);
+    init.disp.destroyPipeline(data.gpu_graphics_pipeline, nullptr);
     init.disp.destroyPipelineLayout(data.pipeline_layout, nullptr);
     init.disp.destroyRenderPass(data.render_pass, nullptr);
 
@@ -1095,7 +1330,7 @@ void processInput(GLFWwindow* window, float deltaTime, Camera& camera) {
 int create_descriptor_set_layout(Init& init, RenderData& renderData) {
     VkDescriptorSetLayoutBinding ubo_layout_binding = {};
     ubo_layout_binding.binding = 0;
-    ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     ubo_layout_binding.descriptorCount = 1;
     ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
     ubo_layout_binding.pImmutableSamplers = nullptr;
@@ -1127,11 +1362,60 @@ int create_descriptor_set_layout(Init& init, RenderData& renderData) {
 		.pImmutableSamplers = nullptr,
 	};
 
-    std::array<VkDescriptorSetLayoutBinding, 4> bindings = {
+	// per-instance object indices, indexed by gl_InstanceIndex
+	VkDescriptorSetLayoutBinding instance_layout_binding = {
+		.binding = 4,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.pImmutableSamplers = nullptr,
+	};
+
+	// material table, indexed by the object's material id
+	VkDescriptorSetLayoutBinding material_layout_binding = {
+		.binding = 5,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pImmutableSamplers = nullptr,
+	};
+
+	// per-object model and normal matrices, written once per frame
+	VkDescriptorSetLayoutBinding object_layout_binding = {
+		.binding = 6,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+		.pImmutableSamplers = nullptr,
+	};
+
+	// spot and point lights with their shadow atlas views
+	VkDescriptorSetLayoutBinding light_layout_binding = {
+		.binding = 7,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pImmutableSamplers = nullptr,
+	};
+
+	VkDescriptorSetLayoutBinding shadow_atlas_sampler_layout_binding = {
+		.binding = 8,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.pImmutableSamplers = nullptr,
+	};
+
+    std::array<VkDescriptorSetLayoutBinding, 9> bindings = {
             ubo_layout_binding,
             sampler_layout_binding,
             cubemap_sampler_layout_binding,
 			shadowmap_sampler_layout_binding,
+			instance_layout_binding,
+			material_layout_binding,
+			object_layout_binding,
+			light_layout_binding,
+			shadow_atlas_sampler_layout_binding,
     };
 
     VkDescriptorSetLayoutCreateInfo layout_info = {};
@@ -1147,23 +1431,20 @@ int create_descriptor_set_layout(Init& init, RenderData& renderData) {
 }
 
 int  create_descriptor_sets(Init& init, RenderData& renderData) {
-    std::vector<VkDescriptorSetLayout> layouts(init.swapchain.image_count, renderData.descriptor_set_layout);
-
-    VkDescriptorSetAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    alloc_info.descriptorPool = renderData.descriptor_pool;
-    alloc_info.descriptorSetCount = static_cast<uint32_t>(init.swapchain.image_count);
-    alloc_info.pSetLayouts = layouts.data();
-
-    renderData.descriptor_sets.resize(init.swapchain.image_count);
-    if (init.disp.allocateDescriptorSets(&alloc_info, renderData.descriptor_sets.data()) != VK_SUCCESS) {
-        std::cout << "failed to allocate descriptor sets\n";
-        return -1;
-    }
+    for (auto& frame : renderData.frames) {
+        VkDescriptorSetAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        alloc_info.descriptorPool = renderData.descriptor_pool;
+        alloc_info.descriptorSetCount = 1;
+        alloc_info.pSetLayouts = &renderData.descriptor_set_layout;
+
+        if (init.disp.allocateDescriptorSets(&alloc_info, &frame.descriptor_set) != VK_SUCCESS) {
+            std::cout << "failed to allocate descriptor sets\n";
+            return -1;
+        }
 
-    for (size_t i = 0; i < init.swapchain.image_count; i++) {
         VkDescriptorBufferInfo buffer_info = {};
-        buffer_info.buffer = renderData.uniform_buffers[i].buffer;
+        buffer_info.buffer = renderData.frame_allocator->buffer();
         buffer_info.offset = 0;
         buffer_info.range = sizeof(UniformBufferObject);
 
@@ -1184,18 +1465,44 @@ int  create_descriptor_sets(Init& init, RenderData& renderData) {
 		    .imageView   = renderData.shadow_map.image_view,
 		    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
 
-        std::array<VkWriteDescriptorSet, 4> descriptor_writes = {};
+		// both storage buffers live in the frame allocator, the dynamic offsets pick this frame's block
+		VkDescriptorBufferInfo instance_buffer_info = {
+		    .buffer = renderData.frame_allocator->buffer(),
+		    .offset = 0,
+		    .range  = renderData.instance_buffer->range()};
+
+		VkDescriptorBufferInfo material_buffer_info = {
+		    .buffer = renderData.frame_allocator->buffer(),
+		    .offset = 0,
+		    .range  = MAX_MATERIALS * sizeof(MaterialData)};
+
+		VkDescriptorBufferInfo object_buffer_info = {
+		    .buffer = renderData.frame_allocator->buffer(),
+		    .offset = 0,
+		    .range  = renderData.object_buffer->range()};
+
+		VkDescriptorBufferInfo light_buffer_info = {
+		    .buffer = renderData.frame_allocator->buffer(),
+		    .offset = 0,
+		    .range  = sizeof(LightBuffer)};
+
+		VkDescriptorImageInfo shadow_atlas_image_info = {
+		    .sampler     = renderData.shadow_atlas->sampler(),
+		    .imageView   = renderData.shadow_atlas->image_view(),
+		    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+        std::array<VkWriteDescriptorSet, 9> descriptor_writes = {};
 
         descriptor_writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptor_writes[0].dstSet = renderData.descriptor_sets[i];
+        descriptor_writes[0].dstSet = frame.descriptor_set;
         descriptor_writes[0].dstBinding = 0;
         descriptor_writes[0].dstArrayElement = 0;
-        descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptor_writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         descriptor_writes[0].descriptorCount = 1;
         descriptor_writes[0].pBufferInfo = &buffer_info;
 
         descriptor_writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptor_writes[1].dstSet = renderData.descriptor_sets[i];
+        descriptor_writes[1].dstSet = frame.descriptor_set;
         descriptor_writes[1].dstBinding = 1;
         descriptor_writes[1].dstArrayElement = 0;
         descriptor_writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -1203,7 +1510,7 @@ int  create_descriptor_sets(Init& init, RenderData& renderData) {
         descriptor_writes[1].pImageInfo = &image_info;
 
         descriptor_writes[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptor_writes[2].dstSet = renderData.descriptor_sets[i];
+        descriptor_writes[2].dstSet = frame.descriptor_set;
         descriptor_writes[2].dstBinding = 2;
         descriptor_writes[2].dstArrayElement = 0;
         descriptor_writes[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -1211,28 +1518,67 @@ int  create_descriptor_sets(Init& init, RenderData& renderData) {
         descriptor_writes[2].pImageInfo = &cubemap_image_info;
 
 		descriptor_writes[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptor_writes[3].dstSet = renderData.descriptor_sets[i];
+		descriptor_writes[3].dstSet = frame.descriptor_set;
 		descriptor_writes[3].dstBinding = 3;
 		descriptor_writes[3].dstArrayElement = 0;
 		descriptor_writes[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		descriptor_writes[3].descriptorCount = 1;
 		descriptor_writes[3].pImageInfo = &shadowmap_image_info;
 
+		descriptor_writes[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptor_writes[4].dstSet = frame.descriptor_set;
+		descriptor_writes[4].dstBinding = 4;
+		descriptor_writes[4].dstArrayElement = 0;
+		descriptor_writes[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		descriptor_writes[4].descriptorCount = 1;
+		descriptor_writes[4].pBufferInfo = &instance_buffer_info;
+
+		descriptor_writes[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptor_writes[5].dstSet = frame.descriptor_set;
+		descriptor_writes[5].dstBinding = 5;
+		descriptor_writes[5].dstArrayElement = 0;
+		descriptor_writes[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		descriptor_writes[5].descriptorCount = 1;
+		descriptor_writes[5].pBufferInfo = &material_buffer_info;
+
+		descriptor_writes[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptor_writes[6].dstSet = frame.descriptor_set;
+		descriptor_writes[6].dstBinding = 6;
+		descriptor_writes[6].dstArrayElement = 0;
+		descriptor_writes[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		descriptor_writes[6].descriptorCount = 1;
+		descriptor_writes[6].pBufferInfo = &object_buffer_info;
+
+		descriptor_writes[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptor_writes[7].dstSet = frame.descriptor_set;
+		descriptor_writes[7].dstBinding = 7;
+		descriptor_writes[7].dstArrayElement = 0;
+		descriptor_writes[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		descriptor_writes[7].descriptorCount = 1;
+		descriptor_writes[7].pBufferInfo = &light_buffer_info;
+
+		descriptor_writes[8].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptor_writes[8].dstSet = frame.descriptor_set;
+		descriptor_writes[8].dstBinding = 8;
+		descriptor_writes[8].dstArrayElement = 0;
+		descriptor_writes[8].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptor_writes[8].descriptorCount = 1;
+		descriptor_writes[8].pImageInfo = &shadow_atlas_image_info;
+
         init.disp.updateDescriptorSets(descriptor_writes.size(), descriptor_writes.data(), 0, nullptr);
     }
     return 0;
 }
 
-int create_uniform_buffers(Init& init, RenderData& renderData) {
-    renderData.uniform_buffers.resize(init.swapchain.image_count);
-    for (size_t i = 0; i < init.swapchain.image_count; i++) {
-        create_buffer(init,
-                      sizeof(UniformBufferObject),
-                      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                      VMA_MEMORY_USAGE_CPU_TO_GPU,
-                      renderData.uniform_buffers[i]);
-    }
+int create_frame_allocator(Init& init, RenderData& renderData) {
+    // sized for the loaded scene, every object drawn by every pass still fits
+    const uint32_t object_capacity = std::max(static_cast<uint32_t>(renderData.scene->instance_count()), 1u);
+    const uint32_t instance_capacity = object_capacity * MAX_INSTANCES_PER_OBJECT;
 
+    // per-frame upload space for uniforms, materials and the object and instance buffers
+    renderData.frame_allocator = new FrameAllocator(init, 4 * 1024 * 1024 + VkDeviceSize(object_capacity) * sizeof(ObjectData) + VkDeviceSize(instance_capacity) * sizeof(uint32_t));
+    renderData.object_buffer = new ObjectBuffer(*renderData.frame_allocator, object_capacity);
+    renderData.instance_buffer = new InstanceBuffer(*renderData.frame_allocator, instance_capacity);
     return 0;
 }
 
@@ -1247,9 +1593,8 @@ int create_new_imgui_frame(Init& init, RenderData& render_data) {
 	ImGui::SliderFloat3("Light Direction", &render_data.shadow_map.light_direction.x, -1.0f, 1.0f);
 
 	ImGui::SliderFloat("Light Distance", &render_data.shadow_map.light_distance, 10.0f, 100.0f);
-	ImGui::SliderFloat("Light Volume", &render_data.shadow_map.radius, 1.0f, 100.0f);
-	ImGui::SliderFloat("Light Near Plane", &render_data.shadow_map.near_plane, 0.1f, 50.0f);
-	ImGui::SliderFloat("Light Far Plane", &render_data.shadow_map.far_plane, 5.0f, 100.0f);
+	ImGui::SliderFloat("Shadow Distance", &render_data.shadow_map.shadow_distance, 5.0f, 100.0f);
+	ImGui::SliderFloat("Cascade Split Lambda", &render_data.shadow_map.split_lambda, 0.0f, 1.0f);
 	ImGui::SliderFloat("Depth Bias Constant", &render_data.shadow_map.bias, 0.0f, 2.0f);
 	ImGui::SliderFloat("Depth Bias Slope", &render_data.shadow_map.slope_bias, 0.0f, 2.0f);
 
@@ -1259,6 +1604,38 @@ int create_new_imgui_frame(Init& init, RenderData& render_data) {
 	// show camera facing
 	ImGui::Text("Camera facing: %.2f %.2f %.2f", render_data.camera.front.x, render_data.camera.front.y, render_data.camera.front.z);
 
+	ImGui::Text("Objects: %u drawn, %u culled", render_data.culling_stats.objects_visible,
+	            render_data.culling_stats.objects_total - render_data.culling_stats.objects_visible);
+	ImGui::Text("Shadow casters: %u / %u", render_data.culling_stats.shadow_casters_visible, render_data.culling_stats.shadow_casters_total);
+	ImGui::Text("Cached cascades: %u / %u", render_data.culling_stats.shadow_cascades_cached, SHADOW_CASCADE_COUNT);
+	ImGui::Text("Atlas lights: %u, views rendered: %u", render_data.culling_stats.shadow_lights, render_data.culling_stats.shadow_views_rendered);
+	ImGui::Text("Meshlets: %u / %u", render_data.culling_stats.meshlets_visible, render_data.culling_stats.meshlets_total);
+	ImGui::Text("Triangles: %u", render_data.culling_stats.triangles);
+	ImGui::Text("Draw calls: %u, objects: %u, instances: %u", render_data.culling_stats.draw_calls, render_data.object_buffer->count(), render_data.instance_buffer->count());
+	ImGui::Checkbox("Parallel Recording", &render_data.parallel_recording);
+	ImGui::Text("Secondary buffers: %u on %u threads", render_data.culling_stats.secondary_buffers, render_data.recorder->worker_count());
+	ImGui::Checkbox("GPU Driven", &render_data.gpu_driven);
+	if (ImGui::Checkbox("Verify GPU Culling", &render_data.verify_gpu_culling))
+	{
+		render_data.gpu_culling->set_verify(render_data.verify_gpu_culling);
+	}
+	ImGui::Checkbox("Occlusion Culling", &render_data.occlusion_culling);
+	ImGui::Text("GPU culling checked: %u frames, %u mismatches", render_data.gpu_culling->verified_frames(), render_data.gpu_culling->mismatched_frames());
+	ImGui::SliderFloat("LOD Pixel Error", &render_data.lod_pixel_error, 0.1f, 16.0f);
+	ImGui::SliderFloat("Shadow LOD Pixel Error", &render_data.shadow_lod_pixel_error, 0.1f, 32.0f);
+
+	// moving a static caster bumps the scene's static revision and refreshes the shadow cache
+	Scene &scene = *render_data.scene;
+	ImGui::SliderInt("Instance", &render_data.selected_instance, 0, static_cast<int>(scene.instance_count()) - 1);
+	const uint32_t instance = static_cast<uint32_t>(render_data.selected_instance);
+	glm::vec3      position = glm::vec3(scene.transforms[instance][3]);
+	if (ImGui::DragFloat3("Instance Position", &position.x, 0.05f))
+	{
+		glm::mat4 transform = scene.transforms[instance];
+		transform[3]        = glm::vec4(position, 1.0f);
+		scene.set_transform(instance, transform);
+	}
+
 	ImGui::End();
 
 	int res = draw_frame(init, render_data);
@@ -1290,13 +1667,58 @@ int main() {
     if (0 != create_sync_objects(init, render_data)) return -1;
     if (0 != create_descriptor_pool(init, render_data)) return -1;
     if (0 != create_imgui(init, render_data)) return -1;
-    if (0 != create_uniform_buffers(init, render_data)) return -1;
 
 	init_shadow_pipeline(init, render_data);
 	init_shadow_map(init, render_data);
+	render_data.shadow_atlas = new ShadowAtlas(init);
+	render_data.transient_images = new TransientImagePool(init);
+
+	// the main thread only waits while the workers record, so they can have every core
+	const uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+	render_data.recorder = new ParallelRecorder(init, std::min(cores, MAX_RECORDING_THREADS));
     //render_data.texture = std::make_unique<Texture>( init, "../textures/wall.KTX2");
 
-	render_data.staging_buffer = create_staging_buffer(init, 65000);
+	// load the truck and put it on a checkered ground plane, the per-frame buffers are sized for it
+	render_data.scene = new Scene();
+	MappedFile truck_cache;
+	load_scene_cached(*render_data.scene, truck_cache, "../meshes/truck.obj", render_data.vertex_format);
+
+	Material ground = {};
+	ground.name = "ground";
+	ground.use_texture = false;
+	ground.pattern_scale = 20.0f;
+
+	// the ground receives shadows but never casts them
+	render_data.scene->add_instance(render_data.scene->add_mesh(Mesh::create_plane(10, 10)),
+	                                render_data.scene->add_material(ground), glm::mat4(1.0f), false);
+
+	// a spot light over the truck and a point light beside it, shadowed through the atlas
+	Light spot = {};
+	spot.type        = LightType::SPOT;
+	spot.position    = glm::vec3(0.0f, 4.0f, 1.5f);
+	spot.direction   = glm::vec3(0.0f, -1.0f, -0.4f);
+	spot.color       = glm::vec3(1.0f, 0.85f, 0.6f);
+	spot.intensity   = 8.0f;
+	spot.range       = 12.0f;
+	spot.outer_angle = glm::radians(35.0f);
+	render_data.scene->add_light(spot);
+
+	Light point = {};
+	point.type      = LightType::POINT;
+	point.position  = glm::vec3(2.5f, 1.5f, -1.0f);
+	point.color     = glm::vec3(0.5f, 0.7f, 1.0f);
+	point.intensity = 4.0f;
+	point.range     = 6.0f;
+	render_data.scene->add_light(point);
+
+    if (0 != create_frame_allocator(init, render_data)) return -1;
+
+	render_data.staging_buffer = create_staging_buffer(init, 64 * 1024 * 1024);
+	render_data.upload_queue = new UploadQueue(init, render_data.staging_buffer);
+	render_data.geometry_pool = new GeometryPool(init, render_data.vertex_format, 1024 * 1024, 4 * 1024 * 1024);
+	render_data.gpu_culling = new GpuCulling(init, *render_data.upload_queue, *render_data.frame_allocator, render_data.object_buffer->capacity());
+	render_data.depth_pyramid = new DepthPyramid(init, init.swapchain.extent);
+	render_data.gpu_culling->set_depth_pyramid(*render_data.depth_pyramid);
 
     ImageLoader* imageLoader = new ImageLoader(init);
     render_data.texture = imageLoader->load_texture("../textures/oldtruck_d.ktx2");
@@ -1305,9 +1727,6 @@ int main() {
 
     if (0 != create_descriptor_sets(init, render_data)) return -1;
 	render_data.mesh = Mesh::create_cube();
-	render_data.mesh->transfer_mesh(init);
-	render_data.plane_mesh = Mesh::create_plane(10, 10);
-	render_data.plane_mesh->transfer_mesh(init);
 
     auto lastTime = std::chrono::high_resolution_clock::now();
     float deltaTime = 0.0f;
@@ -1315,16 +1734,20 @@ int main() {
 	configure_mouse_input(init, render_data);
 
 	const auto cmdBuffer = begin_single_time_commands(init);
-	transition_shadowmap_initial(init, cmdBuffer, render_data.shadow_map.image);
+	BarrierBatch initial_barriers(init);
+	transition_shadowmap_initial(initial_barriers, render_data.shadow_map.image);
+	transition_shadowmap_initial(initial_barriers, render_data.shadow_atlas->image());
+	initial_barriers.flush(cmdBuffer);
 	end_single_time_commands(init, cmdBuffer);
 
 	render_data.camera.position = glm::vec3(-2.2f, 1.66f, 1.7f);
 	render_data.camera.look_at(glm::vec3(0.0f));
 
-	// load the bunny model
-	Mesh bunny_model = create_from_obj("../meshes/truck.obj");
-	bunny_model.transfer_mesh(init);
-	render_data.bunny_mesh = &bunny_model;
+	// all meshes are suballocated from the geometry pool and go out in one batch
+	std::vector<Mesh *> meshes = render_data.scene->meshes;
+	meshes.push_back(render_data.mesh);
+	render_data.geometry_pool->upload(*render_data.upload_queue, meshes);
+	render_data.upload_queue->wait(render_data.upload_queue->flush());
 
     while (!glfwWindowShouldClose(init.window)) {
 
@@ -1347,10 +1770,23 @@ int main() {
     init.disp.deviceWaitIdle();
 
     delete render_data.cube_map;
+    delete render_data.instance_buffer;
+    delete render_data.object_buffer;
+    delete render_data.frame_allocator;
     delete imageLoader;
 
 	cleanup_shadow_map(init, render_data);
-
+	delete render_data.shadow_atlas;
+	delete render_data.transient_images;
+	delete render_data.recorder;
+	delete render_data.gpu_culling;
+	delete render_data.depth_pyramid;
+
+	cleanup_scene(*render_data.scene);
+	delete render_data.scene;
+	delete render_data.mesh;
+	delete render_data.geometry_pool;
+	delete render_data.upload_queue;
 	cleanup_buffer(init, render_data.staging_buffer);
 
     cleanup(init, render_data);
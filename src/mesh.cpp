@@ -5,6 +5,11 @@
 #include "mesh.hpp"
 
 #include "common.hpp"
+#include "geometry_pool.hpp"
+#include "instance_buffer.hpp"
+#include "mesh_optimizer.hpp"
+#include "vertex_format.hpp"
+#include "upload_queue.hpp"
 #include "utils.hpp"
 
 namespace obsidian
@@ -51,7 +56,7 @@ Mesh* Mesh::create_cube()
 	    {{-0.5f, -0.5f,  0.5f}, {1.0f, 1.0f, 1.0f}, {0.0f, 0.0f}, {-1.0f,  0.0f,  0.0f}}  // 23. Bottom-front
 	};
 
-	const std::vector<uint16_t> cube_indices = {
+	const std::vector<uint32_t> cube_indices = {
 	    // Front face
 	    1, 2, 0,    2, 3, 0,
 	    // Back face
@@ -73,6 +78,8 @@ Mesh* Mesh::create_cube()
 
 	mesh->vertices = vertices;
 	mesh->indices = cube_indices;
+	mesh->index_type = select_index_type(vertices.size());
+	compute_bounds(*mesh);
 
 	return mesh;
 }
@@ -99,13 +106,13 @@ Mesh* Mesh::create_plane(uint32_t subdivisions, float size)
 	}
 
 	// Generate the indices
-	std::vector<uint16_t> indices(numIndices);
+	std::vector<uint32_t> indices(numIndices);
 	for (uint32_t y = 0; y < subdivisions; y++) {
 		for (uint32_t x = 0; x < subdivisions; x++) {
-			uint16_t topLeft = y * (subdivisions + 1) + x;
-			uint16_t topRight = topLeft + 1;
-			uint16_t bottomLeft = (y + 1) * (subdivisions + 1) + x;
-			uint16_t bottomRight = bottomLeft + 1;
+			uint32_t topLeft = y * (subdivisions + 1) + x;
+			uint32_t topRight = topLeft + 1;
+			uint32_t bottomLeft = (y + 1) * (subdivisions + 1) + x;
+			uint32_t bottomRight = bottomLeft + 1;
 
 			uint32_t indexOffset = (y * subdivisions + x) * 6;
 			indices[indexOffset + 0] = topLeft;
@@ -124,63 +131,67 @@ Mesh* Mesh::create_plane(uint32_t subdivisions, float size)
 	mesh->index_count = numIndices;
 	mesh->vertices = vertices;
 	mesh->indices = indices;
+	optimize_mesh(*mesh);
+	mesh->index_type = select_index_type(mesh->vertex_count);
+	compute_bounds(*mesh);
 
 	return mesh;
 }
 
 
 
-VkResult Mesh::transfer_mesh(Init &init)
+VkResult Mesh::draw(obsidian::Init &init, VkCommandBuffer commandBuffer, GeometryBinding &binding)
 {
-	VkDeviceSize vertex_buffer_size = sizeof(vertices[0]) * vertices.size();
-	VkDeviceSize index_buffer_size = sizeof(indices[0]) * indices.size();
-
-	BufferAllocation staging_vertex_buffer;
-	BufferAllocation staging_index_buffer;
-
-	create_buffer(init, vertex_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, staging_vertex_buffer);
-	create_buffer(init, index_buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, staging_index_buffer);
-
-	void *data;
-	vmaMapMemory(init.allocator, staging_vertex_buffer.allocation, &data);
-	memcpy(data, vertices.data(), static_cast<size_t>(vertex_buffer_size));
-	vmaUnmapMemory(init.allocator, staging_vertex_buffer.allocation);
+	const MeshLod base = lod(0);
+	return draw_range(init, commandBuffer, binding, base.first_index, base.index_count);
+}
 
-	vmaMapMemory(init.allocator, staging_index_buffer.allocation, &data);
-	memcpy(data, indices.data(), static_cast<size_t>(index_buffer_size));
-	vmaUnmapMemory(init.allocator, staging_index_buffer.allocation);
+MeshLod Mesh::lod(uint32_t level) const
+{
+	if (lods.empty())
+	{
+		return {0, index_count, 0.0f};
+	}
 
-	create_buffer(init, vertex_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, vertex_buffer);
-	create_buffer(init, index_buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, index_buffer);
+	return lods[std::min<size_t>(level, lods.size() - 1)];
+}
 
-	copy_buffer(init, staging_vertex_buffer.buffer, vertex_buffer.buffer, vertex_buffer_size);
-	copy_buffer(init, staging_index_buffer.buffer, index_buffer.buffer, index_buffer_size);
+VkResult Mesh::draw_range(obsidian::Init &init, VkCommandBuffer commandBuffer, GeometryBinding &binding, uint32_t range_first_index, uint32_t range_index_count,
+                          uint32_t first_instance, uint32_t instance_count) const
+{
+	if (!gpu_data_initialized)
+	{
+		return VK_NOT_READY;
+	}
 
-	cleanup_buffer(init, staging_vertex_buffer);
-	cleanup_buffer(init, staging_index_buffer);
+	if (binding.index_type != index_type)
+	{
+		init.disp.cmdBindIndexBuffer(commandBuffer, binding.index_buffer, 0, index_type);
+		binding.index_type = index_type;
+	}
 
-	gpu_data_initialized = true;
+	init.disp.cmdDrawIndexed(commandBuffer, range_index_count, instance_count, first_index + range_first_index, vertex_offset, first_instance);
 
 	return VK_SUCCESS;
 }
 
-VkResult Mesh::draw(obsidian::Init &init, VkCommandBuffer commandBuffer)
+VkResult Mesh::draw_instanced(obsidian::Init &init, VkCommandBuffer commandBuffer, GeometryBinding &binding, InstanceBuffer &instances,
+                              std::span<const uint32_t> object_indices, uint32_t lod_level) const
 {
 	if (!gpu_data_initialized)
 	{
 		return VK_NOT_READY;
 	}
 
-	VkBuffer vertex_buffers[] = {vertex_buffer.buffer};
-	VkDeviceSize offsets[] = {0};
-
-	// bind vertex buffer
-	init.disp.cmdBindVertexBuffers(commandBuffer, 0, 1, vertex_buffers, offsets);
-	init.disp.cmdBindIndexBuffer(commandBuffer, index_buffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+	if (object_indices.empty())
+	{
+		return VK_SUCCESS;
+	}
 
-	init.disp.cmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+	const uint32_t first_instance = instances.push(object_indices);
+	const MeshLod  range          = lod(lod_level);
 
-	return VK_SUCCESS;
+	return draw_range(init, commandBuffer, binding, range.first_index, range.index_count, first_instance, static_cast<uint32_t>(object_indices.size()));
 }
 
 //const std::vector<Vertex> cube_vertices = {
@@ -253,23 +264,177 @@ VkResult Mesh::draw(obsidian::Init &init, VkCommandBuffer commandBuffer)
 //	mesh.indices = cube_indices;
 //}
 
-VkResult cleanup_mesh(Init &init, Mesh& mesh)
+VkDeviceSize position_data_size(const Mesh &mesh, VertexFormat format)
 {
-	cleanup_buffer(init, mesh.vertex_buffer);
-	cleanup_buffer(init, mesh.index_buffer);
-	return VK_SUCCESS;
+	return static_cast<VkDeviceSize>(vertex_position_stride(format)) * mesh.vertex_count;
+}
+
+VkDeviceSize attribute_data_size(const Mesh &mesh, VertexFormat format)
+{
+	return static_cast<VkDeviceSize>(vertex_attribute_stride(format)) * mesh.vertex_count;
 }
 
-VkResult transfer_mesh_to_gpu(Init& init, Mesh& mesh, BufferAllocation staging_buffer)
+void compute_bounds(Mesh &mesh)
 {
+	if (mesh.vertices.empty())
+	{
+		mesh.bounds_min = mesh.bounds_max = mesh.sphere_center = glm::vec3(0.0f);
+		mesh.sphere_radius = 0.0f;
+		return;
+	}
 
-	// copy vertex data to staging buffer
-	VkDeviceSize vertex_buffer_size = sizeof(mesh.vertices[0]) * mesh.vertices.size();
-	VkDeviceSize index_buffer_size = sizeof(mesh.indices[0]) * mesh.indices.size();
+	mesh.bounds_min = mesh.bounds_max = mesh.vertices[0].pos;
+	for (const Vertex &vertex : mesh.vertices)
+	{
+		mesh.bounds_min = glm::min(mesh.bounds_min, vertex.pos);
+		mesh.bounds_max = glm::max(mesh.bounds_max, vertex.pos);
+	}
 
-	return VK_SUCCESS;
+	mesh.sphere_center = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+
+	float radius_squared = 0.0f;
+	for (const Vertex &vertex : mesh.vertices)
+	{
+		const glm::vec3 offset = vertex.pos - mesh.sphere_center;
+		radius_squared         = std::max(radius_squared, glm::dot(offset, offset));
+	}
+	mesh.sphere_radius = std::sqrt(radius_squared);
+}
+
+VkIndexType select_index_type(size_t vertex_count)
+{
+	// 0xFFFF is left out so primitive restart can never be hit by accident
+	return vertex_count < 0xFFFF ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+uint32_t index_type_size(VkIndexType index_type)
+{
+	return index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+VkDeviceSize index_data_size(const Mesh &mesh)
+{
+	return static_cast<VkDeviceSize>(index_type_size(mesh.index_type)) * mesh.index_count;
+}
+
+void write_vertex_data(const Mesh &mesh, VertexFormat format, uint8_t *positions, uint8_t *attributes)
+{
+	if (mesh.packed_position_data && mesh.packed_attribute_data)
+	{
+		memcpy(positions, mesh.packed_position_data, static_cast<size_t>(position_data_size(mesh, format)));
+		memcpy(attributes, mesh.packed_attribute_data, static_cast<size_t>(attribute_data_size(mesh, format)));
+		return;
+	}
+
+	encode_vertices(mesh.vertices.data(), mesh.vertices.size(), format, positions, attributes);
+}
+
+void write_index_data(const Mesh &mesh, uint8_t *dst)
+{
+	if (mesh.packed_index_data)
+	{
+		memcpy(dst, mesh.packed_index_data, static_cast<size_t>(index_data_size(mesh)));
+		return;
+	}
+
+	if (mesh.index_type == VK_INDEX_TYPE_UINT32)
+	{
+		memcpy(dst, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+		return;
+	}
+
+	auto *narrow = reinterpret_cast<uint16_t *>(dst);
+	for (size_t i = 0; i < mesh.indices.size(); i++)
+	{
+		narrow[i] = static_cast<uint16_t>(mesh.indices[i]);
+	}
+}
+
+static VkDeviceSize align_4(VkDeviceSize value)
+{
+	return (value + 3) & ~VkDeviceSize(3);
+}
+
+UploadMeshData pack_mesh_data(const std::vector<Mesh *> &meshes,
+                              const StagingRange       &staging,
+                              VkBuffer                  position_target,
+                              VkBuffer                  attribute_target,
+                              VkBuffer                  index_target,
+                              VertexFormat              vertex_format)
+{
+	UploadMeshData upload = {};
+	upload.total_size     = 0;
+	upload.stages.reserve(meshes.size() * 3);
+
+	for (const Mesh *mesh : meshes)
+	{
+		// every stream starts 4 byte aligned in staging so the encoders write aligned
+		const VkDeviceSize position_size  = position_data_size(*mesh, vertex_format);
+		const VkDeviceSize attribute_size = attribute_data_size(*mesh, vertex_format);
+		const VkDeviceSize index_size     = index_data_size(*mesh);
+
+		const VkDeviceSize position_offset  = align_4(upload.total_size);
+		const VkDeviceSize attribute_offset = align_4(position_offset + position_size);
+		const VkDeviceSize index_offset     = align_4(attribute_offset + attribute_size);
+
+		if (index_offset + index_size > staging.size)
+		{
+			throw std::runtime_error("mesh data does not fit in the staging range!");
+		}
 
+		write_vertex_data(*mesh, vertex_format, staging.data + position_offset, staging.data + attribute_offset);
+		write_index_data(*mesh, staging.data + index_offset);
+
+		upload.stages.push_back({
+		    .staging_buffer = staging.buffer,
+		    .target_buffer  = position_target,
+		    .src_offset     = staging.offset + position_offset,
+		    .dst_offset     = static_cast<VkDeviceSize>(mesh->vertex_offset) * vertex_position_stride(vertex_format),
+		    .size           = position_size,
+		});
+		upload.stages.push_back({
+		    .staging_buffer = staging.buffer,
+		    .target_buffer  = attribute_target,
+		    .src_offset     = staging.offset + attribute_offset,
+		    .dst_offset     = static_cast<VkDeviceSize>(mesh->vertex_offset) * vertex_attribute_stride(vertex_format),
+		    .size           = attribute_size,
+		});
+		upload.stages.push_back({
+		    .staging_buffer = staging.buffer,
+		    .target_buffer  = index_target,
+		    .src_offset     = staging.offset + index_offset,
+		    .dst_offset     = static_cast<VkDeviceSize>(mesh->first_index) * index_type_size(mesh->index_type),
+		    .size           = index_size,
+		});
+
+		upload.total_size = index_offset + index_size;
+	}
+
+	return upload;
+}
+
+VkDeviceSize mesh_upload_size(const Mesh &mesh, VertexFormat format)
+{
+	// what pack_mesh_data can take at worst: up to 3 bytes to align the mesh's first
+	// stream after the previous mesh, then every stream rounded up to 4 bytes
+	return 3 + align_4(position_data_size(mesh, format)) + align_4(attribute_data_size(mesh, format)) + align_4(index_data_size(mesh));
+}
+
+void queue_upload_mesh_data(UploadQueue &upload_queue, const UploadMeshData &upload)
+{
+	std::unordered_map<VkBuffer, std::vector<VkBufferCopy>> regions;
+
+	for (const auto &stage : upload.stages)
+	{
+		regions[stage.target_buffer].push_back({stage.src_offset, stage.dst_offset, stage.size});
+	}
+
+	for (const auto &[target, target_regions] : regions)
+	{
+		upload_queue.copy_regions(target, target_regions);
+	}
 }
+
 BufferAllocation create_staging_buffer(Init &init, uint32_t size)
 {
 	BufferAllocation staging_buffer;
@@ -292,23 +457,9 @@ BufferAllocation create_staging_buffer(Init &init, uint32_t size)
 		throw std::runtime_error("failed to create staging buffer!");
 	}
 
-	return staging_buffer;
-}
+	staging_buffer.size = size;
 
-VkResult copy_buffer_data(Init &init,
-                          const VkCommandBuffer &commandBuffer,
-                          BufferAllocation &src_buffer,
-                          BufferAllocation &dst_buffer,
-                          uint32_t size, uint32_t src_offset, uint32_t dst_offset)
-{
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = size;
-	copyRegion.srcOffset = src_offset;
-	copyRegion.dstOffset = dst_offset;
-	init.disp.cmdCopyBuffer(commandBuffer, src_buffer.buffer, dst_buffer.buffer, 1, &copyRegion);
-
-	return VK_SUCCESS;
+	return staging_buffer;
 }
 
-
 }        // namespace obsidian
\ No newline at end of file
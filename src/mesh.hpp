@@ -3,9 +3,15 @@
 
 #include "common.hpp"
 
+#include <span>
+
 namespace obsidian
 {
 
+class UploadQueue;
+struct StagingRange;
+struct GeometryBinding;
+
 enum class MeshType {
   CUBE,
   SPHERE,
@@ -13,6 +19,30 @@ enum class MeshType {
   CUSTOM
 };
 
+constexpr uint32_t MESHLET_MAX_VERTICES  = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// Cluster of at most MESHLET_MAX_VERTICES unique vertices and MESHLET_MAX_TRIANGLES
+// triangles. Its triangles are a contiguous range of the mesh's index list, so a
+// surviving meshlet is drawn with a plain indexed draw.
+struct Meshlet
+{
+	uint32_t  first_index;        // relative to the mesh's first_index
+	uint32_t  index_count;
+	glm::vec3 center;             // bounding sphere
+	float     radius;
+	glm::vec3 cone_axis;          // average facing of the triangles
+	float     cone_cutoff;        // sine of the cone half angle, 1 means never backfacing
+};
+
+// One level of detail: a range of the mesh's index list over the shared vertices.
+struct MeshLod
+{
+	uint32_t first_index;        // relative to the mesh's first_index
+	uint32_t index_count;
+	float    error;              // object space distance the simplification may deviate by
+};
+
 struct Mesh
 {
 	MeshType mesh_type;
@@ -20,45 +50,99 @@ struct Mesh
 	uint32_t index_count;
 
 	std::vector<Vertex> vertices;
-	std::vector<uint16_t> indices;
+	// indices are kept at full width on the CPU and narrowed on upload when index_type is UINT16
+	std::vector<uint32_t> indices;
+	VkIndexType           index_type = VK_INDEX_TYPE_UINT16;
 
-  	BufferAllocation vertex_buffer;
-  	BufferAllocation index_buffer;
+	// empty for meshes that are always drawn whole, covers lod 0 only
+	std::vector<Meshlet> meshlets;
 
-	bool gpu_data_initialized = false;
+	// lods[0] is the full mesh, coarser levels follow it in the index list; empty means a single level
+	std::vector<MeshLod> lods;
+
+	glm::vec3 bounds_min    = glm::vec3(0.0f);
+	glm::vec3 bounds_max    = glm::vec3(0.0f);
+	glm::vec3 sphere_center = glm::vec3(0.0f);        // bounding sphere around the box center, usually tighter than the box corners
+	float     sphere_radius = 0.0f;
 
-	VkResult transfer_mesh(Init &init);
+	// GPU-ready position, attribute and index streams (vertices in the pool's VertexFormat, indices at
+	// index_type width) uploaded instead of vertices/indices when set, e.g. pointing into a mapped mesh cache
+	const void *packed_position_data  = nullptr;
+	const void *packed_attribute_data = nullptr;
+	const void *packed_index_data     = nullptr;
+
+	// location of this mesh inside the GeometryPool's vertex and index buffers
+	int32_t  vertex_offset = 0;
+	uint32_t first_index   = 0;
+
+	bool gpu_data_initialized = false;
 
 	static Mesh* create_cube();
 	static Mesh* create_plane(uint32_t subdivisions, float size = 1.0f);
 
-	VkResult draw(Init& init, VkCommandBuffer commandBuffer);
+	// expects the GeometryPool to be bound already, rebinds the index buffer only if the width differs
+	VkResult draw(Init& init, VkCommandBuffer commandBuffer, GeometryBinding &binding);
+
+	// index range of a level, the whole mesh for meshes without lods
+	MeshLod lod(uint32_t level) const;
+
+	// draw part of the index list, first_index relative to the mesh, for instances already in the instance buffer
+	VkResult draw_range(Init& init, VkCommandBuffer commandBuffer, GeometryBinding &binding, uint32_t range_first_index, uint32_t range_index_count,
+	                    uint32_t first_instance = 0, uint32_t instance_count = 1) const;
+
+	// append the objects to this frame's instance buffer and draw them all at the given lod in one call
+	VkResult draw_instanced(Init& init, VkCommandBuffer commandBuffer, GeometryBinding &binding, InstanceBuffer &instances,
+	                        std::span<const uint32_t> object_indices, uint32_t lod_level = 0) const;
 };
 
+// One staging-to-target copy produced while packing meshes.
 struct UploadMeshDataStage
 {
-	BufferAllocation staging_buffer;
-	BufferAllocation target_buffer;
-	uint32_t src_offset;
-	uint32_t dst_offset;
-	uint32_t size;
+	VkBuffer     staging_buffer;
+	VkBuffer     target_buffer;
+	VkDeviceSize src_offset;
+	VkDeviceSize dst_offset;
+	VkDeviceSize size;
 };
 
 struct UploadMeshData
 {
 	std::vector<UploadMeshDataStage> stages;
-	uint32_t total_size;
+	VkDeviceSize total_size;
 };
 
 BufferAllocation create_staging_buffer(Init &init, uint32_t size);
 
-VkResult copy_buffer_data(Init &init, const VkCommandBuffer &command_buffer, const UploadMeshDataStage &stage);
+// write the meshes' data into staging, using each mesh's vertex_offset/first_index as destination
+UploadMeshData pack_mesh_data(const std::vector<Mesh *> &meshes,
+                              const StagingRange       &staging,
+                              VkBuffer                  position_target,
+                              VkBuffer                  attribute_target,
+                              VkBuffer                  index_target,
+                              VertexFormat              vertex_format);
+
+// merge the stages into one VkBufferCopy list per target and queue them
+void queue_upload_mesh_data(UploadQueue &upload_queue, const UploadMeshData &upload);
+
+// axis aligned box and bounding sphere of the vertices
+void compute_bounds(Mesh &mesh);
+
+// smallest index type that can address vertex_count vertices
+VkIndexType select_index_type(size_t vertex_count);
+uint32_t    index_type_size(VkIndexType index_type);
+
+// GPU-ready streams of the mesh, vertices encoded as format, indices at index_type width
+VkDeviceSize position_data_size(const Mesh &mesh, VertexFormat format);
+VkDeviceSize attribute_data_size(const Mesh &mesh, VertexFormat format);
+VkDeviceSize index_data_size(const Mesh &mesh);
+void         write_vertex_data(const Mesh &mesh, VertexFormat format, uint8_t *positions, uint8_t *attributes);
+void         write_index_data(const Mesh &mesh, uint8_t *dst);
+
+// bytes of staging space pack_mesh_data needs for the mesh
+VkDeviceSize mesh_upload_size(const Mesh &mesh, VertexFormat format);
 
 void create_cube_mesh(Init &init, Mesh& mesh);
 void create_plane_mesh(Init &init, Mesh& mesh, uint32_t subdivisions, float size);
-VkResult cleanup_mesh(Init &init, Mesh& mesh);
-
-VkResult transfer_mesh_to_gpu(Init &init, Mesh &mesh, BufferAllocation staging_buffer);
 
 
 
@@ -0,0 +1,490 @@
+//
+// Created by rfdic on 9/10/2024.
+//
+
+#include "mesh_cache.hpp"
+
+#include "mesh.hpp"
+#include "scene.hpp"
+
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+namespace obsidian
+{
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string &path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE file_mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!file_mapping)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	const void *view = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view)
+	{
+		CloseHandle(file_mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file        = handle;
+	mapping     = file_mapping;
+	mapped      = static_cast<const uint8_t *>(view);
+	mapped_size = static_cast<size_t>(file_size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat info = {};
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void *view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// the mapping keeps the file alive
+	::close(fd);
+
+	if (view == MAP_FAILED)
+	{
+		return false;
+	}
+
+	mapped      = static_cast<const uint8_t *>(view);
+	mapped_size = static_cast<size_t>(info.st_size);
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!mapped)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(mapped);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	mapping = nullptr;
+	file    = nullptr;
+#else
+	munmap(const_cast<uint8_t *>(mapped), mapped_size);
+#endif
+
+	mapped      = nullptr;
+	mapped_size = 0;
+}
+
+const uint8_t *MappedFile::data() const
+{
+	return mapped;
+}
+
+size_t MappedFile::size() const
+{
+	return mapped_size;
+}
+
+static uint64_t source_key(const std::string &source_path, uint32_t import_flags, VertexFormat vertex_format)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	auto     mix  = [&hash](const void *bytes, size_t count) {
+		const auto *p = static_cast<const uint8_t *>(bytes);
+		for (size_t i = 0; i < count; i++)
+		{
+			hash = (hash ^ p[i]) * 0x100000001b3ull;
+		}
+	};
+
+	mix(source_path.data(), source_path.size());
+	mix(&import_flags, sizeof(import_flags));
+	mix(&vertex_format, sizeof(vertex_format));
+	return hash;
+}
+
+static bool source_stamp(const std::string &source_path, int64_t &mtime, uint64_t &size)
+{
+	std::error_code error;
+
+	const auto write_time = std::filesystem::last_write_time(source_path, error);
+	if (error)
+	{
+		return false;
+	}
+
+	size = std::filesystem::file_size(source_path, error);
+	if (error)
+	{
+		return false;
+	}
+
+	mtime = static_cast<int64_t>(write_time.time_since_epoch().count());
+	return true;
+}
+
+static uint64_t align_16(uint64_t value)
+{
+	return (value + 15) & ~uint64_t(15);
+}
+
+static void copy_string(char *dst, size_t capacity, const std::string &src)
+{
+	const size_t count = std::min(src.size(), capacity - 1);
+	memcpy(dst, src.data(), count);
+	dst[count] = '\0';
+}
+
+std::string mesh_cache_path(const std::string &source_path, uint32_t import_flags, VertexFormat vertex_format)
+{
+	const std::filesystem::path source(source_path);
+
+	char key[17];
+	snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(source_key(source_path, import_flags, vertex_format)));
+
+	return (source.parent_path() / "cache" / (source.stem().string() + "-" + key + ".obmesh")).string();
+}
+
+void write_mesh_cache(const Scene &scene, const std::string &source_path, uint32_t import_flags, VertexFormat vertex_format)
+{
+	MeshCacheHeader header = {};
+	header.magic          = MESH_CACHE_MAGIC;
+	header.version        = MESH_CACHE_VERSION;
+	header.import_flags   = import_flags;
+	header.submesh_count  = static_cast<uint32_t>(scene.meshes.size());
+	header.material_count = static_cast<uint32_t>(scene.materials.size());
+	header.instance_count = static_cast<uint32_t>(scene.instance_count());
+	header.vertex_format  = static_cast<uint32_t>(vertex_format);
+	header.source_hash    = source_key(source_path, import_flags, vertex_format);
+
+	// the cache only saves time on the next run, failing to write it is no reason to stop this one
+	if (!source_stamp(source_path, header.source_mtime, header.source_size))
+	{
+		std::cout << "Skipping mesh cache, failed to stat " << source_path << "\n";
+		return;
+	}
+
+	// lay out the tables, then the streams with every mesh 16 byte aligned
+	std::vector<MeshCacheSubmesh> submeshes(scene.meshes.size());
+
+	uint64_t  position_bytes  = 0;
+	uint64_t  attribute_bytes = 0;
+	uint64_t  index_bytes     = 0;
+	glm::vec3 bounds_min(std::numeric_limits<float>::max());
+	glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+	if (scene.meshes.empty())
+	{
+		bounds_min = bounds_max = glm::vec3(0.0f);
+	}
+
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+	{
+		const Mesh       &mesh    = *scene.meshes[i];
+		MeshCacheSubmesh &submesh = submeshes[i];
+
+		submesh.position_offset  = position_bytes;
+		submesh.attribute_offset = attribute_bytes;
+		submesh.index_offset     = index_bytes;
+		submesh.vertex_count     = mesh.vertex_count;
+		submesh.index_count      = mesh.index_count;
+		submesh.index_type       = static_cast<uint32_t>(mesh.index_type);
+		submesh.first_meshlet    = header.meshlet_count;
+		submesh.meshlet_count    = static_cast<uint32_t>(mesh.meshlets.size());
+		submesh.first_lod        = header.lod_count;
+		submesh.lod_count        = static_cast<uint32_t>(mesh.lods.size());
+		submesh.bounds_min       = glm::vec4(mesh.bounds_min, 0.0f);
+		submesh.bounds_max       = glm::vec4(mesh.bounds_max, 0.0f);
+		submesh.bounding_sphere  = glm::vec4(mesh.sphere_center, mesh.sphere_radius);
+
+		position_bytes  = align_16(position_bytes + position_data_size(mesh, vertex_format));
+		attribute_bytes = align_16(attribute_bytes + attribute_data_size(mesh, vertex_format));
+		index_bytes     = align_16(index_bytes + index_data_size(mesh));
+
+		header.meshlet_count += submesh.meshlet_count;
+		header.lod_count += submesh.lod_count;
+
+		bounds_min = glm::min(bounds_min, mesh.bounds_min);
+		bounds_max = glm::max(bounds_max, mesh.bounds_max);
+	}
+
+	header.bounds_min = glm::vec4(bounds_min, 0.0f);
+	header.bounds_max = glm::vec4(bounds_max, 0.0f);
+
+	header.submesh_table_offset    = align_16(sizeof(MeshCacheHeader));
+	header.material_table_offset   = align_16(header.submesh_table_offset + submeshes.size() * sizeof(MeshCacheSubmesh));
+	header.instance_table_offset   = align_16(header.material_table_offset + scene.materials.size() * sizeof(MeshCacheMaterial));
+	header.meshlet_table_offset    = align_16(header.instance_table_offset + scene.instance_count() * sizeof(MeshCacheInstance));
+	header.lod_table_offset        = align_16(header.meshlet_table_offset + uint64_t(header.meshlet_count) * sizeof(Meshlet));
+	header.position_stream_offset  = align_16(header.lod_table_offset + uint64_t(header.lod_count) * sizeof(MeshLod));
+	header.position_stream_size    = position_bytes;
+	header.attribute_stream_offset = header.position_stream_offset + position_bytes;
+	header.attribute_stream_size   = attribute_bytes;
+	header.index_stream_offset     = header.attribute_stream_offset + attribute_bytes;
+	header.index_stream_size       = index_bytes;
+
+	std::vector<uint8_t> blob(header.index_stream_offset + index_bytes, 0);
+
+	memcpy(blob.data(), &header, sizeof(header));
+	memcpy(blob.data() + header.submesh_table_offset, submeshes.data(), submeshes.size() * sizeof(MeshCacheSubmesh));
+
+	auto *materials = reinterpret_cast<MeshCacheMaterial *>(blob.data() + header.material_table_offset);
+	for (size_t i = 0; i < scene.materials.size(); i++)
+	{
+		const Material &material = scene.materials[i];
+		copy_string(materials[i].name, sizeof(materials[i].name), material.name);
+		copy_string(materials[i].diffuse_texture, sizeof(materials[i].diffuse_texture), material.diffuse_texture);
+		materials[i].base_color    = material.base_color;
+		materials[i].use_texture   = material.use_texture ? 1 : 0;
+		materials[i].pattern_scale = material.pattern_scale;
+	}
+
+	auto *instances = reinterpret_cast<MeshCacheInstance *>(blob.data() + header.instance_table_offset);
+	for (size_t i = 0; i < scene.instance_count(); i++)
+	{
+		instances[i].transform      = scene.transforms[i];
+		instances[i].mesh_index     = scene.mesh_indices[i];
+		instances[i].material_index = scene.material_indices[i];
+		instances[i].casts_shadow   = scene.casts_shadows[i];
+		instances[i].is_static      = scene.is_static[i];
+	}
+
+	auto *meshlets = reinterpret_cast<Meshlet *>(blob.data() + header.meshlet_table_offset);
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+	{
+		const std::vector<Meshlet> &mesh_meshlets = scene.meshes[i]->meshlets;
+		std::copy(mesh_meshlets.begin(), mesh_meshlets.end(), meshlets + submeshes[i].first_meshlet);
+	}
+
+	auto *lods = reinterpret_cast<MeshLod *>(blob.data() + header.lod_table_offset);
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+	{
+		const std::vector<MeshLod> &mesh_lods = scene.meshes[i]->lods;
+		std::copy(mesh_lods.begin(), mesh_lods.end(), lods + submeshes[i].first_lod);
+	}
+
+	for (size_t i = 0; i < scene.meshes.size(); i++)
+	{
+		write_vertex_data(*scene.meshes[i], vertex_format,
+		                  blob.data() + header.position_stream_offset + submeshes[i].position_offset,
+		                  blob.data() + header.attribute_stream_offset + submeshes[i].attribute_offset);
+		write_index_data(*scene.meshes[i], blob.data() + header.index_stream_offset + submeshes[i].index_offset);
+	}
+
+	// write next to the final name and swap it in so a half written blob is never picked up
+	const std::filesystem::path path(mesh_cache_path(source_path, import_flags, vertex_format));
+	const std::filesystem::path temp_path = path.string() + ".tmp";
+
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+		if (!out.write(reinterpret_cast<const char *>(blob.data()), static_cast<std::streamsize>(blob.size())))
+		{
+			std::cout << "Failed to write mesh cache " << temp_path.string() << "\n";
+			out.close();
+			std::filesystem::remove(temp_path, error);
+			return;
+		}
+	}
+
+	std::filesystem::rename(temp_path, path, error);
+	if (error)
+	{
+		std::cout << "Failed to write mesh cache " << path.string() << ": " << error.message() << "\n";
+		std::filesystem::remove(temp_path, error);
+	}
+}
+
+static bool in_file(const MappedFile &file, uint64_t offset, uint64_t size)
+{
+	return offset <= file.size() && size <= file.size() - offset;
+}
+
+static bool in_stream(uint64_t stream_size, uint64_t offset, uint64_t size)
+{
+	return offset <= stream_size && size <= stream_size - offset;
+}
+
+// every submesh's data inside its streams and every instance pointing at a submesh and material of this blob
+static bool tables_consistent(const MappedFile &file, const MeshCacheHeader &header, VertexFormat vertex_format)
+{
+	const uint64_t position_stride  = vertex_position_stride(vertex_format);
+	const uint64_t attribute_stride = vertex_attribute_stride(vertex_format);
+
+	const auto *submeshes = reinterpret_cast<const MeshCacheSubmesh *>(file.data() + header.submesh_table_offset);
+	for (uint32_t i = 0; i < header.submesh_count; i++)
+	{
+		const MeshCacheSubmesh &submesh = submeshes[i];
+		if (submesh.index_type != VK_INDEX_TYPE_UINT16 && submesh.index_type != VK_INDEX_TYPE_UINT32)
+		{
+			return false;
+		}
+
+		const uint64_t index_size = uint64_t(index_type_size(static_cast<VkIndexType>(submesh.index_type))) * submesh.index_count;
+		if (!in_stream(header.position_stream_size, submesh.position_offset, position_stride * submesh.vertex_count) ||
+		    !in_stream(header.attribute_stream_size, submesh.attribute_offset, attribute_stride * submesh.vertex_count) ||
+		    !in_stream(header.index_stream_size, submesh.index_offset, index_size))
+		{
+			return false;
+		}
+	}
+
+	const auto *instances = reinterpret_cast<const MeshCacheInstance *>(file.data() + header.instance_table_offset);
+	for (uint32_t i = 0; i < header.instance_count; i++)
+	{
+		if (instances[i].mesh_index >= header.submesh_count || instances[i].material_index >= header.material_count)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool read_mesh_cache(Scene &scene, MappedFile &file, const std::string &source_path, uint32_t import_flags, VertexFormat vertex_format)
+{
+	int64_t  mtime = 0;
+	uint64_t size  = 0;
+	if (!source_stamp(source_path, mtime, size) || !file.open(mesh_cache_path(source_path, import_flags, vertex_format)))
+	{
+		return false;
+	}
+
+	MeshCacheHeader header;
+	if (file.size() < sizeof(header))
+	{
+		file.close();
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+
+	const bool current = header.magic == MESH_CACHE_MAGIC &&
+	                     header.version == MESH_CACHE_VERSION &&
+	                     header.import_flags == import_flags &&
+	                     header.vertex_format == static_cast<uint32_t>(vertex_format) &&
+	                     header.source_hash == source_key(source_path, import_flags, vertex_format) &&
+	                     header.source_mtime == mtime &&
+	                     header.source_size == size;
+
+	const bool complete = in_file(file, header.submesh_table_offset, uint64_t(header.submesh_count) * sizeof(MeshCacheSubmesh)) &&
+	                      in_file(file, header.material_table_offset, uint64_t(header.material_count) * sizeof(MeshCacheMaterial)) &&
+	                      in_file(file, header.instance_table_offset, uint64_t(header.instance_count) * sizeof(MeshCacheInstance)) &&
+	                      in_file(file, header.meshlet_table_offset, uint64_t(header.meshlet_count) * sizeof(Meshlet)) &&
+	                      in_file(file, header.lod_table_offset, uint64_t(header.lod_count) * sizeof(MeshLod)) &&
+	                      in_file(file, header.position_stream_offset, header.position_stream_size) &&
+	                      in_file(file, header.attribute_stream_offset, header.attribute_stream_size) &&
+	                      in_file(file, header.index_stream_offset, header.index_stream_size);
+
+	if (!current || !complete || !tables_consistent(file, header, vertex_format))
+	{
+		file.close();
+		return false;
+	}
+
+	const uint32_t first_mesh     = static_cast<uint32_t>(scene.meshes.size());
+	const uint32_t first_material = static_cast<uint32_t>(scene.materials.size());
+
+	const auto *submeshes = reinterpret_cast<const MeshCacheSubmesh *>(file.data() + header.submesh_table_offset);
+	const auto *meshlets  = reinterpret_cast<const Meshlet *>(file.data() + header.meshlet_table_offset);
+	const auto *lods      = reinterpret_cast<const MeshLod *>(file.data() + header.lod_table_offset);
+	for (uint32_t i = 0; i < header.submesh_count; i++)
+	{
+		const MeshCacheSubmesh &submesh = submeshes[i];
+
+		Mesh *mesh          = new Mesh();
+		mesh->mesh_type     = MeshType::CUSTOM;
+		mesh->vertex_count  = submesh.vertex_count;
+		mesh->index_count   = submesh.index_count;
+		mesh->index_type    = static_cast<VkIndexType>(submesh.index_type);
+		mesh->bounds_min    = glm::vec3(submesh.bounds_min);
+		mesh->bounds_max    = glm::vec3(submesh.bounds_max);
+		mesh->sphere_center = glm::vec3(submesh.bounding_sphere);
+		mesh->sphere_radius = submesh.bounding_sphere.w;
+
+		if (uint64_t(submesh.first_meshlet) + submesh.meshlet_count <= header.meshlet_count)
+		{
+			mesh->meshlets.assign(meshlets + submesh.first_meshlet, meshlets + submesh.first_meshlet + submesh.meshlet_count);
+		}
+
+		if (uint64_t(submesh.first_lod) + submesh.lod_count <= header.lod_count)
+		{
+			mesh->lods.assign(lods + submesh.first_lod, lods + submesh.first_lod + submesh.lod_count);
+		}
+
+		// no per-vertex work, the streams go to staging as they are
+		mesh->packed_position_data  = file.data() + header.position_stream_offset + submesh.position_offset;
+		mesh->packed_attribute_data = file.data() + header.attribute_stream_offset + submesh.attribute_offset;
+		mesh->packed_index_data     = file.data() + header.index_stream_offset + submesh.index_offset;
+
+		scene.add_mesh(mesh);
+	}
+
+	const auto *materials = reinterpret_cast<const MeshCacheMaterial *>(file.data() + header.material_table_offset);
+	for (uint32_t i = 0; i < header.material_count; i++)
+	{
+		Material material;
+		material.name            = std::string(materials[i].name, strnlen(materials[i].name, sizeof(materials[i].name)));
+		material.diffuse_texture = std::string(materials[i].diffuse_texture, strnlen(materials[i].diffuse_texture, sizeof(materials[i].diffuse_texture)));
+		material.base_color      = materials[i].base_color;
+		material.use_texture     = materials[i].use_texture != 0;
+		material.pattern_scale   = materials[i].pattern_scale;
+		scene.add_material(material);
+	}
+
+	const auto *instances = reinterpret_cast<const MeshCacheInstance *>(file.data() + header.instance_table_offset);
+	for (uint32_t i = 0; i < header.instance_count; i++)
+	{
+		scene.add_instance(first_mesh + instances[i].mesh_index, first_material + instances[i].material_index,
+		                   instances[i].transform, instances[i].casts_shadow != 0, instances[i].is_static != 0);
+	}
+
+	return true;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,131 @@
+//
+// Created by rfdic on 9/10/2024.
+//
+
+#ifndef TOYRENDERER_MESH_CACHE_HPP
+#define TOYRENDERER_MESH_CACHE_HPP
+
+#include "common.hpp"
+#include "vertex_format.hpp"
+
+namespace obsidian
+{
+
+struct Scene;
+
+constexpr uint32_t MESH_CACHE_MAGIC   = 0x434D424F;        // "OBMC"
+constexpr uint32_t MESH_CACHE_VERSION = 8;        // 8: static flag per instance
+
+// On-disk layout of a cooked scene. Every table and stream starts on a 16 byte
+// boundary and the streams hold exactly what the geometry pool uploads.
+struct MeshCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t import_flags;
+	uint32_t submesh_count;
+	uint32_t material_count;
+	uint32_t instance_count;
+	uint32_t meshlet_count;
+	uint32_t vertex_format;
+	uint32_t lod_count;
+	uint32_t padding;
+	uint64_t source_hash;        // hash of the source path, import flags and vertex format
+	int64_t  source_mtime;
+	uint64_t source_size;
+
+	uint64_t submesh_table_offset;
+	uint64_t material_table_offset;
+	uint64_t instance_table_offset;
+	uint64_t meshlet_table_offset;
+	uint64_t lod_table_offset;
+	uint64_t position_stream_offset;
+	uint64_t position_stream_size;
+	uint64_t attribute_stream_offset;
+	uint64_t attribute_stream_size;
+	uint64_t index_stream_offset;
+	uint64_t index_stream_size;
+
+	glm::vec4 bounds_min;
+	glm::vec4 bounds_max;
+};
+
+struct MeshCacheSubmesh
+{
+	uint64_t  position_offset;         // bytes into the position stream
+	uint64_t  attribute_offset;        // bytes into the attribute stream
+	uint64_t  index_offset;            // bytes into the index stream
+	uint32_t  vertex_count;
+	uint32_t  index_count;
+	uint32_t  index_type;
+	uint32_t  first_meshlet;           // into the meshlet table
+	uint32_t  meshlet_count;
+	uint32_t  first_lod;               // into the lod table
+	uint32_t  lod_count;
+	uint32_t  padding;
+	glm::vec4 bounds_min;
+	glm::vec4 bounds_max;
+	glm::vec4 bounding_sphere;         // center, radius
+};
+
+struct MeshCacheMaterial
+{
+	char      name[64];
+	char      diffuse_texture[176];
+	glm::vec4 base_color;
+	uint32_t  use_texture;
+	float     pattern_scale;
+	uint32_t  padding[2];
+};
+
+struct MeshCacheInstance
+{
+	glm::mat4 transform;
+	uint32_t  mesh_index;
+	uint32_t  material_index;
+	uint32_t  casts_shadow;
+	uint32_t  is_static;
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+  public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile &)            = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	bool open(const std::string &path);
+	void close();
+
+	const uint8_t *data() const;
+	size_t         size() const;
+
+  private:
+	const uint8_t *mapped      = nullptr;
+	size_t         mapped_size = 0;
+#ifdef _WIN32
+	void *file    = nullptr;
+	void *mapping = nullptr;
+#endif
+};
+
+// where the cooked blob for a source file lives
+std::string mesh_cache_path(const std::string &source_path, uint32_t import_flags, VertexFormat vertex_format);
+
+// write the scene's meshes, materials and instances as a cooked blob for source_path,
+// the scene must hold nothing but what was imported from that file. Failures are
+// logged and leave no blob behind, the next run imports again.
+void write_mesh_cache(const Scene &scene, const std::string &source_path, uint32_t import_flags, VertexFormat vertex_format);
+
+// Map the cooked blob and fill the scene from it. Meshes point their packed data
+// straight into the mapping, so it has to stay open until they are uploaded.
+// Returns false, without touching the scene, if there is no blob or it is stale
+// or inconsistent.
+bool read_mesh_cache(Scene &scene, MappedFile &file, const std::string &source_path, uint32_t import_flags, VertexFormat vertex_format);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_MESH_CACHE_HPP
@@ -0,0 +1,747 @@
+//
+// Created by rfdic on 9/12/2024.
+//
+
+#include "mesh_optimizer.hpp"
+
+#include "mesh.hpp"
+
+namespace obsidian
+{
+
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size)
+{
+	VertexCacheStats stats = {};
+	if (indices.empty())
+	{
+		return stats;
+	}
+
+	// a vertex is in the cache while fewer than cache_size misses happened after it was loaded
+	std::vector<uint32_t> loaded_at(vertex_count, 0);
+	std::vector<uint8_t>  referenced(vertex_count, 0);
+	uint32_t              misses = 0;
+	size_t                unique = 0;
+
+	for (uint32_t index : indices)
+	{
+		if (!referenced[index] || misses - loaded_at[index] >= cache_size)
+		{
+			misses++;
+			loaded_at[index] = misses;
+		}
+
+		if (!referenced[index])
+		{
+			referenced[index] = 1;
+			unique++;
+		}
+	}
+
+	stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+	stats.atvr = static_cast<float>(misses) / static_cast<float>(unique);
+	return stats;
+}
+
+std::vector<uint32_t> optimize_vertex_cache(std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size)
+{
+	std::vector<uint32_t> clusters;
+	const size_t          triangle_count = indices.size() / 3;
+	if (triangle_count == 0)
+	{
+		return clusters;
+	}
+
+	// vertex -> triangle adjacency in one flat array
+	std::vector<uint32_t> live(vertex_count, 0);
+	for (uint32_t index : indices)
+	{
+		live[index]++;
+	}
+
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		adjacency_offsets[v + 1] = adjacency_offsets[v] + live[v];
+	}
+
+	std::vector<uint32_t> adjacency(indices.size());
+	{
+		std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	std::vector<uint32_t> cache_time(vertex_count, 0);
+	std::vector<uint8_t>  emitted(triangle_count, 0);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+
+	uint32_t time   = cache_size + 1;
+	size_t   cursor = 0;
+
+	auto skip_dead_end = [&]() -> int64_t {
+		while (!dead_end.empty())
+		{
+			const uint32_t v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0)
+			{
+				return v;
+			}
+		}
+
+		while (cursor < vertex_count)
+		{
+			if (live[cursor] > 0)
+			{
+				return static_cast<int64_t>(cursor);
+			}
+			cursor++;
+		}
+
+		return -1;
+	};
+
+	int64_t fanning = skip_dead_end();
+	clusters.push_back(0);
+
+	while (fanning >= 0)
+	{
+		candidates.clear();
+
+		for (uint32_t a = adjacency_offsets[fanning]; a < adjacency_offsets[fanning + 1]; a++)
+		{
+			const uint32_t triangle = adjacency[a];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+
+			for (uint32_t corner = 0; corner < 3; corner++)
+			{
+				const uint32_t v = indices[triangle * 3 + corner];
+				output.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+
+				if (time - cache_time[v] > cache_size)
+				{
+					cache_time[v] = time++;
+				}
+			}
+
+			emitted[triangle] = 1;
+		}
+
+		// prefer the candidate that stays in the cache longest while still having triangles to emit
+		int64_t best          = -1;
+		int64_t best_priority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (live[v] == 0)
+			{
+				continue;
+			}
+
+			int64_t priority = 0;
+			if (time - cache_time[v] + 2 * live[v] <= cache_size)
+			{
+				priority = time - cache_time[v];
+			}
+
+			if (priority > best_priority)
+			{
+				best          = v;
+				best_priority = priority;
+			}
+		}
+
+		if (best < 0)
+		{
+			// nothing left around the current fan, the walk restarts somewhere else
+			best = skip_dead_end();
+			if (best >= 0)
+			{
+				clusters.push_back(static_cast<uint32_t>(output.size() / 3));
+			}
+		}
+
+		fanning = best;
+	}
+
+	indices.swap(output);
+	return clusters;
+}
+
+void optimize_overdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &clusters)
+{
+	const uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+	if (clusters.size() < 2)
+	{
+		return;
+	}
+
+	auto triangle_normal = [&](uint32_t triangle, glm::vec3 &centroid) {
+		const glm::vec3 &a = vertices[indices[triangle * 3 + 0]].pos;
+		const glm::vec3 &b = vertices[indices[triangle * 3 + 1]].pos;
+		const glm::vec3 &c = vertices[indices[triangle * 3 + 2]].pos;
+		centroid           = (a + b + c) / 3.0f;
+		return glm::cross(b - a, c - a);        // length is twice the area
+	};
+
+	glm::vec3 mesh_centroid(0.0f);
+	float     mesh_area = 0.0f;
+	for (uint32_t t = 0; t < triangle_count; t++)
+	{
+		glm::vec3   centroid;
+		const float area = glm::length(triangle_normal(t, centroid));
+		mesh_centroid += centroid * area;
+		mesh_area += area;
+	}
+	mesh_centroid = mesh_area > 0.0f ? mesh_centroid / mesh_area : glm::vec3(0.0f);
+
+	struct ClusterKey
+	{
+		uint32_t begin;
+		uint32_t end;
+		float    sort_key;
+	};
+
+	std::vector<ClusterKey> keys(clusters.size());
+	for (size_t i = 0; i < clusters.size(); i++)
+	{
+		const uint32_t begin = clusters[i];
+		const uint32_t end   = i + 1 < clusters.size() ? clusters[i + 1] : triangle_count;
+
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float     area = 0.0f;
+		for (uint32_t t = begin; t < end; t++)
+		{
+			glm::vec3       triangle_centroid;
+			const glm::vec3 n = triangle_normal(t, triangle_centroid);
+			const float     a = glm::length(n);
+			centroid += triangle_centroid * a;
+			normal += n;
+			area += a;
+		}
+
+		centroid = area > 0.0f ? centroid / area : centroid;
+
+		// clusters far out along their own normal tend to occlude the rest
+		const float normal_length = glm::length(normal);
+		const float key           = normal_length > 0.0f ? glm::dot(centroid - mesh_centroid, normal / normal_length) : 0.0f;
+
+		keys[i] = {begin, end, key};
+	}
+
+	std::stable_sort(keys.begin(), keys.end(), [](const ClusterKey &a, const ClusterKey &b) {
+		return a.sort_key > b.sort_key;
+	});
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for (const ClusterKey &key : keys)
+	{
+		sorted.insert(sorted.end(), indices.begin() + key.begin * 3, indices.begin() + key.end * 3);
+	}
+
+	indices.swap(sorted);
+}
+
+void optimize_vertex_fetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+	constexpr uint32_t UNUSED = ~0u;
+
+	std::vector<uint32_t> remap(vertices.size(), UNUSED);
+	std::vector<Vertex>   reordered;
+	reordered.reserve(vertices.size());
+
+	for (uint32_t &index : indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = static_cast<uint32_t>(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+
+		index = remap[index];
+	}
+
+	vertices.swap(reordered);
+}
+
+void optimize_mesh(Mesh &mesh)
+{
+	if (mesh.indices.size() < 3)
+	{
+		return;
+	}
+
+	const VertexCacheStats before = analyze_vertex_cache(mesh.indices, mesh.vertices.size());
+
+	const std::vector<uint32_t> clusters = optimize_vertex_cache(mesh.indices, mesh.vertices.size());
+	optimize_overdraw(mesh.indices, mesh.vertices, clusters);
+	optimize_vertex_fetch(mesh.vertices, mesh.indices);
+
+	mesh.vertex_count = static_cast<uint32_t>(mesh.vertices.size());
+	mesh.index_count  = static_cast<uint32_t>(mesh.indices.size());
+
+	const VertexCacheStats after = analyze_vertex_cache(mesh.indices, mesh.vertices.size());
+
+	std::cout << "Vertex cache: ACMR " << before.acmr << " -> " << after.acmr
+	          << ", ATVR " << before.atvr << " -> " << after.atvr
+	          << " (" << clusters.size() << " clusters)" << std::endl;
+}
+
+static Meshlet finish_meshlet(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, uint32_t first_index, uint32_t index_count)
+{
+	Meshlet meshlet     = {};
+	meshlet.first_index = first_index;
+	meshlet.index_count = index_count;
+
+	// sphere around the centroid, loose but cheap and good enough for culling
+	glm::vec3 centroid(0.0f);
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		centroid += vertices[indices[first_index + i]].pos;
+	}
+	centroid /= static_cast<float>(index_count);
+
+	float radius = 0.0f;
+	for (uint32_t i = 0; i < index_count; i++)
+	{
+		radius = std::max(radius, glm::length(vertices[indices[first_index + i]].pos - centroid));
+	}
+
+	meshlet.center = centroid;
+	meshlet.radius = radius;
+
+	// normal cone from the face normals
+	std::vector<glm::vec3> normals;
+	normals.reserve(index_count / 3);
+
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i < index_count; i += 3)
+	{
+		const glm::vec3 &a = vertices[indices[first_index + i + 0]].pos;
+		const glm::vec3 &b = vertices[indices[first_index + i + 1]].pos;
+		const glm::vec3 &c = vertices[indices[first_index + i + 2]].pos;
+
+		const glm::vec3 n      = glm::cross(b - a, c - a);
+		const float     length = glm::length(n);
+		if (length > 0.0f)
+		{
+			normals.push_back(n / length);
+			axis += n / length;
+		}
+	}
+
+	meshlet.cone_axis   = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.cone_cutoff = 1.0f;
+
+	const float axis_length = glm::length(axis);
+	if (axis_length == 0.0f)
+	{
+		return meshlet;
+	}
+	axis /= axis_length;
+
+	float min_dot = 1.0f;
+	for (const glm::vec3 &n : normals)
+	{
+		min_dot = std::min(min_dot, glm::dot(axis, n));
+	}
+
+	// a cone wider than a hemisphere can never be entirely backfacing
+	meshlet.cone_axis = axis;
+	if (min_dot > 0.0f)
+	{
+		meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+	}
+
+	return meshlet;
+}
+
+std::vector<Meshlet> build_meshlets(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+{
+	std::vector<Meshlet> meshlets;
+	if (indices.size() < 3)
+	{
+		return meshlets;
+	}
+
+	// vertex -> id of the meshlet that last used it, avoids clearing a set per meshlet
+	std::vector<uint32_t> used_by(vertices.size(), ~0u);
+	uint32_t              meshlet_id   = 0;
+	uint32_t              vertex_count = 0;
+	uint32_t              first_index  = 0;
+
+	for (uint32_t i = 0; i < indices.size(); i += 3)
+	{
+		uint32_t new_vertices = 0;
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			new_vertices += used_by[indices[i + corner]] != meshlet_id ? 1 : 0;
+		}
+
+		const uint32_t triangle_count = (i - first_index) / 3;
+		if (vertex_count + new_vertices > MESHLET_MAX_VERTICES || triangle_count + 1 > MESHLET_MAX_TRIANGLES)
+		{
+			meshlets.push_back(finish_meshlet(vertices, indices, first_index, i - first_index));
+
+			meshlet_id++;
+			vertex_count = 0;
+			first_index  = i;
+		}
+
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			if (used_by[indices[i + corner]] != meshlet_id)
+			{
+				used_by[indices[i + corner]] = meshlet_id;
+				vertex_count++;
+			}
+		}
+	}
+
+	meshlets.push_back(finish_meshlet(vertices, indices, first_index, static_cast<uint32_t>(indices.size()) - first_index));
+
+	return meshlets;
+}
+
+// symmetric 4x4 matrix, upper triangle
+struct Quadric
+{
+	double a00, a01, a02, a03;
+	double a11, a12, a13;
+	double a22, a23;
+	double a33;
+};
+
+static void quadric_add_plane(Quadric &q, const glm::dvec3 &n, double d)
+{
+	q.a00 += n.x * n.x;
+	q.a01 += n.x * n.y;
+	q.a02 += n.x * n.z;
+	q.a03 += n.x * d;
+	q.a11 += n.y * n.y;
+	q.a12 += n.y * n.z;
+	q.a13 += n.y * d;
+	q.a22 += n.z * n.z;
+	q.a23 += n.z * d;
+	q.a33 += d * d;
+}
+
+static void quadric_add(Quadric &q, const Quadric &o)
+{
+	q.a00 += o.a00;
+	q.a01 += o.a01;
+	q.a02 += o.a02;
+	q.a03 += o.a03;
+	q.a11 += o.a11;
+	q.a12 += o.a12;
+	q.a13 += o.a13;
+	q.a22 += o.a22;
+	q.a23 += o.a23;
+	q.a33 += o.a33;
+}
+
+// sum of squared distances of v to the planes accumulated in q
+static double quadric_error(const Quadric &q, const glm::dvec3 &v)
+{
+	return q.a00 * v.x * v.x + 2.0 * q.a01 * v.x * v.y + 2.0 * q.a02 * v.x * v.z + 2.0 * q.a03 * v.x +
+	       q.a11 * v.y * v.y + 2.0 * q.a12 * v.y * v.z + 2.0 * q.a13 * v.y +
+	       q.a22 * v.z * v.z + 2.0 * q.a23 * v.z +
+	       q.a33;
+}
+
+static uint64_t edge_key(uint32_t a, uint32_t b)
+{
+	return a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+}
+
+std::vector<uint32_t> simplify_mesh(const std::vector<Vertex>   &vertices,
+                                    const std::vector<uint32_t> &indices,
+                                    size_t                       target_index_count,
+                                    float                       &error)
+{
+	std::vector<uint32_t> result       = indices;
+	const size_t          vertex_count = vertices.size();
+	double                max_cost     = 0.0;
+
+	error = 0.0f;
+
+	// vertices split along uv or normal seams share a position, weld them to find the real topology
+	std::vector<uint32_t> welded(vertex_count);
+	std::vector<uint8_t>  locked(vertex_count, 0);
+	{
+		std::map<std::array<float, 3>, uint32_t> first_at;
+		for (uint32_t v = 0; v < vertex_count; v++)
+		{
+			const glm::vec3 &p = vertices[v].pos;
+
+			auto [it, inserted] = first_at.try_emplace({p.x, p.y, p.z}, v);
+			welded[v]           = it->second;
+
+			// moving one copy of a seam vertex would tear the seam open
+			if (!inserted)
+			{
+				locked[v]          = 1;
+				locked[it->second] = 1;
+			}
+		}
+	}
+
+	// edges used by a single triangle are on the border, more than two is non-manifold
+	{
+		std::unordered_map<uint64_t, uint32_t> edge_use;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (uint32_t e = 0; e < 3; e++)
+			{
+				edge_use[edge_key(welded[result[i + e]], welded[result[i + (e + 1) % 3]])]++;
+			}
+		}
+
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (uint32_t e = 0; e < 3; e++)
+			{
+				const uint32_t a = result[i + e];
+				const uint32_t b = result[i + (e + 1) % 3];
+				if (edge_use[edge_key(welded[a], welded[b])] != 2)
+				{
+					locked[a] = 1;
+					locked[b] = 1;
+				}
+			}
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertex_count, Quadric{});
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const glm::dvec3 a(vertices[result[i + 0]].pos);
+		const glm::dvec3 b(vertices[result[i + 1]].pos);
+		const glm::dvec3 c(vertices[result[i + 2]].pos);
+
+		glm::dvec3   n      = glm::cross(b - a, c - a);
+		const double length = glm::length(n);
+		if (length == 0.0)
+		{
+			continue;
+		}
+		n /= length;
+
+		for (uint32_t corner = 0; corner < 3; corner++)
+		{
+			quadric_add_plane(quadrics[result[i + corner]], n, -glm::dot(n, a));
+		}
+	}
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double   cost;
+	};
+
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<uint8_t>  touched(vertex_count);
+
+	while (result.size() > target_index_count)
+	{
+		// vertex -> triangle adjacency of the current result
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+		for (uint32_t index : result)
+		{
+			adjacency_offsets[index + 1]++;
+		}
+		for (size_t v = 0; v < vertex_count; v++)
+		{
+			adjacency_offsets[v + 1] += adjacency_offsets[v];
+		}
+
+		adjacency.resize(result.size());
+		{
+			std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+			for (size_t i = 0; i < result.size(); i++)
+			{
+				adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (uint32_t e = 0; e < 3; e++)
+			{
+				const uint32_t a = result[i + e];
+				const uint32_t b = result[i + (e + 1) % 3];
+
+				Quadric q = quadrics[a];
+				quadric_add(q, quadrics[b]);
+
+				if (!locked[a])
+				{
+					collapses.push_back({a, b, quadric_error(q, glm::dvec3(vertices[b].pos))});
+				}
+				if (!locked[b])
+				{
+					collapses.push_back({b, a, quadric_error(q, glm::dvec3(vertices[a].pos))});
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) {
+			return x.cost < y.cost;
+		});
+
+		// every collapse removes about two triangles, stop once the target is in reach
+		const size_t wanted = (result.size() - target_index_count) / 6 + 1;
+		size_t       done   = 0;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for (const Collapse &collapse : collapses)
+		{
+			if (done >= wanted)
+			{
+				break;
+			}
+
+			if (touched[collapse.from] || touched[collapse.to])
+			{
+				continue;
+			}
+
+			// reject collapses that would flip a surviving triangle around the moved vertex
+			const glm::vec3 &target  = vertices[collapse.to].pos;
+			bool             flipped = false;
+			for (uint32_t t = adjacency_offsets[collapse.from]; t < adjacency_offsets[collapse.from + 1] && !flipped; t++)
+			{
+				const uint32_t *tri = &result[adjacency[t] * 3];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to)
+				{
+					continue;
+				}
+
+				glm::vec3 p[3];
+				glm::vec3 q[3];
+				for (uint32_t corner = 0; corner < 3; corner++)
+				{
+					p[corner] = vertices[tri[corner]].pos;
+					q[corner] = tri[corner] == collapse.from ? target : p[corner];
+				}
+
+				const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				const glm::vec3 after  = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flipped                = glm::dot(before, after) <= 0.0f;
+			}
+
+			if (flipped)
+			{
+				continue;
+			}
+
+			for (uint32_t t = adjacency_offsets[collapse.from]; t < adjacency_offsets[collapse.from + 1]; t++)
+			{
+				uint32_t *tri = &result[adjacency[t] * 3];
+				for (uint32_t corner = 0; corner < 3; corner++)
+				{
+					if (tri[corner] == collapse.from)
+					{
+						tri[corner] = collapse.to;
+					}
+					touched[tri[corner]] = 1;
+				}
+			}
+
+			touched[collapse.from] = 1;
+			quadric_add(quadrics[collapse.to], quadrics[collapse.from]);
+			max_cost = std::max(max_cost, collapse.cost);
+			done++;
+		}
+
+		if (done == 0)
+		{
+			break;
+		}
+
+		// drop the triangles that collapsed to lines
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			const uint32_t a = result[i + 0];
+			const uint32_t b = result[i + 1];
+			const uint32_t c = result[i + 2];
+			if (a != b && b != c && c != a)
+			{
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	error = static_cast<float>(std::sqrt(std::max(max_cost, 0.0)));
+	return result;
+}
+
+void build_lods(Mesh &mesh, const std::vector<float> &ratios)
+{
+	const uint32_t base_count = static_cast<uint32_t>(mesh.indices.size());
+
+	mesh.lods.clear();
+	mesh.lods.push_back({0, base_count, 0.0f});
+
+	std::vector<uint32_t> source(mesh.indices.begin(), mesh.indices.end());
+	float                 error = 0.0f;
+
+	std::cout << "LODs: " << base_count / 3;
+
+	for (float ratio : ratios)
+	{
+		const size_t target = static_cast<size_t>(base_count * ratio) / 3 * 3;
+		if (target < 3)
+		{
+			break;
+		}
+
+		float                 lod_error = 0.0f;
+		std::vector<uint32_t> lod       = simplify_mesh(mesh.vertices, source, target, lod_error);
+
+		// locked borders and seams stop the collapse, a level barely smaller than the last is not worth it
+		if (lod.empty() || lod.size() > source.size() * 9 / 10)
+		{
+			break;
+		}
+
+		optimize_vertex_cache(lod, mesh.vertices.size());
+
+		// each level is simplified from the previous one, so the errors add up
+		error += lod_error;
+
+		mesh.lods.push_back({static_cast<uint32_t>(mesh.indices.size()), static_cast<uint32_t>(lod.size()), error});
+		mesh.indices.insert(mesh.indices.end(), lod.begin(), lod.end());
+
+		std::cout << " / " << lod.size() / 3;
+
+		source.swap(lod);
+	}
+
+	std::cout << " triangles" << std::endl;
+
+	mesh.index_count = static_cast<uint32_t>(mesh.indices.size());
+}
+
+}        // namespace obsidian
@@ -0,0 +1,58 @@
+//
+// Created by rfdic on 9/12/2024.
+//
+
+#ifndef TOYRENDERER_MESH_OPTIMIZER_HPP
+#define TOYRENDERER_MESH_OPTIMIZER_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+struct Mesh;
+struct Meshlet;
+
+constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats
+{
+	float acmr;        // vertex shader invocations per triangle
+	float atvr;        // vertex shader invocations per referenced vertex
+};
+
+// simulate a FIFO post-transform cache over the index stream
+VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+// Tipsify triangle reordering (Sander, Nehab, Barczak 2007). Returns the first
+// triangle of every cluster the fan walk had to restart at, for the overdraw pass.
+std::vector<uint32_t> optimize_vertex_cache(std::vector<uint32_t> &indices, size_t vertex_count, uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+// sort the clusters so outward facing ones on the hull are drawn first
+void optimize_overdraw(std::vector<uint32_t> &indices, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &clusters);
+
+// renumber vertices in first use order and drop unreferenced ones
+void optimize_vertex_fetch(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+// all of the above, printing the cache stats before and after
+void optimize_mesh(Mesh &mesh);
+
+// Quadric error metric edge collapse onto existing vertices, so the result
+// indexes the same vertex buffer. Border and seam vertices never move. Stops at
+// target_index_count or when nothing can collapse; error receives the largest
+// deviation introduced, in object space.
+std::vector<uint32_t> simplify_mesh(const std::vector<Vertex>   &vertices,
+                                    const std::vector<uint32_t> &indices,
+                                    size_t                       target_index_count,
+                                    float                       &error);
+
+// append simplified levels at the given fractions of the base triangle count to the mesh's index list
+void build_lods(Mesh &mesh, const std::vector<float> &ratios = {0.5f, 0.25f, 0.125f});
+
+// Split the index list, in its current order, into meshlets. Run after
+// optimize_mesh so the clusters inherit its locality.
+std::vector<Meshlet> build_meshlets(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_MESH_OPTIMIZER_HPP
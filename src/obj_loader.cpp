@@ -5,6 +5,9 @@
 #include "obj_loader.hpp"
 
 #include <mesh.hpp>
+#include "scene.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -13,50 +16,172 @@
 namespace obsidian
 {
 
-Mesh create_from_obj(const std::string &file_path)
+// tangents are not used by any pass, so aiProcess_CalcTangentSpace is left out
+static constexpr uint32_t IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+static Mesh *convert_mesh(const aiMesh *ai_mesh)
 {
-	Assimp::Importer importer;
-	const aiScene   *scene = importer.ReadFile(file_path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+	Mesh *mesh = new Mesh();
+	mesh->mesh_type = MeshType::CUSTOM;
+
+	mesh->vertex_count = ai_mesh->mNumVertices;
+	mesh->vertices.resize(mesh->vertex_count);
+
+	const bool has_normals    = ai_mesh->HasNormals();
+	const bool has_tex_coords = ai_mesh->HasTextureCoords(0);
+	const bool has_colors     = ai_mesh->HasVertexColors(0);
+
+	for (unsigned int i = 0; i < mesh->vertex_count; ++i) {
+		Vertex &vertex = mesh->vertices[i];
+		vertex.pos = {ai_mesh->mVertices[i].x, ai_mesh->mVertices[i].y, ai_mesh->mVertices[i].z};
+		vertex.color = has_colors ? glm::vec3(ai_mesh->mColors[0][i].r, ai_mesh->mColors[0][i].g, ai_mesh->mColors[0][i].b) : glm::vec3(1.0f);
+		vertex.tex_coord = has_tex_coords ? glm::vec2(ai_mesh->mTextureCoords[0][i].x, ai_mesh->mTextureCoords[0][i].y) : glm::vec2(0.0f);
+		vertex.normal = has_normals ? glm::vec3(ai_mesh->mNormals[i].x, ai_mesh->mNormals[i].y, ai_mesh->mNormals[i].z) : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+
+	mesh->indices.reserve(ai_mesh->mNumFaces * 3);
+
+	for (unsigned int i = 0; i < ai_mesh->mNumFaces; i++) {
+		const aiFace &face = ai_mesh->mFaces[i];
+		for (unsigned int j = 0; j < face.mNumIndices; j++) {
+			mesh->indices.push_back(face.mIndices[j]);
+		}
+	}
+
+	mesh->index_count = static_cast<uint32_t>(mesh->indices.size());
+
+	// runs once per import, the cooked blob keeps the optimized order, the meshlets and the lod chain
+	optimize_mesh(*mesh);
+	mesh->meshlets = build_meshlets(mesh->vertices, mesh->indices);
+	build_lods(*mesh);
+
+	// 16-bit indices when every vertex is addressable, otherwise keep the full width
+	mesh->index_type = select_index_type(mesh->vertex_count);
+	compute_bounds(*mesh);
+
+	return mesh;
+}
+
+static Material convert_material(const aiMaterial *ai_material)
+{
+	Material material;
+	material.name = ai_material->GetName().C_Str();
+
+	aiColor4D diffuse;
+	if (aiGetMaterialColor(ai_material, AI_MATKEY_COLOR_DIFFUSE, &diffuse) == AI_SUCCESS)
+	{
+		material.base_color = {diffuse.r, diffuse.g, diffuse.b, diffuse.a};
+	}
+
+	aiString texture_path;
+	if (ai_material->GetTexture(aiTextureType_DIFFUSE, 0, &texture_path) == AI_SUCCESS)
+	{
+		material.diffuse_texture = texture_path.C_Str();
+	}
+
+	return material;
+}
+
+static glm::mat4 to_glm(const aiMatrix4x4 &m)
+{
+	// assimp matrices are row major, glm takes columns
+	return glm::mat4(m.a1, m.b1, m.c1, m.d1,
+	                 m.a2, m.b2, m.c2, m.d2,
+	                 m.a3, m.b3, m.c3, m.d3,
+	                 m.a4, m.b4, m.c4, m.d4);
+}
+
+static void add_node_instances(Scene &scene, const aiScene *ai_scene, const aiNode *node, const glm::mat4 &parent,
+                               uint32_t first_mesh, uint32_t first_material)
+{
+	const glm::mat4 world = parent * to_glm(node->mTransformation);
+
+	// every node that references a mesh becomes an instance of the shared mesh
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+	{
+		const uint32_t ai_index = node->mMeshes[i];
+		scene.add_instance(first_mesh + ai_index, first_material + ai_scene->mMeshes[ai_index]->mMaterialIndex, world);
+	}
+
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+	{
+		add_node_instances(scene, ai_scene, node->mChildren[i], world, first_mesh, first_material);
+	}
+}
+
+static const aiScene *read_scene(Assimp::Importer &importer, const std::string &file_path)
+{
+	const aiScene *scene = importer.ReadFile(file_path, IMPORT_FLAGS);
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 	{
 		std::cerr << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
+		throw std::runtime_error("failed to load " + file_path + "!");
 	}
 
-	Mesh mesh;
+	return scene;
+}
 
-	// assiming the mesh contains only one mesh in the scene
-	aiMesh *ai_mesh = scene->mMeshes[0];
+void load_scene(Scene &scene, const std::string &file_path)
+{
+	Assimp::Importer importer;
+	const aiScene   *ai_scene = read_scene(importer, file_path);
 
-	mesh.vertex_count = ai_mesh->mNumVertices;
-	mesh.vertices.resize(mesh.vertex_count);
+	const uint32_t first_mesh     = static_cast<uint32_t>(scene.meshes.size());
+	const uint32_t first_material = static_cast<uint32_t>(scene.materials.size());
 
-	for (unsigned int i = 0; i < mesh.vertex_count; ++i) {
-		mesh.vertices[i].pos = {ai_mesh->mVertices[i].x, ai_mesh->mVertices[i].y, ai_mesh->mVertices[i].z};
-		mesh.vertices[i].normal = {ai_mesh->mNormals[i].x, ai_mesh->mNormals[i].y, ai_mesh->mNormals[i].z};
-		mesh.vertices[i].tex_coord = {ai_mesh->mTextureCoords[0][i].x, ai_mesh->mTextureCoords[0][i].y};
-		mesh.vertices[i].normal = {ai_mesh->mNormals[i].x, ai_mesh->mNormals[i].y, ai_mesh->mNormals[i].z};
+	// meshes and materials keep assimp's indices, offset by what the scene already holds
+	for (unsigned int i = 0; i < ai_scene->mNumMeshes; i++)
+	{
+		scene.add_mesh(convert_mesh(ai_scene->mMeshes[i]));
 	}
 
-	mesh.index_count = ai_mesh->mNumFaces * 3;
-	mesh.indices.reserve(mesh.index_count);
+	for (unsigned int i = 0; i < ai_scene->mNumMaterials; i++)
+	{
+		scene.add_material(convert_material(ai_scene->mMaterials[i]));
+	}
 
-	for (unsigned int i = 0; i < ai_mesh->mNumFaces; i++) {
-		aiFace face = ai_mesh->mFaces[i];
-		for (unsigned int j = 0; j < face.mNumIndices; j++) {
-			mesh.indices.push_back(face.mIndices[j]);
-		}
+	const size_t first_instance = scene.instance_count();
+	add_node_instances(scene, ai_scene, ai_scene->mRootNode, glm::mat4(1.0f), first_mesh, first_material);
+
+	// show the scene stats
+	std::cout << file_path << ": " << ai_scene->mNumMeshes << " meshes, "
+	          << ai_scene->mNumMaterials << " materials, "
+	          << scene.instance_count() - first_instance << " instances" << std::endl;
+}
+
+void load_scene_cached(Scene &scene, MappedFile &file, const std::string &file_path, VertexFormat vertex_format)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	if (read_mesh_cache(scene, file, file_path, IMPORT_FLAGS, vertex_format))
+	{
+		const auto elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << file_path << ": loaded from mesh cache in " << elapsed << " ms" << std::endl;
+		return;
 	}
 
-	// show the mesh stats
-	std::cout << "Vertices: " << mesh.vertex_count << std::endl;
-    std::cout << "Indices: " << mesh.index_count << std::endl;
+	// first run or the source changed, import and cook a fresh blob for next time
+	load_scene(scene, file_path);
+	write_mesh_cache(scene, file_path, IMPORT_FLAGS, vertex_format);
 
-    // free the assimp resources
-    importer.FreeScene();
-    return mesh;
+	const auto elapsed = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << file_path << ": imported and cooked in " << elapsed << " ms" << std::endl;
+}
+
+Mesh *create_from_obj(const std::string &file_path)
+{
+	Assimp::Importer importer;
+	const aiScene   *scene = read_scene(importer, file_path);
+
+	// only the first mesh, use load_scene for anything with more than one part
+	Mesh *mesh = convert_mesh(scene->mMeshes[0]);
+
+	// show the mesh stats
+	std::cout << "Vertices: " << mesh->vertex_count << std::endl;
+	std::cout << "Indices: " << mesh->index_count << (mesh->index_type == VK_INDEX_TYPE_UINT32 ? " (32-bit)" : " (16-bit)") << std::endl;
 
 	return mesh;
 }
 
-}
\ No newline at end of file
+}
@@ -9,7 +9,17 @@
 
 namespace obsidian {
 
-Mesh create_from_obj(const std::string& filename);
+struct Scene;
+class MappedFile;
+
+// import every mesh, material and node instance of the file into the scene
+void load_scene(Scene &scene, const std::string &file_path);
+
+// Same as load_scene but goes through the binary mesh cache, cooked for the given
+// vertex format. The meshes may point into the mapped file, keep it open until they are uploaded.
+void load_scene_cached(Scene &scene, MappedFile &file, const std::string &file_path, VertexFormat vertex_format);
+
+Mesh *create_from_obj(const std::string& filename);
 
 }
 
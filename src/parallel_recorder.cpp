@@ -0,0 +1,226 @@
+//
+// Created by rfdic on 9/28/2024.
+//
+
+#include "parallel_recorder.hpp"
+
+#include <exception>
+
+namespace obsidian
+{
+
+ThreadPool::ThreadPool(uint32_t worker_count)
+{
+	for (uint32_t i = 0; i < worker_count; i++)
+	{
+		workers.emplace_back(&ThreadPool::run, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	job_ready.notify_all();
+
+	for (std::thread &worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::submit(Job job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push(std::move(job));
+	}
+	job_ready.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	jobs_done.wait(lock, [this] { return jobs.empty() && running == 0; });
+}
+
+uint32_t ThreadPool::worker_count() const
+{
+	return static_cast<uint32_t>(workers.size());
+}
+
+void ThreadPool::run(uint32_t worker)
+{
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_ready.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+			if (stopping && jobs.empty())
+			{
+				return;
+			}
+
+			job = std::move(jobs.front());
+			jobs.pop();
+			running++;
+		}
+
+		job(worker);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running--;
+		}
+		jobs_done.notify_all();
+	}
+}
+
+ParallelRecorder::ParallelRecorder(Init &init, uint32_t worker_count) :
+    init(init),
+    threads(worker_count)
+{
+	VkCommandPoolCreateInfo pool_info = {};
+	pool_info.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.queueFamilyIndex        = init.graphics_queue_family;
+	pool_info.flags                   = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (auto &frame_pools : pools)
+	{
+		frame_pools.resize(worker_count);
+		for (WorkerPool &worker_pool : frame_pools)
+		{
+			if (init.disp.createCommandPool(&pool_info, nullptr, &worker_pool.pool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create worker command pool!");
+			}
+		}
+	}
+}
+
+ParallelRecorder::~ParallelRecorder()
+{
+	for (auto &frame_pools : pools)
+	{
+		for (WorkerPool &worker_pool : frame_pools)
+		{
+			init.disp.destroyCommandPool(worker_pool.pool, nullptr);
+		}
+	}
+}
+
+void ParallelRecorder::begin_frame(uint32_t frame_index)
+{
+	frame = frame_index;
+
+	// the buffers go back to the initial state and are handed out again this frame
+	for (WorkerPool &worker_pool : pools[frame])
+	{
+		init.disp.resetCommandPool(worker_pool.pool, 0);
+		worker_pool.used = 0;
+	}
+}
+
+VkCommandBuffer ParallelRecorder::next_buffer(WorkerPool &worker_pool)
+{
+	if (worker_pool.used == worker_pool.buffers.size())
+	{
+		VkCommandBufferAllocateInfo allocate_info = {};
+		allocate_info.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocate_info.commandPool                 = worker_pool.pool;
+		allocate_info.level                       = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocate_info.commandBufferCount          = 1;
+
+		VkCommandBuffer command_buffer;
+		if (init.disp.allocateCommandBuffers(&allocate_info, &command_buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to allocate secondary command buffer!");
+		}
+		worker_pool.buffers.push_back(command_buffer);
+	}
+
+	return worker_pool.buffers[worker_pool.used++];
+}
+
+void ParallelRecorder::execute(VkCommandBuffer                                 primary,
+                               const VkCommandBufferInheritanceRenderingInfo &rendering,
+                               uint32_t                                        chunk_count,
+                               const RecordFn                                 &record)
+{
+	if (chunk_count == 0)
+	{
+		return;
+	}
+
+	std::vector<VkCommandBuffer> secondaries(chunk_count);
+
+	auto record_chunk = [&](uint32_t worker, uint32_t chunk) {
+		VkCommandBuffer command_buffer = next_buffer(pools[frame][worker]);
+
+		VkCommandBufferInheritanceInfo inheritance_info = {};
+		inheritance_info.sType                          = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance_info.pNext                          = &rendering;
+
+		// continues the primary's dynamic rendering instead of starting its own
+		VkCommandBufferBeginInfo begin_info = {};
+		begin_info.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		begin_info.pInheritanceInfo         = &inheritance_info;
+
+		if (init.disp.beginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to begin secondary command buffer!");
+		}
+
+		record(command_buffer, chunk);
+
+		if (init.disp.endCommandBuffer(command_buffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to record secondary command buffer!");
+		}
+
+		secondaries[chunk] = command_buffer;
+	};
+
+	// an exception must not escape a worker thread, the first one is rethrown here once every job is done
+	std::mutex         error_mutex;
+	std::exception_ptr error;
+
+	for (uint32_t chunk = 0; chunk < chunk_count; chunk++)
+	{
+		threads.submit([&, chunk](uint32_t worker) {
+			try
+			{
+				record_chunk(worker, chunk);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!error)
+				{
+					error = std::current_exception();
+				}
+			}
+		});
+	}
+
+	threads.wait();
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	init.disp.cmdExecuteCommands(primary, chunk_count, secondaries.data());
+}
+
+uint32_t ParallelRecorder::worker_count() const
+{
+	return threads.worker_count();
+}
+
+}        // namespace obsidian
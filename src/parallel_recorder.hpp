@@ -0,0 +1,96 @@
+//
+// Created by rfdic on 9/28/2024.
+//
+
+#ifndef TOYRENDERER_PARALLEL_RECORDER_HPP
+#define TOYRENDERER_PARALLEL_RECORDER_HPP
+
+#include "common.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+namespace obsidian
+{
+
+constexpr uint32_t MAX_RECORDING_THREADS = 8;
+constexpr uint32_t MIN_DRAWS_PER_CHUNK   = 64;        // fewer draws aren't worth a secondary buffer
+
+// Fixed set of worker threads taking jobs from one queue. A job gets the index
+// of the worker running it, so it can use that worker's own resources.
+class ThreadPool
+{
+  public:
+	using Job = std::function<void(uint32_t worker)>;
+
+	explicit ThreadPool(uint32_t worker_count);
+	~ThreadPool();
+
+	void submit(Job job);
+
+	// block until every submitted job has finished
+	void wait();
+
+	uint32_t worker_count() const;
+
+  private:
+	void run(uint32_t worker);
+
+	std::vector<std::thread> workers;
+	std::queue<Job>          jobs;
+	std::mutex               mutex;
+	std::condition_variable  job_ready;
+	std::condition_variable  jobs_done;
+	uint32_t                 running  = 0;
+	bool                     stopping = false;
+};
+
+// Records the chunks of a pass into secondary command buffers on the thread
+// pool and executes them in chunk order from the primary, which has to be
+// inside a cmdBeginRendering with VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT.
+// Every worker has one command pool per frame in flight, so nothing is shared
+// between threads while recording.
+class ParallelRecorder
+{
+  public:
+	// records one chunk, the buffer starts without any state bound
+	using RecordFn = std::function<void(VkCommandBuffer command_buffer, uint32_t chunk)>;
+
+	ParallelRecorder(Init &init, uint32_t worker_count);
+	~ParallelRecorder();
+
+	// reset the frame's pools, call once the frame's fence signalled
+	void begin_frame(uint32_t frame);
+
+	// record every chunk and execute them, throws what the first failing chunk threw
+	// after all of them finished, with nothing added to the primary
+	void execute(VkCommandBuffer                                 primary,
+	             const VkCommandBufferInheritanceRenderingInfo &rendering,
+	             uint32_t                                        chunk_count,
+	             const RecordFn                                 &record);
+
+	uint32_t worker_count() const;
+
+  private:
+	struct WorkerPool
+	{
+		VkCommandPool                pool;
+		std::vector<VkCommandBuffer> buffers;
+		uint32_t                     used = 0;
+	};
+
+	VkCommandBuffer next_buffer(WorkerPool &pool);
+
+	Init      &init;
+	ThreadPool threads;
+	uint32_t   frame = 0;
+
+	std::array<std::vector<WorkerPool>, MAX_FRAMES_IN_FLIGHT> pools;
+};
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_PARALLEL_RECORDER_HPP
@@ -0,0 +1,576 @@
+//
+// Created by rfdic on 9/26/2024.
+//
+
+#include "render_graph.hpp"
+
+#include "barrier_batch.hpp"
+#include "debug_utils.hpp"
+
+namespace obsidian
+{
+
+static constexpr uint32_t NO_PHYSICAL_IMAGE = UINT32_MAX;
+
+static constexpr VkAccessFlags2 WRITE_ACCESS = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+                                               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                               VK_ACCESS_2_TRANSFER_WRITE_BIT |
+                                               VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                                               VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+ImageState image_usage_state(ImageUsage usage)
+{
+	switch (usage)
+	{
+		case ImageUsage::COLOR_ATTACHMENT:
+			return {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+			        VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT};
+		case ImageUsage::DEPTH_ATTACHMENT:
+			return {VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+			        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT};
+		case ImageUsage::FRAGMENT_SAMPLED:
+			return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+			        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT};
+		case ImageUsage::COMPUTE_SAMPLED:
+			return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+			        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT};
+		case ImageUsage::TRANSFER_SRC:
+			return {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			        VK_PIPELINE_STAGE_2_COPY_BIT,
+			        VK_ACCESS_2_TRANSFER_READ_BIT};
+		case ImageUsage::TRANSFER_DST:
+			return {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			        VK_PIPELINE_STAGE_2_COPY_BIT,
+			        VK_ACCESS_2_TRANSFER_WRITE_BIT};
+		case ImageUsage::PRESENT:
+			// the present semaphore orders everything after, nothing to wait for here
+			return {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+	}
+
+	throw std::runtime_error("unknown image usage!");
+}
+
+bool TransientImageDesc::operator==(const TransientImageDesc &other) const
+{
+	return format == other.format &&
+	       extent.width == other.extent.width &&
+	       extent.height == other.extent.height &&
+	       usage == other.usage &&
+	       aspect == other.aspect;
+}
+
+TransientImagePool::TransientImagePool(Init &init) :
+    init(init)
+{
+}
+
+TransientImagePool::~TransientImagePool()
+{
+	for (Entry &entry : entries)
+	{
+		destroy(entry);
+	}
+}
+
+void TransientImagePool::begin_frame()
+{
+	frame++;
+
+	// the frame that last used an image MAX_FRAMES_IN_FLIGHT frames ago has finished
+	for (size_t i = 0; i < entries.size();)
+	{
+		entries[i].claimed = false;
+
+		if (entries[i].last_used + MAX_FRAMES_IN_FLIGHT <= frame)
+		{
+			destroy(entries[i]);
+			entries[i] = entries.back();
+			entries.pop_back();
+			continue;
+		}
+
+		i++;
+	}
+}
+
+void TransientImagePool::acquire(const TransientImageDesc &desc, VkImage &image, VkImageView &view)
+{
+	for (Entry &entry : entries)
+	{
+		if (!entry.claimed && entry.desc == desc)
+		{
+			entry.claimed   = true;
+			entry.last_used = frame;
+			image           = entry.image;
+			view            = entry.view;
+			return;
+		}
+	}
+
+	Entry entry     = {};
+	entry.desc      = desc;
+	entry.last_used = frame;
+	entry.claimed   = true;
+
+	VkImageCreateInfo image_info = {};
+	image_info.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType         = VK_IMAGE_TYPE_2D;
+	image_info.extent            = {desc.extent.width, desc.extent.height, 1};
+	image_info.mipLevels         = 1;
+	image_info.arrayLayers       = 1;
+	image_info.format            = desc.format;
+	image_info.tiling            = VK_IMAGE_TILING_OPTIMAL;
+	image_info.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.usage             = desc.usage;
+	image_info.samples           = VK_SAMPLE_COUNT_1_BIT;
+	image_info.sharingMode       = VK_SHARING_MODE_EXCLUSIVE;
+
+	VmaAllocationCreateInfo allocation_info = {};
+	allocation_info.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	if (vmaCreateImage(init.allocator, &image_info, &allocation_info, &entry.image, &entry.allocation, nullptr) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create transient image!");
+	}
+
+	// depth stencil images are viewed through their depth
+	VkImageViewCreateInfo view_info           = {};
+	view_info.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image                           = entry.image;
+	view_info.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format                          = desc.format;
+	view_info.subresourceRange.aspectMask     = (desc.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) ? VK_IMAGE_ASPECT_DEPTH_BIT : desc.aspect;
+	view_info.subresourceRange.baseMipLevel   = 0;
+	view_info.subresourceRange.levelCount     = 1;
+	view_info.subresourceRange.baseArrayLayer = 0;
+	view_info.subresourceRange.layerCount     = 1;
+
+	if (init.disp.createImageView(&view_info, nullptr, &entry.view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create transient image view!");
+	}
+
+	image = entry.image;
+	view  = entry.view;
+	entries.push_back(entry);
+}
+
+void TransientImagePool::destroy(Entry &entry)
+{
+	init.disp.destroyImageView(entry.view, nullptr);
+	vmaDestroyImage(init.allocator, entry.image, entry.allocation);
+}
+
+RenderGraph::PassBuilder::PassBuilder(RenderGraph &graph, uint32_t pass) :
+    graph(graph),
+    pass(pass)
+{
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::read(RenderResource resource, ImageUsage usage)
+{
+	graph.passes[pass].accesses.push_back({resource, usage, false, false});
+	return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::write(RenderResource resource, ImageUsage usage, bool discard)
+{
+	graph.passes[pass].accesses.push_back({resource, usage, true, discard});
+	return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::side_effect()
+{
+	graph.passes[pass].side_effect = true;
+	return *this;
+}
+
+RenderResource RenderGraph::import_image(const std::string &name,
+                                         VkImage            image,
+                                         VkImageView        view,
+                                         VkImageAspectFlags aspect,
+                                         const ImageState  &initial,
+                                         const ImageState  *final_state)
+{
+	Resource resource = {};
+	resource.name     = name;
+	resource.image    = image;
+	resource.view     = view;
+	resource.aspect   = aspect;
+	resource.initial  = initial;
+	resource.imported = true;
+
+	if (final_state)
+	{
+		resource.final_state = *final_state;
+		resource.exported    = true;
+	}
+
+	resources.push_back(resource);
+	return static_cast<RenderResource>(resources.size() - 1);
+}
+
+RenderResource RenderGraph::create_image(const std::string &name, const TransientImageDesc &desc)
+{
+	Resource resource = {};
+	resource.name     = name;
+	resource.aspect   = desc.aspect;
+	resource.desc     = desc;
+
+	resources.push_back(resource);
+	return static_cast<RenderResource>(resources.size() - 1);
+}
+
+RenderGraph::PassBuilder RenderGraph::add_pass(const std::string &name, const glm::vec3 &label_color, ExecuteFn execute)
+{
+	passes.push_back({name, label_color, std::move(execute), {}, false});
+	return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+}
+
+std::vector<bool> RenderGraph::cull_passes() const
+{
+	// walk back from the frame's outputs, a pass survives when a later pass or the frame needs what it writes
+	std::vector<bool> needed(resources.size());
+	for (size_t i = 0; i < resources.size(); i++)
+	{
+		needed[i] = resources[i].exported;
+	}
+
+	std::vector<bool> kept(passes.size(), false);
+	for (size_t p = passes.size(); p-- > 0;)
+	{
+		const Pass &pass = passes[p];
+
+		bool keep = pass.side_effect;
+		for (const Access &access : pass.accesses)
+		{
+			keep = keep || (access.write && needed[access.resource]);
+		}
+
+		if (!keep)
+		{
+			continue;
+		}
+
+		kept[p] = true;
+
+		// a discarding write ends the dependency on earlier writers, reads and loads extend it
+		for (const Access &access : pass.accesses)
+		{
+			if (access.write && access.discard)
+			{
+				needed[access.resource] = false;
+			}
+		}
+		for (const Access &access : pass.accesses)
+		{
+			if (!access.write || !access.discard)
+			{
+				needed[access.resource] = true;
+			}
+		}
+	}
+
+	return kept;
+}
+
+void RenderGraph::assign_physical_images(const std::vector<bool> &kept)
+{
+	constexpr uint32_t UNUSED = UINT32_MAX;
+
+	std::vector<uint32_t> first_use(resources.size(), UNUSED);
+	std::vector<uint32_t> last_use(resources.size(), UNUSED);
+	for (uint32_t p = 0; p < passes.size(); p++)
+	{
+		if (!kept[p])
+		{
+			continue;
+		}
+
+		for (const Access &access : passes[p].accesses)
+		{
+			if (first_use[access.resource] == UNUSED)
+			{
+				first_use[access.resource] = p;
+			}
+			last_use[access.resource] = p;
+		}
+	}
+
+	std::vector<RenderResource> transients;
+	for (RenderResource r = 0; r < resources.size(); r++)
+	{
+		if (!resources[r].imported && first_use[r] != UNUSED)
+		{
+			transients.push_back(r);
+		}
+	}
+
+	std::sort(transients.begin(), transients.end(), [&](RenderResource a, RenderResource b) { return first_use[a] < first_use[b]; });
+
+	// an image whose last user ran before this one's first user is free to alias
+	compiled.physical_images.assign(resources.size(), NO_PHYSICAL_IMAGE);
+	std::vector<uint32_t> physical_last_use;
+	for (RenderResource r : transients)
+	{
+		uint32_t physical = NO_PHYSICAL_IMAGE;
+		for (uint32_t i = 0; i < compiled.physical_descs.size(); i++)
+		{
+			if (compiled.physical_descs[i] == resources[r].desc && physical_last_use[i] < first_use[r])
+			{
+				physical = i;
+				break;
+			}
+		}
+
+		if (physical == NO_PHYSICAL_IMAGE)
+		{
+			physical = static_cast<uint32_t>(compiled.physical_descs.size());
+			compiled.physical_descs.push_back(resources[r].desc);
+			physical_last_use.push_back(0);
+		}
+
+		compiled.physical_images[r]  = physical;
+		physical_last_use[physical] = last_use[r];
+	}
+}
+
+// What is known about an image while walking the passes: the last write (or
+// layout transition) still to be waited on, which stages have already been
+// made to wait for it and which stages read it since.
+struct TrackedImage
+{
+	VkImageLayout         layout;
+	VkPipelineStageFlags2 write_stages;
+	VkAccessFlags2        write_access;
+	VkPipelineStageFlags2 visible_stages;
+	VkAccessFlags2        visible_access;
+	VkPipelineStageFlags2 read_stages;
+};
+
+static void add_barrier(std::vector<ImageBarrier> &barriers, RenderResource resource, const ImageState &src, const ImageState &dst)
+{
+	// one barrier per image and batch, a second use in the same pass widens the first
+	for (ImageBarrier &barrier : barriers)
+	{
+		if (barrier.resource == resource)
+		{
+			if (barrier.dst.layout != dst.layout)
+			{
+				throw std::runtime_error("image used in two layouts by one pass!");
+			}
+
+			barrier.src.stages |= src.stages;
+			barrier.src.access |= src.access;
+			barrier.dst.stages |= dst.stages;
+			barrier.dst.access |= dst.access;
+			return;
+		}
+	}
+
+	barriers.push_back({resource, src, dst});
+}
+
+static void track_access(TrackedImage              &tracked,
+                         std::vector<ImageBarrier> &barriers,
+                         RenderResource             resource,
+                         const ImageState          &state,
+                         bool                       write,
+                         bool                       discard)
+{
+	const bool layout_change = tracked.layout != state.layout;
+
+	if (write || layout_change)
+	{
+		// RAW/WAW on the last write, WAR on the reads since; a layout change is a write itself
+		const VkPipelineStageFlags2 src_stages = tracked.write_stages | tracked.read_stages;
+		if (src_stages != VK_PIPELINE_STAGE_2_NONE || layout_change)
+		{
+			const VkImageLayout old_layout = discard && layout_change ? VK_IMAGE_LAYOUT_UNDEFINED : tracked.layout;
+			add_barrier(barriers, resource, {old_layout, src_stages, tracked.write_access}, state);
+		}
+
+		tracked.layout = state.layout;
+		if (write)
+		{
+			tracked.write_stages   = state.stages;
+			tracked.write_access   = state.access & WRITE_ACCESS;
+			tracked.visible_stages = VK_PIPELINE_STAGE_2_NONE;
+			tracked.visible_access = VK_ACCESS_2_NONE;
+			tracked.read_stages    = VK_PIPELINE_STAGE_2_NONE;
+		}
+		else
+		{
+			tracked.write_stages   = state.stages;
+			tracked.write_access   = VK_ACCESS_2_NONE;
+			tracked.visible_stages = state.stages;
+			tracked.visible_access = state.access;
+			tracked.read_stages    = state.stages;
+		}
+		return;
+	}
+
+	// read in the current layout, only wait when this stage hasn't seen the last write yet
+	const bool unseen = (state.stages & ~tracked.visible_stages) != 0 || (state.access & ~tracked.visible_access) != 0;
+	if (tracked.write_stages != VK_PIPELINE_STAGE_2_NONE && unseen)
+	{
+		add_barrier(barriers, resource, {tracked.layout, tracked.write_stages, tracked.write_access}, state);
+		tracked.visible_stages |= state.stages;
+		tracked.visible_access |= state.access;
+	}
+
+	tracked.read_stages |= state.stages;
+}
+
+void RenderGraph::derive_barriers(const std::vector<bool> &kept)
+{
+	// transients are tracked per physical image so aliases wait on each other
+	std::vector<TrackedImage> physical(compiled.physical_descs.size());
+	std::vector<TrackedImage> imported(resources.size());
+	std::vector<bool>         touched(resources.size(), false);
+
+	// a physical image ends every frame the way its last user left it, the next frame starts from there
+	std::vector<ImageState> physical_last(compiled.physical_descs.size());
+	for (uint32_t p = 0; p < passes.size(); p++)
+	{
+		for (const Access &access : passes[p].accesses)
+		{
+			const uint32_t index = compiled.physical_images[access.resource];
+			if (kept[p] && index != NO_PHYSICAL_IMAGE)
+			{
+				physical_last[index] = image_usage_state(access.usage);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < physical.size(); i++)
+	{
+		physical[i] = {VK_IMAGE_LAYOUT_UNDEFINED,
+		               physical_last[i].stages, physical_last[i].access & WRITE_ACCESS,
+		               VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+		               physical_last[i].stages};
+	}
+
+	for (size_t r = 0; r < resources.size(); r++)
+	{
+		const ImageState &initial = resources[r].initial;
+		imported[r] = {initial.layout,
+		               initial.stages, initial.access & WRITE_ACCESS,
+		               VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+		               initial.stages};
+	}
+
+	for (uint32_t p = 0; p < passes.size(); p++)
+	{
+		if (!kept[p])
+		{
+			compiled.culled_passes++;
+			continue;
+		}
+
+		CompiledPass compiled_pass = {p, {}};
+		for (const Access &access : passes[p].accesses)
+		{
+			const uint32_t index   = compiled.physical_images[access.resource];
+			TrackedImage  &tracked = index != NO_PHYSICAL_IMAGE ? physical[index] : imported[access.resource];
+
+			// whatever an alias left in the image is garbage to this resource
+			bool discard = access.discard;
+			if (index != NO_PHYSICAL_IMAGE && !touched[access.resource])
+			{
+				tracked.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+				discard        = true;
+			}
+			touched[access.resource] = true;
+
+			track_access(tracked, compiled_pass.barriers, access.resource, image_usage_state(access.usage), access.write, discard);
+		}
+
+		compiled.passes.push_back(std::move(compiled_pass));
+	}
+
+	for (RenderResource r = 0; r < resources.size(); r++)
+	{
+		if (resources[r].exported)
+		{
+			track_access(imported[r], compiled.final_barriers, r, resources[r].final_state, false, false);
+		}
+	}
+}
+
+const CompiledGraph &RenderGraph::compile()
+{
+	compiled = {};
+
+	const std::vector<bool> kept = cull_passes();
+	assign_physical_images(kept);
+	derive_barriers(kept);
+
+	return compiled;
+}
+
+static void emit_barriers(BarrierBatch &batch, VkCommandBuffer command_buffer, const std::vector<ImageBarrier> &barriers, const RenderGraph &graph,
+                          const std::vector<VkImageAspectFlags> &aspects)
+{
+	for (const ImageBarrier &barrier : barriers)
+	{
+		batch.image(graph.image(barrier.resource), image_range(aspects[barrier.resource]),
+		            barrier.src.layout, barrier.dst.layout,
+		            barrier.src.stages, barrier.src.access,
+		            barrier.dst.stages, barrier.dst.access);
+	}
+
+	batch.flush(command_buffer);
+}
+
+void RenderGraph::execute(Init &init, VkCommandBuffer command_buffer, TransientImagePool &pool)
+{
+	std::vector<VkImage>     physical_images(compiled.physical_descs.size());
+	std::vector<VkImageView> physical_views(compiled.physical_descs.size());
+	for (size_t i = 0; i < compiled.physical_descs.size(); i++)
+	{
+		pool.acquire(compiled.physical_descs[i], physical_images[i], physical_views[i]);
+	}
+
+	std::vector<VkImageAspectFlags> aspects(resources.size());
+	for (RenderResource r = 0; r < resources.size(); r++)
+	{
+		const uint32_t index = compiled.physical_images[r];
+		if (index != NO_PHYSICAL_IMAGE)
+		{
+			resources[r].image = physical_images[index];
+			resources[r].view  = physical_views[index];
+		}
+		aspects[r] = resources[r].aspect;
+	}
+
+	BarrierBatch batch(init);
+	for (const CompiledPass &compiled_pass : compiled.passes)
+	{
+		const Pass &pass = passes[compiled_pass.pass];
+
+		emit_barriers(batch, command_buffer, compiled_pass.barriers, *this, aspects);
+
+		begin_debug_label(init, command_buffer, pass.name.c_str(), pass.label_color);
+		pass.execute(command_buffer);
+		end_debug_label(init, command_buffer);
+	}
+
+	emit_barriers(batch, command_buffer, compiled.final_barriers, *this, aspects);
+}
+
+VkImage RenderGraph::image(RenderResource resource) const
+{
+	return resources[resource].image;
+}
+
+VkImageView RenderGraph::image_view(RenderResource resource) const
+{
+	return resources[resource].view;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,199 @@
+//
+// Created by rfdic on 9/26/2024.
+//
+
+#ifndef TOYRENDERER_RENDER_GRAPH_HPP
+#define TOYRENDERER_RENDER_GRAPH_HPP
+
+#include "common.hpp"
+
+#include <functional>
+
+namespace obsidian
+{
+
+using RenderResource = uint32_t;
+
+// How a pass touches an image. Every usage stands for one layout and one set of
+// stages and accesses, see image_usage_state.
+enum class ImageUsage : uint32_t
+{
+	COLOR_ATTACHMENT,
+	DEPTH_ATTACHMENT,
+	FRAGMENT_SAMPLED,
+	COMPUTE_SAMPLED,
+	TRANSFER_SRC,
+	TRANSFER_DST,
+	PRESENT,
+};
+
+struct ImageState
+{
+	VkImageLayout         layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+	VkAccessFlags2        access = VK_ACCESS_2_NONE;
+};
+
+ImageState image_usage_state(ImageUsage usage);
+
+// Image the graph creates for the frame. Transients whose lifetimes don't
+// overlap and whose descriptions match share one physical image.
+struct TransientImageDesc
+{
+	VkFormat           format;
+	VkExtent2D         extent;
+	VkImageUsageFlags  usage;
+	VkImageAspectFlags aspect;
+
+	bool operator==(const TransientImageDesc &other) const;
+};
+
+struct ImageBarrier
+{
+	RenderResource resource;
+	ImageState     src;        // src.layout is the old layout, UNDEFINED when the contents are discarded
+	ImageState     dst;
+};
+
+struct CompiledPass
+{
+	uint32_t                  pass;
+	std::vector<ImageBarrier> barriers;        // issued as one batch before the pass
+};
+
+// Result of RenderGraph::compile. Only indices and states, so the compiler runs
+// and can be checked without a device.
+struct CompiledGraph
+{
+	std::vector<CompiledPass>       passes;        // kept passes in submission order
+	std::vector<ImageBarrier>       final_barriers;        // imported images into their final state
+	std::vector<uint32_t>           physical_images;        // per resource, index into physical_descs or UINT32_MAX when imported
+	std::vector<TransientImageDesc> physical_descs;
+	uint32_t                        culled_passes = 0;
+};
+
+// Keeps the physical images of transient resources alive across frames, an
+// image nobody asked for in MAX_FRAMES_IN_FLIGHT frames is destroyed.
+class TransientImagePool
+{
+  public:
+	explicit TransientImagePool(Init &init);
+	~TransientImagePool();
+
+	// call once per frame after the frame's fence signalled
+	void begin_frame();
+
+	// an image matching desc that nothing else this frame holds
+	void acquire(const TransientImageDesc &desc, VkImage &image, VkImageView &view);
+
+  private:
+	struct Entry
+	{
+		TransientImageDesc desc;
+		VkImage            image;
+		VmaAllocation      allocation;
+		VkImageView        view;
+		uint64_t           last_used;
+		bool               claimed;
+	};
+
+	void destroy(Entry &entry);
+
+	Init              &init;
+	std::vector<Entry> entries;
+	uint64_t           frame = 0;
+};
+
+// One frame's passes and the images they touch. Passes declare their reads and
+// writes, compile() orders nothing but decides which passes are needed, which
+// transients share memory and which barriers go before each pass; execute()
+// records the kept passes with their barriers batched into one
+// vkCmdPipelineBarrier2 each.
+class RenderGraph
+{
+  public:
+	using ExecuteFn = std::function<void(VkCommandBuffer)>;
+
+	class PassBuilder
+	{
+	  public:
+		PassBuilder &read(RenderResource resource, ImageUsage usage);
+
+		// discard when the pass overwrites everything, e.g. a clear load op
+		PassBuilder &write(RenderResource resource, ImageUsage usage, bool discard = false);
+
+		// keep the pass even when nothing reads what it writes
+		PassBuilder &side_effect();
+
+	  private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph &graph, uint32_t pass);
+
+		RenderGraph &graph;
+		uint32_t     pass;
+	};
+
+	// An image owned elsewhere. It is in initial when the frame starts; with a
+	// final state it is an output of the frame and left in that state.
+	RenderResource import_image(const std::string  &name,
+	                            VkImage             image,
+	                            VkImageView         view,
+	                            VkImageAspectFlags  aspect,
+	                            const ImageState   &initial,
+	                            const ImageState   *final_state = nullptr);
+
+	RenderResource create_image(const std::string &name, const TransientImageDesc &desc);
+
+	PassBuilder add_pass(const std::string &name, const glm::vec3 &label_color, ExecuteFn execute);
+
+	const CompiledGraph &compile();
+
+	// create or reuse the transients' physical images, then record the kept passes
+	void execute(Init &init, VkCommandBuffer command_buffer, TransientImagePool &pool);
+
+	VkImage     image(RenderResource resource) const;
+	VkImageView image_view(RenderResource resource) const;
+
+  private:
+	struct Access
+	{
+		RenderResource resource;
+		ImageUsage     usage;
+		bool           write;
+		bool           discard;
+	};
+
+	struct Pass
+	{
+		std::string         name;
+		glm::vec3           label_color;
+		ExecuteFn           execute;
+		std::vector<Access> accesses;
+		bool                side_effect = false;
+	};
+
+	struct Resource
+	{
+		std::string        name;
+		VkImage            image  = VK_NULL_HANDLE;
+		VkImageView        view   = VK_NULL_HANDLE;
+		VkImageAspectFlags aspect = 0;
+		ImageState         initial;
+		ImageState         final_state;
+		bool               imported = false;
+		bool               exported = false;
+		TransientImageDesc desc     = {};
+	};
+
+	std::vector<bool> cull_passes() const;
+	void              assign_physical_images(const std::vector<bool> &kept);
+	void              derive_barriers(const std::vector<bool> &kept);
+
+	std::vector<Pass>     passes;
+	std::vector<Resource> resources;
+	CompiledGraph         compiled;
+};
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_RENDER_GRAPH_HPP
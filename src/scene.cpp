@@ -0,0 +1,79 @@
+//
+// Created by rfdic on 9/8/2024.
+//
+
+#include "scene.hpp"
+
+#include "mesh.hpp"
+
+namespace obsidian
+{
+
+uint32_t Scene::add_mesh(Mesh *mesh)
+{
+	meshes.push_back(mesh);
+	return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+uint32_t Scene::add_material(const Material &material)
+{
+	materials.push_back(material);
+	return static_cast<uint32_t>(materials.size() - 1);
+}
+
+uint32_t Scene::add_light(const Light &light)
+{
+	lights.push_back(light);
+	return static_cast<uint32_t>(lights.size() - 1);
+}
+
+uint32_t Scene::add_instance(uint32_t mesh_index, uint32_t material_index, const glm::mat4 &transform, bool casts_shadow, bool is_static)
+{
+	transforms.push_back(transform);
+	mesh_indices.push_back(mesh_index);
+	material_indices.push_back(material_index);
+	casts_shadows.push_back(casts_shadow ? 1 : 0);
+	this->is_static.push_back(is_static ? 1 : 0);
+
+	if (casts_shadow && is_static)
+	{
+		static_revision++;
+	}
+
+	return static_cast<uint32_t>(transforms.size() - 1);
+}
+
+void Scene::set_transform(uint32_t instance, const glm::mat4 &transform)
+{
+	transforms[instance] = transform;
+
+	if (casts_shadows[instance] && is_static[instance])
+	{
+		static_revision++;
+	}
+}
+
+size_t Scene::instance_count() const
+{
+	return transforms.size();
+}
+
+void cleanup_scene(Scene &scene)
+{
+	for (Mesh *mesh : scene.meshes)
+	{
+		delete mesh;
+	}
+
+	scene.meshes.clear();
+	scene.materials.clear();
+	scene.lights.clear();
+	scene.transforms.clear();
+	scene.mesh_indices.clear();
+	scene.material_indices.clear();
+	scene.casts_shadows.clear();
+	scene.is_static.clear();
+	scene.static_revision++;
+}
+
+}        // namespace obsidian
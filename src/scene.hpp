@@ -0,0 +1,81 @@
+//
+// Created by rfdic on 9/8/2024.
+//
+
+#ifndef TOYRENDERER_SCENE_HPP
+#define TOYRENDERER_SCENE_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+struct Mesh;
+
+struct Material
+{
+	std::string name;
+	glm::vec4   base_color      = glm::vec4(1.0f);
+	std::string diffuse_texture;        // path as written in the source asset, empty if none
+	bool        use_texture     = true;
+	float       pattern_scale   = 2.0f;
+};
+
+enum class LightType : uint32_t
+{
+	SPOT,
+	POINT,
+};
+
+// Spot or point light. The directional light and its cascades live in ShadowMap,
+// shadows of these come from the shadow atlas.
+struct Light
+{
+	LightType type         = LightType::SPOT;
+	glm::vec3 position     = glm::vec3(0.0f);
+	glm::vec3 direction    = glm::vec3(0.0f, -1.0f, 0.0f);        // spot lights only
+	glm::vec3 color        = glm::vec3(1.0f);
+	float     intensity    = 1.0f;
+	float     range        = 10.0f;
+	float     outer_angle  = glm::radians(30.0f);        // half angle of the spot cone
+	bool      casts_shadow = true;
+};
+
+// Flat scene description. Meshes and materials are shared, everything indexed
+// by instance lives in parallel arrays so passes can walk them linearly.
+struct Scene
+{
+	std::vector<Mesh *>   meshes;
+	std::vector<Material> materials;
+	std::vector<Light>    lights;
+
+	// per instance
+	std::vector<glm::mat4> transforms;
+	std::vector<uint32_t>  mesh_indices;
+	std::vector<uint32_t>  material_indices;
+	std::vector<uint8_t>   casts_shadows;
+	std::vector<uint8_t>   is_static;        // static casters are kept in the shadow cache
+
+	// bumped whenever a static caster is added or moved, cached shadows older than this are stale
+	uint32_t static_revision = 0;
+
+	uint32_t add_mesh(Mesh *mesh);
+	uint32_t add_material(const Material &material);
+	uint32_t add_light(const Light &light);
+	uint32_t add_instance(uint32_t         mesh_index,
+	                      uint32_t         material_index,
+	                      const glm::mat4 &transform,
+	                      bool             casts_shadow = true,
+	                      bool             is_static    = true);
+
+	void set_transform(uint32_t instance, const glm::mat4 &transform);
+
+	size_t instance_count() const;
+};
+
+// the scene owns its meshes, release them from the geometry pool first
+void cleanup_scene(Scene &scene);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_SCENE_HPP
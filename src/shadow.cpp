@@ -7,7 +7,17 @@
 #include "common.hpp"
 #include "utils.hpp"
 #include "vk_mem_alloc.h"
+#include "geometry_pool.hpp"
 #include "mesh.hpp"
+#include "scene.hpp"
+#include "vertex_format.hpp"
+#include "culling.hpp"
+#include "instance_buffer.hpp"
+#include "shadow_atlas.hpp"
+#include "barrier_batch.hpp"
+#include "gpu_culling.hpp"
+
+#include <limits>
 
 namespace obsidian
 {
@@ -24,7 +34,7 @@ struct AllocatedImage
 	VkSampler     sampler;
 };
 
-AllocatedImage create_shadow_map_image(Init &init, uint32_t width, uint32_t height)
+AllocatedImage create_shadow_map_image(Init &init, uint32_t width, uint32_t height, VkImageUsageFlags usage)
 {
 	VkImageCreateInfo image_info = {};
 	image_info.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -33,11 +43,11 @@ AllocatedImage create_shadow_map_image(Init &init, uint32_t width, uint32_t heig
 	image_info.extent.height     = height;
 	image_info.extent.depth      = 1;
 	image_info.mipLevels         = 1;
-	image_info.arrayLayers       = 1;
+	image_info.arrayLayers       = SHADOW_CASCADE_COUNT;
 	image_info.format            = SHADOW_MAP_FORMAT;
 	image_info.tiling            = VK_IMAGE_TILING_OPTIMAL;
 	image_info.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
-	image_info.usage             = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.usage             = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | usage;
 	image_info.samples           = VK_SAMPLE_COUNT_1_BIT;
 
 	VmaAllocationCreateInfo allocation_create_info = {};
@@ -49,20 +59,23 @@ AllocatedImage create_shadow_map_image(Init &init, uint32_t width, uint32_t heig
 	return allocated_image;
 }
 
-void create_image_view(Init &init, AllocatedImage &allocated_image)
+VkImageView create_image_view(Init &init, VkImage image, VkImageViewType view_type, uint32_t base_layer, uint32_t layer_count)
 {
 	VkImageViewCreateInfo view_info           = {};
 	view_info.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	view_info.image                           = allocated_image.image;
-	view_info.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.image                           = image;
+	view_info.viewType                        = view_type;
 	view_info.format                          = SHADOW_MAP_FORMAT;
 	view_info.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_DEPTH_BIT;
 	view_info.subresourceRange.baseMipLevel   = 0;
 	view_info.subresourceRange.levelCount     = 1;
-	view_info.subresourceRange.baseArrayLayer = 0;
-	view_info.subresourceRange.layerCount     = 1;
+	view_info.subresourceRange.baseArrayLayer = base_layer;
+	view_info.subresourceRange.layerCount     = layer_count;
+
+	VkImageView image_view;
+	vkCreateImageView(init.device, &view_info, nullptr, &image_view);
 
-	vkCreateImageView(init.device, &view_info, nullptr, &allocated_image.image_view);
+	return image_view;
 }
 
 void create_sampler(Init &init, AllocatedImage &allocated_image)
@@ -91,15 +104,29 @@ void create_sampler(Init &init, AllocatedImage &allocated_image)
 void cleanup_shadow_map(Init &init, RenderData &data)
 {
 	vkDestroySampler(init.device, data.shadow_map.sampler, nullptr);
+	for (VkImageView layer_view : data.shadow_map.layer_views)
+	{
+		vkDestroyImageView(init.device, layer_view, nullptr);
+	}
 	vkDestroyImageView(init.device, data.shadow_map.image_view, nullptr);
 	vmaDestroyImage(init.allocator, data.shadow_map.image, data.shadow_map.allocation);
+
+	for (VkImageView layer_view : data.shadow_map.cache_layer_views)
+	{
+		vkDestroyImageView(init.device, layer_view, nullptr);
+	}
+	vmaDestroyImage(init.allocator, data.shadow_map.cache_image, data.shadow_map.cache_allocation);
 }
 
 void create_shadow_map(Init &init, RenderData& data, uint32_t width, uint32_t height)
 {
-	AllocatedImage allocated_image = create_shadow_map_image(init, width, height);
-	// create image view
-	create_image_view(init, allocated_image);
+	AllocatedImage allocated_image = create_shadow_map_image(init, width, height, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+	// the array view is sampled, each cascade renders into its own layer view
+	allocated_image.image_view = create_image_view(init, allocated_image.image, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, SHADOW_CASCADE_COUNT);
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		data.shadow_map.layer_views[cascade] = create_image_view(init, allocated_image.image, VK_IMAGE_VIEW_TYPE_2D, cascade, 1);
+	}
 	// create sampler
 	create_sampler(init, allocated_image);
 
@@ -108,20 +135,47 @@ void create_shadow_map(Init &init, RenderData& data, uint32_t width, uint32_t he
 	data.shadow_map.image_view = allocated_image.image_view;
 	data.shadow_map.sampler = allocated_image.sampler;
 
+	// the static casters, only ever copied from
+	AllocatedImage cache_image = create_shadow_map_image(init, width, height, VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		data.shadow_map.cache_layer_views[cascade] = create_image_view(init, cache_image.image, VK_IMAGE_VIEW_TYPE_2D, cascade, 1);
+	}
+
+	data.shadow_map.cache_image = cache_image.image;
+	data.shadow_map.cache_allocation = cache_image.allocation;
+}
+
+// Casters of one kind with their world bounds, built once and culled by every cascade.
+struct CasterBatch
+{
+	BoundsBatch           bounds;
+	std::vector<uint32_t> instances;
+};
+
+// Orthographic light box over the light space texels [first, last) of a cascade
+// and the depth range every cascade shares, looking down the light.
+static glm::mat4 light_region_matrix(const ShadowMap &shadow_map, uint32_t cascade, glm::ivec2 first, glm::ivec2 last)
+{
+	const float texel = shadow_map.cascade_texel_sizes[cascade];
 
+	// zero-to-one depth, the shadow pass has no GL style clip space to undo
+	const glm::mat4 projection = glm::orthoRH_ZO(static_cast<float>(first.x) * texel, static_cast<float>(last.x) * texel,
+	                                             static_cast<float>(first.y) * texel, static_cast<float>(last.y) * texel,
+	                                             -shadow_map.depth_range.y, -shadow_map.depth_range.x);
+	return projection * shadow_map.light_view;
 }
 
-void draw_shadow(Init &init, RenderData &data, VkCommandBuffer &command_buffer, uint32_t image_index)
+static void begin_shadow_rendering(Init &init, VkCommandBuffer command_buffer, VkImageView image_view, VkExtent2D extent, VkAttachmentLoadOp load_op)
 {
-	// create dynamic render pass
 	VkRenderingAttachmentInfo attachment_info = {};
 	attachment_info.sType                     = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
 	attachment_info.pNext                     = nullptr;
-	attachment_info.imageView                 = data.shadow_map.image_view;
+	attachment_info.imageView                 = image_view;
 	attachment_info.imageLayout               = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	attachment_info.resolveImageView          = nullptr;
 	attachment_info.resolveImageLayout        = VK_IMAGE_LAYOUT_UNDEFINED;
-	attachment_info.loadOp                    = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachment_info.loadOp                    = load_op;
 	attachment_info.storeOp                   = VK_ATTACHMENT_STORE_OP_STORE;
 	attachment_info.clearValue.depthStencil   = {1.0f, 0};
 
@@ -133,12 +187,472 @@ void draw_shadow(Init &init, RenderData &data, VkCommandBuffer &command_buffer,
 	render_info.colorAttachmentCount = 0;
 	render_info.pDepthAttachment     = &attachment_info;
 	render_info.renderArea.offset    = {0, 0};
-	render_info.renderArea.extent    = {SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT};
+	render_info.renderArea.extent    = extent;
 	render_info.layerCount		   	 = 1;
 	render_info.viewMask			 = 0;
 
 	init.disp.cmdBeginRendering(command_buffer, &render_info);
+}
+
+// Cull a batch of casters against one light view. Every caster is drawn whole,
+// so copies of a mesh at the same lod end up in one instanced draw. Without a
+// camera frustum only the light's volume decides.
+static void cull_casters(RenderData                &data,
+                         const glm::mat4           &light_matrix,
+                         const CasterBatch         &casters,
+                         const Frustum             *camera_frustum,
+                         float                      lod_scale,
+                         std::vector<InstanceDraw> &draws)
+{
+	const Frustum   light_frustum = extract_frustum(light_matrix);
+	const glm::vec3 light_forward = glm::normalize(data.shadow_map.light_direction);
+
+	// how fast the distance to the light's far plane shrinks when walking along the light
+	const glm::vec4 &far_plane = light_frustum.planes[5];
+	const float      far_rate  = std::max(-glm::dot(glm::vec3(far_plane), light_forward), 1e-4f);
+
+	// casters have to be inside the light's volume
+	std::vector<uint8_t> visible;
+	cull_bounds(light_frustum, casters.bounds, visible);
+
+	const Scene &scene = *data.scene;
+	for (size_t k = 0; k < casters.instances.size(); k++)
+	{
+		if (!visible[k])
+		{
+			continue;
+		}
+
+		// and their shadow, which ends at the light's far plane, has to reach into the camera's view
+		const glm::vec3 center(casters.bounds.sphere_x[k], casters.bounds.sphere_y[k], casters.bounds.sphere_z[k]);
+		const float     radius = casters.bounds.sphere_radius[k];
+		const float     length = std::max(glm::dot(glm::vec3(far_plane), center) + far_plane.w, 0.0f) / far_rate + radius;
+		if (camera_frustum && !swept_sphere_in_frustum(*camera_frustum, center, radius, light_forward, length))
+		{
+			continue;
+		}
+
+		const uint32_t i     = casters.instances[k];
+		const Mesh    &mesh  = *scene.meshes[scene.mesh_indices[i]];
+		const uint32_t level = select_lod(mesh, scene.transforms[i], data.camera.position, lod_scale, data.shadow_lod_pixel_error);
+		draws.push_back({scene.mesh_indices[i], level, i});
+	}
+
+	data.culling_stats.shadow_casters_total += static_cast<uint32_t>(casters.instances.size());
+	data.culling_stats.shadow_casters_visible += static_cast<uint32_t>(draws.size());
+}
+
+static bool cache_entry_current(const ShadowMap &shadow_map, const Scene &scene, uint32_t cascade)
+{
+	const ShadowCacheEntry &entry = shadow_map.cache_entries[cascade];
+	return entry.valid &&
+	       entry.light_direction == shadow_map.light_direction &&
+	       entry.bias == shadow_map.bias &&
+	       entry.slope_bias == shadow_map.slope_bias &&
+	       entry.static_revision == scene.static_revision;
+}
+
+// The layer's texels can be kept when they were drawn on the same grid and depth
+// range and the cascade's window still overlaps them.
+static bool cache_layer_scrollable(const ShadowMap &shadow_map, uint32_t cascade)
+{
+	const ShadowCacheEntry &entry = shadow_map.cache_entries[cascade];
+	const glm::ivec2        shift = glm::abs(shadow_map.cascade_windows[cascade] - entry.window);
+	return entry.texel_size == shadow_map.cascade_texel_sizes[cascade] &&
+	       entry.depth_range == shadow_map.depth_range &&
+	       shift.x < static_cast<int32_t>(SHADOW_MAP_WIDTH) &&
+	       shift.y < static_cast<int32_t>(SHADOW_MAP_HEIGHT);
+}
+
+// A run of light space texels and where the cache layer stores its first one.
+struct TexelSpan
+{
+	int32_t first;
+	int32_t count;
+	int32_t stored;
+};
+
+// Split the texels [first, last) of a layer whose origin holds texel base where
+// they wrap around its edge, at most size texels.
+static uint32_t split_span(int32_t first, int32_t last, int32_t base, int32_t size, std::array<TexelSpan, 2> &spans)
+{
+	int32_t stored = (first - base) % size;
+	if (stored < 0)
+	{
+		stored += size;
+	}
+
+	const int32_t count = last - first;
+	if (stored + count <= size)
+	{
+		spans[0] = {first, count, stored};
+		return 1;
+	}
+
+	const int32_t head = size - stored;
+	spans[0]           = {first, head, stored};
+	spans[1]           = {first + head, count - head, 0};
+	return 2;
+}
+
+static void set_shadow_viewport(Init &init, VkCommandBuffer command_buffer, const VkViewport &viewport, const VkRect2D &scissor)
+{
+	init.disp.cmdSetViewport(command_buffer, 0, 1, &viewport);
+	init.disp.cmdSetScissor(command_buffer, 0, 1, &scissor);
+}
+
+// Draw the static casters over the light space texels [first, last) of the
+// cascade's cache layer, which has to be the current attachment. The cascade's
+// own matrix is used with the viewport slid to where the texels are stored, so
+// they end up exactly as a draw of the whole layer would have left them.
+static void draw_cache_region(Init              &init,
+                              RenderData        &data,
+                              VkCommandBuffer    command_buffer,
+                              GeometryBinding   &geometry,
+                              uint32_t           cascade,
+                              const CasterBatch &static_casters,
+                              glm::ivec2         first,
+                              glm::ivec2         last,
+                              bool               clear,
+                              float              lod_scale)
+{
+	const ShadowMap        &shadow_map = data.shadow_map;
+	const ShadowCacheEntry &entry      = shadow_map.cache_entries[cascade];
+	const glm::ivec2        window     = shadow_map.cascade_windows[cascade];
+
+	std::array<TexelSpan, 2> columns;
+	std::array<TexelSpan, 2> rows;
+	const uint32_t           column_count = split_span(first.x, last.x, entry.base.x, SHADOW_MAP_WIDTH, columns);
+	const uint32_t           row_count    = split_span(first.y, last.y, entry.base.y, SHADOW_MAP_HEIGHT, rows);
+
+	for (uint32_t c = 0; c < column_count; c++)
+	{
+		for (uint32_t r = 0; r < row_count; r++)
+		{
+			const TexelSpan &column = columns[c];
+			const TexelSpan &row    = rows[r];
+
+			VkViewport viewport = {};
+			viewport.x          = static_cast<float>(column.stored - (column.first - window.x));
+			viewport.y          = static_cast<float>(row.stored - (row.first - window.y));
+			viewport.width      = static_cast<float>(SHADOW_MAP_WIDTH);
+			viewport.height     = static_cast<float>(SHADOW_MAP_HEIGHT);
+			viewport.minDepth   = 0.0f;
+			viewport.maxDepth   = 1.0f;
+
+			VkRect2D scissor = {};
+			scissor.offset   = {column.stored, row.stored};
+			scissor.extent   = {static_cast<uint32_t>(column.count), static_cast<uint32_t>(row.count)};
+
+			set_shadow_viewport(init, command_buffer, viewport, scissor);
+
+			if (clear)
+			{
+				VkClearAttachment clear_attachment       = {};
+				clear_attachment.aspectMask              = VK_IMAGE_ASPECT_DEPTH_BIT;
+				clear_attachment.clearValue.depthStencil = {1.0f, 0};
+
+				VkClearRect clear_rect    = {};
+				clear_rect.rect           = scissor;
+				clear_rect.baseArrayLayer = 0;
+				clear_rect.layerCount     = 1;
+
+				init.disp.cmdClearAttachments(command_buffer, 1, &clear_attachment, 1, &clear_rect);
+			}
+
+			// the cache outlives the current view, so the camera can't cull what goes in it
+			const glm::ivec2          region_first(column.first, row.first);
+			const glm::ivec2          region_last(column.first + column.count, row.first + row.count);
+			std::vector<InstanceDraw> draws;
+			cull_casters(data, light_region_matrix(shadow_map, cascade, region_first, region_last), static_casters, nullptr, lod_scale, draws);
+
+			// the draw and triangle counts are for the main pass
+			CullingStats shadow_stats = {};
+			draw_instance_batches(init, command_buffer, geometry, *data.instance_buffer, *data.scene, data.scene_first_object, draws, shadow_stats);
+		}
+	}
+}
+
+// Bring the cascade's cache layer up to date. A redraw throws the layer away and
+// starts it over with its origin at the window; otherwise only the texels the
+// window slid onto since the last update are cleared and drawn.
+static void update_cache_layer(Init              &init,
+                               RenderData        &data,
+                               VkCommandBuffer    command_buffer,
+                               BarrierBatch      &barriers,
+                               GeometryBinding   &geometry,
+                               uint32_t           cascade,
+                               const CasterBatch &static_casters,
+                               bool               redraw,
+                               float              lod_scale)
+{
+	ShadowMap        &shadow_map = data.shadow_map;
+	ShadowCacheEntry &entry      = shadow_map.cache_entries[cascade];
+	const glm::ivec2  window     = shadow_map.cascade_windows[cascade];
+	const glm::ivec2  size(SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT);
+
+	// only the last copy out of the layer has to finish, a redraw doesn't care what it left
+	barriers.image(shadow_map.cache_image, image_range(VK_IMAGE_ASPECT_DEPTH_BIT, cascade, 1),
+	               redraw ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_NONE,
+	               VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+	               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+	barriers.flush(command_buffer);
+
+	begin_shadow_rendering(init, command_buffer, shadow_map.cache_layer_views[cascade], {SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT},
+	                       redraw ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD);
+
+	if (redraw)
+	{
+		entry.base = window;
+		draw_cache_region(init, data, command_buffer, geometry, cascade, static_casters, window, window + size, false, lod_scale);
+	}
+	else
+	{
+		const glm::ivec2 previous = entry.window;
+
+		// the columns the window moved onto, full height
+		if (window.x != previous.x)
+		{
+			const int32_t first = window.x > previous.x ? previous.x + size.x : window.x;
+			const int32_t last  = window.x > previous.x ? window.x + size.x : previous.x;
+			draw_cache_region(init, data, command_buffer, geometry, cascade, static_casters,
+			                  {first, window.y}, {last, window.y + size.y}, true, lod_scale);
+		}
+
+		// the rows it moved onto, across the columns the layer already had
+		if (window.y != previous.y)
+		{
+			const int32_t first = window.y > previous.y ? previous.y + size.y : window.y;
+			const int32_t last  = window.y > previous.y ? window.y + size.y : previous.y;
+			draw_cache_region(init, data, command_buffer, geometry, cascade, static_casters,
+			                  {std::max(window.x, previous.x), first}, {std::min(window.x, previous.x) + size.x, last}, true, lod_scale);
+		}
+	}
+
+	init.disp.cmdEndRendering(command_buffer);
+
+	set_shadow_viewport(init, command_buffer,
+	                    {0.0f, 0.0f, static_cast<float>(SHADOW_MAP_WIDTH), static_cast<float>(SHADOW_MAP_HEIGHT), 0.0f, 1.0f},
+	                    {{0, 0}, {SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT}});
+
+	// goes out together with the barrier in front of the copy
+	barriers.image(shadow_map.cache_image, image_range(VK_IMAGE_ASPECT_DEPTH_BIT, cascade, 1),
+	               VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	               VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+	               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+
+	entry.light_direction = shadow_map.light_direction;
+	entry.bias            = shadow_map.bias;
+	entry.slope_bias      = shadow_map.slope_bias;
+	entry.static_revision = data.scene->static_revision;
+	entry.valid           = true;
+	entry.texel_size      = shadow_map.cascade_texel_sizes[cascade];
+	entry.depth_range     = shadow_map.depth_range;
+	entry.window          = window;
+}
+
+// Copy the cascade's window out of the cache layer, in up to four pieces where it wraps.
+static void copy_cache_layer(Init &init, ShadowMap &shadow_map, VkCommandBuffer command_buffer, BarrierBatch &barriers, uint32_t cascade)
+{
+	barriers.image(shadow_map.image, image_range(VK_IMAGE_ASPECT_DEPTH_BIT, cascade, 1),
+	               VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	               VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+	               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+	barriers.flush(command_buffer);
+
+	const ShadowCacheEntry &entry  = shadow_map.cache_entries[cascade];
+	const glm::ivec2        window = shadow_map.cascade_windows[cascade];
+
+	std::array<TexelSpan, 2> columns;
+	std::array<TexelSpan, 2> rows;
+	const uint32_t           column_count = split_span(window.x, window.x + SHADOW_MAP_WIDTH, entry.base.x, SHADOW_MAP_WIDTH, columns);
+	const uint32_t           row_count    = split_span(window.y, window.y + SHADOW_MAP_HEIGHT, entry.base.y, SHADOW_MAP_HEIGHT, rows);
+
+	std::array<VkImageCopy, 4> regions      = {};
+	uint32_t                   region_count = 0;
+	for (uint32_t c = 0; c < column_count; c++)
+	{
+		for (uint32_t r = 0; r < row_count; r++)
+		{
+			VkImageCopy &region                  = regions[region_count++];
+			region.srcSubresource.aspectMask     = VK_IMAGE_ASPECT_DEPTH_BIT;
+			region.srcSubresource.mipLevel       = 0;
+			region.srcSubresource.baseArrayLayer = cascade;
+			region.srcSubresource.layerCount     = 1;
+			region.srcOffset                     = {columns[c].stored, rows[r].stored, 0};
+			region.dstSubresource                = region.srcSubresource;
+			region.dstOffset                     = {columns[c].first - window.x, rows[r].first - window.y, 0};
+			region.extent                        = {static_cast<uint32_t>(columns[c].count), static_cast<uint32_t>(rows[r].count), 1};
+		}
+	}
+
+	init.disp.cmdCopyImage(command_buffer,
+	                       shadow_map.cache_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	                       shadow_map.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	                       region_count, regions.data());
+
+	// flushed by whatever touches the shadow map next
+	barriers.image(shadow_map.image, image_range(VK_IMAGE_ASPECT_DEPTH_BIT, cascade, 1),
+	               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+	               VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+	               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+}
+
+static bool cache_layer_redraw(const ShadowMap &shadow_map, const Scene &scene, uint32_t cascade)
+{
+	return !cache_entry_current(shadow_map, scene, cascade) || !cache_layer_scrollable(shadow_map, cascade);
+}
+
+// Whether the static casters have to be drawn into the cascade's cache layer this frame.
+static bool cache_layer_stale(const ShadowMap &shadow_map, const Scene &scene, uint32_t cascade)
+{
+	return cache_layer_redraw(shadow_map, scene, cascade) ||
+	       shadow_map.cache_entries[cascade].window != shadow_map.cascade_windows[cascade];
+}
+
+// Bring one cascade up to date: redraw the static cache if anything it was
+// rendered with changed or scroll it after the window, restore the layer from
+// it, then draw the dynamic casters on top. A layer that already holds the current cache and has no
+// dynamic casters to add is left alone. The static batch is only read when the
+// cache layer is stale, and in GPU driven mode only the dynamic count is used.
+static void draw_cascade(Init              &init,
+                         RenderData        &data,
+                         VkCommandBuffer    command_buffer,
+                         BarrierBatch      &barriers,
+                         GeometryBinding   &geometry,
+                         uint32_t           cascade,
+                         const CasterBatch &static_casters,
+                         const CasterBatch &dynamic_casters,
+                         uint32_t           dynamic_count,
+                         const Frustum     &camera_frustum,
+                         float              lod_scale)
+{
+	ShadowMap &shadow_map = data.shadow_map;
+
+	init.disp.cmdPushConstants(command_buffer, data.shadow_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &shadow_map.cascade_matrices[cascade]);
+
+	// moving the camera only scrolls the layer, that still counts as cached
+	const bool redraw = cache_layer_redraw(shadow_map, *data.scene, cascade);
+	if (cache_layer_stale(shadow_map, *data.scene, cascade))
+	{
+		update_cache_layer(init, data, command_buffer, barriers, geometry, cascade, static_casters, redraw, lod_scale);
+		shadow_map.layer_is_cache[cascade] = false;
+	}
+	if (!redraw)
+	{
+		data.culling_stats.shadow_cascades_cached++;
+	}
 
+	// the culling pass already wrote the cascade's list, how many survived is only known on the device
+	std::vector<InstanceDraw> draws;
+	bool                      has_dynamic = dynamic_count > 0;
+	if (!data.gpu_driven)
+	{
+		cull_casters(data, shadow_map.cascade_matrices[cascade], dynamic_casters, &camera_frustum, lod_scale, draws);
+		has_dynamic = !draws.empty();
+	}
+
+	if (shadow_map.layer_is_cache[cascade] && !has_dynamic)
+	{
+		return;
+	}
+
+	copy_cache_layer(init, shadow_map, command_buffer, barriers, cascade);
+	shadow_map.layer_is_cache[cascade] = !has_dynamic;
+
+	if (!has_dynamic)
+	{
+		return;
+	}
+
+	barriers.flush(command_buffer);
+	begin_shadow_rendering(init, command_buffer, shadow_map.layer_views[cascade], {SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT}, VK_ATTACHMENT_LOAD_OP_LOAD);
+
+	if (data.gpu_driven)
+	{
+		// the cache layers and the atlas draw through the instance buffer, switch back afterwards
+		init.disp.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.gpu_shadow_pipeline);
+		data.gpu_culling->draw(command_buffer, geometry, GPU_VIEW_FIRST_CASCADE + cascade);
+		init.disp.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.shadow_pipeline);
+	}
+	else
+	{
+		CullingStats shadow_stats = {};
+		draw_instance_batches(init, command_buffer, geometry, *data.instance_buffer, *data.scene, data.scene_first_object, draws, shadow_stats);
+	}
+
+	init.disp.cmdEndRendering(command_buffer);
+}
+
+// Render the atlas tiles that went stale, every other tile keeps last frame's depth.
+static void draw_shadow_atlas(Init              &init,
+                              RenderData        &data,
+                              VkCommandBuffer    command_buffer,
+                              BarrierBatch      &barriers,
+                              GeometryBinding   &geometry,
+                              const CasterBatch &static_casters,
+                              const CasterBatch &dynamic_casters,
+                              float              lod_scale)
+{
+	const ShadowAtlas                  &atlas = *data.shadow_atlas;
+	const std::vector<ShadowAtlasView> &views = atlas.pending_views();
+
+	data.culling_stats.shadow_lights         = atlas.shadowed_lights();
+	data.culling_stats.shadow_views_rendered = static_cast<uint32_t>(views.size());
+
+	if (views.empty())
+	{
+		return;
+	}
+
+	transition_shadowmap_to_depth_attachment(barriers, atlas.image());
+	barriers.flush(command_buffer);
+	begin_shadow_rendering(init, command_buffer, atlas.image_view(), {SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE}, VK_ATTACHMENT_LOAD_OP_LOAD);
+
+	for (const ShadowAtlasView &view : views)
+	{
+		VkViewport viewport{};
+		viewport.x = static_cast<float>(view.rect.offset.x);
+		viewport.y = static_cast<float>(view.rect.offset.y);
+		viewport.width = static_cast<float>(view.rect.extent.width);
+		viewport.height = static_cast<float>(view.rect.extent.height);
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+
+		init.disp.cmdSetViewport(command_buffer, 0, 1, &viewport);
+		init.disp.cmdSetScissor(command_buffer, 0, 1, &view.rect);
+
+		// only this tile is cleared, the load op keeps the others
+		VkClearAttachment clear = {};
+		clear.aspectMask        = VK_IMAGE_ASPECT_DEPTH_BIT;
+		clear.clearValue.depthStencil = {1.0f, 0};
+
+		VkClearRect clear_rect    = {};
+		clear_rect.rect           = view.rect;
+		clear_rect.baseArrayLayer = 0;
+		clear_rect.layerCount     = 1;
+
+		init.disp.cmdClearAttachments(command_buffer, 1, &clear, 1, &clear_rect);
+
+		init.disp.cmdPushConstants(command_buffer, data.shadow_pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &view.view_projection);
+
+		// the tile outlives the current view, so the camera can't cull what goes in it
+		std::vector<InstanceDraw> draws;
+		cull_casters(data, view.view_projection, static_casters, nullptr, lod_scale, draws);
+		cull_casters(data, view.view_projection, dynamic_casters, nullptr, lod_scale, draws);
+
+		CullingStats shadow_stats = {};
+		draw_instance_batches(init, command_buffer, geometry, *data.instance_buffer, *data.scene, data.scene_first_object, draws, shadow_stats);
+	}
+
+	init.disp.cmdEndRendering(command_buffer);
+	transition_shadowmap_to_shader_read(barriers, atlas.image());
+}
+
+void draw_shadow(Init &init, RenderData &data, VkCommandBuffer &command_buffer)
+{
 	// Set viewport
 	VkViewport viewport{};
 	viewport.x = 0.0f;
@@ -163,45 +677,151 @@ void draw_shadow(Init &init, RenderData &data, VkCommandBuffer &command_buffer,
 	init.disp.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.shadow_pipeline);
 
 	// bind descriptor set
-	init.disp.cmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.shadow_pipeline_layout, 0, 1, &data.descriptor_sets[image_index], 0, nullptr);
+	const auto &frame = data.frames[data.current_frame];
+	init.disp.cmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, data.shadow_pipeline_layout, 0, 1, &frame.descriptor_set,
+	                                static_cast<uint32_t>(frame.dynamic_offsets.size()), frame.dynamic_offsets.data());
+
+	GeometryBinding geometry = data.geometry_pool->bind_positions(command_buffer);
+
+	// the error is judged from the main camera, where the shadow ends up on screen
+	const float   lod_scale      = projection_scale(data.camera.fov, static_cast<float>(init.swapchain.extent.height));
+	const Frustum camera_frustum = extract_frustum(data.camera.getProjectionMatrix() * data.camera.getViewMatrix());
+
+	// The atlas culls everything on the CPU. Otherwise static bounds are only needed
+	// when a cache layer is drawn into, and dynamic ones only without the GPU pass,
+	// which culls from the instance buffer and just has to know whether any exist.
+	const Scene &scene         = *data.scene;
+	const bool   atlas_pending = !data.shadow_atlas->pending_views().empty();
+	bool         static_needed = atlas_pending;
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		static_needed = static_needed || cache_layer_stale(data.shadow_map, scene, cascade);
+	}
+	const bool dynamic_needed = atlas_pending || !data.gpu_driven;
+
+	// world bounds of the casters once, every cascade culls the same batches
+	CasterBatch static_casters;
+	CasterBatch dynamic_casters;
+	uint32_t    dynamic_count = 0;
+	for (size_t i = 0; i < scene.instance_count(); i++)
+	{
+		if (!scene.casts_shadows[i])
+		{
+			continue;
+		}
+
+		if (!scene.is_static[i])
+		{
+			dynamic_count++;
+		}
+
+		if (scene.is_static[i] ? static_needed : dynamic_needed)
+		{
+			CasterBatch &casters = scene.is_static[i] ? static_casters : dynamic_casters;
+			casters.bounds.push(*scene.meshes[scene.mesh_indices[i]], scene.transforms[i]);
+			casters.instances.push_back(static_cast<uint32_t>(i));
+		}
+	}
 
-	data.bunny_mesh->draw(init, command_buffer);
-	//data.mesh->draw(init, command_buffer);
-	//data.plane_mesh->draw(init, command_buffer);
+	// barriers trailing one step wait in the batch and go out with the next step's
+	BarrierBatch barriers(init);
 
-	init.disp.cmdEndRendering(command_buffer);
+	// one pass per layer, the states above carry over between them
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		draw_cascade(init, data, command_buffer, barriers, geometry, cascade, static_casters, dynamic_casters, dynamic_count, camera_frustum, lod_scale);
+	}
+
+	// spot and point lights, the viewport and scissor change per tile from here on
+	draw_shadow_atlas(init, data, command_buffer, barriers, geometry, static_casters, dynamic_casters, lod_scale);
+
+	barriers.flush(command_buffer);
 }
 
-glm::mat4 calculate_light_space_matrix(const glm::vec3 &light_direction,
-                                       const glm::vec3 &scene_center,
-                                       float            scene_radius,
-                                       float light_distance = 25.0f,
-                                       float near_plane = 1.0f,
-                                       float far_plane = 7.5f
-                                       )
+// Practical split scheme: blend of logarithmic and uniform splits of [near, far].
+static std::array<float, SHADOW_CASCADE_COUNT> calculate_cascade_splits(float near_plane, float far_plane, float lambda)
 {
-	glm::vec3 light_position = scene_center - light_direction * light_distance;
+	std::array<float, SHADOW_CASCADE_COUNT> splits;
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		const float p           = static_cast<float>(i + 1) / SHADOW_CASCADE_COUNT;
+		const float logarithmic = near_plane * std::pow(far_plane / near_plane, p);
+		const float uniform     = near_plane + (far_plane - near_plane) * p;
+		splits[i]               = lambda * logarithmic + (1.0f - lambda) * uniform;
+	}
+	return splits;
+}
+
+// Bounding sphere of one slice of the camera frustum. Its size stays the same
+// while the camera moves and turns, and with it the cascade's texel size.
+static void calculate_slice_sphere(const Camera &camera, float slice_near, float slice_far, glm::vec3 &center, float &radius)
+{
+	const glm::mat4 inverse_view = glm::inverse(camera.getViewMatrix());
+	const float     tan_y        = std::tan(glm::radians(camera.fov) * 0.5f);
+	const float     tan_x        = tan_y * camera.aspectRatio;
+
+	std::array<glm::vec3, 8> corners;
+	center = glm::vec3(0.0f);
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		const float     distance = i < 4 ? slice_near : slice_far;
+		const glm::vec3 view_corner((i & 1 ? 1.0f : -1.0f) * tan_x * distance,
+		                            (i & 2 ? 1.0f : -1.0f) * tan_y * distance,
+		                            -distance);
+		corners[i] = glm::vec3(inverse_view * glm::vec4(view_corner, 1.0f));
+		center += corners[i] / 8.0f;
+	}
 
-	glm::mat4 light_view = glm::lookAt(
-	    light_position,
-	    scene_center,
-	    glm::vec3(0.0f, 1.0f, 0.0f)
-	);
+	radius = 0.0f;
+	for (const glm::vec3 &corner : corners)
+	{
+		radius = std::max(radius, glm::length(corner - center));
+	}
+	radius = std::ceil(radius * 16.0f) / 16.0f;
+}
 
-	glm::mat4 light_projection = glm::ortho(
-	    -scene_radius, scene_radius,
-	    -scene_radius, scene_radius,
-	    near_plane, far_plane
-	);
+// Rotation into light space about the world origin, shared by every cascade so
+// the light's texel grid stays where it is while the camera moves.
+static glm::mat4 calculate_light_view(const glm::vec3 &light_direction)
+{
+	const glm::vec3 forward = glm::normalize(light_direction);
+	const glm::vec3 up      = std::abs(forward.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	return glm::lookAt(glm::vec3(0.0f), forward, up);
+}
 
-	return light_projection * light_view;
+// World box around the bounding spheres of the static casters.
+static void fit_static_bounds(ShadowMap &shadow_map, const Scene &scene)
+{
+	glm::vec3 bounds_min(std::numeric_limits<float>::max());
+	glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+	bool      found = false;
+
+	for (size_t i = 0; i < scene.instance_count(); i++)
+	{
+		if (!scene.casts_shadows[i] || !scene.is_static[i])
+		{
+			continue;
+		}
+
+		glm::vec3 center;
+		float     radius;
+		bounding_sphere(*scene.meshes[scene.mesh_indices[i]], scene.transforms[i], center, radius);
+
+		bounds_min = glm::min(bounds_min, center - glm::vec3(radius));
+		bounds_max = glm::max(bounds_max, center + glm::vec3(radius));
+		found      = true;
+	}
+
+	shadow_map.static_bounds_min      = bounds_min;
+	shadow_map.static_bounds_max      = bounds_max;
+	shadow_map.has_static_bounds      = found;
+	shadow_map.static_bounds_revision = scene.static_revision;
 }
 
 void init_shadow_map(Init &init, RenderData &data) {
 	create_shadow_map(init, data, SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT);
 
 	const glm::vec3 light_direction = glm::normalize(glm::vec3(-1.0f, -1.0f, -2.2f));
-	const glm::vec3 center = glm::vec3(0.0f);
 
 	data.shadow_map.light_direction = light_direction;
 
@@ -210,16 +830,68 @@ void init_shadow_map(Init &init, RenderData &data) {
 }
 
 void update_shadow(Init &init, RenderData &data) {
-	const glm::vec3 center = glm::vec3(0.0f);
-
-	data.shadow_map.light_space_matrix = calculate_light_space_matrix(
-	    data.shadow_map.light_direction,
-	    center,
-	    data.shadow_map.radius,
-	    data.shadow_map.light_distance,
-	    data.shadow_map.near_plane,
-	    data.shadow_map.far_plane
-	    );
+	ShadowMap    &shadow_map = data.shadow_map;
+	const Camera &camera     = data.camera;
+
+	if (data.scene && data.scene->static_revision != shadow_map.static_bounds_revision)
+	{
+		fit_static_bounds(shadow_map, *data.scene);
+	}
+
+	shadow_map.light_view = calculate_light_view(shadow_map.light_direction);
+
+	const float shadow_far = std::min(camera.farPlane, shadow_map.shadow_distance);
+	shadow_map.cascade_splits = calculate_cascade_splits(camera.nearPlane, shadow_far, shadow_map.split_lambda);
+
+	// Depth covers the static casters, pulled towards the light so casters above them
+	// are still caught. Receivers past the far end compare as lit, the reference is
+	// clamped to one. Without static casters it follows the slices instead.
+	glm::vec2 depth_range(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+	if (shadow_map.has_static_bounds)
+	{
+		for (uint32_t i = 0; i < 8; i++)
+		{
+			const glm::vec3 corner(i & 1 ? shadow_map.static_bounds_max.x : shadow_map.static_bounds_min.x,
+			                       i & 2 ? shadow_map.static_bounds_max.y : shadow_map.static_bounds_min.y,
+			                       i & 4 ? shadow_map.static_bounds_max.z : shadow_map.static_bounds_min.z);
+			const float     z = (shadow_map.light_view * glm::vec4(corner, 1.0f)).z;
+			depth_range       = glm::vec2(std::min(depth_range.x, z), std::max(depth_range.y, z));
+		}
+		depth_range.y += shadow_map.light_distance;
+	}
+
+	// each window snapped to whole texels of the grid, which keeps edges from shimmering
+	float slice_near = camera.nearPlane;
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		glm::vec3 center;
+		float     radius;
+		calculate_slice_sphere(camera, slice_near, shadow_map.cascade_splits[cascade], center, radius);
+
+		const float     texel        = 2.0f * radius / static_cast<float>(SHADOW_MAP_WIDTH);
+		const glm::vec3 light_center = glm::vec3(shadow_map.light_view * glm::vec4(center, 1.0f));
+
+		shadow_map.cascade_texel_sizes[cascade] = texel;
+		shadow_map.cascade_windows[cascade]     = glm::ivec2(glm::round(glm::vec2(light_center) / texel)) -
+		                                          glm::ivec2(SHADOW_MAP_WIDTH / 2, SHADOW_MAP_HEIGHT / 2);
+
+		if (!shadow_map.has_static_bounds)
+		{
+			depth_range = glm::vec2(std::min(depth_range.x, light_center.z - radius),
+			                        std::max(depth_range.y, light_center.z + radius + shadow_map.light_distance));
+		}
+
+		slice_near = shadow_map.cascade_splits[cascade];
+	}
+
+	shadow_map.depth_range = depth_range;
+
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		const glm::ivec2 window = shadow_map.cascade_windows[cascade];
+		shadow_map.cascade_matrices[cascade] = light_region_matrix(shadow_map, cascade, window,
+		                                                           window + glm::ivec2(SHADOW_MAP_WIDTH, SHADOW_MAP_HEIGHT));
+	}
 }
 
 VkPipelineLayout create_shadow_pipeline_layout(Init& init, RenderData& data) {
@@ -227,8 +899,15 @@ VkPipelineLayout create_shadow_pipeline_layout(Init& init, RenderData& data) {
 	pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipeline_layout_info.setLayoutCount = 1;
 	pipeline_layout_info.pSetLayouts = &data.descriptor_set_layout;
-	pipeline_layout_info.pushConstantRangeCount = 0;
-	pipeline_layout_info.pPushConstantRanges = nullptr;
+
+	// per instance model matrix comes from the instance buffer, only the light's matrix is pushed
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	push_constant_range.offset = 0;
+	push_constant_range.size = sizeof(glm::mat4);
+
+	pipeline_layout_info.pushConstantRangeCount = 1;
+	pipeline_layout_info.pPushConstantRanges = &push_constant_range;
 
 	VkPipelineLayout pipeline_layout;
 	vkCreatePipelineLayout(init.device, &pipeline_layout_info, nullptr, &pipeline_layout);
@@ -236,7 +915,7 @@ VkPipelineLayout create_shadow_pipeline_layout(Init& init, RenderData& data) {
 	return pipeline_layout;
 }
 
-VkPipeline create_shadow_pipeline(Init &init, VkPipelineLayout pipeline_layout) {
+VkPipeline create_shadow_pipeline(Init &init, VkPipelineLayout pipeline_layout, VertexFormat vertex_format, bool direct_objects) {
 
 	auto vert_code = read_file("shaders/shadow.vert.spv");
 
@@ -248,26 +927,17 @@ VkPipeline create_shadow_pipeline(Init &init, VkPipelineLayout pipeline_layout)
 	vert_shader_stage_info.module = vert_shader_module;
 	vert_shader_stage_info.pName = "main";
 
-	VkPipelineShaderStageCreateInfo shader_stages[] = {vert_shader_stage_info};
-
-	VkVertexInputBindingDescription bindingDescription;
-	bindingDescription.binding = 0;
-	bindingDescription.stride = sizeof(Vertex);
-	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	// DIRECT_OBJECTS, the GPU culling's draws carry the object index as firstInstance
+	const VkBool32                 direct_objects_value = direct_objects ? VK_TRUE : VK_FALSE;
+	const VkSpecializationMapEntry specialization_entry = {0, 0, sizeof(VkBool32)};
+	const VkSpecializationInfo     specialization_info  = {1, &specialization_entry, sizeof(VkBool32), &direct_objects_value};
+	vert_shader_stage_info.pSpecializationInfo = &specialization_info;
 
-	std::array<VkVertexInputAttributeDescription, 1> attributeDescriptions{};
-
-	attributeDescriptions[0].binding = 0;
-	attributeDescriptions[0].location = 0;
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[0].offset = offsetof(Vertex, pos);
+	VkPipelineShaderStageCreateInfo shader_stages[] = {vert_shader_stage_info};
 
-	VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
-	vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertex_input_info.vertexBindingDescriptionCount = 1;
-	vertex_input_info.pVertexBindingDescriptions = &bindingDescription;
-	vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertex_input_info.pVertexAttributeDescriptions = attributeDescriptions.data();
+	// only the position is fetched, but the stride has to match the pool's layout
+	const VertexInputDescription vertex_input = describe_vertex_input(vertex_format, true);
+	VkPipelineVertexInputStateCreateInfo vertex_input_info = vertex_input.create_info();
 
 	VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
 	input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -375,7 +1045,8 @@ VkPipeline create_shadow_pipeline(Init &init, VkPipelineLayout pipeline_layout)
 
 void init_shadow_pipeline(Init &init, RenderData &data) {
 	data.shadow_pipeline_layout = create_shadow_pipeline_layout(init, data);
-	data.shadow_pipeline = create_shadow_pipeline(init, data.shadow_pipeline_layout);
+	data.shadow_pipeline = create_shadow_pipeline(init, data.shadow_pipeline_layout, data.vertex_format, false);
+	data.gpu_shadow_pipeline = create_shadow_pipeline(init, data.shadow_pipeline_layout, data.vertex_format, true);
 }
 
 }		// namespace obsidian
\ No newline at end of file
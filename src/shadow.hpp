@@ -12,7 +12,7 @@ struct RenderData;
 
 
 
-void draw_shadow(Init &init, RenderData &data, VkCommandBuffer &command_buffer, uint32_t image_index);
+void draw_shadow(Init &init, RenderData &data, VkCommandBuffer &command_buffer);
 
 void update_shadow(Init &init, RenderData &data);
 
@@ -0,0 +1,438 @@
+//
+// Created by rfdic on 9/24/2024.
+//
+
+#include "shadow_atlas.hpp"
+
+#include "culling.hpp"
+#include "mesh.hpp"
+#include "scene.hpp"
+
+namespace obsidian
+{
+
+ShadowAtlas::ShadowAtlas(Init &init) :
+    init(init)
+{
+	VkImageCreateInfo image_info = {};
+	image_info.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType         = VK_IMAGE_TYPE_2D;
+	image_info.extent.width      = SHADOW_ATLAS_SIZE;
+	image_info.extent.height     = SHADOW_ATLAS_SIZE;
+	image_info.extent.depth      = 1;
+	image_info.mipLevels         = 1;
+	image_info.arrayLayers       = 1;
+	image_info.format            = SHADOW_ATLAS_FORMAT;
+	image_info.tiling            = VK_IMAGE_TILING_OPTIMAL;
+	image_info.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+	image_info.usage             = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.samples           = VK_SAMPLE_COUNT_1_BIT;
+
+	VmaAllocationCreateInfo allocation_create_info = {};
+	allocation_create_info.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	if (vmaCreateImage(init.allocator, &image_info, &allocation_create_info, &atlas_image, &allocation, nullptr) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create shadow atlas!");
+	}
+
+	VkImageViewCreateInfo view_info           = {};
+	view_info.sType                           = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image                           = atlas_image;
+	view_info.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format                          = SHADOW_ATLAS_FORMAT;
+	view_info.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_DEPTH_BIT;
+	view_info.subresourceRange.baseMipLevel   = 0;
+	view_info.subresourceRange.levelCount     = 1;
+	view_info.subresourceRange.baseArrayLayer = 0;
+	view_info.subresourceRange.layerCount     = 1;
+
+	if (vkCreateImageView(init.device, &view_info, nullptr, &view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create shadow atlas view!");
+	}
+
+	// the shader clamps to the tile, the edge mode only matters for the atlas border
+	VkSamplerCreateInfo sampler_info     = {};
+	sampler_info.sType                   = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter               = VK_FILTER_LINEAR;
+	sampler_info.minFilter               = VK_FILTER_LINEAR;
+	sampler_info.addressModeU            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW            = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.anisotropyEnable        = VK_FALSE;
+	sampler_info.maxAnisotropy           = 1.0f;
+	sampler_info.borderColor             = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	sampler_info.unnormalizedCoordinates = VK_FALSE;
+	sampler_info.compareEnable           = VK_TRUE;
+	sampler_info.compareOp               = VK_COMPARE_OP_LESS_OR_EQUAL;
+	sampler_info.mipmapMode              = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler_info.mipLodBias              = 0.0f;
+	sampler_info.minLod                  = 0.0f;
+	sampler_info.maxLod                  = 0.0f;
+
+	if (vkCreateSampler(init.device, &sampler_info, nullptr, &atlas_sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create shadow atlas sampler!");
+	}
+
+	// the whole atlas starts out as free tiles of the largest size
+	const uint32_t root_tiles = SHADOW_ATLAS_SIZE / SHADOW_ATLAS_MAX_TILE;
+	for (uint32_t y = 0; y < root_tiles; y++)
+	{
+		for (uint32_t x = 0; x < root_tiles; x++)
+		{
+			free_tiles[0].push_back(glm::uvec2(x, y));
+		}
+	}
+}
+
+ShadowAtlas::~ShadowAtlas()
+{
+	vkDestroySampler(init.device, atlas_sampler, nullptr);
+	vkDestroyImageView(init.device, view, nullptr);
+	vmaDestroyImage(init.allocator, atlas_image, allocation);
+}
+
+bool ShadowAtlas::allocate_tile(uint32_t level, Tile &tile)
+{
+	if (!free_tiles[level].empty())
+	{
+		tile = {level, free_tiles[level].back()};
+		free_tiles[level].pop_back();
+		return true;
+	}
+
+	// split a tile of the level above, keep one quarter and free the rest
+	Tile parent;
+	if (level == 0 || !allocate_tile(level - 1, parent))
+	{
+		return false;
+	}
+
+	const glm::uvec2 base = parent.position * 2u;
+	free_tiles[level].push_back(base + glm::uvec2(1, 0));
+	free_tiles[level].push_back(base + glm::uvec2(0, 1));
+	free_tiles[level].push_back(base + glm::uvec2(1, 1));
+
+	tile = {level, base};
+	return true;
+}
+
+void ShadowAtlas::free_tile(const Tile &tile)
+{
+	std::vector<glm::uvec2> &free_list = free_tiles[tile.level];
+
+	if (tile.level > 0)
+	{
+		// merge back into the parent when the other three quarters are free too
+		const glm::uvec2 base = tile.position & ~glm::uvec2(1);
+
+		std::array<std::vector<glm::uvec2>::iterator, 3> siblings;
+		size_t                                           found = 0;
+		for (auto it = free_list.begin(); it != free_list.end() && found < siblings.size(); ++it)
+		{
+			if ((*it & ~glm::uvec2(1)) == base)
+			{
+				siblings[found++] = it;
+			}
+		}
+
+		if (found == siblings.size())
+		{
+			// erase from the back so the earlier iterators stay valid
+			for (size_t i = siblings.size(); i-- > 0;)
+			{
+				free_list.erase(siblings[i]);
+			}
+
+			free_tile({tile.level - 1, base / 2u});
+			return;
+		}
+	}
+
+	free_list.push_back(tile.position);
+}
+
+bool ShadowAtlas::allocate_slot(uint32_t light, uint32_t level, uint32_t view_count)
+{
+	Slot slot = {};
+	slot.light = light;
+	slot.level = level;
+
+	while (slot.tiles.size() < view_count)
+	{
+		Tile tile;
+		if (allocate_tile(level, tile))
+		{
+			slot.tiles.push_back(tile);
+			continue;
+		}
+
+		if (!evict_least_recently_used())
+		{
+			for (const Tile &allocated : slot.tiles)
+			{
+				free_tile(allocated);
+			}
+			return false;
+		}
+	}
+
+	slots.push_back(std::move(slot));
+	return true;
+}
+
+void ShadowAtlas::release_slot(size_t slot)
+{
+	for (const Tile &tile : slots[slot].tiles)
+	{
+		free_tile(tile);
+	}
+
+	if (slot + 1 < slots.size())
+	{
+		slots[slot] = std::move(slots.back());
+	}
+	slots.pop_back();
+}
+
+bool ShadowAtlas::evict_least_recently_used()
+{
+	// lights already placed this frame keep their tiles
+	size_t   victim    = slots.size();
+	uint64_t last_used = frame;
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		if (slots[i].last_used < last_used)
+		{
+			victim    = i;
+			last_used = slots[i].last_used;
+		}
+	}
+
+	if (victim == slots.size())
+	{
+		return false;
+	}
+
+	release_slot(victim);
+	return true;
+}
+
+ShadowAtlas::Slot *ShadowAtlas::find_slot(uint32_t light)
+{
+	for (Slot &slot : slots)
+	{
+		if (slot.light == light)
+		{
+			return &slot;
+		}
+	}
+
+	return nullptr;
+}
+
+VkRect2D ShadowAtlas::tile_rect(const Tile &tile) const
+{
+	const uint32_t size = SHADOW_ATLAS_MAX_TILE >> tile.level;
+
+	VkRect2D rect;
+	rect.offset = {static_cast<int32_t>(tile.position.x * size), static_cast<int32_t>(tile.position.y * size)};
+	rect.extent = {size, size};
+	return rect;
+}
+
+void ShadowAtlas::update(const Scene &scene, const Camera &camera, float viewport_height, LightBuffer &buffer)
+{
+	frame++;
+	pending.clear();
+
+	const glm::mat4 view_projection = camera.getProjectionMatrix() * camera.getViewMatrix();
+	const Frustum   frustum         = extract_frustum(view_projection);
+	const float     scale           = projection_scale(camera.fov, viewport_height);
+	const uint32_t  light_count     = static_cast<uint32_t>(std::min<size_t>(scene.lights.size(), MAX_LIGHTS));
+
+	// screen space size of every visible shadowed light, the largest get served first
+	struct Request
+	{
+		uint32_t light;
+		float    importance;
+	};
+
+	std::vector<Request> requests;
+	for (uint32_t i = 0; i < light_count; i++)
+	{
+		const Light &light = scene.lights[i];
+		if (!light.casts_shadow || !sphere_in_frustum(frustum, light.position, light.range))
+		{
+			continue;
+		}
+
+		const float distance = glm::length(light.position - camera.position);
+		const float pixels   = distance > light.range ? light.range * scale / distance : viewport_height;
+		requests.push_back({i, pixels});
+	}
+
+	std::sort(requests.begin(), requests.end(), [](const Request &a, const Request &b) { return a.importance > b.importance; });
+
+	// lights that are close to a moving caster are rendered every frame
+	std::vector<glm::vec4> dynamic_casters;
+	for (size_t i = 0; i < scene.instance_count(); i++)
+	{
+		if (scene.casts_shadows[i] && !scene.is_static[i])
+		{
+			glm::vec3 center;
+			float     radius;
+			bounding_sphere(*scene.meshes[scene.mesh_indices[i]], scene.transforms[i], center, radius);
+			dynamic_casters.push_back(glm::vec4(center, radius));
+		}
+	}
+
+	buffer.light_count = light_count;
+	for (uint32_t i = 0; i < light_count; i++)
+	{
+		const Light &light = scene.lights[i];
+
+		LightData &data        = buffer.lights[i];
+		data.position_range    = glm::vec4(light.position, light.range);
+		data.direction_cone    = glm::vec4(glm::normalize(light.direction), std::cos(light.outer_angle));
+		data.color             = glm::vec4(light.color * light.intensity, 1.0f);
+		data.type              = static_cast<uint32_t>(light.type);
+		data.first_shadow_view = -1;
+	}
+
+	uint32_t view_count = 0;
+	shadowed_count      = 0;
+
+	for (const Request &request : requests)
+	{
+		const Light &light = scene.lights[request.light];
+
+		std::array<glm::mat4, 6> matrices;
+		const uint32_t           light_views = light_shadow_matrices(light, matrices);
+		if (view_count + light_views > MAX_SHADOW_VIEWS)
+		{
+			continue;
+		}
+
+		// tile about as large as the light is on screen
+		const float    texels = std::clamp(request.importance, static_cast<float>(SHADOW_ATLAS_MIN_TILE), static_cast<float>(SHADOW_ATLAS_MAX_TILE));
+		const uint32_t level  = std::min(static_cast<uint32_t>(std::log2(SHADOW_ATLAS_MAX_TILE / texels)), SHADOW_ATLAS_LEVELS - 1);
+
+		Slot *slot = find_slot(request.light);
+		if (slot && slot->level != level)
+		{
+			release_slot(static_cast<size_t>(slot - slots.data()));
+			slot = nullptr;
+		}
+
+		// fall back to smaller tiles when the atlas is full of this frame's lights
+		for (uint32_t try_level = level; !slot && try_level < SHADOW_ATLAS_LEVELS; try_level++)
+		{
+			if (allocate_slot(request.light, try_level, light_views))
+			{
+				slot = &slots.back();
+			}
+		}
+
+		if (!slot)
+		{
+			continue;
+		}
+
+		slot->last_used = frame;
+
+		bool stale = slot->static_revision != scene.static_revision ||
+		             slot->matrices.size() != light_views ||
+		             !std::equal(slot->matrices.begin(), slot->matrices.end(), matrices.begin());
+
+		for (const glm::vec4 &caster : dynamic_casters)
+		{
+			stale = stale || glm::length(glm::vec3(caster) - light.position) < light.range + caster.w;
+		}
+
+		buffer.lights[request.light].first_shadow_view = static_cast<int32_t>(view_count);
+
+		for (uint32_t v = 0; v < light_views; v++)
+		{
+			const VkRect2D rect = tile_rect(slot->tiles[v]);
+
+			const glm::vec4 texel_rect(rect.offset.x, rect.offset.y, rect.extent.width, rect.extent.height);
+
+			ShadowViewData &shadow_view = buffer.shadow_views[view_count++];
+			shadow_view.view_projection = matrices[v];
+			shadow_view.uv_rect         = texel_rect / static_cast<float>(SHADOW_ATLAS_SIZE);
+
+			if (stale)
+			{
+				pending.push_back({matrices[v], rect});
+			}
+		}
+
+		slot->matrices.assign(matrices.begin(), matrices.begin() + light_views);
+		slot->static_revision = scene.static_revision;
+		shadowed_count++;
+	}
+}
+
+const std::vector<ShadowAtlasView> &ShadowAtlas::pending_views() const
+{
+	return pending;
+}
+
+uint32_t ShadowAtlas::shadowed_lights() const
+{
+	return shadowed_count;
+}
+
+VkImage ShadowAtlas::image() const
+{
+	return atlas_image;
+}
+
+VkImageView ShadowAtlas::image_view() const
+{
+	return view;
+}
+
+VkSampler ShadowAtlas::sampler() const
+{
+	return atlas_sampler;
+}
+
+uint32_t light_shadow_matrices(const Light &light, std::array<glm::mat4, 6> &matrices)
+{
+	// zero-to-one depth like the cascades, the near plane scales with the light
+	const float near_plane = std::max(light.range * 0.01f, 0.05f);
+
+	if (light.type == LightType::SPOT)
+	{
+		const glm::vec3 forward = glm::normalize(light.direction);
+		const glm::vec3 up      = std::abs(forward.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+		matrices[0] = glm::perspectiveRH_ZO(2.0f * light.outer_angle, 1.0f, near_plane, light.range) *
+		              glm::lookAt(light.position, light.position + forward, up);
+		return 1;
+	}
+
+	// cube faces in the order simple.frag picks them: +x, -x, +y, -y, +z, -z
+	static const std::array<glm::vec3, 6> directions = {
+	    glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+	    glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	    glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)};
+	static const std::array<glm::vec3, 6> ups = {
+	    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	    glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+	    glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)};
+
+	const glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(90.0f), 1.0f, near_plane, light.range);
+	for (uint32_t face = 0; face < 6; face++)
+	{
+		matrices[face] = projection * glm::lookAt(light.position, light.position + directions[face], ups[face]);
+	}
+
+	return 6;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,99 @@
+//
+// Created by rfdic on 9/24/2024.
+//
+
+#ifndef TOYRENDERER_SHADOW_ATLAS_HPP
+#define TOYRENDERER_SHADOW_ATLAS_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+struct Light;
+
+constexpr uint32_t SHADOW_ATLAS_SIZE       = 4096;
+constexpr uint32_t SHADOW_ATLAS_MAX_TILE   = 1024;
+constexpr uint32_t SHADOW_ATLAS_MIN_TILE   = 128;
+constexpr uint32_t SHADOW_ATLAS_LEVELS     = 4;        // 1024, 512, 256 and 128 texel tiles
+constexpr VkFormat SHADOW_ATLAS_FORMAT     = VK_FORMAT_D16_UNORM;
+
+// A view of the atlas that has to be rendered this frame.
+struct ShadowAtlasView
+{
+	glm::mat4 view_projection;
+	VkRect2D  rect;
+};
+
+// One depth texture shared by every shadowed spot and point light. Lights get
+// power of two tiles sized by how large they are on screen, allocated from a
+// quadtree so four tiles of one level always merge back into one of the level
+// above. Tiles stay with their light across frames and are only rendered again
+// when the light or the casters around it change; when the atlas is full, the
+// least recently used lights lose their tiles first.
+class ShadowAtlas
+{
+  public:
+	explicit ShadowAtlas(Init &init);
+	~ShadowAtlas();
+
+	// Pick tiles for this frame's lights, fill the light buffer and collect the
+	// views whose tiles need rendering.
+	void update(const Scene &scene, const Camera &camera, float viewport_height, LightBuffer &buffer);
+
+	const std::vector<ShadowAtlasView> &pending_views() const;
+	uint32_t                            shadowed_lights() const;
+
+	VkImage     image() const;
+	VkImageView image_view() const;
+	VkSampler   sampler() const;
+
+  private:
+	struct Tile
+	{
+		uint32_t   level;
+		glm::uvec2 position;        // in tiles of this level
+	};
+
+	// a light holding tiles, point lights hold one per cube face
+	struct Slot
+	{
+		uint32_t                 light;
+		uint32_t                 level;
+		std::vector<Tile>        tiles;
+		std::vector<glm::mat4>   matrices;        // what the tiles were rendered with
+		uint64_t                 last_used;
+		uint32_t                 static_revision;
+	};
+
+	bool allocate_tile(uint32_t level, Tile &tile);
+	void free_tile(const Tile &tile);
+
+	bool allocate_slot(uint32_t light, uint32_t level, uint32_t view_count);
+	void release_slot(size_t slot);
+	bool evict_least_recently_used();
+
+	Slot    *find_slot(uint32_t light);
+	VkRect2D tile_rect(const Tile &tile) const;
+
+	Init &init;
+
+	VkImage       atlas_image;
+	VmaAllocation allocation;
+	VkImageView   view;
+	VkSampler     atlas_sampler;
+
+	std::array<std::vector<glm::uvec2>, SHADOW_ATLAS_LEVELS> free_tiles;
+	std::vector<Slot>                                        slots;
+	std::vector<ShadowAtlasView>                             pending;
+
+	uint64_t frame          = 0;
+	uint32_t shadowed_count = 0;
+};
+
+// view projections of a light, one for a spot light and six cube faces for a point light
+uint32_t light_shadow_matrices(const Light &light, std::array<glm::mat4, 6> &matrices);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_SHADOW_ATLAS_HPP
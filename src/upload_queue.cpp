@@ -0,0 +1,330 @@
+//
+// Created by rfdic on 9/3/2024.
+//
+
+#include "upload_queue.hpp"
+
+#include "barrier_batch.hpp"
+
+namespace obsidian
+{
+
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static VkCommandPool create_upload_command_pool(Init &init, uint32_t queue_family)
+{
+	VkCommandPoolCreateInfo pool_info = {};
+	pool_info.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.queueFamilyIndex        = queue_family;
+	pool_info.flags                   = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandPool pool;
+	if (init.disp.createCommandPool(&pool_info, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload command pool!");
+	}
+
+	return pool;
+}
+
+UploadQueue::UploadQueue(Init &init, BufferAllocation staging_buffer) :
+    init(init), staging(staging_buffer), staging_head(0), timeline_value(0)
+{
+	VmaAllocationInfo allocation_info = {};
+	vmaGetAllocationInfo(init.allocator, staging.allocation, &allocation_info);
+	staging_data = static_cast<uint8_t *>(allocation_info.pMappedData);
+
+	transfer_pool = create_upload_command_pool(init, init.transfer_queue_family);
+
+	VkSemaphoreTypeCreateInfo type_info = {};
+	type_info.sType                     = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	type_info.semaphoreType             = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue              = 0;
+
+	VkSemaphoreCreateInfo semaphore_info = {};
+	semaphore_info.sType                 = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphore_info.pNext                 = &type_info;
+
+	if (init.disp.createSemaphore(&semaphore_info, nullptr, &timeline_semaphore) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload timeline semaphore!");
+	}
+}
+
+UploadQueue::~UploadQueue()
+{
+	wait(flush());
+
+	init.disp.destroySemaphore(timeline_semaphore, nullptr);
+	init.disp.destroyCommandPool(transfer_pool, nullptr);
+}
+
+VkDeviceSize UploadQueue::allocate_staging(VkDeviceSize                         size, VkDeviceSize alignment)
+{
+	VkDeviceSize offset = align_up(staging_head, alignment);
+
+	if (offset + size > staging.size)
+	{
+		recycle_staging();
+		offset = 0;
+	}
+
+	staging_head = offset + size;
+	return offset;
+}
+
+void UploadQueue::recycle_staging()
+{
+	// the staging buffer is full: everything queued so far has to land before it can be reused
+	wait(flush());
+	staging_head = 0;
+}
+
+void UploadQueue::upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, const void                           *data, VkDeviceSize                         size)
+{
+	const auto *src = static_cast<const uint8_t *>(data);
+
+	while (size > 0)
+	{
+		VkDeviceSize offset = align_up(staging_head, STAGING_ALIGNMENT);
+		if (offset >= staging.size)
+		{
+			recycle_staging();
+			offset = 0;
+		}
+
+		VkDeviceSize chunk = std::min(size, staging.size - offset);
+		memcpy(staging_data + offset, src, static_cast<size_t>(chunk));
+		staging_head = offset + chunk;
+
+		VkBufferCopy region = {};
+		region.srcOffset    = offset;
+		region.dstOffset    = dst_offset;
+		region.size         = chunk;
+		pending_buffer_copies[dst].push_back(region);
+
+		src += chunk;
+		dst_offset += chunk;
+		size -= chunk;
+	}
+}
+
+StagingRange UploadQueue::reserve_staging(VkDeviceSize                         size)
+{
+	if (size > staging.size)
+	{
+		throw std::runtime_error("staging reservation does not fit in the staging buffer!");
+	}
+
+	VkDeviceSize offset = allocate_staging(size, STAGING_ALIGNMENT);
+	return {staging.buffer, offset, size, staging_data + offset};
+}
+
+VkDeviceSize UploadQueue::staging_capacity() const
+{
+	return staging.size;
+}
+
+void UploadQueue::copy_regions(VkBuffer dst, const std::vector<VkBufferCopy> &regions)
+{
+	auto &pending = pending_buffer_copies[dst];
+	pending.insert(pending.end(), regions.begin(), regions.end());
+}
+
+void UploadQueue::upload_image(VkImage                              dst,
+                               const VkImageSubresourceRange        &range,
+                               const void                           *data,
+                               VkDeviceSize                         size,
+                               const std::vector<VkBufferImageCopy> &regions,
+                               VkImageLayout                        final_layout)
+{
+	if (size > staging.size)
+	{
+		throw std::runtime_error("image upload does not fit in the staging buffer!");
+	}
+
+	// the alignment covers the texel block sizes bufferOffset has to be a multiple of
+	VkDeviceSize offset = allocate_staging(size, STAGING_ALIGNMENT);
+	memcpy(staging_data + offset, data, static_cast<size_t>(size));
+
+	ImageCopy copy = {dst, range, regions, final_layout};
+	for (VkBufferImageCopy &region : copy.regions)
+	{
+		region.bufferOffset += offset;
+	}
+	pending_image_copies.push_back(std::move(copy));
+}
+
+VkCommandBuffer UploadQueue::begin_command_buffer()
+{
+	VkCommandBufferAllocateInfo alloc_info = {};
+	alloc_info.sType                       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	alloc_info.level                       = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	alloc_info.commandPool                 = transfer_pool;
+	alloc_info.commandBufferCount          = 1;
+
+	VkCommandBuffer command_buffer;
+	if (init.disp.allocateCommandBuffers(&alloc_info, &command_buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+
+	VkCommandBufferBeginInfo begin_info = {};
+	begin_info.sType                    = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags                    = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	init.disp.beginCommandBuffer(command_buffer, &begin_info);
+
+	return command_buffer;
+}
+
+void UploadQueue::submit(VkCommandBuffer command_buffer, UploadTicket signal_value)
+{
+	VkTimelineSemaphoreSubmitInfo timeline_info = {};
+	timeline_info.sType                         = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timeline_info.signalSemaphoreValueCount     = 1;
+	timeline_info.pSignalSemaphoreValues        = &signal_value;
+
+	VkSubmitInfo submit_info         = {};
+	submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext                = &timeline_info;
+	submit_info.commandBufferCount   = 1;
+	submit_info.pCommandBuffers      = &command_buffer;
+	submit_info.signalSemaphoreCount = 1;
+	submit_info.pSignalSemaphores    = &timeline_semaphore;
+
+	if (init.disp.queueSubmit(init.transfer_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to submit upload batch!");
+	}
+}
+
+UploadTicket UploadQueue::flush()
+{
+	if (pending_buffer_copies.empty() && pending_image_copies.empty())
+	{
+		return timeline_value;
+	}
+
+	collect();
+
+	// staging memory may not be host coherent
+	vmaFlushAllocation(init.allocator, staging.allocation, 0, VK_WHOLE_SIZE);
+
+	VkCommandBuffer command_buffer = begin_command_buffer();
+
+	// every destination image into TRANSFER_DST in one barrier, its old contents are dropped
+	BarrierBatch barriers(init);
+	for (const ImageCopy &copy : pending_image_copies)
+	{
+		barriers.image(copy.image, copy.range,
+		               VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		               VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+		               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+	}
+	barriers.flush(command_buffer);
+
+	for (const auto &[buffer, regions] : pending_buffer_copies)
+	{
+		init.disp.cmdCopyBuffer(command_buffer, staging.buffer, buffer, static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	for (const ImageCopy &copy : pending_image_copies)
+	{
+		init.disp.cmdCopyBufferToImage(command_buffer, staging.buffer, copy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		                               static_cast<uint32_t>(copy.regions.size()), copy.regions.data());
+	}
+
+	// Destinations are CONCURRENT across the families (see create_upload_buffer), so nothing changes
+	// hands. On a dedicated transfer queue the timeline signal makes the writes available to whoever
+	// waits on the ticket; on the graphics queue the copied regions need a barrier of their own.
+	const bool            shared_queue = init.transfer_queue_family == init.graphics_queue_family;
+	VkPipelineStageFlags2 dst_stages   = shared_queue ? VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_2_NONE;
+	VkAccessFlags2        dst_access   = shared_queue ? VK_ACCESS_2_MEMORY_READ_BIT : VK_ACCESS_2_NONE;
+	if (shared_queue)
+	{
+		for (const auto &[buffer, regions] : pending_buffer_copies)
+		{
+			for (const VkBufferCopy &region : regions)
+			{
+				barriers.buffer(buffer, region.dstOffset, region.size,
+				                VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+				                dst_stages, dst_access);
+			}
+		}
+	}
+
+	// the images still have to reach their final layout on this queue, before the ticket signals
+	for (const ImageCopy &copy : pending_image_copies)
+	{
+		barriers.image(copy.image, copy.range,
+		               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy.final_layout,
+		               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		               dst_stages, dst_access);
+	}
+	barriers.flush(command_buffer);
+
+	init.disp.endCommandBuffer(command_buffer);
+
+	Batch batch          = {};
+	batch.command_buffer = command_buffer;
+	batch.ticket         = ++timeline_value;
+	submit(command_buffer, batch.ticket);
+
+	in_flight.push_back(batch);
+	pending_buffer_copies.clear();
+	pending_image_copies.clear();
+
+	return batch.ticket;
+}
+
+void UploadQueue::collect()
+{
+	uint64_t completed = 0;
+	init.disp.getSemaphoreCounterValue(timeline_semaphore, &completed);
+
+	auto done = std::remove_if(in_flight.begin(), in_flight.end(), [&](const Batch &batch) {
+		if (batch.ticket > completed)
+		{
+			return false;
+		}
+
+		init.disp.freeCommandBuffers(transfer_pool, 1, &batch.command_buffer);
+		return true;
+	});
+	in_flight.erase(done, in_flight.end());
+}
+
+bool UploadQueue::is_complete(UploadTicket ticket)
+{
+	uint64_t completed = 0;
+	init.disp.getSemaphoreCounterValue(timeline_semaphore, &completed);
+	return completed >= ticket;
+}
+
+void UploadQueue::wait(UploadTicket ticket)
+{
+	if (ticket != 0)
+	{
+		VkSemaphoreWaitInfo wait_info = {};
+		wait_info.sType               = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		wait_info.semaphoreCount      = 1;
+		wait_info.pSemaphores         = &timeline_semaphore;
+		wait_info.pValues             = &ticket;
+
+		init.disp.waitSemaphores(&wait_info, UINT64_MAX);
+	}
+
+	collect();
+}
+
+VkSemaphore UploadQueue::timeline() const
+{
+	return timeline_semaphore;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,105 @@
+//
+// Created by rfdic on 9/3/2024.
+//
+
+#ifndef TOYRENDERER_UPLOAD_QUEUE_HPP
+#define TOYRENDERER_UPLOAD_QUEUE_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+// Value of the upload timeline semaphore at which a flushed batch is complete.
+using UploadTicket = uint64_t;
+
+// Mapped slice of the staging buffer handed out for callers that pack data themselves.
+struct StagingRange
+{
+	VkBuffer     buffer;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	uint8_t     *data;
+};
+
+// Batches buffer and image uploads through the shared staging buffer and
+// submits them together on the transfer queue. Nothing blocks until a caller
+// waits on a ticket, so loading N meshes costs one submission instead of N
+// queue idles. Destinations must not be used by the GPU before their ticket
+// has been reached, and are created with create_upload_buffer so the transfer
+// and graphics families can share them without ownership transfers; images
+// need the same CONCURRENT sharing when the families differ.
+class UploadQueue
+{
+  public:
+	UploadQueue(Init &init, BufferAllocation staging_buffer);
+	~UploadQueue();
+
+	// copy data into staging and queue a copy into dst, large uploads are split across batches
+	void upload_buffer(VkBuffer dst, VkDeviceSize dst_offset, const void                           *data, VkDeviceSize                         size);
+
+	// reserve contiguous staging space, the contents must be consumed by copy_regions before the next flush
+	StagingRange reserve_staging(VkDeviceSize                         size);
+	VkDeviceSize staging_capacity() const;
+
+	// queue copies whose srcOffset points into ranges returned by reserve_staging
+	void copy_regions(VkBuffer dst, const std::vector<VkBufferCopy> &regions);
+
+	// Copy data into staging and queue its copy into dst, each region's bufferOffset
+	// relative to data. The range goes from UNDEFINED to final_layout in the same batch,
+	// so whatever it held is lost. Unlike buffers an image is never split across batches.
+	void upload_image(VkImage                              dst,
+	                  const VkImageSubresourceRange        &range,
+	                  const void                           *data,
+	                  VkDeviceSize                         size,
+	                  const std::vector<VkBufferImageCopy> &regions,
+	                  VkImageLayout                        final_layout);
+
+	// submit everything queued so far
+	UploadTicket flush();
+
+	bool is_complete(UploadTicket ticket);
+	void wait(UploadTicket ticket);
+
+	VkSemaphore timeline() const;
+
+  private:
+	struct Batch
+	{
+		VkCommandBuffer command_buffer;
+		UploadTicket    ticket;
+	};
+
+	struct ImageCopy
+	{
+		VkImage                        image;
+		VkImageSubresourceRange        range;
+		std::vector<VkBufferImageCopy> regions;        // bufferOffset into staging
+		VkImageLayout                  final_layout;
+	};
+
+	VkDeviceSize    allocate_staging(VkDeviceSize                         size, VkDeviceSize alignment);
+	void            recycle_staging();
+	VkCommandBuffer begin_command_buffer();
+	void            submit(VkCommandBuffer command_buffer, UploadTicket signal_value);
+	void            collect();
+
+	Init &init;
+
+	BufferAllocation staging;
+	uint8_t         *staging_data;
+	VkDeviceSize     staging_head;
+
+	VkCommandPool transfer_pool;
+
+	VkSemaphore  timeline_semaphore;
+	UploadTicket timeline_value;
+
+	std::unordered_map<VkBuffer, std::vector<VkBufferCopy>> pending_buffer_copies;
+	std::vector<ImageCopy>                                 pending_image_copies;
+	std::vector<Batch>                                     in_flight;
+};
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_UPLOAD_QUEUE_HPP
@@ -3,6 +3,7 @@
 #include <vulkan/vulkan.h>
 
 #include "common.hpp"
+#include "barrier_batch.hpp"
 
 namespace obsidian
 {
@@ -37,12 +38,39 @@ void end_single_time_commands(Init &init, VkCommandBuffer commandBuffer)
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers    = &commandBuffer;
 
-	init.disp.queueSubmit(init.graphics_queue, 1, &submitInfo, VK_NULL_HANDLE);
-	init.disp.queueWaitIdle(init.graphics_queue);
+	// wait for this submission only instead of idling the whole graphics queue
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 
+	VkFence fence;
+	init.disp.createFence(&fenceInfo, nullptr, &fence);
+
+	init.disp.queueSubmit(init.graphics_queue, 1, &submitInfo, fence);
+	init.disp.waitForFences(1, &fence, VK_TRUE, UINT64_MAX);
+
+	init.disp.destroyFence(fence, nullptr);
 	init.disp.freeCommandBuffers(init.command_pool, 1, &commandBuffer);
 }
 
+static void create_buffer(Init                     &init,
+                          const VkBufferCreateInfo &bufferInfo,
+                          VmaMemoryUsage            memoryUsage,
+                          BufferAllocation         &bufferAllocation)
+{
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage                   = memoryUsage;
+
+	if (vmaCreateBuffer(init.allocator, &bufferInfo, &allocInfo,
+	                    &bufferAllocation.buffer,
+	                    &bufferAllocation.allocation,
+	                    nullptr) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create buffer!");
+	}
+
+	bufferAllocation.size = bufferInfo.size;
+}
+
 void create_buffer(Init              &init,
                    VkDeviceSize       size,
                    VkBufferUsageFlags usage,
@@ -55,18 +83,32 @@ void create_buffer(Init              &init,
 	bufferInfo.usage              = usage;
 	bufferInfo.sharingMode        = VK_SHARING_MODE_EXCLUSIVE;
 
-	VmaAllocationCreateInfo allocInfo = {};
-	allocInfo.usage                   = memoryUsage;
+	create_buffer(init, bufferInfo, memoryUsage, bufferAllocation);
+}
 
-	if (vmaCreateBuffer(init.allocator, &bufferInfo, &allocInfo,
-	                    &bufferAllocation.buffer,
-	                    &bufferAllocation.allocation,
-	                    nullptr) != VK_SUCCESS)
+void create_upload_buffer(Init              &init,
+                          VkDeviceSize       size,
+                          VkBufferUsageFlags usage,
+                          VmaMemoryUsage     memoryUsage,
+                          BufferAllocation  &bufferAllocation)
+{
+	const uint32_t families[] = {init.graphics_queue_family, init.transfer_queue_family};
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType              = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size               = size;
+	bufferInfo.usage              = usage;
+	bufferInfo.sharingMode        = VK_SHARING_MODE_EXCLUSIVE;
+
+	// with a single family there is nobody to share with
+	if (init.graphics_queue_family != init.transfer_queue_family)
 	{
-		throw std::runtime_error("failed to create buffer!");
+		bufferInfo.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices   = families;
 	}
 
-	bufferAllocation.size = size;
+	create_buffer(init, bufferInfo, memoryUsage, bufferAllocation);
 }
 
 void cleanup_buffer(Init &init, BufferAllocation &bufferAllocation)
@@ -124,143 +166,31 @@ VkResult copy_buffer(Init &init, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDevic
 	return VK_SUCCESS;
 }
 
-void transition_image_to_color_attachment(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image) {
-	VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-
-	init.disp.cmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-}
-
-void transition_image_to_depth_attachment(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image)
-{
-	VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = 0;
-	barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
-
-    init.disp.cmdPipelineBarrier(command_buffer,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-}
-
-void transition_shadowmap_to_shader_read(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image) {
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-	init.disp.cmdPipelineBarrier(
-	    command_buffer,
-		VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-	 	VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-	 	0,
-	    0, nullptr,
-	    0, nullptr,
-	    1, &barrier);
-
-}
-
-void transition_image_to_present(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image)
+void transition_shadowmap_to_shader_read(BarrierBatch &barriers, const VkImage& image)
 {
-	VkImageMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-
-	init.disp.cmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	// depth stores land in the late fragment tests
+	barriers.image(image, image_range(VK_IMAGE_ASPECT_DEPTH_BIT),
+	               VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	               VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+	               VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
 }
 
-void transition_shadowmap_to_depth_attachment(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image)
+void transition_shadowmap_to_depth_attachment(BarrierBatch &barriers, const VkImage& image)
 {
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-	init.disp.cmdPipelineBarrier(
-	    command_buffer,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-	 	VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-	 	0,
-	    0, nullptr,
-	    0, nullptr,
-	    1, &barrier);
+	// reads only have to finish before the depth tests overwrite them, there is nothing to make visible
+	barriers.image(image, image_range(VK_IMAGE_ASPECT_DEPTH_BIT),
+	               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	               VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_NONE,
+	               VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+	               VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
 }
 
-void transition_shadowmap_initial(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image)
+void transition_shadowmap_initial(BarrierBatch &barriers, const VkImage& image)
 {
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = 0;
-	barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-	init.disp.cmdPipelineBarrier(
-	    command_buffer,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-	 	VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-	 	0,
-	    0, nullptr,
-	    0, nullptr,
-	    1, &barrier);
+	barriers.image(image, image_range(VK_IMAGE_ASPECT_DEPTH_BIT),
+	               VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	               VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+	               VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
 }
 
 }
\ No newline at end of file
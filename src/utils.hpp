@@ -7,6 +7,7 @@ namespace obsidian
 {
 struct Init;
 struct BufferAllocation;
+class BarrierBatch;
 
 VkCommandBuffer begin_single_time_commands(Init &init);
 void            end_single_time_commands(Init &init, VkCommandBuffer commandBuffer);
@@ -17,6 +18,15 @@ void create_buffer(Init              &init,
                    VmaMemoryUsage     memoryUsage,
                    BufferAllocation  &bufferAllocation);
 
+// A buffer the upload queue copies into, possibly many times over its life. It is
+// shared by the graphics and transfer families, so uploads into one region leave
+// the contents of the others defined without any ownership transfers.
+void create_upload_buffer(Init              &init,
+                          VkDeviceSize       size,
+                          VkBufferUsageFlags usage,
+                          VmaMemoryUsage     memoryUsage,
+                          BufferAllocation  &bufferAllocation);
+
 void cleanup_buffer(Init &init, BufferAllocation &bufferAllocation);
 
 std::vector<char> read_file(const std::string &filename);
@@ -24,14 +34,9 @@ VkShaderModule    create_shader_module(Init &init, const std::vector<char> &code
 
 VkResult copy_buffer(Init &init, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
-void transition_image_to_color_attachment(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image);
-
-void transition_image_to_depth_attachment(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image);
-
-void transition_image_to_present(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image);
-
-void transition_shadowmap_initial(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image);
-void transition_shadowmap_to_shader_read(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image);
-void transition_shadowmap_to_depth_attachment(Init &init, const VkCommandBuffer& command_buffer, const VkImage& image);
+// shadow map layout changes, added to a batch that the caller flushes
+void transition_shadowmap_initial(BarrierBatch &barriers, const VkImage& image);
+void transition_shadowmap_to_shader_read(BarrierBatch &barriers, const VkImage& image);
+void transition_shadowmap_to_depth_attachment(BarrierBatch &barriers, const VkImage& image);
 
 } // namespace obsidian
\ No newline at end of file
@@ -0,0 +1,257 @@
+//
+// Created by rfdic on 9/14/2024.
+//
+
+#include "vertex_format.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+namespace obsidian
+{
+
+VkPipelineVertexInputStateCreateInfo VertexInputDescription::create_info() const
+{
+	VkPipelineVertexInputStateCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	info.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+	info.pVertexBindingDescriptions = bindings.data();
+	info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+	info.pVertexAttributeDescriptions = attributes.data();
+	return info;
+}
+
+uint32_t vertex_position_stride(VertexFormat format)
+{
+	return format == VertexFormat::FULL ? sizeof(glm::vec3) : sizeof(CompactPosition);
+}
+
+uint32_t vertex_attribute_stride(VertexFormat format)
+{
+	switch (format)
+	{
+		case VertexFormat::COMPACT:
+			return sizeof(CompactAttributes);
+		case VertexFormat::COMPACT_COLOR:
+			return sizeof(CompactColorAttributes);
+		case VertexFormat::FULL:
+		default:
+			return sizeof(FullAttributes);
+	}
+}
+
+uint32_t vertex_format_stride(VertexFormat format)
+{
+	return vertex_position_stride(format) + vertex_attribute_stride(format);
+}
+
+VertexInputDescription describe_vertex_input(VertexFormat format, bool position_only)
+{
+	VertexInputDescription description;
+
+	description.bindings.push_back({POSITION_BINDING, vertex_position_stride(format), VK_VERTEX_INPUT_RATE_VERTEX});
+	description.attributes.push_back({0, POSITION_BINDING, format == VertexFormat::FULL ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R16G16B16A16_SFLOAT, 0});
+
+	if (position_only)
+	{
+		return description;
+	}
+
+	description.bindings.push_back({ATTRIBUTE_BINDING, vertex_attribute_stride(format), VK_VERTEX_INPUT_RATE_VERTEX});
+
+	if (format == VertexFormat::FULL)
+	{
+		description.attributes.push_back({1, ATTRIBUTE_BINDING, VK_FORMAT_R32G32B32_SFLOAT, offsetof(FullAttributes, color)});
+		description.attributes.push_back({2, ATTRIBUTE_BINDING, VK_FORMAT_R32G32_SFLOAT, offsetof(FullAttributes, tex_coord)});
+		description.attributes.push_back({3, ATTRIBUTE_BINDING, VK_FORMAT_R32G32B32_SFLOAT, offsetof(FullAttributes, normal)});
+		return description;
+	}
+
+	description.attributes.push_back({2, ATTRIBUTE_BINDING, VK_FORMAT_R16G16_SFLOAT, offsetof(CompactAttributes, tex_coord)});
+	description.attributes.push_back({3, ATTRIBUTE_BINDING, VK_FORMAT_R16G16_SNORM, offsetof(CompactAttributes, normal)});
+	if (format == VertexFormat::COMPACT_COLOR)
+	{
+		description.attributes.push_back({1, ATTRIBUTE_BINDING, VK_FORMAT_R8G8B8A8_UNORM, offsetof(CompactColorAttributes, color)});
+	}
+
+	return description;
+}
+
+static float sign_not_zero(float value)
+{
+	return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+glm::vec2 encode_octahedral(const glm::vec3 &normal)
+{
+	const float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (l1 == 0.0f)
+	{
+		return glm::vec2(0.0f);
+	}
+
+	glm::vec2 p = glm::vec2(normal.x, normal.y) / l1;
+
+	// fold the lower hemisphere over the diagonals
+	if (normal.z < 0.0f)
+	{
+		p = glm::vec2((1.0f - std::abs(p.y)) * sign_not_zero(p.x),
+		              (1.0f - std::abs(p.x)) * sign_not_zero(p.y));
+	}
+
+	return p;
+}
+
+glm::vec3 decode_octahedral(const glm::vec2 &encoded)
+{
+	glm::vec3 n(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+
+	const float t = std::max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+
+	return glm::normalize(n);
+}
+
+static CompactPosition encode_compact_position(const glm::vec3 &pos)
+{
+	CompactPosition compact = {};
+	compact.pos[0] = glm::packHalf1x16(pos.x);
+	compact.pos[1] = glm::packHalf1x16(pos.y);
+	compact.pos[2] = glm::packHalf1x16(pos.z);
+	compact.pos[3] = glm::packHalf1x16(1.0f);
+	return compact;
+}
+
+static CompactAttributes encode_compact_attributes(const Vertex &vertex)
+{
+	CompactAttributes compact = {};
+
+	const glm::vec2 octahedral = encode_octahedral(vertex.normal);
+	compact.normal[0] = static_cast<int16_t>(glm::packSnorm1x16(octahedral.x));
+	compact.normal[1] = static_cast<int16_t>(glm::packSnorm1x16(octahedral.y));
+
+	compact.tex_coord[0] = glm::packHalf1x16(vertex.tex_coord.x);
+	compact.tex_coord[1] = glm::packHalf1x16(vertex.tex_coord.y);
+
+	return compact;
+}
+
+void encode_vertices(const Vertex *vertices, size_t count, VertexFormat format, uint8_t *positions, uint8_t *attributes)
+{
+	switch (format)
+	{
+		case VertexFormat::FULL:
+		{
+			auto *out_positions  = reinterpret_cast<glm::vec3 *>(positions);
+			auto *out_attributes = reinterpret_cast<FullAttributes *>(attributes);
+			for (size_t i = 0; i < count; i++)
+			{
+				out_positions[i]  = vertices[i].pos;
+				out_attributes[i] = {vertices[i].color, vertices[i].tex_coord, vertices[i].normal};
+			}
+			break;
+		}
+
+		case VertexFormat::COMPACT:
+		{
+			auto *out_positions  = reinterpret_cast<CompactPosition *>(positions);
+			auto *out_attributes = reinterpret_cast<CompactAttributes *>(attributes);
+			for (size_t i = 0; i < count; i++)
+			{
+				out_positions[i]  = encode_compact_position(vertices[i].pos);
+				out_attributes[i] = encode_compact_attributes(vertices[i]);
+			}
+			break;
+		}
+
+		case VertexFormat::COMPACT_COLOR:
+		{
+			auto *out_positions  = reinterpret_cast<CompactPosition *>(positions);
+			auto *out_attributes = reinterpret_cast<CompactColorAttributes *>(attributes);
+			for (size_t i = 0; i < count; i++)
+			{
+				out_positions[i]             = encode_compact_position(vertices[i].pos);
+				out_attributes[i].attributes = encode_compact_attributes(vertices[i]);
+
+				const glm::vec3 color = glm::clamp(vertices[i].color, 0.0f, 1.0f) * 255.0f + 0.5f;
+				out_attributes[i].color[0] = static_cast<uint8_t>(color.r);
+				out_attributes[i].color[1] = static_cast<uint8_t>(color.g);
+				out_attributes[i].color[2] = static_cast<uint8_t>(color.b);
+				out_attributes[i].color[3] = 255;
+			}
+			break;
+		}
+	}
+}
+
+Vertex decode_vertex(const uint8_t *position, const uint8_t *attributes, VertexFormat format)
+{
+	Vertex vertex = {};
+
+	if (format == VertexFormat::FULL)
+	{
+		FullAttributes full;
+		memcpy(&vertex.pos, position, sizeof(glm::vec3));
+		memcpy(&full, attributes, sizeof(full));
+		vertex.color     = full.color;
+		vertex.tex_coord = full.tex_coord;
+		vertex.normal    = full.normal;
+		return vertex;
+	}
+
+	CompactPosition   compact_position;
+	CompactAttributes compact;
+	memcpy(&compact_position, position, sizeof(compact_position));
+	memcpy(&compact, attributes, sizeof(compact));
+
+	vertex.pos = {glm::unpackHalf1x16(compact_position.pos[0]), glm::unpackHalf1x16(compact_position.pos[1]), glm::unpackHalf1x16(compact_position.pos[2])};
+	vertex.normal = decode_octahedral({glm::unpackSnorm1x16(static_cast<uint16_t>(compact.normal[0])),
+	                                   glm::unpackSnorm1x16(static_cast<uint16_t>(compact.normal[1]))});
+	vertex.tex_coord = {glm::unpackHalf1x16(compact.tex_coord[0]), glm::unpackHalf1x16(compact.tex_coord[1])};
+	vertex.color = glm::vec3(1.0f);
+
+	if (format == VertexFormat::COMPACT_COLOR)
+	{
+		CompactColorAttributes colored;
+		memcpy(&colored, attributes, sizeof(colored));
+		vertex.color = glm::vec3(colored.color[0], colored.color[1], colored.color[2]) / 255.0f;
+	}
+
+	return vertex;
+}
+
+VertexEncodingError measure_encoding_error(const std::vector<Vertex> &vertices, VertexFormat format)
+{
+	VertexEncodingError error = {};
+
+	const uint32_t       position_stride  = vertex_position_stride(format);
+	const uint32_t       attribute_stride = vertex_attribute_stride(format);
+	std::vector<uint8_t> positions(vertices.size() * position_stride);
+	std::vector<uint8_t> attributes(vertices.size() * attribute_stride);
+	encode_vertices(vertices.data(), vertices.size(), format, positions.data(), attributes.data());
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const Vertex &source  = vertices[i];
+		const Vertex  decoded = decode_vertex(positions.data() + i * position_stride, attributes.data() + i * attribute_stride, format);
+
+		error.position  = std::max(error.position, glm::length(decoded.pos - source.pos));
+		error.tex_coord = std::max(error.tex_coord, glm::length(decoded.tex_coord - source.tex_coord));
+
+		const float source_length = glm::length(source.normal);
+		if (source_length > 0.0f)
+		{
+			const float cosine = glm::clamp(glm::dot(decoded.normal, source.normal / source_length), -1.0f, 1.0f);
+			error.normal_degrees = std::max(error.normal_degrees, glm::degrees(std::acos(cosine)));
+		}
+
+		if (format == VertexFormat::COMPACT_COLOR)
+		{
+			error.color = std::max(error.color, glm::length(decoded.color - glm::clamp(source.color, 0.0f, 1.0f)));
+		}
+	}
+
+	return error;
+}
+
+}        // namespace obsidian
@@ -0,0 +1,78 @@
+//
+// Created by rfdic on 9/14/2024.
+//
+
+#ifndef TOYRENDERER_VERTEX_FORMAT_HPP
+#define TOYRENDERER_VERTEX_FORMAT_HPP
+
+#include "common.hpp"
+
+namespace obsidian
+{
+
+// Vertices are stored as two streams indexed by the same vertex: positions at
+// binding 0 and everything else at binding 1, so depth-only passes fetch
+// nothing but positions.
+constexpr uint32_t POSITION_BINDING  = 0;
+constexpr uint32_t ATTRIBUTE_BINDING = 1;
+
+struct FullAttributes
+{
+	glm::vec3 color;
+	glm::vec2 tex_coord;
+	glm::vec3 normal;
+};
+
+struct CompactPosition
+{
+	uint16_t pos[4];        // fp16, w is always 1
+};
+
+struct CompactAttributes
+{
+	int16_t  normal[2];           // octahedral, snorm
+	uint16_t tex_coord[2];        // fp16
+};
+
+struct CompactColorAttributes
+{
+	CompactAttributes attributes;
+	uint8_t           color[4];
+};
+
+struct VertexInputDescription
+{
+	std::vector<VkVertexInputBindingDescription>   bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+
+	// points into this description, keep it alive until the pipeline is created
+	VkPipelineVertexInputStateCreateInfo create_info() const;
+};
+
+// largest differences between the source vertices and their decoded encoding
+struct VertexEncodingError
+{
+	float position;              // world units
+	float normal_degrees;
+	float tex_coord;
+	float color;
+};
+
+uint32_t vertex_position_stride(VertexFormat format);
+uint32_t vertex_attribute_stride(VertexFormat format);
+uint32_t vertex_format_stride(VertexFormat format);        // both streams together
+
+// vertex input state matching the format, optionally just the position stream
+VertexInputDescription describe_vertex_input(VertexFormat format, bool position_only = false);
+
+void   encode_vertices(const Vertex *vertices, size_t count, VertexFormat format, uint8_t *positions, uint8_t *attributes);
+Vertex decode_vertex(const uint8_t *position, const uint8_t *attributes, VertexFormat format);
+
+glm::vec2 encode_octahedral(const glm::vec3 &normal);
+glm::vec3 decode_octahedral(const glm::vec2 &encoded);
+
+VertexEncodingError measure_encoding_error(const std::vector<Vertex> &vertices, VertexFormat format);
+
+}        // namespace obsidian
+
+#endif        // TOYRENDERER_VERTEX_FORMAT_HPP
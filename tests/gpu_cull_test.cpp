@@ -0,0 +1,545 @@
+//
+// Created by rfdic on 10/2/2024.
+//
+
+// Runs cull.comp once on a headless device over a random scene and compares the
+// draw lists it writes with gpu_cull_reference. Any Vulkan 1.3 device does,
+// lavapipe included; without one the check reports itself as skipped. Objects
+// the device's float math may decide either way are left out of the comparison.
+
+#include "barrier_batch.hpp"
+#include "culling.hpp"
+#include "gpu_culling.hpp"
+#include "utils.hpp"
+
+#include <random>
+
+using namespace obsidian;
+
+constexpr int          SKIPPED        = 77;        // SKIP_RETURN_CODE of the test
+constexpr uint32_t     OBJECT_COUNT   = 4096;
+constexpr uint32_t     FIRST_OBJECT   = 16;        // the scene doesn't start at the front of the object buffer
+constexpr uint32_t     VIEW_COUNT     = 2;
+constexpr uint32_t     LIST_COUNT     = VIEW_COUNT * 2;
+constexpr VkDeviceSize COMMAND_STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+
+// Relative distance to a plane or an lod threshold under which the shader and the
+// reference may round to different sides. Well above float error, well below the
+// gaps between the scene's objects.
+constexpr float BORDERLINE_MARGIN = 1e-4f;
+
+static bool create_device(Init &init)
+{
+	vkb::InstanceBuilder instance_builder;
+	auto                 instance_ret = instance_builder.set_app_name("gpu_cull_test").require_api_version(1, 3, 0).set_headless(true).build();
+	if (!instance_ret)
+	{
+		std::cout << instance_ret.error().message() << std::endl;
+		return false;
+	}
+	init.instance  = instance_ret.value();
+	init.inst_disp = init.instance.make_table();
+
+	// the barrier batch records vkCmdPipelineBarrier2
+	VkPhysicalDeviceVulkan13Features features13 = {};
+	features13.sType                            = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+	features13.synchronization2                 = VK_TRUE;
+
+	vkb::PhysicalDeviceSelector selector(init.instance);
+	auto                        physical_device_ret = selector.set_minimum_version(1, 3).set_required_features_13(features13).select();
+	if (!physical_device_ret)
+	{
+		std::cout << physical_device_ret.error().message() << std::endl;
+		return false;
+	}
+	init.physical_device = physical_device_ret.value();
+
+	vkb::DeviceBuilder device_builder(init.physical_device);
+	auto               device_ret = device_builder.build();
+	if (!device_ret)
+	{
+		std::cout << device_ret.error().message() << std::endl;
+		return false;
+	}
+	init.device = device_ret.value();
+	init.disp   = init.device.make_table();
+
+	init.graphics_queue        = init.device.get_queue(vkb::QueueType::graphics).value();
+	init.graphics_queue_family = init.device.get_queue_index(vkb::QueueType::graphics).value();
+	init.transfer_queue        = init.graphics_queue;
+	init.transfer_queue_family = init.graphics_queue_family;
+
+	VkCommandPoolCreateInfo pool_info = {};
+	pool_info.sType                   = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.queueFamilyIndex        = init.graphics_queue_family;
+	if (init.disp.createCommandPool(&pool_info, nullptr, &init.command_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create command pool!");
+	}
+
+	VmaVulkanFunctions vulkan_functions    = {};
+	vulkan_functions.vkGetInstanceProcAddr = init.inst_disp.fp_vkGetInstanceProcAddr;
+	vulkan_functions.vkGetDeviceProcAddr   = init.device.fp_vkGetDeviceProcAddr;
+
+	VmaAllocatorCreateInfo allocator_info = {};
+	allocator_info.physicalDevice         = init.physical_device.physical_device;
+	allocator_info.device                 = init.device.device;
+	allocator_info.instance               = init.instance.instance;
+	allocator_info.vulkanApiVersion       = VK_API_VERSION_1_3;
+	allocator_info.pVulkanFunctions       = &vulkan_functions;
+	if (vmaCreateAllocator(&allocator_info, &init.allocator) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create VMA allocator!");
+	}
+
+	std::cout << "device: " << init.physical_device.name << std::endl;
+	return true;
+}
+
+// Instances spread around the origin with every mix of flags and lod counts,
+// a lod count of 0 standing for a mesh that isn't resident yet.
+static void make_scene(std::vector<GpuDrawData> &draws, std::vector<glm::mat4> &transforms)
+{
+	std::mt19937                            random(1234);
+	std::uniform_real_distribution<float>   position(-200.0f, 200.0f);
+	std::uniform_real_distribution<float>   scale(0.5f, 4.0f);
+	std::uniform_real_distribution<float>   radius(0.5f, 3.0f);
+	std::uniform_int_distribution<uint32_t> lod_count(0, MAX_GPU_LODS);
+	std::uniform_int_distribution<uint32_t> flags(0, DRAW_INDEX32 | DRAW_CASTS_SHADOW | DRAW_STATIC);
+
+	draws.resize(OBJECT_COUNT);
+	transforms.resize(OBJECT_COUNT);
+	for (uint32_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random) * 0.1f, position(random)));
+		transforms[i]       = glm::scale(transform, glm::vec3(scale(random)));
+
+		GpuDrawData &draw  = draws[i];
+		draw               = {};
+		draw.sphere        = glm::vec4(0.0f, 0.5f, 0.0f, radius(random));
+		draw.vertex_offset = static_cast<int32_t>(i * 64);
+		draw.lod_count     = lod_count(random);
+		draw.flags         = flags(random);
+		for (uint32_t level = 0; level < draw.lod_count; level++)
+		{
+			draw.lod_first_index[level] = i * 1024 + level * 256;
+			draw.lod_index_count[level] = 768 >> level;
+			draw.lod_error[level]       = 0.02f * static_cast<float>(level);
+		}
+	}
+}
+
+// the main camera and a cascade taking the dynamic casters, as update_gpu_culling sets them up
+static std::array<GpuCullView, VIEW_COUNT> make_views()
+{
+	const glm::vec3 camera_position(0.0f, 10.0f, 0.0f);
+	const glm::mat4 view       = glm::lookAt(camera_position, glm::vec3(0.0f, 10.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+
+	const glm::mat4 light_view       = glm::lookAt(glm::vec3(0.0f, 200.0f, 0.0f), glm::vec3(30.0f, 0.0f, -20.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	const glm::mat4 light_projection = glm::orthoRH_ZO(-80.0f, 80.0f, -80.0f, 80.0f, 0.0f, 400.0f);
+
+	const float lod_scale = projection_scale(60.0f, 1080.0f);
+	return {
+	    make_cull_view(projection * view, camera_position, lod_scale, 1.0f),
+	    make_cull_view(light_projection * light_view, camera_position, lod_scale, 4.0f, DRAW_CASTS_SHADOW, DRAW_STATIC),
+	};
+}
+
+// Whether the view's decision on the object hinges on rounding: its sphere just
+// touching a plane, the camera just at its surface or one of its lod ratios at
+// the pixel error. Mirrors the math of gpu_cull_reference.
+static bool borderline(const GpuDrawData &draw, const glm::mat4 &model, const GpuCullView &view)
+{
+	const float     scale  = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	const glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(draw.sphere), 1.0f));
+	const float     radius = draw.sphere.w * scale;
+
+	// plane distances are as exact as the coordinates that go into them
+	const float magnitude = glm::length(center) + radius;
+	for (const glm::vec4 &plane : view.planes)
+	{
+		if (std::abs(glm::dot(glm::vec3(plane), center) + plane.w + radius) <= BORDERLINE_MARGIN * magnitude)
+		{
+			return true;
+		}
+	}
+
+	const float distance = glm::length(center - glm::vec3(view.camera_position)) - radius;
+	if (std::abs(distance) <= BORDERLINE_MARGIN * magnitude)
+	{
+		return true;
+	}
+
+	for (uint32_t level = 1; level < draw.lod_count && distance > 0.0f; level++)
+	{
+		const float ratio = draw.lod_error[level] * scale * view.camera_position.w / distance;
+		if (std::abs(ratio - view.pixel_error) <= BORDERLINE_MARGIN * view.pixel_error)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// the commands of a list whose object isn't borderline, by firstInstance
+static std::vector<VkDrawIndexedIndirectCommand> decided_commands(const VkDrawIndexedIndirectCommand *commands,
+                                                                  uint32_t                            count,
+                                                                  const std::vector<bool>            &borderline_objects)
+{
+	std::vector<VkDrawIndexedIndirectCommand> decided;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		// an instance outside the scene is a bug, keep it so the comparison fails
+		const uint32_t object = commands[i].firstInstance - FIRST_OBJECT;
+		if (commands[i].firstInstance < FIRST_OBJECT || object >= borderline_objects.size() || !borderline_objects[object])
+		{
+			decided.push_back(commands[i]);
+		}
+	}
+
+	std::sort(decided.begin(), decided.end(), [](const VkDrawIndexedIndirectCommand &a, const VkDrawIndexedIndirectCommand &b) {
+		return a.firstInstance < b.firstInstance;
+	});
+	return decided;
+}
+
+static void *map(Init &init, BufferAllocation &buffer)
+{
+	void *mapped = nullptr;
+	if (vmaMapMemory(init.allocator, buffer.allocation, &mapped) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to map buffer!");
+	}
+	return mapped;
+}
+
+static void upload(Init &init, BufferAllocation &buffer, const void *data, size_t size)
+{
+	memcpy(map(init, buffer), data, size);
+	vmaFlushAllocation(init.allocator, buffer.allocation, 0, VK_WHOLE_SIZE);
+	vmaUnmapMemory(init.allocator, buffer.allocation);
+}
+
+int main()
+{
+	Init init = {};
+	if (!create_device(init))
+	{
+		std::cout << "no Vulkan 1.3 device, GPU culling check skipped" << std::endl;
+		return SKIPPED;
+	}
+
+	std::vector<GpuDrawData> draws;
+	std::vector<glm::mat4>   transforms;
+	make_scene(draws, transforms);
+	const std::array<GpuCullView, VIEW_COUNT> views = make_views();
+
+	std::vector<ObjectData> objects(FIRST_OBJECT + OBJECT_COUNT);
+	for (uint32_t i = 0; i < OBJECT_COUNT; i++)
+	{
+		objects[FIRST_OBJECT + i].model = transforms[i];
+	}
+
+	// everything host visible, the dispatch is all there is to synchronize
+	BufferAllocation object_buffer;
+	BufferAllocation draw_buffer;
+	BufferAllocation view_buffer;
+	BufferAllocation command_buffer;
+	BufferAllocation count_buffer;
+	BufferAllocation visibility_buffer;
+	create_buffer(init, objects.size() * sizeof(ObjectData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, object_buffer);
+	create_buffer(init, draws.size() * sizeof(GpuDrawData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, draw_buffer);
+	create_buffer(init, views.size() * sizeof(GpuCullView), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, view_buffer);
+	create_buffer(init, LIST_COUNT * OBJECT_COUNT * COMMAND_STRIDE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, command_buffer);
+	create_buffer(init, LIST_COUNT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU, count_buffer);
+	create_buffer(init, OBJECT_COUNT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, visibility_buffer);
+
+	const std::vector<uint32_t> zero_counts(LIST_COUNT, 0);
+	const std::vector<uint32_t> zero_visibility(OBJECT_COUNT, 0);
+	upload(init, object_buffer, objects.data(), objects.size() * sizeof(ObjectData));
+	upload(init, draw_buffer, draws.data(), draws.size() * sizeof(GpuDrawData));
+	upload(init, view_buffer, views.data(), views.size() * sizeof(GpuCullView));
+	upload(init, count_buffer, zero_counts.data(), zero_counts.size() * sizeof(uint32_t));
+	upload(init, visibility_buffer, zero_visibility.data(), zero_visibility.size() * sizeof(uint32_t));
+
+	// the shader declares the pyramid even though CULL_ALL never samples it
+	VkImageCreateInfo image_info = {};
+	image_info.sType             = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_info.imageType         = VK_IMAGE_TYPE_2D;
+	image_info.format            = VK_FORMAT_R32_SFLOAT;
+	image_info.extent            = {1, 1, 1};
+	image_info.mipLevels         = 1;
+	image_info.arrayLayers       = 1;
+	image_info.samples           = VK_SAMPLE_COUNT_1_BIT;
+	image_info.tiling            = VK_IMAGE_TILING_OPTIMAL;
+	image_info.usage             = VK_IMAGE_USAGE_SAMPLED_BIT;
+	image_info.initialLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	VmaAllocationCreateInfo image_allocation_info = {};
+	image_allocation_info.usage                   = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VkImage       pyramid_image;
+	VmaAllocation pyramid_allocation;
+	if (vmaCreateImage(init.allocator, &image_info, &image_allocation_info, &pyramid_image, &pyramid_allocation, nullptr) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pyramid image!");
+	}
+
+	VkImageViewCreateInfo view_info = {};
+	view_info.sType                 = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_info.image                 = pyramid_image;
+	view_info.viewType              = VK_IMAGE_VIEW_TYPE_2D;
+	view_info.format                = VK_FORMAT_R32_SFLOAT;
+	view_info.subresourceRange      = image_range(VK_IMAGE_ASPECT_COLOR_BIT);
+
+	VkImageView pyramid_view;
+	if (init.disp.createImageView(&view_info, nullptr, &pyramid_view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pyramid image view!");
+	}
+
+	VkSamplerCreateInfo sampler_info = {};
+	sampler_info.sType               = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_info.magFilter           = VK_FILTER_NEAREST;
+	sampler_info.minFilter           = VK_FILTER_NEAREST;
+	sampler_info.addressModeU        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeV        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler_info.addressModeW        = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+	VkSampler pyramid_sampler;
+	if (init.disp.createSampler(&sampler_info, nullptr, &pyramid_sampler) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pyramid sampler!");
+	}
+
+	// same interface as GpuCulling::create_pipeline
+	std::array<VkDescriptorSetLayoutBinding, CULL_BINDING_TYPES.size()> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding         = i;
+		bindings[i].descriptorType  = CULL_BINDING_TYPES[i];
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags      = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layout_info = {};
+	layout_info.sType                           = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout_info.bindingCount                    = static_cast<uint32_t>(bindings.size());
+	layout_info.pBindings                       = bindings.data();
+
+	VkDescriptorSetLayout descriptor_set_layout;
+	if (init.disp.createDescriptorSetLayout(&layout_info, nullptr, &descriptor_set_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor set layout!");
+	}
+
+	const VkDescriptorPoolSize pool_sizes[] = {
+	    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 2},
+	    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+	    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+	};
+
+	VkDescriptorPoolCreateInfo pool_info = {};
+	pool_info.sType                      = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_info.maxSets                    = 1;
+	pool_info.poolSizeCount              = 3;
+	pool_info.pPoolSizes                 = pool_sizes;
+
+	VkDescriptorPool descriptor_pool;
+	if (init.disp.createDescriptorPool(&pool_info, nullptr, &descriptor_pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor pool!");
+	}
+
+	VkDescriptorSetAllocateInfo allocate_info = {};
+	allocate_info.sType                       = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocate_info.descriptorPool              = descriptor_pool;
+	allocate_info.descriptorSetCount          = 1;
+	allocate_info.pSetLayouts                 = &descriptor_set_layout;
+
+	VkDescriptorSet descriptor_set;
+	if (init.disp.allocateDescriptorSets(&allocate_info, &descriptor_set) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate culling descriptor set!");
+	}
+
+	const VkDescriptorBufferInfo buffer_infos[] = {
+	    {object_buffer.buffer, 0, object_buffer.size},
+	    {draw_buffer.buffer, 0, VK_WHOLE_SIZE},
+	    {view_buffer.buffer, 0, view_buffer.size},
+	    {command_buffer.buffer, 0, VK_WHOLE_SIZE},
+	    {count_buffer.buffer, 0, VK_WHOLE_SIZE},
+	    {visibility_buffer.buffer, 0, VK_WHOLE_SIZE},
+	};
+	const VkDescriptorImageInfo pyramid_info = {pyramid_sampler, pyramid_view, VK_IMAGE_LAYOUT_GENERAL};
+
+	std::array<VkWriteDescriptorSet, CULL_BINDING_TYPES.size()> writes = {};
+	for (uint32_t i = 0; i < writes.size(); i++)
+	{
+		writes[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet          = descriptor_set;
+		writes[i].dstBinding      = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType  = CULL_BINDING_TYPES[i];
+		if (i == DEPTH_PYRAMID_BINDING)
+		{
+			writes[i].pImageInfo = &pyramid_info;
+		}
+		else
+		{
+			writes[i].pBufferInfo = &buffer_infos[i];
+		}
+	}
+	init.disp.updateDescriptorSets(static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+	VkPushConstantRange push_constant_range = {};
+	push_constant_range.stageFlags          = VK_SHADER_STAGE_COMPUTE_BIT;
+	push_constant_range.offset              = 0;
+	push_constant_range.size                = sizeof(CullPushConstants);
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+	pipeline_layout_info.sType                      = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipeline_layout_info.setLayoutCount             = 1;
+	pipeline_layout_info.pSetLayouts                = &descriptor_set_layout;
+	pipeline_layout_info.pushConstantRangeCount     = 1;
+	pipeline_layout_info.pPushConstantRanges        = &push_constant_range;
+
+	VkPipelineLayout pipeline_layout;
+	if (init.disp.createPipelineLayout(&pipeline_layout_info, nullptr, &pipeline_layout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling pipeline layout!");
+	}
+
+	VkShaderModule shader_module = create_shader_module(init, read_file(CULL_SHADER_PATH));
+
+	VkComputePipelineCreateInfo pipeline_info = {};
+	pipeline_info.sType                       = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_info.stage.sType                 = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_info.stage.stage                 = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_info.stage.module                = shader_module;
+	pipeline_info.stage.pName                 = "main";
+	pipeline_info.layout                      = pipeline_layout;
+
+	VkPipeline pipeline;
+	if (init.disp.createComputePipelines(VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling pipeline!");
+	}
+	init.disp.destroyShaderModule(shader_module, nullptr);
+
+	// one dispatch over every instance and view, as GpuCulling::dispatch without occlusion
+	VkCommandBuffer commands = begin_single_time_commands(init);
+	BarrierBatch    barriers(init);
+
+	barriers.image(pyramid_image, image_range(VK_IMAGE_ASPECT_COLOR_BIT),
+	               VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+	               VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+	               VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+	barriers.flush(commands);
+
+	const uint32_t          dynamic_offsets[] = {0, 0};
+	const CullPushConstants push_constants    = {OBJECT_COUNT, FIRST_OBJECT, OBJECT_COUNT, CULL_ALL, 0};
+
+	init.disp.cmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	init.disp.cmdBindDescriptorSets(commands, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &descriptor_set, 2, dynamic_offsets);
+	init.disp.cmdPushConstants(commands, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+	init.disp.cmdDispatch(commands, (OBJECT_COUNT + 63) / 64, VIEW_COUNT, 1);
+
+	barriers.buffer(command_buffer.buffer, 0, VK_WHOLE_SIZE,
+	                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+	                VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+	barriers.buffer(count_buffer.buffer, 0, VK_WHOLE_SIZE,
+	                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+	                VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+	barriers.flush(commands);
+
+	end_single_time_commands(init, commands);
+
+	// the shader appends in no particular order, the reference is sorted by firstInstance
+	const auto *counts  = static_cast<const uint32_t *>(map(init, count_buffer));
+	const auto *written = static_cast<const VkDrawIndexedIndirectCommand *>(map(init, command_buffer));
+	vmaInvalidateAllocation(init.allocator, count_buffer.allocation, 0, VK_WHOLE_SIZE);
+	vmaInvalidateAllocation(init.allocator, command_buffer.allocation, 0, VK_WHOLE_SIZE);
+
+	auto same_command = [](const VkDrawIndexedIndirectCommand &a, const VkDrawIndexedIndirectCommand &b) {
+		return a.indexCount == b.indexCount && a.instanceCount == b.instanceCount && a.firstIndex == b.firstIndex &&
+		       a.vertexOffset == b.vertexOffset && a.firstInstance == b.firstInstance;
+	};
+
+	uint32_t failures = 0;
+	uint32_t drawn    = 0;
+	for (uint32_t view = 0; view < VIEW_COUNT; view++)
+	{
+		std::array<std::vector<VkDrawIndexedIndirectCommand>, 2> expected;
+		gpu_cull_reference(draws, transforms, views[view], FIRST_OBJECT, expected);
+
+		std::vector<bool> borderline_objects(OBJECT_COUNT);
+		uint32_t          borderline_count = 0;
+		for (uint32_t i = 0; i < OBJECT_COUNT; i++)
+		{
+			borderline_objects[i] = borderline(draws[i], transforms[i], views[view]);
+			borderline_count += borderline_objects[i] ? 1 : 0;
+		}
+
+		for (uint32_t bucket = 0; bucket < 2; bucket++)
+		{
+			const uint32_t list = view * 2 + bucket;
+
+			const std::vector<VkDrawIndexedIndirectCommand> gpu = decided_commands(written + VkDeviceSize(list) * OBJECT_COUNT, counts[list], borderline_objects);
+			const std::vector<VkDrawIndexedIndirectCommand> cpu = decided_commands(expected[bucket].data(), static_cast<uint32_t>(expected[bucket].size()), borderline_objects);
+
+			bool matches = gpu.size() == cpu.size();
+			for (size_t i = 0; i < gpu.size() && matches; i++)
+			{
+				matches = same_command(gpu[i], cpu[i]);
+			}
+
+			std::cout << "view " << view << ", " << (bucket == 0 ? "16" : "32") << "-bit: " << counts[list] << " draws, "
+			          << expected[bucket].size() << " expected" << (matches ? "" : ", lists differ") << std::endl;
+
+			failures += matches ? 0 : 1;
+			drawn += static_cast<uint32_t>(gpu.size());
+		}
+
+		std::cout << "view " << view << ": " << borderline_count << " borderline objects not compared" << std::endl;
+	}
+
+	vmaUnmapMemory(init.allocator, command_buffer.allocation);
+	vmaUnmapMemory(init.allocator, count_buffer.allocation);
+
+	init.disp.destroyPipeline(pipeline, nullptr);
+	init.disp.destroyPipelineLayout(pipeline_layout, nullptr);
+	init.disp.destroyDescriptorPool(descriptor_pool, nullptr);
+	init.disp.destroyDescriptorSetLayout(descriptor_set_layout, nullptr);
+	init.disp.destroySampler(pyramid_sampler, nullptr);
+	init.disp.destroyImageView(pyramid_view, nullptr);
+	vmaDestroyImage(init.allocator, pyramid_image, pyramid_allocation);
+	cleanup_buffer(init, object_buffer);
+	cleanup_buffer(init, draw_buffer);
+	cleanup_buffer(init, view_buffer);
+	cleanup_buffer(init, command_buffer);
+	cleanup_buffer(init, count_buffer);
+	cleanup_buffer(init, visibility_buffer);
+	vmaDestroyAllocator(init.allocator);
+	init.disp.destroyCommandPool(init.command_pool, nullptr);
+	vkb::destroy_device(init.device);
+	vkb::destroy_instance(init.instance);
+
+	// a scene nothing survives in checks nothing
+	if (drawn == 0)
+	{
+		std::cout << "no draws survived, the scene doesn't exercise the shader" << std::endl;
+		return 1;
+	}
+
+	if (failures > 0)
+	{
+		std::cout << failures << " GPU culling lists differ from the CPU reference" << std::endl;
+		return 1;
+	}
+
+	std::cout << "GPU culling matches the CPU reference" << std::endl;
+	return 0;
+}
@@ -0,0 +1,262 @@
+//
+// Created by rfdic on 10/2/2024.
+//
+
+// Checks cull_meshlets on a mesh of flat patches that build_meshlets turns into
+// one meshlet each: which meshlets the frustum and the normal cones reject and
+// how the survivors' index ranges are merged. Pure CPU, no device is created.
+
+#include "culling.hpp"
+#include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+
+using namespace obsidian;
+
+// a patch of 7x7 quads has 64 vertices, as many as a meshlet takes
+constexpr uint32_t PATCH_QUADS   = 7;
+constexpr uint32_t PATCH_INDICES = PATCH_QUADS * PATCH_QUADS * 6;
+constexpr uint32_t GRID_SIZE     = 4;        // patches per side, the mesh covers [-2, 2] in x and y
+
+static int failures = 0;
+
+static void check(bool condition, const char *test, const char *what)
+{
+	if (!condition)
+	{
+		std::cout << test << ": " << what << std::endl;
+		failures++;
+	}
+}
+
+// Unit patches in z = 0, row by row, each facing +z unless its column is flipped.
+// Patches don't share vertices, so every one of them becomes its own meshlet.
+static Mesh make_patch_grid(const std::array<bool, GRID_SIZE> &flipped_columns)
+{
+	Mesh mesh      = {};
+	mesh.mesh_type = MeshType::CUSTOM;
+
+	for (uint32_t row = 0; row < GRID_SIZE; row++)
+	{
+		for (uint32_t column = 0; column < GRID_SIZE; column++)
+		{
+			const uint32_t  first_vertex = static_cast<uint32_t>(mesh.vertices.size());
+			const glm::vec2 origin(static_cast<float>(column) - 2.0f, static_cast<float>(row) - 2.0f);
+
+			for (uint32_t y = 0; y <= PATCH_QUADS; y++)
+			{
+				for (uint32_t x = 0; x <= PATCH_QUADS; x++)
+				{
+					Vertex vertex = {};
+					vertex.pos    = glm::vec3(origin + glm::vec2(x, y) / static_cast<float>(PATCH_QUADS), 0.0f);
+					mesh.vertices.push_back(vertex);
+				}
+			}
+
+			for (uint32_t y = 0; y < PATCH_QUADS; y++)
+			{
+				for (uint32_t x = 0; x < PATCH_QUADS; x++)
+				{
+					const uint32_t v00 = first_vertex + y * (PATCH_QUADS + 1) + x;
+					const uint32_t v10 = v00 + 1;
+					const uint32_t v01 = v00 + PATCH_QUADS + 1;
+					const uint32_t v11 = v01 + 1;
+
+					// counter-clockwise seen from +z, the other way round when flipped
+					const std::array<uint32_t, 6> quad = flipped_columns[column] ? std::array<uint32_t, 6>{v00, v11, v10, v00, v01, v11}
+					                                                             : std::array<uint32_t, 6>{v00, v10, v11, v00, v11, v01};
+					mesh.indices.insert(mesh.indices.end(), quad.begin(), quad.end());
+				}
+			}
+		}
+	}
+
+	mesh.vertex_count = static_cast<uint32_t>(mesh.vertices.size());
+	mesh.index_count  = static_cast<uint32_t>(mesh.indices.size());
+	mesh.meshlets     = build_meshlets(mesh.vertices, mesh.indices);
+	return mesh;
+}
+
+static Frustum perspective_frustum(const glm::vec3 &eye)
+{
+	return extract_frustum(glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 100.0f) *
+	                       glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+}
+
+// the meshlets a draw list covers, by index
+static std::vector<bool> covered_meshlets(const Mesh &mesh, const std::vector<DrawRange> &draws)
+{
+	std::vector<bool> covered(mesh.meshlets.size(), false);
+	for (size_t i = 0; i < mesh.meshlets.size(); i++)
+	{
+		for (const DrawRange &range : draws)
+		{
+			if (mesh.meshlets[i].first_index >= range.first_index &&
+			    mesh.meshlets[i].first_index + mesh.meshlets[i].index_count <= range.first_index + range.index_count)
+			{
+				covered[i] = true;
+			}
+		}
+	}
+	return covered;
+}
+
+static void test_patch_meshlets()
+{
+	const char *test = "patch_meshlets";
+
+	const Mesh mesh = make_patch_grid({false, false, false, false});
+
+	check(mesh.meshlets.size() == GRID_SIZE * GRID_SIZE, test, "one meshlet per patch");
+	for (size_t i = 0; i < mesh.meshlets.size(); i++)
+	{
+		check(mesh.meshlets[i].first_index == i * PATCH_INDICES && mesh.meshlets[i].index_count == PATCH_INDICES, test,
+		      "meshlets follow the patches in the index list");
+	}
+}
+
+static void test_all_visible_merge()
+{
+	const char *test = "all_visible_merge";
+
+	const Mesh      mesh = make_patch_grid({false, false, false, false});
+	const glm::vec3 eye(0.0f, 0.0f, 5.0f);
+
+	std::vector<DrawRange> draws;
+	CullingStats           stats = {};
+	cull_meshlets(mesh, glm::mat4(1.0f), perspective_frustum(eye), eye, draws, stats);
+
+	check(stats.meshlets_total == mesh.meshlets.size(), test, "every meshlet counted");
+	check(stats.meshlets_visible == mesh.meshlets.size(), test, "every meshlet visible");
+	check(draws.size() == 1, test, "consecutive meshlets merged into one range");
+	check(!draws.empty() && draws[0].first_index == 0 && draws[0].index_count == mesh.index_count, test, "range covers the whole mesh");
+}
+
+static void test_frustum_rejection()
+{
+	const char *test = "frustum_rejection";
+
+	const Mesh      mesh = make_patch_grid({false, false, false, false});
+	const glm::vec3 eye(0.0f, 0.0f, 5.0f);
+
+	// only x in [-2, -0.9] is inside, the spheres of the two right columns are fully outside
+	const Frustum frustum = extract_frustum(glm::ortho(-2.0f, -0.9f, -3.0f, 3.0f, 0.1f, 100.0f) *
+	                                        glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+
+	std::vector<DrawRange> draws;
+	CullingStats           stats = {};
+	cull_meshlets(mesh, glm::mat4(1.0f), frustum, eye, draws, stats);
+
+	check(stats.meshlets_visible == GRID_SIZE * 2, test, "two columns visible");
+
+	const std::vector<bool> covered = covered_meshlets(mesh, draws);
+	for (uint32_t i = 0; i < covered.size(); i++)
+	{
+		check(covered[i] == (i % GRID_SIZE < 2), test, "drawn exactly when in the left two columns");
+	}
+
+	// the two visible patches of a row are neighbours, rows are separated by the rejected ones
+	check(draws.size() == GRID_SIZE, test, "one range per row");
+	for (uint32_t row = 0; row < draws.size(); row++)
+	{
+		check(draws[row].first_index == row * GRID_SIZE * PATCH_INDICES && draws[row].index_count == 2 * PATCH_INDICES, test,
+		      "row range spans its two visible patches");
+	}
+
+	// moved out of the frustum entirely, nothing is left
+	draws.clear();
+	stats = {};
+	cull_meshlets(mesh, glm::translate(glm::mat4(1.0f), glm::vec3(10.0f, 0.0f, 0.0f)), frustum, eye, draws, stats);
+	check(draws.empty() && stats.meshlets_visible == 0, test, "mesh outside the frustum draws nothing");
+}
+
+static void test_cone_rejection()
+{
+	const char *test = "cone_rejection";
+
+	// columns 1 and 3 face -z
+	const Mesh mesh = make_patch_grid({false, true, false, true});
+
+	for (const glm::vec3 &eye : {glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, -5.0f)})
+	{
+		std::vector<DrawRange> draws;
+		CullingStats           stats = {};
+		cull_meshlets(mesh, glm::mat4(1.0f), perspective_frustum(eye), eye, draws, stats);
+
+		// from the front the even columns face the camera, from behind the odd ones
+		const uint32_t          facing  = eye.z > 0.0f ? 0 : 1;
+		const std::vector<bool> covered = covered_meshlets(mesh, draws);
+		for (uint32_t i = 0; i < covered.size(); i++)
+		{
+			check(covered[i] == (i % 2 == facing), test, "drawn exactly when facing the camera");
+		}
+
+		// no two surviving meshlets are neighbours, so nothing merges
+		check(draws.size() == mesh.meshlets.size() / 2, test, "one range per front facing meshlet");
+		check(stats.meshlets_visible == mesh.meshlets.size() / 2, test, "back facing meshlets not counted visible");
+	}
+
+	// turned around the y axis the flipped columns face the camera, the cone axes have to follow the rotation
+	{
+		const glm::vec3 eye(0.0f, 0.0f, 5.0f);
+		const glm::mat4 turned = glm::rotate(glm::mat4(1.0f), glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+		std::vector<DrawRange> draws;
+		CullingStats           stats = {};
+		cull_meshlets(mesh, turned, perspective_frustum(eye), eye, draws, stats);
+
+		const std::vector<bool> covered = covered_meshlets(mesh, draws);
+		for (uint32_t i = 0; i < covered.size(); i++)
+		{
+			check(covered[i] == (i % 2 == 1), test, "rotated cones follow the transform");
+		}
+	}
+
+	// a non-uniform scale bends the normals, the cones are ignored and the whole mesh merges into one range
+	{
+		const glm::vec3 eye(0.0f, 0.0f, 5.0f);
+		const glm::mat4 stretched = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, 0.5f, 1.0f));
+
+		std::vector<DrawRange> draws;
+		CullingStats           stats = {};
+		cull_meshlets(mesh, stretched, perspective_frustum(eye), eye, draws, stats);
+
+		check(stats.meshlets_visible == mesh.meshlets.size(), test, "no cone test under non-uniform scale");
+		check(draws.size() == 1, test, "non-uniform scale merges into one range");
+	}
+}
+
+static void test_cone_backfacing()
+{
+	const char *test = "cone_backfacing";
+
+	const glm::vec3 center(0.0f);
+	const glm::vec3 axis(0.0f, 0.0f, 1.0f);
+
+	check(cone_backfacing(glm::vec3(0.0f, 0.0f, -5.0f), center, 0.5f, axis, 0.0f), test, "camera behind a flat cluster");
+	check(!cone_backfacing(glm::vec3(0.0f, 0.0f, 5.0f), center, 0.5f, axis, 0.0f), test, "camera in front of a flat cluster");
+
+	// the sphere reaches past the camera's distance, part of it may face the camera
+	check(!cone_backfacing(glm::vec3(0.0f, 0.0f, -0.4f), center, 0.5f, axis, 0.0f), test, "camera inside the bounding sphere");
+
+	// a 60 degree half angle cone, sin = 0.866: straight behind it's backfacing, from the side it isn't
+	check(cone_backfacing(glm::vec3(0.0f, 0.0f, -10.0f), center, 0.5f, axis, 0.866f), test, "camera behind a wide cone");
+	check(!cone_backfacing(glm::vec3(10.0f, 0.0f, -5.0f), center, 0.5f, axis, 0.866f), test, "camera beside a wide cone");
+}
+
+int main()
+{
+	test_patch_meshlets();
+	test_all_visible_merge();
+	test_frustum_rejection();
+	test_cone_rejection();
+	test_cone_backfacing();
+
+	if (failures > 0)
+	{
+		std::cout << failures << " meshlet culling checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "meshlet culling checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,206 @@
+//
+// Created by rfdic on 10/2/2024.
+//
+
+// Checks RenderGraph::compile on small graphs: which passes are culled, which
+// transients alias and which barriers are derived. compile() only works on
+// indices and states, so no device is created.
+
+#include "render_graph.hpp"
+
+using namespace obsidian;
+
+static int failures = 0;
+
+static void check(bool condition, const char *test, const char *what)
+{
+	if (!condition)
+	{
+		std::cout << test << ": " << what << std::endl;
+		failures++;
+	}
+}
+
+static void no_op(VkCommandBuffer)
+{
+}
+
+static TransientImageDesc color_desc(VkFormat format = VK_FORMAT_R8G8B8A8_UNORM)
+{
+	return {format, {64, 64}, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT};
+}
+
+static RenderResource import_swapchain(RenderGraph &graph)
+{
+	const ImageState initial = {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE};
+	const ImageState present = image_usage_state(ImageUsage::PRESENT);
+	return graph.import_image("swapchain", VK_NULL_HANDLE, VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT, initial, &present);
+}
+
+static const ImageBarrier *find_barrier(const std::vector<ImageBarrier> &barriers, RenderResource resource)
+{
+	for (const ImageBarrier &barrier : barriers)
+	{
+		if (barrier.resource == resource)
+		{
+			return &barrier;
+		}
+	}
+
+	return nullptr;
+}
+
+static std::vector<uint32_t> kept_passes(const CompiledGraph &compiled)
+{
+	std::vector<uint32_t> kept;
+	for (const CompiledPass &pass : compiled.passes)
+	{
+		kept.push_back(pass.pass);
+	}
+	return kept;
+}
+
+static void test_culling()
+{
+	const char *test = "culling";
+
+	RenderGraph    graph;
+	RenderResource swapchain = import_swapchain(graph);
+	RenderResource unused    = graph.create_image("unused", color_desc());
+	RenderResource capture   = graph.create_image("capture", color_desc());
+	RenderResource debug     = graph.create_image("debug", color_desc());
+
+	// 0: nobody reads what it writes
+	graph.add_pass("unused", glm::vec3(0.0f), no_op).write(unused, ImageUsage::COLOR_ATTACHMENT, true);
+	// 1: only feeds the side effect pass, kept through it
+	graph.add_pass("capture", glm::vec3(0.0f), no_op).write(capture, ImageUsage::COLOR_ATTACHMENT, true);
+	// 2: the frame's output
+	graph.add_pass("main", glm::vec3(0.0f), no_op).write(swapchain, ImageUsage::COLOR_ATTACHMENT, true);
+	// 3: writes nothing anyone reads, but asked to stay
+	graph.add_pass("readback", glm::vec3(0.0f), no_op)
+	    .read(capture, ImageUsage::TRANSFER_SRC)
+	    .write(debug, ImageUsage::TRANSFER_DST, true)
+	    .side_effect();
+
+	const CompiledGraph &compiled = graph.compile();
+
+	check(kept_passes(compiled) == std::vector<uint32_t>{1, 2, 3}, test, "expected passes 1, 2 and 3 to be kept");
+	check(compiled.culled_passes == 1, test, "expected one culled pass");
+	check(compiled.physical_images[unused] == UINT32_MAX, test, "a culled pass's transient got an image");
+}
+
+static void test_aliasing()
+{
+	const char *test = "aliasing";
+
+	RenderGraph    graph;
+	RenderResource swapchain = import_swapchain(graph);
+	RenderResource first     = graph.create_image("first", color_desc());
+	RenderResource second    = graph.create_image("second", color_desc());
+	RenderResource third     = graph.create_image("third", color_desc());
+	RenderResource other     = graph.create_image("other", color_desc(VK_FORMAT_R16G16B16A16_SFLOAT));
+
+	// lifetimes: first [0, 1], second [1, 2], third [2, 3], other [3, 4]
+	graph.add_pass("a", glm::vec3(0.0f), no_op).write(first, ImageUsage::COLOR_ATTACHMENT, true);
+	graph.add_pass("b", glm::vec3(0.0f), no_op)
+	    .read(first, ImageUsage::FRAGMENT_SAMPLED)
+	    .write(second, ImageUsage::COLOR_ATTACHMENT, true);
+	graph.add_pass("c", glm::vec3(0.0f), no_op)
+	    .read(second, ImageUsage::FRAGMENT_SAMPLED)
+	    .write(third, ImageUsage::COLOR_ATTACHMENT, true);
+	graph.add_pass("d", glm::vec3(0.0f), no_op)
+	    .read(third, ImageUsage::FRAGMENT_SAMPLED)
+	    .write(other, ImageUsage::COLOR_ATTACHMENT, true);
+	graph.add_pass("e", glm::vec3(0.0f), no_op)
+	    .read(other, ImageUsage::FRAGMENT_SAMPLED)
+	    .write(swapchain, ImageUsage::COLOR_ATTACHMENT, true);
+
+	const CompiledGraph &compiled = graph.compile();
+
+	check(compiled.physical_images[first] == compiled.physical_images[third], test, "first and third don't overlap and should share an image");
+	check(compiled.physical_images[first] != compiled.physical_images[second], test, "first and second overlap and must not share");
+	check(compiled.physical_images[second] != compiled.physical_images[third], test, "second and third overlap and must not share");
+	check(compiled.physical_images[other] != compiled.physical_images[first] &&
+	          compiled.physical_images[other] != compiled.physical_images[second],
+	      test, "an image of another format was aliased");
+	check(compiled.physical_descs.size() == 3, test, "expected three physical images");
+	check(compiled.physical_images[swapchain] == UINT32_MAX, test, "an imported image got a physical image");
+
+	// third starts from whatever first left behind
+	const ImageBarrier *reuse = compiled.passes.size() == 5 ? find_barrier(compiled.passes[2].barriers, third) : nullptr;
+	check(reuse && reuse->src.layout == VK_IMAGE_LAYOUT_UNDEFINED, test, "an aliased image should be entered from UNDEFINED");
+	check(reuse && (reuse->src.stages & VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT), test, "an aliased image should wait for the previous user's reads");
+}
+
+static void test_barriers()
+{
+	const char *test = "barriers";
+
+	const ImageState sampled = image_usage_state(ImageUsage::FRAGMENT_SAMPLED);
+
+	RenderGraph    graph;
+	RenderResource swapchain = import_swapchain(graph);
+	RenderResource history   = graph.import_image("history", VK_NULL_HANDLE, VK_NULL_HANDLE, VK_IMAGE_ASPECT_COLOR_BIT, sampled, &sampled);
+	RenderResource depth     = graph.create_image("depth", {VK_FORMAT_D32_SFLOAT, {64, 64},
+	                                                        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+	                                                        VK_IMAGE_ASPECT_DEPTH_BIT});
+
+	graph.add_pass("depth", glm::vec3(0.0f), no_op).write(depth, ImageUsage::DEPTH_ATTACHMENT, true);
+	graph.add_pass("main", glm::vec3(0.0f), no_op)
+	    .read(depth, ImageUsage::FRAGMENT_SAMPLED)
+	    .write(swapchain, ImageUsage::COLOR_ATTACHMENT, true)
+	    .write(history, ImageUsage::COLOR_ATTACHMENT, true);
+
+	const CompiledGraph &compiled = graph.compile();
+	if (compiled.passes.size() != 2)
+	{
+		check(false, test, "expected both passes to be kept");
+		return;
+	}
+
+	const ImageBarrier *depth_write = find_barrier(compiled.passes[0].barriers, depth);
+	check(depth_write && depth_write->src.layout == VK_IMAGE_LAYOUT_UNDEFINED, test, "a discarded transient should start from UNDEFINED");
+	check(depth_write && depth_write->dst.layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, test, "depth should become an attachment");
+
+	const ImageBarrier *depth_read = find_barrier(compiled.passes[1].barriers, depth);
+	check(depth_read && depth_read->src.layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL &&
+	          depth_read->dst.layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	      test, "depth should move from attachment to sampled");
+	check(depth_read && depth_read->src.access == VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT &&
+	          (depth_read->src.stages & VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT),
+	      test, "sampling depth should wait on the depth writes");
+
+	// history held last frame's contents, the discarding write drops them
+	const ImageBarrier *history_write = find_barrier(compiled.passes[1].barriers, history);
+	check(history_write && history_write->src.layout == VK_IMAGE_LAYOUT_UNDEFINED, test, "a discarding write should transition from UNDEFINED");
+	check(history_write && (history_write->src.stages & VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT), test, "overwriting history should wait for last frame's reads");
+
+	const ImageBarrier *swapchain_final = find_barrier(compiled.final_barriers, swapchain);
+	check(swapchain_final && swapchain_final->src.layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL &&
+	          swapchain_final->dst.layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+	      test, "the swapchain should end in PRESENT_SRC");
+	check(swapchain_final && swapchain_final->src.access == VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, test, "present should wait on the color writes");
+
+	const ImageBarrier *history_final = find_barrier(compiled.final_barriers, history);
+	check(history_final && history_final->dst.layout == sampled.layout && history_final->dst.stages == sampled.stages &&
+	          history_final->dst.access == sampled.access,
+	      test, "history should end in its exported state");
+
+	check(compiled.final_barriers.size() == 2, test, "only the exported images get final barriers");
+}
+
+int main()
+{
+	test_culling();
+	test_aliasing();
+	test_barriers();
+
+	if (failures > 0)
+	{
+		std::cout << failures << " render graph checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "render graph checks passed" << std::endl;
+	return 0;
+}
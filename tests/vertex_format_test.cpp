@@ -0,0 +1,182 @@
+//
+// Created by rfdic on 10/2/2024.
+//
+
+// Checks the encode_vertices / decode_vertex round trip of every VertexFormat
+// against fixed error bounds, through measure_encoding_error and on single
+// vertices for the cases it doesn't single out: normals on the octahedral folds
+// and the COMPACT_COLOR color. Pure CPU, no device is created.
+
+#include "vertex_format.hpp"
+
+#include <random>
+
+using namespace obsidian;
+
+// Positions stay within POSITION_RANGE, where an fp16 ulp is 2^-9, and the bounds
+// allow up to one ulp or step per component. The normal bound is mostly the
+// noise of acos near 1 in float, snorm16 octahedral is far below it.
+constexpr float POSITION_RANGE      = 4.0f;
+constexpr float MAX_POSITION_ERROR  = 0.004f;
+constexpr float MAX_TEX_COORD_ERROR = 0.0007f;        // [0, 1] in fp16
+constexpr float MAX_NORMAL_DEGREES  = 0.1f;
+constexpr float MAX_COLOR_ERROR     = 0.004f;        // unorm8, clamped to [0, 1] first
+
+static int failures = 0;
+
+static void check(bool condition, const char *test, const char *what)
+{
+	if (!condition)
+	{
+		std::cout << test << ": " << what << std::endl;
+		failures++;
+	}
+}
+
+// colors reach past [0, 1] so the clamp is part of what is measured
+static std::vector<Vertex> make_vertices(size_t count)
+{
+	std::mt19937                          rng(1234);
+	std::uniform_real_distribution<float> position(-POSITION_RANGE, POSITION_RANGE);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> color(-0.25f, 1.25f);
+
+	std::vector<Vertex> vertices(count);
+	for (Vertex &vertex : vertices)
+	{
+		vertex.pos       = glm::vec3(position(rng), position(rng), position(rng));
+		vertex.color     = glm::vec3(color(rng), color(rng), color(rng));
+		vertex.tex_coord = glm::vec2(unit(rng), unit(rng));
+
+		glm::vec3 normal(0.0f);
+		while (glm::length(normal) < 0.1f)
+		{
+			normal = glm::vec3(direction(rng), direction(rng), direction(rng));
+		}
+		vertex.normal = glm::normalize(normal);
+	}
+	return vertices;
+}
+
+static Vertex round_trip(const Vertex &vertex, VertexFormat format)
+{
+	std::vector<uint8_t> position(vertex_position_stride(format));
+	std::vector<uint8_t> attributes(vertex_attribute_stride(format));
+	encode_vertices(&vertex, 1, format, position.data(), attributes.data());
+	return decode_vertex(position.data(), attributes.data(), format);
+}
+
+static float normal_degrees(const glm::vec3 &a, const glm::vec3 &b)
+{
+	return glm::degrees(std::acos(glm::clamp(glm::dot(a, b), -1.0f, 1.0f)));
+}
+
+static void test_full_is_exact()
+{
+	const char *test = "full_is_exact";
+
+	const VertexEncodingError error = measure_encoding_error(make_vertices(4096), VertexFormat::FULL);
+
+	check(error.position == 0.0f, test, "positions unchanged");
+	check(error.tex_coord == 0.0f, test, "tex coords unchanged");
+	check(error.normal_degrees <= MAX_NORMAL_DEGREES, test, "normals unchanged");
+
+	const Vertex source  = make_vertices(1)[0];
+	const Vertex decoded = round_trip(source, VertexFormat::FULL);
+	check(decoded.color == source.color, test, "color unchanged, not clamped");
+}
+
+static void test_compact_bounds()
+{
+	const char *test = "compact_bounds";
+
+	for (VertexFormat format : {VertexFormat::COMPACT, VertexFormat::COMPACT_COLOR})
+	{
+		const VertexEncodingError error = measure_encoding_error(make_vertices(4096), format);
+
+		check(error.position <= MAX_POSITION_ERROR, test, "position within an fp16 ulp");
+		check(error.tex_coord <= MAX_TEX_COORD_ERROR, test, "tex coord within an fp16 ulp");
+		check(error.normal_degrees <= MAX_NORMAL_DEGREES, test, "normal within the octahedral bound");
+
+		// COMPACT has no color to measure
+		if (format == VertexFormat::COMPACT_COLOR)
+		{
+			check(error.color <= MAX_COLOR_ERROR, test, "color within a unorm8 step");
+		}
+		else
+		{
+			check(error.color == 0.0f, test, "no color error without a color");
+		}
+	}
+}
+
+// the axes and the diagonals sit on the edges of the folded octahedron, where the sign matters
+static void test_octahedral_folds()
+{
+	const char *test = "octahedral_folds";
+
+	std::vector<glm::vec3> normals;
+	for (int x = -1; x <= 1; x++)
+	{
+		for (int y = -1; y <= 1; y++)
+		{
+			for (int z = -1; z <= 1; z++)
+			{
+				if (x != 0 || y != 0 || z != 0)
+				{
+					normals.push_back(glm::normalize(glm::vec3(x, y, z)));
+				}
+			}
+		}
+	}
+
+	for (VertexFormat format : {VertexFormat::COMPACT, VertexFormat::COMPACT_COLOR})
+	{
+		for (const glm::vec3 &normal : normals)
+		{
+			Vertex source = {};
+			source.normal = normal;
+
+			check(normal_degrees(round_trip(source, format).normal, normal) <= MAX_NORMAL_DEGREES, test, "fold normal within the bound");
+		}
+	}
+}
+
+static void test_compact_color()
+{
+	const char *test = "compact_color";
+
+	Vertex source    = {};
+	source.normal    = glm::vec3(0.0f, 0.0f, 1.0f);
+	source.color     = glm::vec3(1.0f, 0.5f, 0.0f);
+	const Vertex out = round_trip(source, VertexFormat::COMPACT_COLOR);
+
+	check(out.color.r == 1.0f && out.color.b == 0.0f, test, "ends of the range exact");
+	check(std::abs(out.color.g - 0.5f) <= 1.0f / 255.0f, test, "mid gray within a step");
+
+	// out of range channels are clamped, not wrapped
+	source.color             = glm::vec3(-0.5f, 2.0f, 1.0f);
+	const Vertex out_clamped = round_trip(source, VertexFormat::COMPACT_COLOR);
+	check(out_clamped.color == glm::vec3(0.0f, 1.0f, 1.0f), test, "out of range color clamped");
+
+	// without a color stream the shaders get white
+	check(round_trip(source, VertexFormat::COMPACT).color == glm::vec3(1.0f), test, "COMPACT decodes white");
+}
+
+int main()
+{
+	test_full_is_exact();
+	test_compact_bounds();
+	test_octahedral_folds();
+	test_compact_color();
+
+	if (failures > 0)
+	{
+		std::cout << failures << " vertex format checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "vertex format checks passed" << std::endl;
+	return 0;
+}